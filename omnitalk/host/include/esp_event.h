@@ -0,0 +1,7 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef const char* esp_event_base_t;
+
+esp_err_t esp_event_loop_create_default(void);
@@ -0,0 +1,54 @@
+#pragma once
+
+// The web UI isn't served on the host, but stats.c wants to be able to
+// write metrics to a request.  Chunks sent to a NULL request go to stdout,
+// so the metrics can be dumped with http_metrics_handler(NULL).  The query
+// string functions work, so that handlers' configuration parsing can be
+// used from the command line.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+typedef struct httpd_req httpd_req_t;
+typedef void* httpd_handle_t;
+
+typedef enum {
+	HTTP_GET = 1,
+} httpd_method_t;
+
+struct httpd_req {
+	void* handle;
+	int method;
+	const char uri[512];
+	size_t content_len;
+	void* aux;
+	void* user_ctx;
+};
+
+typedef struct httpd_uri {
+	const char* uri;
+	httpd_method_t method;
+	esp_err_t (*handler)(httpd_req_t* req);
+	void* user_ctx;
+} httpd_uri_t;
+
+typedef struct {
+	int server_port;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80 }
+#define HTTPD_RESP_USE_STRLEN -1
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value);
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status);
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t len);
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t* req, const char* str);
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len);
+esp_err_t httpd_resp_send_404(httpd_req_t* req);
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len);
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size);
@@ -0,0 +1,30 @@
+#pragma once
+
+// On the host, an esp_netif_t just names a Linux interface, so that code
+// that wants to know our IP address can find it.
+
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "esp_err.h"
+#include "esp_netif_types.h"
+
+typedef struct {
+	uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+	esp_ip4_addr_t ip;
+	esp_ip4_addr_t netmask;
+	esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+#define IPADDR_ANY ((uint32_t)0x00000000UL)
+#define inet_addr_from_ip4addr(target, source) ((target)->s_addr = (source)->addr)
+
+esp_err_t esp_netif_init(void);
+esp_err_t esp_netif_get_ip_info(esp_netif_t* netif, esp_netif_ip_info_t* ip_info);
+
+// host_netif_new returns an esp_netif_t for the named Linux interface.
+esp_netif_t* host_netif_new(const char* ifname);
@@ -0,0 +1,3 @@
+#pragma once
+
+typedef struct esp_netif_obj esp_netif_t;
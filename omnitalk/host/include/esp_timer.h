@@ -0,0 +1,15 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdint.h>
+
+// esp_timer_get_time returns microseconds since some point in the past,
+// from CLOCK_MONOTONIC.
+int64_t esp_timer_get_time(void);
+
+// Host only: esp_timer_set_clock makes esp_timer_get_time (and so
+// xTaskGetTickCount) return whatever clock says instead, so that the
+// router can be run on simulated time (see sim/).  NULL goes back to
+// CLOCK_MONOTONIC.
+typedef int64_t (*esp_timer_clock_t)(void);
+void esp_timer_set_clock(esp_timer_clock_t clock);
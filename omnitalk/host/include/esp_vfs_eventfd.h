@@ -0,0 +1,18 @@
+#pragma once
+
+// Linux has eventfds already, so there's nothing to register.
+
+#include <stddef.h>
+#include <sys/eventfd.h>
+
+#include "esp_err.h"
+
+typedef struct {
+	size_t max_fds;
+} esp_vfs_eventfd_config_t;
+
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() (esp_vfs_eventfd_config_t) { .max_fds = 5 }
+
+static inline esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config) {
+	return ESP_OK;
+}
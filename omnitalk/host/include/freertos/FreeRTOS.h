@@ -0,0 +1,40 @@
+#pragma once
+
+// Just enough of FreeRTOS for OmniTalk to build as a Linux process.  Tasks
+// are pthreads; queues, mutexes and event groups are built out of pthread
+// mutexes and condition variables.  See shim/freertos.c.
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOSConfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(x) ((TickType_t)(x) / portTICK_PERIOD_MS)
+#define tskIDLE_PRIORITY 0
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+typedef struct host_queue_s* QueueHandle_t;
+typedef struct host_queue_s* SemaphoreHandle_t;
+typedef struct host_task_s* TaskHandle_t;
+typedef struct host_event_group_s* EventGroupHandle_t;
+typedef uint32_t EventBits_t;
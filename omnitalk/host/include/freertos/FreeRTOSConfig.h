@@ -0,0 +1,4 @@
+#pragma once
+
+#define configUSE_16_BIT_TICKS 0
+#define configTICK_RATE_HZ 1000
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#define PP_HTONS(x) ((uint16_t)((((x) & 0xff) << 8) | (((x) & 0xff00) >> 8)))
+#define PP_HTONL(x) ((((x) & 0xffUL) << 24) | (((x) & 0xff00UL) << 8) | \
+	(((x) & 0xff0000UL) >> 8) | (((x) & 0xff000000UL) >> 24))
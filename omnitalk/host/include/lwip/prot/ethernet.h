@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define ETH_HWADDR_LEN 6
+#define SIZEOF_ETH_HDR 14
+
+struct eth_addr {
+	uint8_t addr[ETH_HWADDR_LEN];
+} __attribute__((packed));
+
+struct eth_hdr {
+	struct eth_addr dest;
+	struct eth_addr src;
+	uint16_t type;
+} __attribute__((packed));
+
+#define eth_addr_cmp(a, b) (memcmp((a)->addr, (b)->addr, ETH_HWADDR_LEN) == 0)
@@ -0,0 +1,12 @@
+#pragma once
+
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+// nvs_flash_set_directory is the host's own: it keeps NVS in files in the
+// directory, one per key, so that it lasts from one run to the next.
+// Without it NVS only lasts as long as the process.
+void nvs_flash_set_directory(const char* path);
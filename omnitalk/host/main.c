@@ -0,0 +1,282 @@
+// omnitalk_host runs the OmniTalk router as a Linux process, with the same
+// router core, LAPs, tables and apps as the device, so it can be profiled
+// and load tested on an ordinary machine.  Which ports it has is up to the
+// command line:
+//
+//   -e ifname   EtherTalk on an existing interface, over AF_PACKET
+//   -t ifname   EtherTalk on a TAP interface (created if need be)
+//   -l group    LToUDP on a multicast group ("-l default" for the usual one)
+//   -b port     a B2 tunnel on a UDP port
+//   -p peers    B2 peers for every tunnel to always send to, comma-separated
+//   -s device   LocalTalk through a TashTalk on a serial device
+//   -i ifname   the interface whose address LToUDP sends from
+//   -g network  a load generator port, pretending to be that network
+//   -G query    what the load generator should do, as a /loadgen query
+//               string (e.g. "traffic=aep&rate=1000")
+//   -n dir      keep NVS, and so what the router remembers from one run to
+//               the next, in files in dir; otherwise every run's a cold start
+//
+// -l and -b can each be given up to MAX_UDP_TRANSPORTS times, for a port
+// per group or tunnel.
+//
+// Sending the process SIGUSR1 dumps its metrics to stdout, in the same
+// format as /metrics on the device, followed by the load generator's.
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_netif.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <nvs_flash.h>
+
+#include "app/app.h"
+#include "boot/boot.h"
+#include "lap/llap/llap.h"
+#include "lap/registry.h"
+#include "lap/sink/sink.h"
+#include "net/b2udptunnel/b2udptunnel.h"
+#include "net/ethernet/ethernet.h"
+#include "net/loadgen/loadgen.h"
+#include "net/ltoudp/ltoudp.h"
+#include "net/tashtalk/tashtalk.h"
+#include "net/common.h"
+#include "net/packet_capture.h"
+#include "persist/persist.h"
+#include "web/loadgen.h"
+#include "web/stats.h"
+#include "controlplane_runloop.h"
+#include "global_state.h"
+#include "router_runloop.h"
+#include "tunables.h"
+
+static const char* TAG = "HOST";
+
+typedef struct {
+	const char* packet_ifname;
+	const char* tap_ifname;
+	const char* ltoudp_groups[MAX_UDP_TRANSPORTS];
+	int ltoudp_group_count;
+	uint16_t b2_ports[MAX_UDP_TRANSPORTS];
+	int b2_port_count;
+	const char* b2_peers;
+	const char* tashtalk_device;
+	const char* ip_ifname;
+	uint16_t loadgen_network;
+	const char* loadgen_query;
+	const char* nvs_dir;
+} host_config_t;
+
+static volatile sig_atomic_t dump_metrics = 0;
+
+static void on_sigusr1(int sig) {
+	dump_metrics = 1;
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr, "usage: %s [-e ifname | -t ifname] [-l group] [-b port [-p peers]]\n"
+		"          [-s device] [-i ifname] [-g network [-G query]] [-n dir]\n", argv0);
+	exit(2);
+}
+
+static void parse_args(int argc, char** argv, host_config_t* config) {
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "e:t:l:b:p:s:i:g:G:n:h")) != -1) {
+		switch (opt) {
+			case 'e':
+				config->packet_ifname = optarg;
+				break;
+			case 't':
+				config->tap_ifname = optarg;
+				break;
+			case 'l':
+				if (config->ltoudp_group_count == MAX_UDP_TRANSPORTS) {
+					fprintf(stderr, "at most %d of -l\n", MAX_UDP_TRANSPORTS);
+					usage(argv[0]);
+				}
+				config->ltoudp_groups[config->ltoudp_group_count++] =
+					strcmp(optarg, "default") == 0 ? LTOUDP_DEFAULT_GROUP : optarg;
+				break;
+			case 'b':
+				if (config->b2_port_count == MAX_UDP_TRANSPORTS) {
+					fprintf(stderr, "at most %d of -b\n", MAX_UDP_TRANSPORTS);
+					usage(argv[0]);
+				}
+				config->b2_ports[config->b2_port_count++] = (uint16_t)strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				config->b2_peers = optarg;
+				break;
+			case 's':
+				config->tashtalk_device = optarg;
+				break;
+			case 'i':
+				config->ip_ifname = optarg;
+				break;
+			case 'g':
+				config->loadgen_network = (uint16_t)strtoul(optarg, NULL, 0);
+				break;
+			case 'G':
+				config->loadgen_query = optarg;
+				break;
+			case 'n':
+				config->nvs_dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	
+	if (config->packet_ifname != NULL && config->tap_ifname != NULL) {
+		fprintf(stderr, "pick one of -e and -t\n");
+		usage(argv[0]);
+	}
+	
+	// The UDP transports need to know what address we've got.  On the
+	// device that's the Ethernet port's; here it's whatever we're told, or
+	// the interface we're doing EtherTalk on, or failing that, loopback.
+	if (config->ip_ifname == NULL) {
+		config->ip_ifname = config->packet_ifname != NULL ? config->packet_ifname : "lo";
+	}
+}
+
+// The host's version of start_net's phases (see net/net.h): the same
+// transports and LAPs, but which ones is up to the command line.
+static host_config_t config;
+static runloop_info_t controlplane;
+static runloop_info_t router;
+
+static transport_t* ethernet_transport;
+static transport_t* ltoudp_transports[MAX_UDP_TRANSPORTS];
+static transport_t* b2_transports[MAX_UDP_TRANSPORTS];
+
+static void start_runloops(void) {
+	controlplane = start_controlplane_runloop();
+	router = start_router_runloop();
+}
+
+static void start_host_persist(void) {
+	nvs_flash_set_directory(config.nvs_dir);
+	start_persist();
+}
+
+static void start_host_netif(void) {
+	start_common();
+	packet_capture_init();
+	global_aarp_table = aarp_new_table();
+	
+	// The host's already got its IP address sorted out
+	active_ip_net_if = host_netif_new(config.ip_ifname);
+	mark_ip_ready();
+}
+
+static void start_host_ethernet(void) {
+	if (config.packet_ifname != NULL) {
+		ethernet_transport = start_ethernet(ethernet_packet_driver(config.packet_ifname));
+	} else if (config.tap_ifname != NULL) {
+		ethernet_transport = start_ethernet(ethernet_tap_driver(config.tap_ifname));
+	}
+}
+
+static void start_host_tashtalk(void) {
+	if (config.tashtalk_device != NULL) {
+		start_tashtalk(tt_uart_linux_backend(config.tashtalk_device));
+	}
+}
+
+static void start_host_udp(void) {
+	for (int i = 0; i < config.ltoudp_group_count; i++) {
+		ltoudp_transports[i] = start_ltoudp(config.ltoudp_groups[i]);
+	}
+	for (int i = 0; i < config.b2_port_count; i++) {
+		if (config.b2_ports[i] != 0) {
+			b2_transports[i] = start_b2udptunnel(config.b2_ports[i], config.b2_peers);
+		}
+	}
+}
+
+static void start_host_laps(void) {
+	global_lap_registry = lap_registry_new();
+	
+	if (ethernet_transport != NULL) {
+		start_sink("SINK-eth", ethernet_transport);
+	}
+	for (int i = 0; i < config.b2_port_count; i++) {
+		if (b2_transports[i] != NULL) {
+			char* name;
+			asprintf(&name, "SINK-b2-%u", (unsigned int)config.b2_ports[i]);
+			start_sink(name, b2_transports[i]);
+		}
+	}
+	
+	if (config.tashtalk_device != NULL) {
+		start_llap("localtalk", tashtalk_get_transport(), global_lap_registry, &controlplane, &router);
+	}
+	
+	// Each group's LAP is named after it, so they don't trip over each
+	// other in the LAP registry or in what's persisted about them.
+	for (int i = 0; i < config.ltoudp_group_count; i++) {
+		if (ltoudp_transports[i] != NULL) {
+			char* name;
+			asprintf(&name, "ltoudp-%s", config.ltoudp_groups[i]);
+			start_llap(name, ltoudp_transports[i], global_lap_registry, &controlplane, &router);
+		}
+	}
+	if (config.loadgen_network != 0) {
+		start_llap("loadgen", start_loadgen(config.loadgen_network), global_lap_registry,
+			&controlplane, &router);
+		
+		if (config.loadgen_query != NULL && !loadgen_apply_query(config.loadgen_query)) {
+			ESP_LOGE(TAG, "bad load generator configuration: %s", config.loadgen_query);
+		}
+	}
+}
+
+// The same graph as the device's, less mDNS and the web server
+static boot_phase_t boot_phases[] = {
+	{ .name = "stats", .start = &start_stats },
+	{ .name = "runloops", .start = &start_runloops },
+	{ .name = "apps", .start = &start_apps, .after = { "runloops" } },
+	{ .name = "persist", .start = &start_host_persist },
+	{ .name = "netif", .start = &start_host_netif },
+	{ .name = "ethernet", .start = &start_host_ethernet, .after = { "netif" } },
+	{ .name = "tashtalk", .start = &start_host_tashtalk },
+	{ .name = "udp", .start = &start_host_udp, .after = { "netif" } },
+	{ .name = "laps", .start = &start_host_laps,
+		.after = { "runloops", "apps", "persist", "ethernet", "tashtalk", "udp" } },
+	{ .name = "warm_start", .start = &persist_warm_start, .after = { "laps" } },
+};
+
+int main(int argc, char** argv) {
+	parse_args(argc, argv, &config);
+	
+	printf("Welcome to OmniTalk\n");
+	printf("Version: %s built on %s (host)\n", GIT_VERSION, BUILD_TIMESTAMP);
+	
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR1, &on_sigusr1);
+	
+	size_t phase_count = sizeof(boot_phases) / sizeof(boot_phase_t);
+	if (!boot_run(boot_phases, phase_count)) {
+		return 1;
+	}
+	boot_report(boot_phases, phase_count);
+	ESP_LOGI(TAG, "router started");
+	
+	while (1) {
+		vTaskDelay(100 / portTICK_PERIOD_MS);
+		
+		if (dump_metrics) {
+			dump_metrics = 0;
+			http_metrics_handler(NULL);
+			loadgen_write_status(NULL);
+			fflush(stdout);
+		}
+	}
+}
@@ -0,0 +1,306 @@
+// replay_bench plays a pcap capture into a real LLAP LAP, through the
+// control plane and apps, and reports how fast the router got through it:
+// frames per second, heap allocations per frame, request-to-reply latency
+// and what got dropped where.
+//
+//   replay_bench [-s speed] [-r node] [-N network] [-S node] capture.pcap
+//
+//   -s speed    replay at the recorded rate times speed; 0 (the default) is
+//               as fast as the router will take them
+//   -r node     the router's node address when the capture was made
+//               (default 254)
+//   -N network  the network the router's on; by default it's taken from
+//               the first RTMP data packet in the capture
+//   -S node     the seed router's node address, likewise
+//
+// The build makes a few captures to compare changes against, in captures/
+// in the build directory; see mkcaptures.pl for what's in them.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "app/app.h"
+#include "lap/llap/llap.h"
+#include "lap/registry.h"
+#include "net/common.h"
+#include "net/packet_capture.h"
+#include "proto/llap.h"
+#include "web/stats.h"
+#include "controlplane_runloop.h"
+#include "global_state.h"
+#include "router_runloop.h"
+
+#include "capture.h"
+#include "replay.h"
+
+static const char* TAG = "REPLAY_BENCH";
+
+#define BENCH_DEFAULT_CAPTURE_NODE 254
+
+// How long the router has to be quiet for before we call it done
+#define BENCH_SETTLE_US 250000
+#define BENCH_STARTUP_TIMEOUT_US 5000000
+
+typedef struct {
+	const char* name;
+	size_t offset;
+} bench_drop_counter_t;
+
+#define DROP(name, field) { name, offsetof(stats_t, field) }
+
+// The places a frame can be thrown away on its way through.  The replay
+// transport's own queue-full count is reported alongside these.
+static const bench_drop_counter_t drop_counters[] = {
+	DROP("llap: control frame", llap_in_drops__reason_control_frame),
+	DROP("llap: malformed", llap_in_drops__reason_malformed),
+	DROP("llap: not for us", llap_in_drops__reason_not_for_us),
+	DROP("controlplane: queue full", controlplane_inbound_queue_full),
+	DROP("controlplane: no app", controlplane_drops__reason_no_app),
+	DROP("ddp: no route", ddp_out_errors__err_no_route_for_network),
+	DROP("rtmp: too short", rtmp_errors__err_packet_too_short),
+	DROP("rtmp: wrong id length", rtmp_errors__err_wrong_id_len),
+	DROP("rtmp: unreachable nexthop", rtmp_errors__err_unreachable_nexthop),
+	DROP("zip: query too short", zip_in_errors__err_query_packet_too_short),
+	DROP("zip: atp dispatch", zip_in_errors__err_atp_dispatch_error),
+	DROP("zip: unknown atp command", zip_in_errors__err_unknown_atp_packet_command),
+	DROP("zip: truncated GetNetInfo", zip_in_errors__err_truncated_GetNetInfo_request),
+	DROP("zip: send failed", zip_out_errors__err_ddp_send_failed),
+	DROP("nbp: no tuple", nbp_in_errors__err_no_tuple),
+	DROP("nbp: zone not known yet", nbp_in_errors__err_zone_not_known_yet),
+	DROP("nbp: reply send failed", nbp_out_errors__type_reply__err_ddp_send_failed),
+	DROP("nbp: too many matches", nbp_out_errors__type_reply__err_too_many_matches),
+	DROP("atp: send failed", atp_out_errors__err_ddp_send_failed),
+};
+
+// Each app's queue-full drops when the replay started, by socket
+static unsigned long socket_drops_before[256];
+
+static unsigned long stat_at(const stats_t* s, size_t offset) {
+	return *(const prometheus_counter_t*)((const uint8_t*)s + offset);
+}
+
+// find_seed_router looks for the first RTMP data packet in the capture,
+// and takes its sender as the seed router
+static bool find_seed_router(capture_t* capture, uint8_t capture_node, uint16_t* network, uint8_t* node) {
+	for (size_t i = 0; i < capture->count; i++) {
+		const uint8_t* f = capture->frames[i].data;
+		size_t len = capture->frames[i].length;
+		const uint8_t* body;
+		
+		if (f[1] == capture_node) {
+			continue;
+		}
+		
+		if (len >= 12 && f[2] == LLAP_TYPE_DDP_SHORT && f[6] == 1 && f[7] == 1) {
+			body = f + 8;
+		} else if (len >= 20 && f[2] == LLAP_TYPE_DDP_LONG && f[14] == 1 && f[15] == 1) {
+			body = f + 16;
+		} else {
+			continue;
+		}
+		
+		*network = ((uint16_t)body[0] << 8) | body[1];
+		*node = body[3];
+		return true;
+	}
+	
+	return false;
+}
+
+static int compare_int64(const void* a, const void* b) {
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static bool bench_wait_for_lap(lap_t* lap) {
+	llap_info_t* info = (llap_info_t*)lap->info;
+	int64_t deadline = esp_timer_get_time() + BENCH_STARTUP_TIMEOUT_US;
+	
+	while (info->state != LLAP_RUNNING) {
+		if (esp_timer_get_time() > deadline) {
+			return false;
+		}
+		usleep(1000);
+	}
+	return true;
+}
+
+// bench_wait_for_quiet waits until the router's had everything and has
+// stopped sending, and returns when it last did anything
+static int64_t bench_wait_for_quiet(transport_t* transport) {
+	replay_counters_t counters;
+	int64_t drained_at = 0;
+	
+	while (1) {
+		int64_t now = esp_timer_get_time();
+		replay_get_counters(transport, &counters);
+		
+		if (uxQueueMessagesWaiting(transport->inbound) != 0) {
+			drained_at = 0;
+		} else if (drained_at == 0) {
+			drained_at = now;
+		}
+		
+		int64_t last = drained_at > counters.last_out_time ? drained_at : counters.last_out_time;
+		if (drained_at != 0 && now - last > BENCH_SETTLE_US) {
+			return last;
+		}
+		usleep(1000);
+	}
+}
+
+static void bench_report(const char* path, capture_t* capture, transport_t* transport,
+	stats_t* before, int64_t finished) {
+	
+	replay_counters_t c;
+	replay_get_counters(transport, &c);
+	
+	size_t n = 0;
+	int64_t* latencies = replay_get_latencies(transport, &n);
+	qsort(latencies, n, sizeof(int64_t), &compare_int64);
+	
+	double seconds = (finished - c.first_in_time) / 1e6;
+	unsigned long allocs = stats.mem_all_allocs - before->mem_all_allocs;
+	
+	printf("%s: %u frames, %u not replayable, %u sent by the router (skipped)\n", path,
+		(unsigned)capture->count, (unsigned)capture->unsupported, (unsigned)c.frames_skipped);
+	printf("  in   %8llu frames %10llu octets", (unsigned long long)c.frames_in,
+		(unsigned long long)c.octets_in);
+	if (seconds > 0) {
+		printf("  %.0f frames/s  %.1f kB/s", c.frames_in / seconds, c.octets_in / seconds / 1000.0);
+	}
+	printf("\n");
+	printf("  out  %8llu frames %10llu octets\n", (unsigned long long)c.frames_out,
+		(unsigned long long)c.octets_out);
+	if (c.frames_in > 0) {
+		printf("  heap %8.2f allocations/frame\n", (double)allocs / c.frames_in);
+	}
+	printf("  replies %5llu, unanswered %llu", (unsigned long long)c.replies,
+		(unsigned long long)c.unanswered);
+	if (n > 0) {
+		printf("  latency us: p50 %" PRId64 " p90 %" PRId64 " p99 %" PRId64 " max %" PRId64,
+			latencies[n / 2], latencies[(n * 9) / 10], latencies[(n * 99) / 100], latencies[n - 1]);
+	}
+	printf("\n");
+	
+	printf("  drops:\n");
+	if (c.frames_queue_full > 0) {
+		printf("    %-28s %8llu\n", "replay: queue full", (unsigned long long)c.frames_queue_full);
+	}
+	for (size_t i = 0; i < sizeof(drop_counters) / sizeof(drop_counters[0]); i++) {
+		unsigned long delta = stat_at(&stats, drop_counters[i].offset) -
+			stat_at(before, drop_counters[i].offset);
+		if (delta > 0) {
+			printf("    %-28s %8lu\n", drop_counters[i].name, delta);
+		}
+	}
+	for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
+		ddp_socket_t* socket = unicast_apps[i].socket;
+		if (socket == NULL) {
+			continue;
+		}
+		
+		unsigned long delta = socket->drops - socket_drops_before[socket->number];
+		if (delta > 0) {
+			printf("    %-16s %-11s %8lu\n", unicast_apps[i].name, "queue full", delta);
+		}
+	}
+	
+	free(latencies);
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr, "usage: %s [-s speed] [-r node] [-N network] [-S node] capture.pcap\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	replay_config_t config = { .capture_node = BENCH_DEFAULT_CAPTURE_NODE };
+	double speed = 0;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "s:r:N:S:h")) != -1) {
+		switch (opt) {
+			case 's':
+				speed = strtod(optarg, NULL);
+				break;
+			case 'r':
+				config.capture_node = strtoul(optarg, NULL, 0);
+				break;
+			case 'N':
+				config.network = strtoul(optarg, NULL, 0);
+				break;
+			case 'S':
+				config.seed_node = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+	}
+	
+	const char* path = argv[optind];
+	capture_t* capture = capture_load(path);
+	if (capture == NULL) {
+		return 1;
+	}
+	
+	if (config.network == 0) {
+		uint16_t network = 0;
+		uint8_t node = 0;
+		if (find_seed_router(capture, config.capture_node, &network, &node)) {
+			config.network = network;
+			if (config.seed_node == 0) {
+				config.seed_node = node;
+			}
+		}
+	}
+	ESP_LOGI(TAG, "network %d, seed router node %d", (int)config.network, (int)config.seed_node);
+	
+	start_stats();
+	runloop_info_t controlplane = start_controlplane_runloop();
+	runloop_info_t router = start_router_runloop();
+	start_apps();
+	start_common();
+	packet_capture_init();
+	global_lap_registry = lap_registry_new();
+	
+	transport_t* transport = start_replay(&config);
+	lap_t* lap = start_llap("replay", transport, global_lap_registry, &controlplane, &router);
+	
+	if (!bench_wait_for_lap(lap)) {
+		ESP_LOGE(TAG, "LAP never got going");
+		return 1;
+	}
+	
+	replay_reset(transport);
+	stats_t before;
+	memcpy(&before, &stats, sizeof(stats));
+	for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
+		if (unicast_apps[i].socket != NULL) {
+			socket_drops_before[unicast_apps[i].socket_number] = unicast_apps[i].socket->drops;
+		}
+	}
+	
+	replay_run(transport, capture, speed);
+	int64_t finished = bench_wait_for_quiet(transport);
+	
+	bench_report(path, capture, transport, &before, finished);
+	
+	replay_counters_t counters;
+	replay_get_counters(transport, &counters);
+	return counters.frames_in > 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+#include "capture.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
+#include "net/ltoudp/ltoudp.h"
+#include "proto/llap.h"
+
+static const char* TAG = "CAPTURE";
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_FILE_HDR_LEN 24
+#define PCAP_RECORD_HDR_LEN 16
+
+#define ETH_HDR_LEN 14
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_MAX_8023_LEN 1500
+
+#define IP_PROTO_UDP 17
+#define UDP_HDR_LEN 8
+#define LTOUDP_HDR_LEN 4
+
+#define DDP_LONG_HDR_LEN 13
+
+static const uint8_t elap_snap_hdr[] = { 0xaa, 0xaa, 0x03, 0x08, 0x00, 0x07, 0x80, 0x9b };
+
+static uint16_t get_be16(const uint8_t* p) {
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static uint32_t get_u32(const uint8_t* p, bool swapped) {
+	if (swapped) {
+		return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+	return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+// elap_to_llap handles an 802.3 frame, which might be ELAP
+static size_t elap_to_llap(const uint8_t* frame, size_t len, uint8_t* out) {
+	size_t llc_len = get_be16(frame + 12);
+	const uint8_t* ddp = frame + ETH_HDR_LEN + sizeof(elap_snap_hdr);
+	
+	if (len < ETH_HDR_LEN + sizeof(elap_snap_hdr) + DDP_LONG_HDR_LEN ||
+		memcmp(frame + ETH_HDR_LEN, elap_snap_hdr, sizeof(elap_snap_hdr)) != 0) {
+		
+		return 0;
+	}
+	
+	// Short frames get padded, so believe DDP about how long the packet is
+	size_t ddp_len = get_be16(ddp) & 0x3ff;
+	if (ddp_len < DDP_LONG_HDR_LEN || ddp_len + sizeof(elap_snap_hdr) > llc_len ||
+		ddp - frame + ddp_len > len) {
+		
+		return 0;
+	}
+	
+	out[0] = ddp[8]; // DDP destination node
+	out[1] = ddp[9]; // DDP source node
+	out[2] = LLAP_TYPE_DDP_LONG;
+	memcpy(out + 3, ddp, ddp_len);
+	return ddp_len + 3;
+}
+
+// ltoudp_to_llap handles an Ethernet II frame, which might be IPv4 carrying
+// LToUDP
+static size_t ltoudp_to_llap(const uint8_t* frame, size_t len, uint8_t* out) {
+	const uint8_t* ip = frame + ETH_HDR_LEN;
+	
+	if (get_be16(frame + 12) != ETH_TYPE_IPV4 || len < ETH_HDR_LEN + 20) {
+		return 0;
+	}
+	
+	size_t ip_hdr_len = (ip[0] & 0x0f) * 4;
+	if ((ip[0] >> 4) != 4 || ip[9] != IP_PROTO_UDP || ip_hdr_len < 20 ||
+		ETH_HDR_LEN + ip_hdr_len + UDP_HDR_LEN > len) {
+		
+		return 0;
+	}
+	
+	const uint8_t* udp = ip + ip_hdr_len;
+	size_t udp_len = get_be16(udp + 4);
+	if (get_be16(udp + 2) != LTOUDP_PORT || udp_len < UDP_HDR_LEN + LTOUDP_HDR_LEN + 3 ||
+		udp - frame + udp_len > len) {
+		
+		return 0;
+	}
+	
+	size_t llap_len = udp_len - UDP_HDR_LEN - LTOUDP_HDR_LEN;
+	memcpy(out, udp + UDP_HDR_LEN + LTOUDP_HDR_LEN, llap_len);
+	return llap_len;
+}
+
+size_t capture_frame_to_llap(uint32_t linktype, const uint8_t* frame, size_t len, uint8_t* out) {
+	switch (linktype) {
+		case CAPTURE_LINKTYPE_LOCALTALK:
+			if (len < 3) {
+				return 0;
+			}
+			memcpy(out, frame, len);
+			return len;
+		
+		case CAPTURE_LINKTYPE_ETHERNET:
+			if (len < ETH_HDR_LEN) {
+				return 0;
+			}
+			if (get_be16(frame + 12) <= ETH_MAX_8023_LEN) {
+				return elap_to_llap(frame, len, out);
+			}
+			return ltoudp_to_llap(frame, len, out);
+		
+		default:
+			return 0;
+	}
+}
+
+static uint8_t* read_whole_file(const char* path, size_t* len_out) {
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		ESP_LOGE(TAG, "couldn't open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+	
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	
+	uint8_t* data = malloc(len > 0 ? len : 1);
+	if (data == NULL || fread(data, 1, len, f) != (size_t)len) {
+		ESP_LOGE(TAG, "couldn't read %s", path);
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	
+	fclose(f);
+	*len_out = len;
+	return data;
+}
+
+capture_t* capture_load(const char* path) {
+	size_t file_len = 0;
+	uint8_t* file = read_whole_file(path, &file_len);
+	if (file == NULL) {
+		return NULL;
+	}
+	
+	capture_t* capture = NULL;
+	bool swapped;
+	uint32_t ts_divisor;
+	
+	if (file_len < PCAP_FILE_HDR_LEN) {
+		ESP_LOGE(TAG, "%s is too short to be a pcap file", path);
+		goto cleanup;
+	}
+	
+	// The magic number tells us both the byte order and whether the
+	// timestamps are in micro- or nanoseconds
+	uint32_t magic = get_u32(file, false);
+	uint32_t magic_swapped = get_u32(file, true);
+	if (magic == PCAP_MAGIC_US || magic_swapped == PCAP_MAGIC_US) {
+		ts_divisor = 1;
+	} else if (magic == PCAP_MAGIC_NS || magic_swapped == PCAP_MAGIC_NS) {
+		ts_divisor = 1000;
+	} else {
+		ESP_LOGE(TAG, "%s isn't a pcap file (pcapng isn't supported)", path);
+		goto cleanup;
+	}
+	swapped = magic != PCAP_MAGIC_US && magic != PCAP_MAGIC_NS;
+	
+	capture = calloc(1, sizeof(capture_t));
+	capture->linktype = get_u32(file + 20, swapped) & 0x0fffffff;
+	if (capture->linktype != CAPTURE_LINKTYPE_ETHERNET &&
+		capture->linktype != CAPTURE_LINKTYPE_LOCALTALK) {
+		
+		ESP_LOGE(TAG, "%s has link type %u, which we can't replay", path,
+			(unsigned)capture->linktype);
+		capture_free(capture);
+		capture = NULL;
+		goto cleanup;
+	}
+	
+	// Two passes: one to count the frames, one to convert them
+	size_t records = 0;
+	for (size_t off = PCAP_FILE_HDR_LEN; off + PCAP_RECORD_HDR_LEN <= file_len; ) {
+		off += PCAP_RECORD_HDR_LEN + get_u32(file + off + 8, swapped);
+		records++;
+	}
+	capture->frames = calloc(records > 0 ? records : 1, sizeof(capture_frame_t));
+	
+	int64_t first_time = 0;
+	for (size_t off = PCAP_FILE_HDR_LEN; off + PCAP_RECORD_HDR_LEN <= file_len; ) {
+		const uint8_t* hdr = file + off;
+		int64_t time = (int64_t)get_u32(hdr, swapped) * 1000000 +
+			get_u32(hdr + 4, swapped) / ts_divisor;
+		size_t caplen = get_u32(hdr + 8, swapped);
+		size_t origlen = get_u32(hdr + 12, swapped);
+		
+		off += PCAP_RECORD_HDR_LEN;
+		if (off + caplen > file_len) {
+			ESP_LOGW(TAG, "%s is truncated", path);
+			break;
+		}
+		
+		const uint8_t* frame = file + off;
+		off += caplen;
+		
+		uint8_t* llap = malloc(caplen > 0 ? caplen : 1);
+		size_t llap_len = 0;
+		if (caplen == origlen) {
+			llap_len = capture_frame_to_llap(capture->linktype, frame, caplen, llap);
+		}
+		if (llap_len == 0) {
+			capture->unsupported++;
+			free(llap);
+			continue;
+		}
+		
+		if (capture->count == 0) {
+			first_time = time;
+		}
+		capture->frames[capture->count++] = (capture_frame_t) {
+			.time = time - first_time,
+			.length = llap_len,
+			.data = llap,
+		};
+	}
+	
+	ESP_LOGI(TAG, "%s: %u frames, %u not replayable", path,
+		(unsigned)capture->count, (unsigned)capture->unsupported);
+
+cleanup:
+	free(file);
+	return capture;
+}
+
+void capture_free(capture_t* capture) {
+	if (capture == NULL) {
+		return;
+	}
+	
+	for (size_t i = 0; i < capture->count; i++) {
+		free(capture->frames[i].data);
+	}
+	free(capture->frames);
+	free(capture);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A capture is a pcap file loaded into memory and turned into the LLAP
+// frames the router would have been handed for it, ready to replay.
+//
+// Three kinds of capture are understood:
+//
+//   - LocalTalk (LINKTYPE_LOCALTALK), which is LLAP already;
+//   - LToUDP, as UDP to port 1954 in an Ethernet capture; the LToUDP header
+//     is taken off and what's left is LLAP;
+//   - EtherTalk, as ELAP in an Ethernet capture.  There's no ELAP LAP yet,
+//     so these are turned into long-header LLAP frames addressed to the
+//     DDP destination node.
+//
+// Anything else (AARP, IP that isn't LToUDP, truncated frames) is counted
+// and left out.
+
+#define CAPTURE_LINKTYPE_ETHERNET 1
+#define CAPTURE_LINKTYPE_LOCALTALK 114
+
+typedef struct {
+	// microseconds since the first frame in the capture
+	int64_t time;
+
+	size_t length;
+	uint8_t* data;
+} capture_frame_t;
+
+typedef struct {
+	uint32_t linktype;
+
+	size_t count;
+	capture_frame_t* frames;
+
+	// unsupported is how many frames in the file weren't ones we could
+	// turn into LLAP
+	size_t unsupported;
+} capture_t;
+
+// capture_load reads a pcap file, or returns NULL (having said why) if it
+// can't.
+capture_t* capture_load(const char* path);
+
+void capture_free(capture_t* capture);
+
+// capture_frame_to_llap turns one captured frame into an LLAP frame in out,
+// which must have room for at least len bytes.  It returns the length of
+// the LLAP frame, or 0 if the frame isn't one we can replay.
+size_t capture_frame_to_llap(uint32_t linktype, const uint8_t* frame, size_t len, uint8_t* out);
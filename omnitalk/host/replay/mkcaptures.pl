@@ -0,0 +1,246 @@
+#!/usr/bin/perl
+use strict;
+use File::Basename;
+
+# mkcaptures.pl writes the reference captures for replay_bench into the
+# directory it's given (by default captures/ next to it); the host build
+# runs it to make them in its own captures/.
+# They're synthetic, but built from what real networks do, and there's one
+# of each kind of capture the replay transport understands:
+#
+#   startup.pcap    LToUDP: a network of Macs booting at once behind a seed
+#                   router: ENQs, RTMP requests, GetZoneList, GetMyZone and
+#                   NBP lookups for their own names.  RTMP and ZIP heavy.
+#   nbp_storm.pcap  LocalTalk: a couple of seconds of Choosers open on a
+#                   busy network; broadcast LkUps, a fifth of them for
+#                   things the router has.
+#   atp_bulk.pcap   EtherTalk: a bulk ATP transfer (XO requests and 8-packet
+#                   responses) between two other machines, with AEP echoes
+#                   to the router mixed in.
+#
+# In all of them the router is node 254 and the seed router is node 10 on
+# network 42, in zone "Lab".  Each starts with the seed router's RTMP data
+# and a ZIP reply, so the router knows where it is, and has some of the
+# router's own frames in, which the replay skips.
+#
+# The output is the same every time, so the files only change when this
+# script does.
+
+my $dir = @ARGV ? $ARGV[0] : dirname($0) . "/captures";
+mkdir $dir;
+
+my $ROUTER = 254;
+my $SEED = 10;
+my $NET = 42;
+my $ZONE = "Lab";
+
+my $LINKTYPE_ETHERNET = 1;
+my $LINKTYPE_LOCALTALK = 114;
+
+# A little LCG, so that we don't depend on perl's rand being the same
+# everywhere
+my $seed = 1;
+sub rnd {
+	my ($n) = @_;
+	$seed = ($seed * 1103515245 + 12345) & 0x7fffffff;
+	return ($seed >> 8) % $n;
+}
+
+sub pstr {
+	my ($s) = @_;
+	return pack("C", length($s)) . $s;
+}
+
+# LLAP frames
+
+sub llap_control {
+	my ($dst, $src, $type) = @_;
+	return pack("CCC", $dst, $src, $type);
+}
+
+sub ddp_short {
+	my ($dst, $src, $dsock, $ssock, $type, $body) = @_;
+	return pack("CCCnCCC", $dst, $src, 1, 5 + length($body), $dsock, $ssock, $type) . $body;
+}
+
+sub ddp_long {
+	my ($lldst, $dnet, $dnode, $dsock, $snet, $snode, $ssock, $type, $body) = @_;
+	return pack("CCCnnnnCCCCC", $lldst, $snode, 2, 13 + length($body), 0,
+		$dnet, $snet, $dnode, $snode, $dsock, $ssock, $type) . $body;
+}
+
+# Link-layer wrapping
+
+sub node_mac {
+	my ($node) = @_;
+	return pack("C6", 0x02, 0x00, 0xa7, 0x00, 0x00, $node);
+}
+
+sub ip_checksum {
+	my ($hdr) = @_;
+	my $sum = 0;
+	$sum += $_ for unpack("n*", $hdr);
+	$sum = ($sum & 0xffff) + ($sum >> 16) while $sum > 0xffff;
+	return ~$sum & 0xffff;
+}
+
+sub ltoudp {
+	my ($llap) = @_;
+	my $src = unpack("x1C", $llap);
+	my $udp = pack("nnnn", 1954, 1954, 8 + 4 + length($llap), 0) . pack("N", 0x4f540000 | $src) . $llap;
+	my $ip = pack("CCnnnCCnNN", 0x45, 0, 20 + length($udp), 0, 0, 1, 17, 0,
+		0x0a000000 | $src, 0xefc04c54);
+	substr($ip, 10, 2) = pack("n", ip_checksum($ip));
+	my $frame = pack("C6", 0x01, 0x00, 0x5e, 0x40, 0x4c, 0x54) . node_mac($src) . pack("n", 0x0800) . $ip . $udp;
+	return $frame;
+}
+
+sub elap {
+	my ($llap) = @_;
+	my ($dst, $src, $type) = unpack("CCC", $llap);
+	die "ELAP only carries long headers" unless $type == 2;
+	my $ddp = substr($llap, 3);
+	my $dmac = $dst == 255 ? pack("C6", 0x09, 0x00, 0x07, 0xff, 0xff, 0xff) : node_mac($dst);
+	my $frame = $dmac . node_mac($src) . pack("n", 8 + length($ddp)) .
+		pack("C8", 0xaa, 0xaa, 0x03, 0x08, 0x00, 0x07, 0x80, 0x9b) . $ddp;
+	$frame .= "\0" x (60 - length($frame)) if length($frame) < 60;
+	return $frame;
+}
+
+# pcap writing
+
+sub write_pcap {
+	my ($name, $linktype, $wrap, @frames) = @_;
+	open(my $out, ">:raw", "$dir/$name") or die "$dir/$name: $!";
+	print $out pack("VvvVVVV", 0xa1b2c3d4, 2, 4, 0, 0, 65535, $linktype);
+	my $base = 1700000000;
+	for my $f (sort { $a->[0] <=> $b->[0] } @frames) {
+		my ($us, $llap) = @$f;
+		my $frame = $wrap->($llap);
+		print $out pack("VVVV", $base + int($us / 1000000), $us % 1000000,
+			length($frame), length($frame)) . $frame;
+	}
+	close($out);
+	printf("%s: %d frames\n", $name, scalar(@frames));
+}
+
+# Things every capture has
+
+sub rtmp_data {
+	my ($long) = @_;
+	my $body = pack("nCC", $NET, 8, $SEED) . pack("nC", 0, 0x82) . pack("nC", $NET, 0);
+	$body .= pack("nC", $_, 1) for (100 .. 119);
+	$body .= pack("nCnC", $_ * 10, 0x82, $_ * 10 + 9, 0x82) for (20 .. 29);
+	return $long ? ddp_long(255, 0, 255, 1, $NET, $SEED, 1, 1, $body)
+		: ddp_short(255, $SEED, 1, 1, 1, $body);
+}
+
+sub zip_reply {
+	my @tuples = ([$NET, $ZONE]);
+	push @tuples, [$_, "Building " . chr(ord("A") + ($_ - 100) % 5)] for (100 .. 119);
+	my $body = pack("CC", 2, scalar(@tuples));
+	$body .= pack("n", $_->[0]) . pstr($_->[1]) for @tuples;
+	return ddp_long($ROUTER, $NET, $ROUTER, 6, $NET, $SEED, 6, 6, $body);
+}
+
+sub zip_query_from_router {
+	my @nets = (100 .. 119);
+	my $body = pack("CC", 1, scalar(@nets)) . pack("n*", @nets);
+	return ddp_long($SEED, $NET, $SEED, 6, $NET, $ROUTER, 6, 6, $body);
+}
+
+sub preamble {
+	my ($long) = @_;
+	return ([0, rtmp_data($long)], [2000, zip_query_from_router()], [5000, zip_reply()]);
+}
+
+sub nbp_lkup {
+	my ($node, $sock, $id, $object, $type, $broadcast) = @_;
+	my $body = pack("CC", 0x21, $id) . pack("nCCC", $NET, $node, $sock, 0) .
+		pstr($object) . pstr($type) . pstr("*");
+	return $broadcast ? ddp_short(255, $node, 2, $sock, 2, $body)
+		: ddp_long($ROUTER, $NET, $ROUTER, 2, $NET, $node, $sock, 2, $body);
+}
+
+sub nbp_reply_from_router {
+	my ($node, $sock, $id, $object, $type) = @_;
+	my $body = pack("CC", 0x31, $id) . pack("nCCC", $NET, $ROUTER, 253, 0) .
+		pstr($object) . pstr($type) . pstr($ZONE);
+	return ddp_long($node, $NET, $node, $sock, $NET, $ROUTER, 2, 2, $body);
+}
+
+sub atp {
+	my ($ctrl, $bitmap, $tid, $user, $payload) = @_;
+	return pack("CCn", $ctrl, $bitmap, $tid) . $user . $payload;
+}
+
+# startup.pcap
+
+{
+	my @f = preamble(0);
+	my $t = 10000;
+	for my $i (0 .. 39) {
+		my $node = 20 + $i;
+		my $sock = 0xfd;
+		my $start = $t + $i * 35000 + rnd(10000);
+
+		push @f, [$start + $_ * 200, llap_control($node, $node, 0x81)] for (0 .. 2);
+		push @f, [$start + 2000, ddp_short(255, $node, 1, $sock, 5, pack("C", 1))];
+		push @f, [$start + 3000, ddp_long($ROUTER, $NET, $ROUTER, 6, $NET, $node, $sock, 3,
+			atp(0x40, 0x01, 0x100 + $i, pack("CCn", 7, 0, 1), ""))];
+		push @f, [$start + 4000, ddp_long($ROUTER, $NET, $ROUTER, 6, $NET, $node, $sock, 3,
+			atp(0x40, 0x01, 0x200 + $i, pack("CCn", 8, 0, 1), ""))];
+		for my $try (0 .. 2) {
+			push @f, [$start + 6000 + $try * 1000,
+				nbp_lkup($node, $sock, $i, "Mac $node", "Workstation", 1)];
+		}
+		push @f, [$start + 10000, nbp_lkup($node, $sock, 0x80 + $i, "=", "OmniTalk", 0)];
+		push @f, [$start + 11000, nbp_reply_from_router($node, $sock, 0x80 + $i, "omnitalk", "OmniTalk")];
+	}
+	push @f, [1500000, rtmp_data(0)];
+	write_pcap("startup.pcap", $LINKTYPE_ETHERNET, \&ltoudp, @f);
+}
+
+# nbp_storm.pcap
+
+{
+	my @f = preamble(0);
+	my @types = ("LaserWriter", "AFPServer", "Workstation", "OmniTalk", "ImageWriter");
+	for my $i (0 .. 1999) {
+		my $node = 20 + rnd(60);
+		my $sock = 0xf0 + rnd(8);
+		my $type = $types[rnd(scalar(@types))];
+		my $t = 10000 + $i * 1000 + rnd(800);
+		push @f, [$t, nbp_lkup($node, $sock, $i & 0xff, "=", $type, 1)];
+		if ($type eq "Workstation" || $type eq "OmniTalk") {
+			push @f, [$t + 300, nbp_reply_from_router($node, $sock, $i & 0xff, "omnitalk", $type)];
+		}
+	}
+	write_pcap("nbp_storm.pcap", $LINKTYPE_LOCALTALK, sub { return $_[0]; }, @f);
+}
+
+# atp_bulk.pcap
+
+{
+	my @f = preamble(1);
+	my ($client, $server) = (30, 31);
+	my $payload = join("", map { chr($_ & 0xff) } (0 .. 577));
+	for my $i (0 .. 119) {
+		my $t = 10000 + $i * 6000;
+		my $tid = 0x1000 + $i;
+		push @f, [$t, ddp_long($server, $NET, $server, 0xf0, $NET, $client, 0xe0, 3,
+			atp(0x40 | 0x20, 0xff, $tid, pack("N", 0x00020000), pack("Nn", $i * 4624, 4624)))];
+		for my $seq (0 .. 7) {
+			my $ctrl = 0x80 | ($seq == 7 ? 0x10 : 0);
+			push @f, [$t + 600 + $seq * 520, ddp_long($client, $NET, $client, 0xe0, $NET, $server, 0xf0, 3,
+				atp($ctrl, $seq, $tid, pack("N", 0), $payload))];
+		}
+		push @f, [$t + 5000, ddp_long($server, $NET, $server, 0xf0, $NET, $client, 0xe0, 3,
+			atp(0xc0, 0xff, $tid, pack("N", 0), ""))];
+		if ($i % 2 == 0) {
+			push @f, [$t + 5500, ddp_long($ROUTER, $NET, $ROUTER, 4, $NET, 40, 0xe8, 4,
+				pack("C", 1) . substr($payload, 0, 64 + ($i % 8) * 64))];
+		}
+	}
+	write_pcap("atp_bulk.pcap", $LINKTYPE_ETHERNET, \&elap, @f);
+}
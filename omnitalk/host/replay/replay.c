@@ -0,0 +1,349 @@
+#include "replay.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "mem/buffers.h"
+#include "net/common.h"
+#include "net/transport.h"
+#include "proto/llap.h"
+#include "tunables.h"
+
+static const char* TAG = "REPLAY";
+
+#define REPLAY_QUEUE_DEPTH 60
+
+// How many requests we remember while waiting for replies.  When it fills
+// up the oldest is given up on.
+#define REPLAY_MAX_OUTSTANDING 4096
+
+#define DDP_TYPE_RTMP_REQUEST 5
+
+typedef struct {
+	uint16_t net;
+	uint8_t node;
+	uint8_t socket;
+} replay_endpoint_t;
+
+typedef struct {
+	replay_endpoint_t from;
+	int64_t sent_at;
+	bool waiting;
+} replay_request_t;
+
+typedef struct {
+	replay_config_t config;
+	
+	_Atomic uint8_t node_address;
+	
+	// the mutex covers everything below it
+	SemaphoreHandle_t mutex;
+	replay_counters_t counters;
+	
+	// outstanding is a ring; head and tail count up forever
+	replay_request_t outstanding[REPLAY_MAX_OUTSTANDING];
+	size_t head;
+	size_t tail;
+	
+	int64_t* latencies;
+	size_t latency_count;
+	size_t latency_capacity;
+} replay_state_t;
+
+// llap_ddp_endpoints pulls the DDP source and destination out of an LLAP
+// frame, if it's carrying DDP
+static bool llap_ddp_endpoints(const uint8_t* frame, size_t len,
+	replay_endpoint_t* src, replay_endpoint_t* dst, uint8_t* ddp_type) {
+	
+	if (len >= 8 && frame[2] == LLAP_TYPE_DDP_SHORT) {
+		*dst = (replay_endpoint_t) { .net = 0, .node = frame[0], .socket = frame[5] };
+		*src = (replay_endpoint_t) { .net = 0, .node = frame[1], .socket = frame[6] };
+		*ddp_type = frame[7];
+		return true;
+	}
+	
+	if (len >= 16 && frame[2] == LLAP_TYPE_DDP_LONG) {
+		*dst = (replay_endpoint_t) {
+			.net = ((uint16_t)frame[7] << 8) | frame[8],
+			.node = frame[11],
+			.socket = frame[13],
+		};
+		*src = (replay_endpoint_t) {
+			.net = ((uint16_t)frame[9] << 8) | frame[10],
+			.node = frame[12],
+			.socket = frame[14],
+		};
+		*ddp_type = frame[15];
+		return true;
+	}
+	
+	return false;
+}
+
+static bool replay_endpoints_match(replay_endpoint_t* a, replay_endpoint_t* b) {
+	// A short header packet doesn't say what network it's on, so zero
+	// matches anything
+	return a->node == b->node && a->socket == b->socket &&
+		(a->net == b->net || a->net == 0 || b->net == 0);
+}
+
+// replay_expect_reply remembers a packet we've sent in as something the
+// router might answer, and returns where it put it
+static size_t replay_expect_reply(replay_state_t* state, replay_endpoint_t* from, int64_t now) {
+	if (state->head - state->tail == REPLAY_MAX_OUTSTANDING) {
+		if (state->outstanding[state->tail % REPLAY_MAX_OUTSTANDING].waiting) {
+			state->counters.unanswered++;
+		}
+		state->tail++;
+	}
+	
+	size_t slot = state->head++;
+	state->outstanding[slot % REPLAY_MAX_OUTSTANDING] = (replay_request_t) {
+		.from = *from,
+		.sent_at = now,
+		.waiting = true,
+	};
+	return slot;
+}
+
+// replay_match_reply looks for the oldest request the router's sent a
+// reply to, and records how long it took
+static void replay_match_reply(replay_state_t* state, replay_endpoint_t* to, int64_t now) {
+	for (size_t i = state->tail; i != state->head; i++) {
+		replay_request_t* req = &state->outstanding[i % REPLAY_MAX_OUTSTANDING];
+		if (!req->waiting || !replay_endpoints_match(&req->from, to)) {
+			continue;
+		}
+		
+		req->waiting = false;
+		state->counters.replies++;
+		
+		if (state->latency_count == state->latency_capacity) {
+			state->latency_capacity = state->latency_capacity == 0 ? 1024 : state->latency_capacity * 2;
+			state->latencies = realloc(state->latencies, state->latency_capacity * sizeof(int64_t));
+		}
+		state->latencies[state->latency_count++] = now - req->sent_at;
+		break;
+	}
+	
+	while (state->tail != state->head && !state->outstanding[state->tail % REPLAY_MAX_OUTSTANDING].waiting) {
+		state->tail++;
+	}
+}
+
+// replay_answer_rtmp_request plays the seed router, and tells the LAP what
+// network it's on
+static void replay_answer_rtmp_request(transport_t* transport, replay_state_t* state, uint8_t requester) {
+	buffer_t* buf = newbuf(ETHERNET_FRAME_LEN, 3);
+	uint8_t* f = buf->data;
+	
+	f[0] = requester;
+	f[1] = state->config.seed_node;
+	f[2] = LLAP_TYPE_DDP_SHORT;
+	f[3] = 0;
+	f[4] = 9; // DDP length: 5 header bytes and 4 of response
+	f[5] = 1; // to and from the RTMP socket
+	f[6] = 1;
+	f[7] = 1; // RTMP response
+	f[8] = state->config.network >> 8;
+	f[9] = state->config.network & 0xff;
+	f[10] = 8; // node ID length in bits
+	f[11] = state->config.seed_node;
+	buf->length = 12;
+	
+	if (!tdeliver(transport, buf)) {
+		freebuf(buf);
+	}
+}
+
+static void replay_outbound_runloop(void* param) {
+	transport_t* transport = (transport_t*)param;
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	buffer_t* buf = NULL;
+	
+	while (1) {
+		xQueueReceive(transport->outbound, &buf, portMAX_DELAY);
+		if (buf == NULL) {
+			continue;
+		}
+		
+		int64_t now = esp_timer_get_time();
+		replay_endpoint_t src, dst;
+		uint8_t ddp_type = 0;
+		bool is_ddp = llap_ddp_endpoints(buf->data, buf->length, &src, &dst, &ddp_type);
+		
+		while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+		state->counters.frames_out++;
+		state->counters.octets_out += buf->length;
+		state->counters.last_out_time = now;
+		if (is_ddp) {
+			replay_match_reply(state, &dst, now);
+		}
+		xSemaphoreGive(state->mutex);
+		
+		if (is_ddp && state->config.network != 0 && ddp_type == DDP_TYPE_RTMP_REQUEST &&
+			dst.socket == 1) {
+			
+			replay_answer_rtmp_request(transport, state, src.node);
+		}
+		
+		freebuf(buf);
+	}
+}
+
+void replay_run(transport_t* transport, capture_t* capture, double speed) {
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	uint8_t capture_node = state->config.capture_node;
+	int64_t start = esp_timer_get_time();
+	
+	for (size_t i = 0; i < capture->count; i++) {
+		capture_frame_t* frame = &capture->frames[i];
+		
+		if (speed > 0) {
+			int64_t due = start + (int64_t)(frame->time / speed);
+			int64_t now = esp_timer_get_time();
+			if (due > now) {
+				usleep(due - now);
+			}
+		}
+		
+		if (capture_node != 0 && frame->data[1] == capture_node) {
+			while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+			state->counters.frames_skipped++;
+			xSemaphoreGive(state->mutex);
+			continue;
+		}
+		
+		buffer_t* buf = newbuf(ETHERNET_FRAME_LEN, 3);
+		memcpy(buf->data, frame->data, frame->length);
+		buf->length = frame->length;
+		
+		// Readdress anything for the router in the capture to us
+		uint8_t node = state->node_address;
+		if (capture_node != 0 && node != 0) {
+			if (buf->data[0] == capture_node) {
+				buf->data[0] = node;
+			}
+			if (buf->length >= 16 && buf->data[2] == LLAP_TYPE_DDP_LONG && buf->data[11] == capture_node) {
+				buf->data[11] = node;
+			}
+		}
+		
+		replay_endpoint_t src = { 0 }, dst = { 0 };
+		uint8_t ddp_type;
+		bool is_request = llap_ddp_endpoints(buf->data, buf->length, &src, &dst, &ddp_type) &&
+			(buf->data[0] == node || buf->data[0] == 0xff);
+		
+		int64_t now = esp_timer_get_time();
+		size_t slot = 0;
+		
+		while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+		if (state->counters.frames_in == 0) {
+			state->counters.first_in_time = now;
+		}
+		state->counters.frames_in++;
+		state->counters.octets_in += buf->length;
+		state->counters.last_in_time = now;
+		if (is_request) {
+			slot = replay_expect_reply(state, &src, now);
+		}
+		xSemaphoreGive(state->mutex);
+		
+		// Flat out, we go as fast as the LAP can take them; otherwise we
+		// behave like a real transport and drop what it can't
+		TickType_t wait = speed > 0 ? 0 : portMAX_DELAY;
+		if (!tdeliver_with_timeout(transport, buf, wait)) {
+			while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+			state->counters.frames_queue_full++;
+			if (is_request) {
+				state->outstanding[slot % REPLAY_MAX_OUTSTANDING].waiting = false;
+			}
+			xSemaphoreGive(state->mutex);
+			freebuf(buf);
+		}
+	}
+}
+
+void replay_get_counters(transport_t* transport, replay_counters_t* out) {
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	*out = state->counters;
+	for (size_t i = state->tail; i != state->head; i++) {
+		if (state->outstanding[i % REPLAY_MAX_OUTSTANDING].waiting) {
+			out->unanswered++;
+		}
+	}
+	xSemaphoreGive(state->mutex);
+}
+
+int64_t* replay_get_latencies(transport_t* transport, size_t* count) {
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	int64_t* latencies = malloc((state->latency_count + 1) * sizeof(int64_t));
+	memcpy(latencies, state->latencies, state->latency_count * sizeof(int64_t));
+	*count = state->latency_count;
+	xSemaphoreGive(state->mutex);
+	
+	return latencies;
+}
+
+void replay_reset(transport_t* transport) {
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	memset(&state->counters, 0, sizeof(state->counters));
+	state->head = state->tail = 0;
+	state->latency_count = 0;
+	xSemaphoreGive(state->mutex);
+}
+
+static esp_err_t replay_transport_enable(transport_t* transport) {
+	return ESP_OK;
+}
+
+static esp_err_t replay_transport_disable(transport_t* transport) {
+	return ESP_OK;
+}
+
+static esp_err_t replay_set_node_address(transport_t* transport, uint8_t addr) {
+	replay_state_t* state = (replay_state_t*)transport->private_data;
+	state->node_address = addr;
+	ESP_LOGI(TAG, "router is node %d; readdressing frames for node %d to it",
+		(int)addr, (int)state->config.capture_node);
+	return ESP_OK;
+}
+
+transport_t* start_replay(replay_config_t* config) {
+	transport_t* transport = calloc(1, sizeof(transport_t));
+	replay_state_t* state = calloc(1, sizeof(replay_state_t));
+	
+	state->config = *config;
+	state->mutex = xSemaphoreCreateMutex();
+	
+	transport->quality = QUALITY_LOCALTALK;
+	transport->kind = "replay";
+	transport->private_data = state;
+	transport->enable = &replay_transport_enable;
+	transport->disable = &replay_transport_disable;
+	transport->set_node_address = &replay_set_node_address;
+	
+	transport->ready_event = xEventGroupCreate();
+	transport->inbound = xQueueCreate(REPLAY_QUEUE_DEPTH, sizeof(buffer_t*));
+	transport->outbound = xQueueCreate(REPLAY_QUEUE_DEPTH, sizeof(buffer_t*));
+	
+	xTaskCreate(&replay_outbound_runloop, "REPLAY-out", 4096, transport, 5, NULL);
+	mark_transport_ready(transport);
+	
+	return transport;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "net/transport.h"
+
+#include "capture.h"
+
+// The replay transport plays a capture into whatever LAP is started on it,
+// and counts what the router sends back out.  Nothing it's sent goes
+// anywhere; it's a counting sink.
+//
+// It also does two things a real network would have done for the router
+// while the capture was being made:
+//
+//   - frames to the router's node address in the capture are readdressed
+//     to whatever address the LAP picks, and frames from it are skipped,
+//     since they're the router's output rather than its input;
+//   - if it's given a network number, it answers the LAP's RTMP requests
+//     as the seed router would have, so that the LAP knows where it is.
+//
+// Each inbound DDP packet is remembered as a possible request, and the
+// first thing the router sends back to the socket it came from is taken
+// as the reply to it; the time between the two is the packet's latency.
+
+typedef struct {
+	uint8_t capture_node;
+	uint16_t network;
+	uint8_t seed_node;
+} replay_config_t;
+
+typedef struct {
+	uint64_t frames_in;
+	uint64_t octets_in;
+	uint64_t frames_out;
+	uint64_t octets_out;
+
+	// frames_skipped is frames the router sent in the capture
+	uint64_t frames_skipped;
+	// frames_queue_full is frames dropped because the LAP wasn't keeping up
+	uint64_t frames_queue_full;
+
+	uint64_t replies;
+	uint64_t unanswered;
+
+	int64_t first_in_time;
+	int64_t last_in_time;
+	int64_t last_out_time;
+} replay_counters_t;
+
+transport_t* start_replay(replay_config_t* config);
+
+// replay_run plays the capture into the transport and returns once it's
+// all been handed over.  With speed 0 frames go as fast as the LAP will
+// take them; otherwise they go at the recorded rate times speed, and any
+// the LAP can't keep up with are dropped, as a real transport would.
+void replay_run(transport_t* transport, capture_t* capture, double speed);
+
+// replay_get_counters copies the counters out.  Requests still waiting
+// for a reply are counted as unanswered.
+void replay_get_counters(transport_t* transport, replay_counters_t* out);
+
+// replay_get_latencies returns the request-to-reply latencies seen so far,
+// in microseconds and in no particular order, in a fresh array the caller
+// must free.
+int64_t* replay_get_latencies(transport_t* transport, size_t* count);
+
+// replay_reset forgets all the counters and latencies, for between runs.
+void replay_reset(transport_t* transport);
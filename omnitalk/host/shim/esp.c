@@ -0,0 +1,223 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_http_server.h"
+#include "esp_idf_version.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+static esp_timer_clock_t timer_clock;
+
+// On the device esp_timer counts from boot, so here it counts from when
+// the process started
+static int64_t process_started;
+
+static int64_t monotonic_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+__attribute__((constructor))
+static void note_process_started(void) {
+	process_started = monotonic_us();
+}
+
+void esp_timer_set_clock(esp_timer_clock_t clock) {
+	timer_clock = clock;
+}
+
+int64_t esp_timer_get_time(void) {
+	if (timer_clock != NULL) {
+		return timer_clock();
+	}
+	
+	return monotonic_us() - process_started;
+}
+
+uint32_t esp_random(void) {
+	uint32_t r = 0;
+	if (getrandom(&r, sizeof(r), 0) != sizeof(r)) {
+		r = (uint32_t)random() ^ ((uint32_t)random() << 16);
+	}
+	return r;
+}
+
+void esp_restart(void) {
+	exit(0);
+}
+
+const char* esp_get_idf_version(void) {
+	return "host";
+}
+
+const char* esp_err_to_name(esp_err_t code) {
+	switch (code) {
+		case ESP_OK:
+			return "ESP_OK";
+		case ESP_FAIL:
+			return "ESP_FAIL";
+		case ESP_ERR_NO_MEM:
+			return "ESP_ERR_NO_MEM";
+		case ESP_ERR_INVALID_ARG:
+			return "ESP_ERR_INVALID_ARG";
+		case ESP_ERR_INVALID_STATE:
+			return "ESP_ERR_INVALID_STATE";
+		case ESP_ERR_INVALID_SIZE:
+			return "ESP_ERR_INVALID_SIZE";
+		case ESP_ERR_NOT_FOUND:
+			return "ESP_ERR_NOT_FOUND";
+		case ESP_ERR_NOT_SUPPORTED:
+			return "ESP_ERR_NOT_SUPPORTED";
+		case ESP_ERR_TIMEOUT:
+			return "ESP_ERR_TIMEOUT";
+		default:
+			return "UNKNOWN ERROR";
+	}
+}
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps) {
+	struct mallinfo2 mi = mallinfo2();
+	
+	*info = (multi_heap_info_t) {
+		.total_free_bytes = mi.fordblks,
+		.total_allocated_bytes = mi.uordblks,
+		.largest_free_block = mi.fordblks,
+		.minimum_free_bytes = mi.fordblks,
+		.allocated_blocks = 0,
+		.free_blocks = mi.ordblks,
+		.total_blocks = mi.ordblks,
+	};
+}
+
+// CONFIG_HEAP_USE_HOOKS: the device's heap calls these on every allocation
+// and free, and the memory stats (and the tests that check them) rely on
+// it, so do the same with glibc's.
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps);
+void esp_heap_trace_free_hook(void* ptr);
+
+void* malloc(size_t size) {
+	void* ptr = __libc_malloc(size);
+	if (ptr != NULL) {
+		esp_heap_trace_alloc_hook(ptr, size, MALLOC_CAP_8BIT);
+	}
+	return ptr;
+}
+
+void* calloc(size_t nmemb, size_t size) {
+	void* ptr = __libc_calloc(nmemb, size);
+	if (ptr != NULL) {
+		esp_heap_trace_alloc_hook(ptr, nmemb * size, MALLOC_CAP_8BIT);
+	}
+	return ptr;
+}
+
+void* realloc(void* old, size_t size) {
+	void* ptr = __libc_realloc(old, size);
+	if (ptr != NULL && old == NULL) {
+		esp_heap_trace_alloc_hook(ptr, size, MALLOC_CAP_8BIT);
+	}
+	return ptr;
+}
+
+void free(void* ptr) {
+	if (ptr != NULL) {
+		esp_heap_trace_free_hook(ptr);
+	}
+	__libc_free(ptr);
+}
+
+// There's no web server on the host.  Anything written to a NULL request
+// goes to stdout, which is handy for dumping stats; everything else is
+// thrown away.
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type) {
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value) {
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status) {
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t len) {
+	if (req != NULL || buf == NULL) {
+		return ESP_OK;
+	}
+	
+	if (len == HTTPD_RESP_USE_STRLEN) {
+		fputs(buf, stdout);
+	} else {
+		fwrite(buf, 1, len, stdout);
+	}
+	return ESP_OK;
+}
+
+esp_err_t httpd_resp_sendstr_chunk(httpd_req_t* req, const char* str) {
+	return httpd_resp_send_chunk(req, str, HTTPD_RESP_USE_STRLEN);
+}
+
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t len) {
+	return httpd_resp_send_chunk(req, buf, len);
+}
+
+esp_err_t httpd_resp_send_404(httpd_req_t* req) {
+	return ESP_OK;
+}
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config) {
+	*handle = NULL;
+	return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri) {
+	return ESP_OK;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len) {
+	const char* query = req == NULL ? NULL : strchr(req->uri, '?');
+	if (query == NULL) {
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (strlen(query + 1) >= buf_len) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	strcpy(buf, query + 1);
+	return ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size) {
+	size_t key_len = strlen(key);
+	
+	while (qry != NULL && *qry != '\0') {
+		const char* end = strchr(qry, '&');
+		size_t len = end != NULL ? (size_t)(end - qry) : strlen(qry);
+		
+		if (len > key_len && strncmp(qry, key, key_len) == 0 && qry[key_len] == '=') {
+			size_t value_len = len - key_len - 1;
+			if (value_len >= val_size) {
+				return ESP_ERR_INVALID_SIZE;
+			}
+			memcpy(val, qry + key_len + 1, value_len);
+			val[value_len] = '\0';
+			return ESP_OK;
+		}
+		qry = end != NULL ? end + 1 : NULL;
+	}
+	return ESP_ERR_NOT_FOUND;
+}
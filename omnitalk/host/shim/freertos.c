@@ -0,0 +1,335 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+// Queues are ring buffers of fixed-size items guarded by a mutex.  A mutex
+// (the FreeRTOS kind) is a queue with room for one zero-sized item, where
+// taking the mutex is putting the item in.
+struct host_queue_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	
+	size_t length;
+	size_t item_size;
+	size_t head;
+	size_t count;
+	uint8_t* items;
+};
+
+struct host_task_s {
+	TaskFunction_t fn;
+	void* param;
+};
+
+struct host_event_group_s {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	EventBits_t bits;
+};
+
+static void deadline_for(TickType_t wait, struct timespec* deadline) {
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	
+	uint64_t ns = (uint64_t)wait * portTICK_PERIOD_MS * 1000000ULL;
+	deadline->tv_sec += ns / 1000000000ULL;
+	deadline->tv_nsec += ns % 1000000000ULL;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+// wait_on waits on a condition variable for as long as a FreeRTOS call
+// with the given wait would block.  It returns false if we've run out of
+// time.
+static bool wait_on(pthread_cond_t* cond, pthread_mutex_t* mutex, TickType_t wait,
+	struct timespec* deadline) {
+	
+	if (wait == 0) {
+		return false;
+	}
+	
+	if (wait == portMAX_DELAY) {
+		pthread_cond_wait(cond, mutex);
+		return true;
+	}
+	
+	return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static void init_cond(pthread_cond_t* cond) {
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+	struct host_queue_s* queue = calloc(1, sizeof(struct host_queue_s));
+	if (queue == NULL) {
+		return NULL;
+	}
+	
+	pthread_mutex_init(&queue->mutex, NULL);
+	init_cond(&queue->not_empty);
+	init_cond(&queue->not_full);
+	queue->length = length;
+	queue->item_size = item_size;
+	queue->items = calloc(length > 0 ? length : 1, item_size > 0 ? item_size : 1);
+	
+	return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_cond_destroy(&queue->not_full);
+	free(queue->items);
+	free(queue);
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void* item, TickType_t wait, bool to_front) {
+	struct timespec deadline;
+	deadline_for(wait, &deadline);
+	
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->length) {
+		if (!wait_on(&queue->not_full, &queue->mutex, wait, &deadline) &&
+			queue->count == queue->length) {
+			
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+	}
+	
+	size_t slot;
+	if (to_front) {
+		queue->head = (queue->head + queue->length - 1) % queue->length;
+		slot = queue->head;
+	} else {
+		slot = (queue->head + queue->count) % queue->length;
+	}
+	
+	if (queue->item_size > 0) {
+		memcpy(queue->items + slot * queue->item_size, item, queue->item_size);
+	}
+	queue->count++;
+	
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void* item, TickType_t wait) {
+	return queue_send(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t wait) {
+	return queue_send(queue, item, wait, true);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t wait) {
+	struct timespec deadline;
+	deadline_for(wait, &deadline);
+	
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == 0) {
+		if (!wait_on(&queue->not_empty, &queue->mutex, wait, &deadline) &&
+			queue->count == 0) {
+			
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFALSE;
+		}
+	}
+	
+	memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+	queue->head = (queue->head + 1) % queue->length;
+	queue->count--;
+	
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+	pthread_mutex_lock(&queue->mutex);
+	queue->head = 0;
+	queue->count = 0;
+	pthread_cond_broadcast(&queue->not_full);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+	pthread_mutex_lock(&queue->mutex);
+	UBaseType_t count = queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+	return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+	pthread_mutex_lock(&queue->mutex);
+	UBaseType_t spaces = queue->length - queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+	return spaces;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+	return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait) {
+	return queue_send(sem, NULL, wait, false);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+	pthread_mutex_lock(&sem->mutex);
+	sem->count = 0;
+	pthread_cond_signal(&sem->not_full);
+	pthread_mutex_unlock(&sem->mutex);
+	return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate(void) {
+	struct host_event_group_s* group = calloc(1, sizeof(struct host_event_group_s));
+	if (group == NULL) {
+		return NULL;
+	}
+	
+	pthread_mutex_init(&group->mutex, NULL);
+	init_cond(&group->cond);
+	return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+	pthread_mutex_destroy(&group->mutex);
+	pthread_cond_destroy(&group->cond);
+	free(group);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+	pthread_mutex_lock(&group->mutex);
+	group->bits |= bits;
+	EventBits_t result = group->bits;
+	pthread_cond_broadcast(&group->cond);
+	pthread_mutex_unlock(&group->mutex);
+	return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+	pthread_mutex_lock(&group->mutex);
+	EventBits_t result = group->bits;
+	group->bits &= ~bits;
+	pthread_mutex_unlock(&group->mutex);
+	return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+	pthread_mutex_lock(&group->mutex);
+	EventBits_t result = group->bits;
+	pthread_mutex_unlock(&group->mutex);
+	return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+	BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t wait) {
+	
+	struct timespec deadline;
+	deadline_for(wait, &deadline);
+	
+	pthread_mutex_lock(&group->mutex);
+	while (1) {
+		bool satisfied = wait_for_all ? ((group->bits & bits) == bits) : ((group->bits & bits) != 0);
+		if (satisfied || !wait_on(&group->cond, &group->mutex, wait, &deadline)) {
+			break;
+		}
+	}
+	
+	EventBits_t result = group->bits;
+	if (clear_on_exit) {
+		group->bits &= ~bits;
+	}
+	pthread_mutex_unlock(&group->mutex);
+	return result;
+}
+
+// The task each thread's running, so that it can delete itself
+static __thread struct host_task_s* current_task;
+
+static void* task_trampoline(void* arg) {
+	struct host_task_s* task = (struct host_task_s*)arg;
+	current_task = task;
+	task->fn(task->param);
+	return NULL;
+}
+
+// Stack sizes and priorities don't mean anything to us: Linux gives every
+// thread plenty of stack and schedules them as it sees fit.
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack_depth,
+	void* param, UBaseType_t priority, TaskHandle_t* created_task) {
+	
+	struct host_task_s* task = calloc(1, sizeof(struct host_task_s));
+	if (task == NULL) {
+		return pdFAIL;
+	}
+	
+	task->fn = fn;
+	task->param = param;
+	
+	// The task might have deleted itself, and task with it, by the time
+	// pthread_create returns
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, &task_trampoline, task) != 0) {
+		free(task);
+		return pdFAIL;
+	}
+	
+	pthread_setname_np(thread, name);
+	pthread_detach(thread);
+	
+	if (created_task != NULL) {
+		*created_task = task;
+	}
+	return pdPASS;
+}
+
+// Only a task deleting itself is supported
+void vTaskDelete(TaskHandle_t task) {
+	if (task != NULL) {
+		abort();
+	}
+	
+	free(current_task);
+	pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks) {
+	if (ticks == portMAX_DELAY) {
+		while (1) {
+			pause();
+		}
+	}
+	
+	uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+	struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = (ms % 1000) * 1000000L,
+	};
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include "esp_event.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+
+struct esp_netif_obj {
+	char ifname[IFNAMSIZ];
+};
+
+esp_err_t esp_netif_init(void) {
+	return ESP_OK;
+}
+
+esp_err_t esp_event_loop_create_default(void) {
+	return ESP_OK;
+}
+
+esp_netif_t* host_netif_new(const char* ifname) {
+	esp_netif_t* netif = calloc(1, sizeof(esp_netif_t));
+	if (netif == NULL) {
+		return NULL;
+	}
+	
+	snprintf(netif->ifname, IFNAMSIZ, "%s", ifname);
+	return netif;
+}
+
+static esp_err_t get_if_addr(int sock, const char* ifname, unsigned long request, esp_ip4_addr_t* out) {
+	struct ifreq ifr = { 0 };
+	
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname);
+	if (ioctl(sock, request, &ifr) < 0) {
+		return ESP_FAIL;
+	}
+	
+	out->addr = ((struct sockaddr_in*)&ifr.ifr_addr)->sin_addr.s_addr;
+	return ESP_OK;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t* netif, esp_netif_ip_info_t* ip_info) {
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		return ESP_FAIL;
+	}
+	
+	memset(ip_info, 0, sizeof(esp_netif_ip_info_t));
+	esp_err_t err = get_if_addr(sock, netif->ifname, SIOCGIFADDR, &ip_info->ip);
+	if (err == ESP_OK) {
+		get_if_addr(sock, netif->ifname, SIOCGIFNETMASK, &ip_info->netmask);
+	}
+	
+	close(sock);
+	return err;
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type) {
+	char hostname[256] = { 0 };
+	uint32_t hash = 2166136261u;
+	
+	gethostname(hostname, sizeof(hostname) - 1);
+	for (char* c = hostname; *c != '\0'; c++) {
+		hash = (hash ^ (uint8_t)*c) * 16777619u;
+	}
+	
+	mac[0] = 0x02;
+	mac[1] = (uint8_t)type;
+	memcpy(mac + 2, &hash, sizeof(hash));
+	return ESP_OK;
+}
@@ -0,0 +1,288 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+// NVS on the host is a set of blobs named "<namespace>.<key>".  They live
+// in memory, and if there's a directory to keep them in, in a file each
+// there as well, which is read back in the next time they're asked for.
+
+static const char* TAG = "NVS";
+
+#define NVS_MAX_HANDLES 8
+
+typedef struct nvs_blob_s {
+	char name[2 * NVS_KEY_NAME_MAX_SIZE];
+	void* data;
+	size_t length;
+	struct nvs_blob_s* next;
+} nvs_blob_t;
+
+static pthread_mutex_t nvs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static nvs_blob_t* blobs;
+static char* directory;
+static bool initialised;
+
+static char namespaces[NVS_MAX_HANDLES][NVS_KEY_NAME_MAX_SIZE];
+static bool writable[NVS_MAX_HANDLES];
+
+void nvs_flash_set_directory(const char* path) {
+	free(directory);
+	directory = path != NULL ? strdup(path) : NULL;
+}
+
+esp_err_t nvs_flash_init(void) {
+	if (directory != NULL && mkdir(directory, 0755) != 0 && errno != EEXIST) {
+		ESP_LOGE(TAG, "can't make %s: %s", directory, strerror(errno));
+		return ESP_FAIL;
+	}
+	initialised = true;
+	return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+	pthread_mutex_lock(&nvs_mutex);
+	while (blobs != NULL) {
+		nvs_blob_t* blob = blobs;
+		blobs = blob->next;
+		
+		if (directory != NULL) {
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", directory, blob->name);
+			unlink(path);
+		}
+		free(blob->data);
+		free(blob);
+	}
+	pthread_mutex_unlock(&nvs_mutex);
+	return ESP_OK;
+}
+
+static bool nvs_valid_name(const char* name) {
+	return name != NULL && name[0] != '\0' && strlen(name) < NVS_KEY_NAME_MAX_SIZE &&
+		strchr(name, '/') == NULL;
+}
+
+esp_err_t nvs_open(const char* namespace_name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle) {
+	if (!initialised) {
+		return ESP_ERR_NVS_NOT_INITIALIZED;
+	}
+	if (!nvs_valid_name(namespace_name)) {
+		return ESP_ERR_NVS_INVALID_NAME;
+	}
+	
+	esp_err_t err = ESP_ERR_NO_MEM;
+	pthread_mutex_lock(&nvs_mutex);
+	for (int i = 0; i < NVS_MAX_HANDLES; i++) {
+		if (namespaces[i][0] == '\0') {
+			strcpy(namespaces[i], namespace_name);
+			writable[i] = open_mode == NVS_READWRITE;
+			*out_handle = i + 1;
+			err = ESP_OK;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&nvs_mutex);
+	return err;
+}
+
+void nvs_close(nvs_handle_t handle) {
+	if (handle >= 1 && handle <= NVS_MAX_HANDLES) {
+		pthread_mutex_lock(&nvs_mutex);
+		namespaces[handle - 1][0] = '\0';
+		pthread_mutex_unlock(&nvs_mutex);
+	}
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+	// Everything's written as it's set
+	return ESP_OK;
+}
+
+// nvs_blob_name works out what a key's blob is called, under the mutex
+static esp_err_t nvs_blob_name(nvs_handle_t handle, const char* key, char* name, bool for_writing) {
+	if (handle < 1 || handle > NVS_MAX_HANDLES || namespaces[handle - 1][0] == '\0') {
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	if (for_writing && !writable[handle - 1]) {
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	}
+	if (!nvs_valid_name(key)) {
+		return ESP_ERR_NVS_INVALID_NAME;
+	}
+	snprintf(name, 2 * NVS_KEY_NAME_MAX_SIZE, "%s.%s", namespaces[handle - 1], key);
+	return ESP_OK;
+}
+
+static nvs_blob_t* nvs_find_blob(const char* name) {
+	for (nvs_blob_t* blob = blobs; blob != NULL; blob = blob->next) {
+		if (strcmp(blob->name, name) == 0) {
+			return blob;
+		}
+	}
+	return NULL;
+}
+
+static nvs_blob_t* nvs_new_blob(const char* name, const void* data, size_t length) {
+	nvs_blob_t* blob = calloc(1, sizeof(nvs_blob_t));
+	strcpy(blob->name, name);
+	blob->data = malloc(length > 0 ? length : 1);
+	memcpy(blob->data, data, length);
+	blob->length = length;
+	blob->next = blobs;
+	blobs = blob;
+	return blob;
+}
+
+// nvs_load_blob reads a blob in from its file, if it's got one
+static nvs_blob_t* nvs_load_blob(const char* name) {
+	if (directory == NULL) {
+		return NULL;
+	}
+	
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", directory, name);
+	FILE* f = fopen(path, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	
+	nvs_blob_t* blob = NULL;
+	struct stat st;
+	if (fstat(fileno(f), &st) == 0) {
+		void* data = malloc(st.st_size > 0 ? st.st_size : 1);
+		if (fread(data, 1, st.st_size, f) == (size_t)st.st_size) {
+			blob = nvs_new_blob(name, data, st.st_size);
+		}
+		free(data);
+	}
+	fclose(f);
+	return blob;
+}
+
+// nvs_save_blob writes a blob's file, all at once, so that a crash halfway
+// through leaves the old one
+static esp_err_t nvs_save_blob(nvs_blob_t* blob) {
+	if (directory == NULL) {
+		return ESP_OK;
+	}
+	
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", directory, blob->name);
+	snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.tmp", directory, blob->name);
+	
+	FILE* f = fopen(tmp_path, "wb");
+	if (f == NULL) {
+		ESP_LOGE(TAG, "can't write %s: %s", tmp_path, strerror(errno));
+		return ESP_FAIL;
+	}
+	bool written = fwrite(blob->data, 1, blob->length, f) == blob->length;
+	if (fclose(f) != 0 || !written || rename(tmp_path, path) != 0) {
+		ESP_LOGE(TAG, "can't write %s: %s", path, strerror(errno));
+		unlink(tmp_path);
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+	char name[2 * NVS_KEY_NAME_MAX_SIZE];
+	
+	pthread_mutex_lock(&nvs_mutex);
+	esp_err_t err = nvs_blob_name(handle, key, name, false);
+	if (err != ESP_OK) {
+		goto done;
+	}
+	
+	nvs_blob_t* blob = nvs_find_blob(name);
+	if (blob == NULL) {
+		blob = nvs_load_blob(name);
+	}
+	if (blob == NULL) {
+		err = ESP_ERR_NVS_NOT_FOUND;
+		goto done;
+	}
+	
+	// As on the device, with nowhere to put it you get the length
+	if (out_value == NULL) {
+		*length = blob->length;
+	} else if (*length < blob->length) {
+		err = ESP_ERR_NVS_INVALID_LENGTH;
+	} else {
+		memcpy(out_value, blob->data, blob->length);
+		*length = blob->length;
+	}
+	
+done:
+	pthread_mutex_unlock(&nvs_mutex);
+	return err;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+	char name[2 * NVS_KEY_NAME_MAX_SIZE];
+	
+	pthread_mutex_lock(&nvs_mutex);
+	esp_err_t err = nvs_blob_name(handle, key, name, true);
+	if (err != ESP_OK) {
+		goto done;
+	}
+	
+	nvs_blob_t* blob = nvs_find_blob(name);
+	if (blob == NULL) {
+		blob = nvs_new_blob(name, value, length);
+	} else {
+		free(blob->data);
+		blob->data = malloc(length > 0 ? length : 1);
+		memcpy(blob->data, value, length);
+		blob->length = length;
+	}
+	err = nvs_save_blob(blob);
+	
+done:
+	pthread_mutex_unlock(&nvs_mutex);
+	return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+	char name[2 * NVS_KEY_NAME_MAX_SIZE];
+	
+	pthread_mutex_lock(&nvs_mutex);
+	esp_err_t err = nvs_blob_name(handle, key, name, true);
+	if (err != ESP_OK) {
+		goto done;
+	}
+	
+	err = ESP_ERR_NVS_NOT_FOUND;
+	for (nvs_blob_t** link = &blobs; *link != NULL; link = &(*link)->next) {
+		if (strcmp((*link)->name, name) == 0) {
+			nvs_blob_t* blob = *link;
+			*link = blob->next;
+			free(blob->data);
+			free(blob);
+			err = ESP_OK;
+			break;
+		}
+	}
+	
+	if (directory != NULL) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%s", directory, name);
+		if (unlink(path) == 0) {
+			err = ESP_OK;
+		}
+	}
+	
+done:
+	pthread_mutex_unlock(&nvs_mutex);
+	return err;
+}
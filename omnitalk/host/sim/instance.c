@@ -0,0 +1,228 @@
+#include "instance.h"
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "app/zip/zip.h"
+#include "mem/buffers.h"
+#include "proto/ddp.h"
+#include "web/stats.h"
+#include "controlplane_runloop.h"
+#include "global_state.h"
+
+// The instance whose tables the globals point at, while it's doing
+// something
+static instance_t* current;
+
+// What the instance's code used, apart from what the simulator did on its
+// behalf while it was running
+static uint64_t entered_cpu_ns;
+static int64_t entered_heap;
+static uint64_t entered_allocs;
+static uint64_t excluded_cpu_ns;
+static int64_t excluded_heap;
+
+static uint64_t cpu_time_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int64_t heap_in_use(void) {
+	return (int64_t)mallinfo2().uordblks;
+}
+
+static void instance_note_route_event(rt_route_t* route, bool deleted) {
+	instance_t* instance = current;
+	assert(instance != NULL);
+	
+	if (instance->route_event_count == instance->route_event_capacity) {
+		instance->route_event_capacity = instance->route_event_capacity == 0 ? 64 :
+			instance->route_event_capacity * 2;
+		instance->route_events = realloc(instance->route_events,
+			instance->route_event_capacity * sizeof(instance_route_event_t));
+		assert(instance->route_events != NULL);
+	}
+	
+	instance->route_events[instance->route_event_count++] = (instance_route_event_t){
+		.route = *route,
+		.deleted = deleted,
+	};
+}
+
+static void instance_route_touched(void* param) {
+	if (param != NULL) {
+		instance_note_route_event((rt_route_t*)param, false);
+	}
+}
+
+static void instance_network_deleted(void* param) {
+	if (param != NULL) {
+		instance_note_route_event((rt_route_t*)param, true);
+	}
+}
+
+static bool instance_lsend(lap_t* lap, buffer_t* buff) {
+	instance_t* instance = current;
+	assert(instance != NULL && lap >= instance->laps && lap < instance->laps + instance->port_count);
+	
+	// The LAP sends to the nexthop if there is one, otherwise straight to
+	// the destination
+	uint8_t link_dst = DDP_DST(buff);
+	if (buff->send_chain.via_net != 0 || buff->send_chain.via_node != 0) {
+		link_dst = buff->send_chain.via_node;
+	}
+	
+	uint64_t cpu_before = cpu_time_ns();
+	int64_t heap_before = heap_in_use();
+	sim_transmit(&instance->ports[lap - instance->laps], link_dst, buff->ddp_data, buff->ddp_length);
+	excluded_cpu_ns += cpu_time_ns() - cpu_before;
+	excluded_heap += heap_in_use() - heap_before;
+	
+	instance->frames_out++;
+	freebuf(buff);
+	return true;
+}
+
+static void instance_enter(instance_t* instance) {
+	assert(current == NULL);
+	current = instance;
+	
+	global_routing_table = instance->routing_table;
+	global_zip_table = instance->zip_table;
+	global_lap_registry = instance->lap_registry;
+	lap_lsend_mock = &instance_lsend;
+	
+	excluded_cpu_ns = 0;
+	excluded_heap = 0;
+	entered_allocs = stats.mem_all_allocs;
+	entered_heap = heap_in_use();
+	entered_cpu_ns = cpu_time_ns();
+}
+
+static void instance_leave(void) {
+	instance_t* instance = current;
+	
+	// Let the ZIP app catch up with the routing table, as its idle task
+	// would
+	for (size_t i = 0; i < instance->route_event_count; i++) {
+		instance_route_event_t* event = &instance->route_events[i];
+		if (event->deleted) {
+			app_zip_network_deleted(&event->route);
+		} else {
+			app_zip_route_touched(&event->route);
+		}
+	}
+	instance->route_event_count = 0;
+	
+	instance->cpu_ns += cpu_time_ns() - entered_cpu_ns - excluded_cpu_ns;
+	instance->heap_bytes += heap_in_use() - entered_heap - excluded_heap;
+	instance->allocs += stats.mem_all_allocs - entered_allocs;
+	if (instance->heap_bytes > instance->heap_peak) {
+		instance->heap_peak = instance->heap_bytes;
+	}
+	
+	lap_lsend_mock = NULL;
+	current = NULL;
+}
+
+static void instance_receive(sim_port_t* port, sim_frame_t* frame) {
+	instance_t* instance = (instance_t*)port->owner;
+	lap_t* lap = &instance->laps[port - instance->ports];
+	
+	instance_enter(instance);
+	instance->frames_in++;
+	
+	buffer_t* packet = newbuf(frame->length, 0);
+	memcpy(packet->data, frame->data, frame->length);
+	packet->length = frame->length;
+	
+	if (!buf_setup_ddp(packet, 0, BUF_LONG_HEADER)) {
+		freebuf(packet);
+	} else {
+		packet->recv_chain.lap = lap;
+		if (ddp_packet_is_mine(lap, packet)) {
+			controlplane_dispatch(packet);
+		} else {
+			// The router doesn't forward anything yet
+			freebuf(packet);
+		}
+	}
+	
+	instance_leave();
+}
+
+static void instance_prune(void* ctx, void* arg) {
+	instance_t* instance = (instance_t*)ctx;
+	
+	instance_enter(instance);
+	rt_prune(instance->routing_table);
+	instance_leave();
+	
+	sim_schedule(sim_now() + INSTANCE_PRUNE_INTERVAL_US, &instance_prune, instance, NULL);
+}
+
+void instance_init(instance_t* instance, int index) {
+	memset(instance, 0, sizeof(instance_t));
+	instance->index = index;
+	
+	instance_enter(instance);
+	instance->routing_table = rt_new();
+	instance->zip_table = zt_new();
+	instance->lap_registry = lap_registry_new();
+	rt_attach_touch_callback(instance->routing_table, &instance_route_touched);
+	rt_attach_net_range_removed_callback(instance->routing_table, &instance_network_deleted);
+	instance_leave();
+}
+
+bool instance_attach(instance_t* instance, sim_segment_t* segment) {
+	if (instance->port_count == INSTANCE_MAX_PORTS) {
+		return false;
+	}
+	
+	size_t i = instance->port_count;
+	sim_port_t* port = &instance->ports[i];
+	if (!sim_attach(segment, port, &instance_receive, instance)) {
+		return false;
+	}
+	instance->port_count++;
+	
+	snprintf(instance->lap_names[i], sizeof(instance->lap_names[i]), "sim%d.%d",
+		instance->index, (int)i);
+	
+	lap_t* lap = &instance->laps[i];
+	memset(lap, 0, sizeof(lap_t));
+	lap->kind = (char*)sim_link_models[segment->kind].name;
+	lap->name = instance->lap_names[i];
+	lap->quality = segment->kind == SIM_LOCALTALK ? 1 : 2;
+	lap->my_address = port->node;
+	lap->my_network = segment->network;
+	lap->network_range_start = segment->network;
+	lap->network_range_end = segment->network;
+	
+	instance_enter(instance);
+	lap_registry_register(instance->lap_registry, lap);
+	rt_touch_direct(instance->routing_table, segment->network, segment->network, lap);
+	instance_leave();
+	return true;
+}
+
+void instance_start(instance_t* instance) {
+	sim_schedule(sim_now() + sim_random() % INSTANCE_PRUNE_INTERVAL_US, &instance_prune, instance, NULL);
+}
+
+bool instance_knows_network(instance_t* instance, uint16_t network, bool* zones_complete) {
+	if (!zt_contains_net(instance->zip_table, network)) {
+		return false;
+	}
+	*zones_complete = zt_network_is_complete(instance->zip_table, network);
+	return true;
+}
+
+size_t instance_network_count(instance_t* instance) {
+	return zt_count_net_ranges(instance->zip_table);
+}
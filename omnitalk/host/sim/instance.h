@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lap/lap.h"
+#include "lap/registry.h"
+#include "table/routing/table.h"
+#include "table/zip/table.h"
+
+#include "sim.h"
+
+// An instance is a real OmniTalk router: its own routing table, ZIP table
+// and LAP registry, with the real RTMP, ZIP and other apps handling what
+// arrives on its ports.  The router keeps those in globals, so before an
+// instance does anything the simulator points the globals at its tables,
+// and points lsend at the segments its LAPs are on.
+//
+// What the router's tasks would do is done by the simulator instead, as
+// events on the virtual clock:
+//
+//   - a port's LAP is up from the start, with the segment's network and a
+//     node address the simulator gives it, as though it had acquired them
+//     (see below);
+//   - a packet for the router goes straight to the app on its socket, as
+//     the control plane would pass it on;
+//   - the ZIP app's idle task is kept up to date with what's happened to
+//     the routing table as soon as the instance is done with each packet;
+//   - the RTMP app's idle task prunes the routing table every
+//     INSTANCE_PRUNE_INTERVAL_US.
+//
+// How much CPU time and heap each instance uses doing all that is counted
+// separately.
+//
+// LLAP's address and network acquisition isn't simulated, on purpose.  It
+// could be driven from the virtual clock (llap_start_acquisition, then
+// llap_handle_frame and llap_handle_deadline), but segments only carry
+// long-header datagrams, with no ENQs, ACKs or short-header RTMP requests,
+// and peers don't answer requests.  What's measured is convergence after
+// the ports are up, which acquisition would only put off by a fixed
+// LLAP_ENQ_WAIT_US + LLAP_NETINFO_WAIT_US.
+
+#define INSTANCE_MAX_PORTS 4
+#define INSTANCE_PRUNE_INTERVAL_US (20 * SIM_US_PER_SECOND)
+
+typedef struct {
+	rt_route_t route;
+	bool deleted;
+} instance_route_event_t;
+
+typedef struct {
+	int index;
+	
+	rt_routing_table_t* routing_table;
+	zt_zip_table_t* zip_table;
+	lap_registry_t* lap_registry;
+	
+	size_t port_count;
+	sim_port_t ports[INSTANCE_MAX_PORTS];
+	lap_t laps[INSTANCE_MAX_PORTS];
+	char lap_names[INSTANCE_MAX_PORTS][16];
+	
+	// What the routing table's said has happened, for the ZIP app
+	instance_route_event_t* route_events;
+	size_t route_event_count;
+	size_t route_event_capacity;
+	
+	uint64_t frames_in;
+	uint64_t frames_out;
+	
+	// CPU time, in nanoseconds, and heap used by the router's own code
+	uint64_t cpu_ns;
+	uint64_t allocs;
+	int64_t heap_bytes;
+	int64_t heap_peak;
+} instance_t;
+
+void instance_init(instance_t* instance, int index);
+
+// instance_attach gives the instance a port on the segment.
+bool instance_attach(instance_t* instance, sim_segment_t* segment);
+
+// instance_start schedules the instance's first prune, at a random point in
+// its first interval.
+void instance_start(instance_t* instance);
+
+// instance_knows_network says whether the instance has the network in its
+// tables, and if so whether it knows all of the network's zones.
+bool instance_knows_network(instance_t* instance, uint16_t network, bool* zones_complete);
+size_t instance_network_count(instance_t* instance);
@@ -0,0 +1,547 @@
+// router_sim runs OmniTalk routers in a simulated AppleTalk internet, on a
+// virtual clock, and reports how long they took to converge and what it
+// cost them.  Simulated minutes take seconds, and the same seed gives the
+// same run every time (apart from the CPU times, which are measured).
+//
+//   router_sim [-r peers] [-n networks] [-x links] [-o instances]
+//              [-p ports] [-z zones] [-t seconds] [-k seconds] [-s seed]
+//
+//   -r peers      how many modelled routers there are (default 50; see
+//                 peer.h)
+//   -n networks   how many stub networks hang off them (default 200),
+//                 mostly LocalTalk
+//   -x links      how many extra Ethernet or LToUDP links there are
+//                 between peers, on top of the tree that connects them all,
+//                 to make loops (default peers / 10)
+//   -o instances  how many OmniTalk routers there are (default 4; see
+//                 instance.h)
+//   -p ports      how many segments each instance is on (default 2)
+//   -z zones      how many zones the networks are spread over (default 20)
+//   -t seconds    how long to simulate for (default 300)
+//   -k seconds    unplug a random peer this far in, and see how long the
+//                 instances take to forget the networks that cuts off
+//   -s seed       for the topology and timings (default 1)
+//
+// An instance has converged when its tables have every network it can
+// reach and no others ("routes"), and then when it also knows all of their
+// zones ("zones").  It exits with 1 if any instance hadn't converged by
+// the end of a phase.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <esp_timer.h>
+
+#include "app/app.h"
+#include "web/stats.h"
+
+#include "instance.h"
+#include "peer.h"
+#include "sim.h"
+
+#define SIM_NETWORK_BASE 1000
+// How often to look at whether the instances have converged
+#define SIM_CHECK_INTERVAL_US SIM_US_PER_SECOND
+// The tree of peers is kept this shallow, so that everything's in reach
+#define SIM_MAX_TREE_DEPTH 6
+#define SIM_MAX_DISTANCE (PEER_MAX_DISTANCE + 1)
+#define SIM_ZONE_NAME_LEN 16
+
+typedef struct {
+	int64_t routes_at;
+	int64_t zones_at;
+} convergence_t;
+
+typedef struct {
+	size_t peer_count;
+	size_t stub_count;
+	size_t extra_links;
+	size_t instance_count;
+	size_t ports_per_instance;
+	size_t zone_count;
+	int64_t duration;
+	int64_t fail_at;
+	uint64_t seed;
+} sim_config_t;
+
+static sim_segment_t* segments;
+static size_t segment_count;
+static size_t transit_count;
+static peer_t* peers;
+static instance_t* instances;
+static char (*zone_names)[SIM_ZONE_NAME_LEN];
+
+// What each instance should be able to reach, indexed by instance and
+// then segment
+static bool* reachable;
+static size_t* reachable_count;
+
+static convergence_t* convergence;
+static int64_t phase_started;
+
+static size_t peer_port_space(int* ports, size_t peer) {
+	return PEER_MAX_PORTS - ports[peer];
+}
+
+// pick_peer picks a random peer with a free port, out of the first count
+static int pick_peer(int* ports, size_t count) {
+	for (int tries = 0; tries < 1000; tries++) {
+		int peer = sim_random() % count;
+		if (peer_port_space(ports, peer) > 0) {
+			return peer;
+		}
+	}
+	return -1;
+}
+
+static sim_link_kind_t pick_transit_kind(void) {
+	return sim_random() % 10 < 7 ? SIM_ETHERNET : SIM_LTOUDP;
+}
+
+static sim_link_kind_t pick_stub_kind(void) {
+	uint32_t r = sim_random() % 10;
+	if (r < 6) {
+		return SIM_LOCALTALK;
+	}
+	return r < 9 ? SIM_ETHERNET : SIM_LTOUDP;
+}
+
+// build_topology connects the peers into a tree, adds extra links and
+// stub networks, then puts the instances on random segments.
+static bool build_topology(sim_config_t* config) {
+	size_t max_segments = config->peer_count + config->extra_links + config->stub_count;
+	int* ports = calloc(config->peer_count, sizeof(int));
+	int* depth = calloc(config->peer_count, sizeof(int));
+	int (*ends)[2] = calloc(max_segments, sizeof(*ends));
+	sim_link_kind_t* kinds = calloc(max_segments, sizeof(sim_link_kind_t));
+	size_t planned = 0;
+	
+	for (size_t i = 1; i < config->peer_count; i++) {
+		int parent = -1;
+		for (int tries = 0; tries < 1000 && parent < 0; tries++) {
+			int candidate = pick_peer(ports, i);
+			if (candidate >= 0 && depth[candidate] < SIM_MAX_TREE_DEPTH) {
+				parent = candidate;
+			}
+		}
+		if (parent < 0) {
+			fprintf(stderr, "couldn't fit %d peers into a tree\n", (int)config->peer_count);
+			return false;
+		}
+		depth[i] = depth[parent] + 1;
+		ports[parent]++;
+		ports[i]++;
+		ends[planned][0] = parent;
+		ends[planned][1] = i;
+		kinds[planned++] = pick_transit_kind();
+	}
+	
+	for (size_t i = 0; i < config->extra_links && config->peer_count > 1; i++) {
+		int a = pick_peer(ports, config->peer_count);
+		int b = pick_peer(ports, config->peer_count);
+		if (a < 0 || b < 0 || a == b) {
+			continue;
+		}
+		ports[a]++;
+		ports[b]++;
+		ends[planned][0] = a;
+		ends[planned][1] = b;
+		kinds[planned++] = pick_transit_kind();
+	}
+	transit_count = planned;
+	
+	for (size_t i = 0; i < config->stub_count; i++) {
+		int owner = pick_peer(ports, config->peer_count);
+		if (owner < 0) {
+			fprintf(stderr, "%d peers don't have room for %d networks\n",
+				(int)config->peer_count, (int)config->stub_count);
+			return false;
+		}
+		ports[owner]++;
+		ends[planned][0] = owner;
+		ends[planned][1] = -1;
+		kinds[planned++] = pick_stub_kind();
+	}
+	
+	segments = calloc(planned, sizeof(sim_segment_t));
+	for (size_t i = 0; i < planned; i++) {
+		sim_segment_init(&segments[i], i, kinds[i], SIM_NETWORK_BASE + i,
+			zone_names[sim_random() % config->zone_count]);
+	}
+	segment_count = planned;
+	
+	peers = calloc(config->peer_count, sizeof(peer_t));
+	for (size_t i = 0; i < config->peer_count; i++) {
+		peer_init(&peers[i], i, segments, segment_count);
+	}
+	for (size_t i = 0; i < planned; i++) {
+		for (int end = 0; end < 2; end++) {
+			if (ends[i][end] >= 0 && !peer_attach(&peers[ends[i][end]], &segments[i])) {
+				fprintf(stderr, "couldn't attach peer %d to network %d\n", ends[i][end],
+					(int)segments[i].network);
+				return false;
+			}
+		}
+	}
+	
+	instances = calloc(config->instance_count, sizeof(instance_t));
+	for (size_t i = 0; i < config->instance_count; i++) {
+		instance_init(&instances[i], i);
+		for (size_t p = 0; p < config->ports_per_instance && p < segment_count; p++) {
+			sim_segment_t* segment;
+			bool taken;
+			do {
+				segment = &segments[sim_random() % segment_count];
+				taken = false;
+				for (size_t q = 0; q < instances[i].port_count; q++) {
+					taken |= instances[i].ports[q].segment == segment;
+				}
+			} while (taken);
+			
+			if (!instance_attach(&instances[i], segment)) {
+				fprintf(stderr, "couldn't attach instance %d to network %d\n", (int)i,
+					(int)segment->network);
+				return false;
+			}
+		}
+	}
+	
+	free(ports);
+	free(depth);
+	free(ends);
+	free(kinds);
+	return true;
+}
+
+// work_out_reachability finds which networks each instance ought to have
+// routes to: those within RTMP's reach through peers that are still up
+static void work_out_reachability(sim_config_t* config) {
+	int* distance = malloc(segment_count * sizeof(int));
+	size_t* queue = malloc(segment_count * sizeof(size_t));
+	
+	for (size_t i = 0; i < config->instance_count; i++) {
+		bool* mine = &reachable[i * segment_count];
+		size_t head = 0;
+		size_t tail = 0;
+		
+		for (size_t s = 0; s < segment_count; s++) {
+			distance[s] = -1;
+		}
+		for (size_t p = 0; p < instances[i].port_count; p++) {
+			size_t s = instances[i].ports[p].segment->index;
+			distance[s] = 0;
+			queue[tail++] = s;
+		}
+		
+		// Breadth-first across the segments, through the peers on them
+		while (head < tail) {
+			size_t s = queue[head++];
+			if (distance[s] == SIM_MAX_DISTANCE) {
+				continue;
+			}
+			for (sim_port_t* port = segments[s].ports; port != NULL; port = port->next_on_segment) {
+				peer_t* peer = peer_for_port(port);
+				if (peer == NULL || port->down) {
+					continue;
+				}
+				for (size_t p = 0; p < peer->port_count; p++) {
+					size_t next = peer->ports[p].segment->index;
+					if (distance[next] < 0) {
+						distance[next] = distance[s] + 1;
+						queue[tail++] = next;
+					}
+				}
+			}
+		}
+		
+		reachable_count[i] = 0;
+		for (size_t s = 0; s < segment_count; s++) {
+			mine[s] = distance[s] >= 0;
+			reachable_count[i] += mine[s];
+		}
+	}
+	
+	free(distance);
+	free(queue);
+}
+
+static bool instance_has_exactly(size_t i, bool* zones_complete) {
+	instance_t* instance = &instances[i];
+	bool* mine = &reachable[i * segment_count];
+	
+	*zones_complete = true;
+	if (instance_network_count(instance) != reachable_count[i]) {
+		*zones_complete = false;
+		return false;
+	}
+	
+	for (size_t s = 0; s < segment_count; s++) {
+		bool complete = false;
+		if (!mine[s]) {
+			continue;
+		}
+		if (!instance_knows_network(instance, segments[s].network, &complete)) {
+			*zones_complete = false;
+			return false;
+		}
+		*zones_complete &= complete;
+	}
+	return true;
+}
+
+static void check_convergence(void* ctx, void* arg) {
+	sim_config_t* config = (sim_config_t*)ctx;
+	int64_t now = sim_now();
+	bool all_done = true;
+	
+	for (size_t i = 0; i < config->instance_count; i++) {
+		convergence_t* c = &convergence[i];
+		if (c->zones_at != 0) {
+			continue;
+		}
+		
+		bool zones_complete;
+		if (instance_has_exactly(i, &zones_complete)) {
+			if (c->routes_at == 0) {
+				c->routes_at = now;
+			}
+			if (zones_complete) {
+				c->zones_at = now;
+			}
+		}
+		all_done &= c->zones_at != 0;
+	}
+	
+	if (!all_done) {
+		sim_schedule(now + SIM_CHECK_INTERVAL_US, &check_convergence, config, NULL);
+	}
+}
+
+static void start_phase(sim_config_t* config) {
+	phase_started = sim_now();
+	memset(convergence, 0, config->instance_count * sizeof(convergence_t));
+	work_out_reachability(config);
+	sim_schedule(sim_now(), &check_convergence, config, NULL);
+}
+
+static int compare_int64(const void* a, const void* b) {
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// report_phase prints how long the instances took to converge, and
+// returns whether they all did
+static bool report_phase(const char* name, sim_config_t* config) {
+	int64_t* routes = calloc(config->instance_count, sizeof(int64_t));
+	int64_t* zones = calloc(config->instance_count, sizeof(int64_t));
+	size_t converged = 0;
+	
+	for (size_t i = 0; i < config->instance_count; i++) {
+		if (convergence[i].zones_at != 0) {
+			routes[converged] = convergence[i].routes_at - phase_started;
+			zones[converged] = convergence[i].zones_at - phase_started;
+			converged++;
+		}
+	}
+	qsort(routes, converged, sizeof(int64_t), &compare_int64);
+	qsort(zones, converged, sizeof(int64_t), &compare_int64);
+	
+	printf("%s: %d of %d instances converged", name, (int)converged, (int)config->instance_count);
+	if (converged > 0) {
+		printf("; routes p50 %.0fs max %.0fs, zones p50 %.0fs max %.0fs",
+			routes[converged / 2] / 1e6, routes[converged - 1] / 1e6,
+			zones[converged / 2] / 1e6, zones[converged - 1] / 1e6);
+	}
+	printf("\n");
+	
+	for (size_t i = 0; i < config->instance_count; i++) {
+		if (convergence[i].zones_at == 0) {
+			printf("  instance %d: has %d networks of %d reachable%s\n", (int)i,
+				(int)instance_network_count(&instances[i]), (int)reachable_count[i],
+				convergence[i].routes_at != 0 ? ", missing zones" : "");
+		}
+	}
+	
+	free(routes);
+	free(zones);
+	return converged == config->instance_count;
+}
+
+static void report_instances(sim_config_t* config, int64_t simulated) {
+	printf("  %-8s %5s %8s %9s %9s %9s %10s %9s %9s %9s\n", "instance", "ports", "networks",
+		"frames in", "out", "cpu ms", "cpu us/s", "heap kB", "peak kB", "allocs");
+	
+	for (size_t i = 0; i < config->instance_count; i++) {
+		instance_t* instance = &instances[i];
+		printf("  %-8d %5d %8d %9llu %9llu %9.1f %10.1f %9.1f %9.1f %9llu\n", (int)i,
+			(int)instance->port_count, (int)instance_network_count(instance),
+			(unsigned long long)instance->frames_in, (unsigned long long)instance->frames_out,
+			instance->cpu_ns / 1e6, instance->cpu_ns / 1e3 / (simulated / (double)SIM_US_PER_SECOND),
+			instance->heap_bytes / 1024.0, instance->heap_peak / 1024.0,
+			(unsigned long long)instance->allocs);
+	}
+}
+
+static void report_segments(int64_t simulated) {
+	for (sim_link_kind_t kind = 0; kind < SIM_LINK_KINDS; kind++) {
+		size_t count = 0;
+		uint64_t frames = 0;
+		int64_t busiest = 0;
+		int64_t max_queue = 0;
+		
+		for (size_t s = 0; s < segment_count; s++) {
+			if (segments[s].kind != kind) {
+				continue;
+			}
+			count++;
+			frames += segments[s].frames;
+			if (segments[s].busy_us > busiest) {
+				busiest = segments[s].busy_us;
+			}
+			if (segments[s].max_queue_us > max_queue) {
+				max_queue = segments[s].max_queue_us;
+			}
+		}
+		
+		if (count > 0) {
+			printf("  %-9s %5d segments %10llu frames, busiest %5.2f%% utilised, longest wait %.1fms\n",
+				sim_link_models[kind].name, (int)count, (unsigned long long)frames,
+				100.0 * busiest / simulated, max_queue / 1000.0);
+		}
+	}
+}
+
+static double wall_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr, "usage: %s [-r peers] [-n networks] [-x links] [-o instances] [-p ports]\n"
+		"       [-z zones] [-t seconds] [-k seconds] [-s seed]\n", argv0);
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	sim_config_t config = {
+		.peer_count = 50,
+		.stub_count = 200,
+		.extra_links = (size_t)-1,
+		.instance_count = 4,
+		.ports_per_instance = 2,
+		.zone_count = 20,
+		.duration = 300 * SIM_US_PER_SECOND,
+		.seed = 1,
+	};
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "r:n:x:o:p:z:t:k:s:h")) != -1) {
+		switch (opt) {
+			case 'r':
+				config.peer_count = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				config.stub_count = strtoul(optarg, NULL, 0);
+				break;
+			case 'x':
+				config.extra_links = strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				config.instance_count = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				config.ports_per_instance = strtoul(optarg, NULL, 0);
+				break;
+			case 'z':
+				config.zone_count = strtoul(optarg, NULL, 0);
+				break;
+			case 't':
+				config.duration = (int64_t)(strtod(optarg, NULL) * SIM_US_PER_SECOND);
+				break;
+			case 'k':
+				config.fail_at = (int64_t)(strtod(optarg, NULL) * SIM_US_PER_SECOND);
+				break;
+			case 's':
+				config.seed = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (optind != argc || config.peer_count == 0 || config.zone_count == 0 ||
+		config.ports_per_instance == 0 || config.ports_per_instance > INSTANCE_MAX_PORTS ||
+		(config.fail_at != 0 && config.fail_at >= config.duration)) {
+		
+		usage(argv[0]);
+	}
+	if (config.extra_links == (size_t)-1) {
+		config.extra_links = config.peer_count / 10;
+	}
+	if (SIM_NETWORK_BASE + config.peer_count + config.extra_links + config.stub_count >= 0xff00) {
+		fprintf(stderr, "too many networks\n");
+		return 2;
+	}
+	
+	start_stats();
+	app_open_sockets();
+	sim_reset();
+	sim_seed(config.seed);
+	
+	zone_names = calloc(config.zone_count, SIM_ZONE_NAME_LEN);
+	for (size_t i = 0; i < config.zone_count; i++) {
+		snprintf(zone_names[i], SIM_ZONE_NAME_LEN, "Zone %d", (int)i);
+	}
+	
+	if (!build_topology(&config)) {
+		return 2;
+	}
+	reachable = calloc(config.instance_count * segment_count, sizeof(bool));
+	reachable_count = calloc(config.instance_count, sizeof(size_t));
+	convergence = calloc(config.instance_count, sizeof(convergence_t));
+	
+	printf("seed %llu: %d peers, %d networks (%d stub, %d transit), %d zones, %d instances\n",
+		(unsigned long long)config.seed, (int)config.peer_count, (int)segment_count,
+		(int)(segment_count - transit_count), (int)transit_count, (int)config.zone_count,
+		(int)config.instance_count);
+	
+	for (size_t i = 0; i < config.peer_count; i++) {
+		peer_start(&peers[i]);
+	}
+	for (size_t i = 0; i < config.instance_count; i++) {
+		instance_start(&instances[i]);
+	}
+	
+	double wall_started = wall_seconds();
+	uint64_t events = 0;
+	bool converged = true;
+	
+	start_phase(&config);
+	if (config.fail_at != 0) {
+		events += sim_run(config.fail_at);
+		converged &= report_phase("startup", &config);
+		
+		peer_t* victim = &peers[sim_random() % config.peer_count];
+		peer_fail(victim);
+		printf("unplugged peer %d (%d ports) at %.0fs\n", victim->index, (int)victim->port_count,
+			config.fail_at / 1e6);
+		start_phase(&config);
+	}
+	events += sim_run(config.duration);
+	converged &= report_phase(config.fail_at != 0 ? "after unplugging" : "startup", &config);
+	
+	double wall = wall_seconds() - wall_started;
+	printf("%.0fs simulated in %.2fs (%.0fx), %llu events\n", config.duration / 1e6, wall,
+		config.duration / 1e6 / wall, (unsigned long long)events);
+	report_instances(&config, config.duration);
+	report_segments(config.duration);
+	
+	esp_timer_set_clock(NULL);
+	return converged ? 0 : 1;
+}
@@ -0,0 +1,294 @@
+#include "peer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "proto/ddp.h"
+#include "proto/zip.h"
+
+#define PEER_DDP_HEADER_LEN 13
+#define PEER_RTMP_HEADER_LEN 4
+#define PEER_RTMP_TUPLE_LEN 3
+#define PEER_DDP_TYPE_RTMP_DATA 1
+
+static int peer_port_index(peer_t* peer, sim_port_t* port) {
+	return (int)(port - peer->ports);
+}
+
+static peer_route_t* peer_route_for(peer_t* peer, uint16_t network) {
+	size_t index = (size_t)(network - peer->segments[0].network);
+	if (network < peer->segments[0].network || index >= peer->segment_count) {
+		return NULL;
+	}
+	return &peer->routes[index];
+}
+
+static size_t peer_ddp_header(uint8_t* buf, sim_port_t* from, uint16_t dst_network,
+	uint8_t dst, uint8_t dst_sock, uint8_t src_sock, uint8_t type) {
+	
+	memset(buf, 0, PEER_DDP_HEADER_LEN);
+	buf[4] = dst_network >> 8;
+	buf[5] = dst_network & 0xff;
+	buf[6] = from->segment->network >> 8;
+	buf[7] = from->segment->network & 0xff;
+	buf[8] = dst;
+	buf[9] = from->node;
+	buf[10] = dst_sock;
+	buf[11] = src_sock;
+	buf[12] = type;
+	return PEER_DDP_HEADER_LEN;
+}
+
+static void peer_send(sim_port_t* port, uint8_t link_dst, uint8_t* datagram, size_t length) {
+	datagram[0] = (length >> 8) & 0x03;
+	datagram[1] = length & 0xff;
+	sim_transmit(port, link_dst, datagram, length);
+}
+
+static void peer_send_rtmp(peer_t* peer, int port_index) {
+	sim_port_t* port = &peer->ports[port_index];
+	uint8_t datagram[SIM_MAX_DATAGRAM];
+	size_t length = 0;
+	
+	for (size_t i = 0; i <= peer->segment_count; i++) {
+		// Send what we've got if there's no room for another tuple, or
+		// we've got to the end
+		bool last = i == peer->segment_count;
+		if (length > 0 && (last || length + PEER_RTMP_TUPLE_LEN > PEER_DDP_HEADER_LEN + DDP_MAX_PAYLOAD_LEN)) {
+			peer_send(port, 0xff, datagram, length);
+			peer->rtmp_sent++;
+			length = 0;
+		}
+		if (last) {
+			break;
+		}
+		
+		peer_route_t* route = &peer->routes[i];
+		if (route->distance == PEER_NO_ROUTE || route->port == port_index) {
+			continue;
+		}
+		
+		if (length == 0) {
+			length = peer_ddp_header(datagram, port, 0, 0xff, DDP_SOCKET_RTMP, DDP_SOCKET_RTMP,
+				PEER_DDP_TYPE_RTMP_DATA);
+			uint8_t* header = datagram + length;
+			header[0] = port->segment->network >> 8;
+			header[1] = port->segment->network & 0xff;
+			header[2] = 8;
+			header[3] = port->node;
+			// The version tuple a nonextended network's RTMP data starts with
+			header[4] = 0;
+			header[5] = 0;
+			header[6] = 0x82;
+			length += PEER_RTMP_HEADER_LEN + PEER_RTMP_TUPLE_LEN;
+		}
+		
+		uint16_t network = peer->segments[i].network;
+		datagram[length++] = network >> 8;
+		datagram[length++] = network & 0xff;
+		datagram[length++] = route->distance;
+	}
+}
+
+static void peer_tick(void* ctx, void* arg) {
+	peer_t* peer = (peer_t*)ctx;
+	int64_t now = sim_now();
+	
+	if (peer->down) {
+		return;
+	}
+	
+	for (size_t i = 0; i < peer->segment_count; i++) {
+		peer_route_t* route = &peer->routes[i];
+		if (route->distance != PEER_NO_ROUTE && route->distance != 0 &&
+			now - route->heard_at > PEER_ROUTE_VALIDITY_US) {
+			
+			route->distance = PEER_NO_ROUTE;
+		}
+	}
+	
+	for (size_t i = 0; i < peer->port_count; i++) {
+		peer_send_rtmp(peer, i);
+	}
+	
+	sim_schedule(now + PEER_RTMP_INTERVAL_US, &peer_tick, peer, NULL);
+}
+
+static void peer_handle_rtmp_data(peer_t* peer, int port_index, uint8_t from,
+	const uint8_t* body, size_t length) {
+	
+	if (length < PEER_RTMP_HEADER_LEN || body[2] != 8) {
+		return;
+	}
+	
+	size_t offset = PEER_RTMP_HEADER_LEN;
+	while (offset + PEER_RTMP_TUPLE_LEN <= length) {
+		uint16_t network = ((uint16_t)body[offset] << 8) | body[offset + 1];
+		uint8_t flags = body[offset + 2];
+		bool extended = (flags & 0x80) != 0;
+		
+		// Skip the version tuple, and the range end of extended tuples
+		if (network == 0 && flags == 0x82) {
+			offset += PEER_RTMP_TUPLE_LEN;
+			continue;
+		}
+		offset += extended ? 6 : PEER_RTMP_TUPLE_LEN;
+		
+		peer_route_t* route = peer_route_for(peer, network);
+		if (route == NULL || route->distance == 0) {
+			continue;
+		}
+		
+		uint8_t distance = (flags & 0x7f) + 1;
+		bool same_way = route->distance != PEER_NO_ROUTE &&
+			route->port == port_index && route->nexthop == from;
+		
+		if (distance > PEER_MAX_DISTANCE) {
+			// Unreachable now, as far as the router we had it from knows
+			if (same_way) {
+				route->distance = PEER_NO_ROUTE;
+			}
+			continue;
+		}
+		
+		if (route->distance == PEER_NO_ROUTE || distance < route->distance || same_way) {
+			route->distance = distance;
+			route->port = port_index;
+			route->nexthop = from;
+			route->heard_at = sim_now();
+		}
+	}
+}
+
+static void peer_handle_zip_query(peer_t* peer, sim_port_t* port, const uint8_t* header,
+	const uint8_t* body, size_t length) {
+	
+	if (length < 2 || body[0] != ZIP_QUERY || length < 2 + (size_t)body[1] * 2) {
+		return;
+	}
+	
+	uint16_t to_network = ((uint16_t)header[6] << 8) | header[7];
+	uint8_t to_node = header[9];
+	uint8_t to_socket = header[11];
+	
+	uint8_t datagram[SIM_MAX_DATAGRAM];
+	size_t reply_length = 0;
+	uint8_t tuples = 0;
+	
+	for (size_t i = 0; i <= body[1]; i++) {
+		bool last = i == body[1];
+		uint16_t network = 0;
+		peer_route_t* route = NULL;
+		const char* zone = NULL;
+		size_t zone_len = 0;
+		
+		if (!last) {
+			network = ((uint16_t)body[2 + i * 2] << 8) | body[3 + i * 2];
+			route = peer_route_for(peer, network);
+			if (route == NULL || route->distance == PEER_NO_ROUTE) {
+				continue;
+			}
+			zone = peer->segments[network - peer->segments[0].network].zone;
+			zone_len = strlen(zone);
+		}
+		
+		if (reply_length > 0 &&
+			(last || reply_length + 3 + zone_len > PEER_DDP_HEADER_LEN + DDP_MAX_PAYLOAD_LEN)) {
+			
+			datagram[PEER_DDP_HEADER_LEN + 1] = tuples;
+			peer_send(port, to_node, datagram, reply_length);
+			peer->zip_replies_sent++;
+			reply_length = 0;
+		}
+		if (last) {
+			break;
+		}
+		
+		if (reply_length == 0) {
+			reply_length = peer_ddp_header(datagram, port, to_network, to_node, to_socket,
+				DDP_SOCKET_ZIP, DDP_TYPE_ZIP);
+			datagram[reply_length++] = ZIP_REPLY;
+			datagram[reply_length++] = 0;
+			tuples = 0;
+		}
+		
+		datagram[reply_length++] = network >> 8;
+		datagram[reply_length++] = network & 0xff;
+		datagram[reply_length++] = zone_len;
+		memcpy(datagram + reply_length, zone, zone_len);
+		reply_length += zone_len;
+		tuples++;
+	}
+}
+
+static void peer_receive(sim_port_t* port, sim_frame_t* frame) {
+	peer_t* peer = (peer_t*)port->owner;
+	const uint8_t* header = frame->data;
+	
+	if (peer->down || frame->length < PEER_DDP_HEADER_LEN) {
+		return;
+	}
+	
+	uint8_t dst = header[8];
+	if (dst != 0xff && dst != port->node) {
+		return;
+	}
+	
+	const uint8_t* body = header + PEER_DDP_HEADER_LEN;
+	size_t length = frame->length - PEER_DDP_HEADER_LEN;
+	uint8_t dst_sock = header[10];
+	uint8_t type = header[12];
+	
+	if (dst_sock == DDP_SOCKET_RTMP && type == PEER_DDP_TYPE_RTMP_DATA) {
+		peer_handle_rtmp_data(peer, peer_port_index(peer, port), header[9], body, length);
+	} else if (dst_sock == DDP_SOCKET_ZIP && type == DDP_TYPE_ZIP) {
+		peer_handle_zip_query(peer, port, header, body, length);
+	}
+}
+
+void peer_init(peer_t* peer, int index, sim_segment_t* segments, size_t segment_count) {
+	memset(peer, 0, sizeof(peer_t));
+	peer->index = index;
+	peer->segments = segments;
+	peer->segment_count = segment_count;
+	
+	peer->routes = calloc(segment_count, sizeof(peer_route_t));
+	assert(peer->routes != NULL);
+	for (size_t i = 0; i < segment_count; i++) {
+		peer->routes[i].distance = PEER_NO_ROUTE;
+	}
+}
+
+bool peer_attach(peer_t* peer, sim_segment_t* segment) {
+	if (peer->port_count == PEER_MAX_PORTS) {
+		return false;
+	}
+	
+	int port_index = peer->port_count;
+	if (!sim_attach(segment, &peer->ports[port_index], &peer_receive, peer)) {
+		return false;
+	}
+	peer->port_count++;
+	
+	peer->routes[segment->index] = (peer_route_t){
+		.distance = 0,
+		.port = port_index,
+	};
+	return true;
+}
+
+void peer_start(peer_t* peer) {
+	sim_schedule(sim_now() + sim_random() % PEER_RTMP_INTERVAL_US, &peer_tick, peer, NULL);
+}
+
+peer_t* peer_for_port(sim_port_t* port) {
+	return port->receive == &peer_receive ? (peer_t*)port->owner : NULL;
+}
+
+void peer_fail(peer_t* peer) {
+	peer->down = true;
+	for (size_t i = 0; i < peer->port_count; i++) {
+		peer->ports[i].down = true;
+	}
+}
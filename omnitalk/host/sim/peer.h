@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+
+// A peer is a modelled AppleTalk router: the rest of the internet the
+// OmniTalk instances are plugged into.  It isn't OmniTalk code, just
+// enough of a router to be realistic about what OmniTalk sees:
+//
+//   - every PEER_RTMP_INTERVAL_US it sends RTMP data out of each port, with
+//     split horizon, and ages out routes it's stopped hearing about;
+//   - it learns routes from other peers' RTMP data, distance-vector style,
+//     up to 15 hops;
+//   - it answers ZIP queries for networks it has a route to.
+//
+// Zones aren't learnt by ZIP between peers; a peer knows the zone of any
+// network it has a route to.  That's what a converged ZIP would give it,
+// and it keeps the simulation's work on the OmniTalk side.
+
+#define PEER_MAX_PORTS 32
+#define PEER_RTMP_INTERVAL_US (10 * SIM_US_PER_SECOND)
+// A route that hasn't been heard about for this long is dropped
+#define PEER_ROUTE_VALIDITY_US (2 * PEER_RTMP_INTERVAL_US)
+#define PEER_MAX_DISTANCE 15
+
+// No route, in peer_route_t.distance
+#define PEER_NO_ROUTE 0xff
+
+typedef struct {
+	uint8_t distance;
+	uint8_t port;
+	uint8_t nexthop;
+	int64_t heard_at;
+} peer_route_t;
+
+typedef struct {
+	int index;
+	bool down;
+	
+	sim_segment_t* segments;
+	size_t segment_count;
+	
+	size_t port_count;
+	sim_port_t ports[PEER_MAX_PORTS];
+	
+	// One per network in the simulation, indexed by segment index
+	peer_route_t* routes;
+	
+	uint64_t rtmp_sent;
+	uint64_t zip_replies_sent;
+} peer_t;
+
+// peer_init sets a peer up with nothing attached; segments is every
+// segment in the simulation, which is where it finds zone names.
+void peer_init(peer_t* peer, int index, sim_segment_t* segments, size_t segment_count);
+
+// peer_attach puts the peer on a segment, with a direct route to it.
+bool peer_attach(peer_t* peer, sim_segment_t* segment);
+
+// peer_start schedules the peer's first RTMP broadcast, at a random point
+// in its first interval, as routers that come up at different times
+// would.
+void peer_start(peer_t* peer);
+
+// peer_for_port returns the peer a port belongs to, or NULL if it isn't a
+// peer's.
+peer_t* peer_for_port(sim_port_t* port);
+
+// peer_fail takes the peer off the network, as if it had been unplugged.
+void peer_fail(peer_t* peer);
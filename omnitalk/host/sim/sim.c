@@ -0,0 +1,250 @@
+#include "sim.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+// LocalTalk is 230.4kbit/s with an LLAP header, FCS and flags around each
+// frame and an interdialog gap between them; LToUDP is LLAP inside UDP on
+// a switched LAN, where the host's network stack is most of the latency;
+// EtherTalk is 802.2 SNAP framed, with a preamble and interframe gap.
+const sim_link_model_t sim_link_models[SIM_LINK_KINDS] = {
+	[SIM_LOCALTALK] = {
+		.name = "localtalk",
+		.bits_per_second = 230400,
+		.overhead = 3 + 2 + 3,
+		.min_frame = 0,
+		.gap_us = 400,
+		.latency_us = 50,
+	},
+	[SIM_LTOUDP] = {
+		.name = "ltoudp",
+		.bits_per_second = 100000000,
+		.overhead = 4 + 3 + 8 + 20 + 18,
+		.min_frame = 64,
+		.gap_us = 1,
+		.latency_us = 200,
+	},
+	[SIM_ETHERNET] = {
+		.name = "ethernet",
+		.bits_per_second = 100000000,
+		.overhead = 14 + 8 + 4,
+		.min_frame = 64,
+		.gap_us = 1,
+		.latency_us = 20,
+	},
+};
+
+typedef struct {
+	int64_t at;
+	uint64_t seq;
+	sim_event_fn fn;
+	void* ctx;
+	void* arg;
+} sim_event_t;
+
+// The event queue is a binary heap ordered by time and then sequence
+static sim_event_t* events;
+static size_t event_count;
+static size_t event_capacity;
+static uint64_t next_seq;
+
+static int64_t now;
+static uint64_t rng_state;
+
+static int64_t sim_clock(void) {
+	return now;
+}
+
+static bool event_before(sim_event_t* a, sim_event_t* b) {
+	if (a->at != b->at) {
+		return a->at < b->at;
+	}
+	return a->seq < b->seq;
+}
+
+static void event_swap(size_t a, size_t b) {
+	sim_event_t tmp = events[a];
+	events[a] = events[b];
+	events[b] = tmp;
+}
+
+static void event_push(sim_event_t* event) {
+	if (event_count == event_capacity) {
+		event_capacity = event_capacity == 0 ? 1024 : event_capacity * 2;
+		events = realloc(events, event_capacity * sizeof(sim_event_t));
+		assert(events != NULL);
+	}
+	
+	size_t i = event_count++;
+	events[i] = *event;
+	
+	while (i > 0 && event_before(&events[i], &events[(i - 1) / 2])) {
+		event_swap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void event_pop(sim_event_t* out) {
+	*out = events[0];
+	events[0] = events[--event_count];
+	
+	size_t i = 0;
+	while (1) {
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+		
+		if (left < event_count && event_before(&events[left], &events[smallest])) {
+			smallest = left;
+		}
+		if (right < event_count && event_before(&events[right], &events[smallest])) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			break;
+		}
+		event_swap(i, smallest);
+		i = smallest;
+	}
+}
+
+void sim_reset(void) {
+	event_count = 0;
+	next_seq = 0;
+	now = 0;
+	esp_timer_set_clock(&sim_clock);
+}
+
+int64_t sim_now(void) {
+	return now;
+}
+
+void sim_schedule(int64_t at, sim_event_fn fn, void* ctx, void* arg) {
+	assert(at >= now);
+	
+	sim_event_t event = {
+		.at = at,
+		.seq = next_seq++,
+		.fn = fn,
+		.ctx = ctx,
+		.arg = arg,
+	};
+	event_push(&event);
+}
+
+uint64_t sim_run(int64_t until) {
+	uint64_t ran = 0;
+	sim_event_t event;
+	
+	while (event_count > 0 && events[0].at <= until) {
+		event_pop(&event);
+		now = event.at;
+		event.fn(event.ctx, event.arg);
+		ran++;
+	}
+	
+	now = until;
+	return ran;
+}
+
+void sim_seed(uint64_t seed) {
+	rng_state = seed != 0 ? seed : 1;
+}
+
+// xorshift64*
+uint32_t sim_random(void) {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (uint32_t)((rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+void sim_segment_init(sim_segment_t* segment, int index, sim_link_kind_t kind,
+	uint16_t network, const char* zone) {
+	
+	memset(segment, 0, sizeof(sim_segment_t));
+	segment->index = index;
+	segment->kind = kind;
+	segment->network = network;
+	segment->zone = zone;
+	segment->next_node = 1;
+}
+
+bool sim_attach(sim_segment_t* segment, sim_port_t* port, sim_receive_fn receive, void* owner) {
+	if (segment->next_node > SIM_MAX_PORTS_PER_SEGMENT) {
+		return false;
+	}
+	
+	port->segment = segment;
+	port->node = segment->next_node++;
+	port->down = false;
+	port->receive = receive;
+	port->owner = owner;
+	
+	// Keep the ports in node order, so that a broadcast reaches them in the
+	// same order every time
+	sim_port_t** tail = &segment->ports;
+	while (*tail != NULL) {
+		tail = &(*tail)->next_on_segment;
+	}
+	port->next_on_segment = NULL;
+	*tail = port;
+	return true;
+}
+
+static void sim_deliver(void* ctx, void* arg) {
+	sim_port_t* port = (sim_port_t*)ctx;
+	sim_frame_t* frame = (sim_frame_t*)arg;
+	
+	if (!port->down) {
+		port->receive(port, frame);
+	}
+	
+	if (--frame->references == 0) {
+		free(frame);
+	}
+}
+
+void sim_transmit(sim_port_t* port, uint8_t link_dst, const uint8_t* data, size_t length) {
+	sim_segment_t* segment = port->segment;
+	const sim_link_model_t* model = &sim_link_models[segment->kind];
+	
+	if (port->down || length > SIM_MAX_DATAGRAM) {
+		return;
+	}
+	
+	size_t on_wire = length + model->overhead;
+	if (on_wire < model->min_frame) {
+		on_wire = model->min_frame;
+	}
+	int64_t duration = (int64_t)((on_wire * 8 * SIM_US_PER_SECOND) / model->bits_per_second) + model->gap_us;
+	
+	int64_t start = segment->busy_until > now ? segment->busy_until : now;
+	if (start - now > segment->max_queue_us) {
+		segment->max_queue_us = start - now;
+	}
+	segment->busy_until = start + duration;
+	segment->busy_us += duration;
+	segment->frames++;
+	segment->octets += on_wire;
+	
+	sim_frame_t* frame = NULL;
+	for (sim_port_t* to = segment->ports; to != NULL; to = to->next_on_segment) {
+		if (to == port || (link_dst != 0xff && to->node != link_dst)) {
+			continue;
+		}
+		
+		if (frame == NULL) {
+			frame = calloc(1, sizeof(sim_frame_t));
+			assert(frame != NULL);
+			frame->link_dst = link_dst;
+			frame->length = length;
+			memcpy(frame->data, data, length);
+		}
+		frame->references++;
+		sim_schedule(start + duration + model->latency_us, &sim_deliver, to, frame);
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The simulator's core: a virtual clock, an event queue that runs things
+// at points on it, and the network segments that frames travel over.
+//
+// Everything happens on one thread, one event at a time, in order of
+// simulated time and then of when the event was scheduled, so a run is
+// the same every time for the same seed.  esp_timer_get_time returns the
+// simulated time while the simulator's running.
+
+#define SIM_US_PER_SECOND 1000000LL
+
+// Frames carry a DDP datagram with a long header, however the segment
+// would really have framed it; sim_link_model_t accounts for the framing.
+#define SIM_MAX_DATAGRAM 599
+
+// How many nodes a segment can have on it
+#define SIM_MAX_PORTS_PER_SEGMENT 254
+
+typedef enum {
+	SIM_LOCALTALK = 0,
+	SIM_LTOUDP,
+	SIM_ETHERNET,
+	SIM_LINK_KINDS,
+} sim_link_kind_t;
+
+// A segment's link model: how long a frame takes to get onto the wire,
+// and how long it then takes to arrive.
+typedef struct {
+	const char* name;
+	uint64_t bits_per_second;
+	// Framing around the DDP datagram, and the smallest a frame can be
+	size_t overhead;
+	size_t min_frame;
+	// The gap the medium needs between frames, in microseconds
+	int64_t gap_us;
+	// Propagation and stack latency, in microseconds
+	int64_t latency_us;
+} sim_link_model_t;
+
+extern const sim_link_model_t sim_link_models[SIM_LINK_KINDS];
+
+typedef struct sim_frame_s {
+	int references;
+	// The link-layer destination: a node on the segment, or 255
+	uint8_t link_dst;
+	size_t length;
+	uint8_t data[SIM_MAX_DATAGRAM];
+} sim_frame_t;
+
+typedef struct sim_port_s sim_port_t;
+typedef struct sim_segment_s sim_segment_t;
+
+// A port's receive function is called when a frame addressed to its node
+// (or broadcast) arrives.  The frame belongs to the simulator.
+typedef void (*sim_receive_fn)(sim_port_t* port, sim_frame_t* frame);
+
+struct sim_port_s {
+	sim_segment_t* segment;
+	uint8_t node;
+	bool down;
+	
+	sim_receive_fn receive;
+	void* owner;
+	
+	sim_port_t* next_on_segment;
+};
+
+struct sim_segment_s {
+	int index;
+	sim_link_kind_t kind;
+	uint16_t network;
+	const char* zone;
+	
+	sim_port_t* ports;
+	uint8_t next_node;
+	
+	// When the medium's next free
+	int64_t busy_until;
+	
+	uint64_t frames;
+	uint64_t octets;
+	int64_t busy_us;
+	// The longest any frame waited for the medium
+	int64_t max_queue_us;
+};
+
+typedef void (*sim_event_fn)(void* ctx, void* arg);
+
+// sim_reset throws away any pending events and sets the clock back to 0.
+void sim_reset(void);
+
+int64_t sim_now(void);
+
+// sim_schedule runs fn(ctx, arg) at the given simulated time, which mustn't
+// be in the past.
+void sim_schedule(int64_t at, sim_event_fn fn, void* ctx, void* arg);
+
+// sim_run runs events until the queue's empty or the next one's after
+// until, leaving the clock at until.  It returns how many events it ran.
+uint64_t sim_run(int64_t until);
+
+// The simulator's pseudo-random numbers, from a fixed seed, so that runs
+// can be repeated.
+void sim_seed(uint64_t seed);
+uint32_t sim_random(void);
+
+void sim_segment_init(sim_segment_t* segment, int index, sim_link_kind_t kind,
+	uint16_t network, const char* zone);
+
+// sim_attach puts a port on a segment, giving it the segment's next node
+// address; it returns false if the segment's full.
+bool sim_attach(sim_segment_t* segment, sim_port_t* port, sim_receive_fn receive, void* owner);
+
+// sim_transmit sends a DDP datagram out of a port.  It waits for the medium
+// if something else is sending, then arrives at every other port on the
+// segment it's addressed to.  Frames to or from a port that's down go
+// nowhere.
+void sim_transmit(sim_port_t* port, uint8_t link_dst, const uint8_t* data, size_t length);
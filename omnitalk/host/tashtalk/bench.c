@@ -0,0 +1,364 @@
+// tashtalk_bench drives the real TashTalk UART code, state machine and all,
+// against the emulator over a pty, and measures how fast frames get through
+// it and how long they take in each direction.
+//
+// Ingress is from the emulator writing a frame to the pty to the frame
+// turning up on the transport's inbound queue.  Egress is from tsend to
+// the emulator having read the whole frame off the pty.  Each direction is
+// run twice: once flat out, for throughput, and once a frame at a time,
+// for latency without any queueing in it.
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "mem/buffers.h"
+#include "net/packet_capture.h"
+#include "net/tashtalk/tashtalk.h"
+#include "net/tashtalk/uart.h"
+#include "net/tashtalk/uart_backend.h"
+#include "net/transport.h"
+#include "proto/llap.h"
+#include "web/stats.h"
+
+#include "emulator.h"
+
+static const char* TAG = "TT_BENCH";
+
+#define BENCH_NODE_ADDRESS 42
+#define BENCH_REMOTE_ADDRESS 7
+
+// LLAP header, then a short DDP header, then a sequence number
+#define BENCH_SEQ_OFFSET 8
+#define BENCH_MIN_PAYLOAD 4
+#define BENCH_MAX_PAYLOAD 586
+
+// How long to wait for stragglers once we've sent everything
+#define BENCH_SETTLE_US 2000000
+
+typedef struct {
+	const char* name;
+	uint32_t count;
+	int64_t* sent_at;
+	int64_t* arrived_at;
+	_Atomic uint32_t received;
+	_Atomic uint32_t bad;
+	int64_t started;
+} bench_phase_t;
+
+static _Atomic(bench_phase_t*) current_phase = NULL;
+static size_t payload_size = 64;
+
+static size_t bench_frame_len(void) {
+	return 3 + 5 + payload_size;
+}
+
+static void bench_fill_frame(uint8_t* frame, uint32_t seq) {
+	size_t ddp_len = 5 + payload_size;
+	
+	frame[0] = BENCH_NODE_ADDRESS;
+	frame[1] = BENCH_REMOTE_ADDRESS;
+	frame[2] = LLAP_TYPE_DDP_SHORT;
+	frame[3] = (ddp_len >> 8) & 0x3;
+	frame[4] = ddp_len & 0xff;
+	frame[5] = 4; // destination socket
+	frame[6] = 4; // source socket
+	frame[7] = 4; // DDP type, AEP
+	
+	memcpy(frame + BENCH_SEQ_OFFSET, &seq, sizeof(seq));
+	
+	// Fill the rest with something with plenty of zeroes in, since those
+	// have to be escaped on the way in
+	for (size_t i = BENCH_SEQ_OFFSET + sizeof(seq); i < bench_frame_len(); i++) {
+		frame[i] = (i % 3 == 0) ? 0x00 : (uint8_t)i;
+	}
+}
+
+static void bench_record_arrival(bench_phase_t* phase, const uint8_t* frame, size_t len) {
+	uint32_t seq;
+	
+	if (len < bench_frame_len()) {
+		phase->bad++;
+		return;
+	}
+	
+	memcpy(&seq, frame + BENCH_SEQ_OFFSET, sizeof(seq));
+	if (seq >= phase->count || phase->arrived_at[seq] != 0) {
+		phase->bad++;
+		return;
+	}
+	
+	phase->arrived_at[seq] = esp_timer_get_time();
+	phase->received++;
+}
+
+// bench_on_emulator_frame is called for each frame the UART code sends
+static void bench_on_emulator_frame(void* ctx, const uint8_t* frame, size_t len, bool crc_ok) {
+	bench_phase_t* phase = current_phase;
+	if (phase == NULL) {
+		return;
+	}
+	
+	if (!crc_ok) {
+		phase->bad++;
+		return;
+	}
+	
+	// chop off the CRC
+	bench_record_arrival(phase, frame, len - 2);
+}
+
+// bench_inbound_runloop takes frames off the transport's inbound queue,
+// like a LAP would
+static void bench_inbound_runloop(void* param) {
+	transport_t* transport = (transport_t*)param;
+	
+	while (1) {
+		buffer_t* buf = trecv(transport);
+		bench_phase_t* phase = current_phase;
+		if (phase != NULL) {
+			bench_record_arrival(phase, buf->data, buf->length);
+		}
+		freebuf(buf);
+	}
+}
+
+static bench_phase_t* bench_new_phase(const char* name, uint32_t count) {
+	bench_phase_t* phase = calloc(1, sizeof(bench_phase_t));
+	phase->name = name;
+	phase->count = count;
+	phase->sent_at = calloc(count, sizeof(int64_t));
+	phase->arrived_at = calloc(count, sizeof(int64_t));
+	return phase;
+}
+
+static void bench_wait_for_phase(bench_phase_t* phase, uint32_t expected) {
+	int64_t last_progress = esp_timer_get_time();
+	uint32_t last_received = phase->received;
+	
+	while (phase->received < expected) {
+		usleep(100);
+		
+		int64_t now = esp_timer_get_time();
+		if (phase->received != last_received) {
+			last_received = phase->received;
+			last_progress = now;
+		} else if (now - last_progress > BENCH_SETTLE_US) {
+			break;
+		}
+	}
+}
+
+static int compare_int64(const void* a, const void* b) {
+	int64_t x = *(const int64_t*)a;
+	int64_t y = *(const int64_t*)b;
+	return (x > y) - (x < y);
+}
+
+// bench_report prints what happened in a phase, and returns false if any
+// frames went missing or arrived mangled.
+static bool bench_report(bench_phase_t* phase, bool show_throughput) {
+	int64_t* latencies = calloc(phase->count, sizeof(int64_t));
+	size_t n = 0;
+	int64_t finished = phase->started;
+	
+	for (uint32_t i = 0; i < phase->count; i++) {
+		if (phase->arrived_at[i] == 0) {
+			continue;
+		}
+		latencies[n++] = phase->arrived_at[i] - phase->sent_at[i];
+		if (phase->arrived_at[i] > finished) {
+			finished = phase->arrived_at[i];
+		}
+	}
+	
+	qsort(latencies, n, sizeof(int64_t), &compare_int64);
+	
+	printf("%-18s %6u sent %6u received %4u dropped %4u bad", phase->name,
+		(unsigned)phase->count, (unsigned)phase->received,
+		(unsigned)(phase->count - phase->received), (unsigned)phase->bad);
+	
+	if (n > 0) {
+		printf("  latency us: p50 %" PRId64 " p99 %" PRId64 " max %" PRId64,
+			latencies[n / 2], latencies[(n * 99) / 100], latencies[n - 1]);
+	}
+	
+	if (show_throughput && finished > phase->started) {
+		double seconds = (finished - phase->started) / 1e6;
+		printf("  %.0f frames/s %.1f kB/s", n / seconds,
+			(n * bench_frame_len()) / seconds / 1000.0);
+	}
+	printf("\n");
+	
+	free(latencies);
+	return phase->received == phase->count && phase->bad == 0;
+}
+
+static bool bench_ingress(tt_emulator_t* emulator, const char* name, uint32_t count, bool one_at_a_time) {
+	bench_phase_t* phase = bench_new_phase(name, count);
+	uint8_t frame[3 + 5 + BENCH_MAX_PAYLOAD];
+	
+	current_phase = phase;
+	phase->started = esp_timer_get_time();
+	
+	for (uint32_t i = 0; i < count; i++) {
+		bench_fill_frame(frame, i);
+		phase->sent_at[i] = esp_timer_get_time();
+		tt_emulator_send_frame(emulator, frame, bench_frame_len(), false);
+		
+		if (one_at_a_time) {
+			bench_wait_for_phase(phase, i + 1);
+		}
+	}
+	
+	bench_wait_for_phase(phase, count);
+	current_phase = NULL;
+	
+	return bench_report(phase, !one_at_a_time);
+}
+
+static bool bench_egress(transport_t* transport, const char* name, uint32_t count, bool one_at_a_time) {
+	bench_phase_t* phase = bench_new_phase(name, count);
+	
+	current_phase = phase;
+	phase->started = esp_timer_get_time();
+	
+	for (uint32_t i = 0; i < count; i++) {
+		// leave room for the CRC, and l2 headroom for the 0x01
+		buffer_t* buf = newbuf(bench_frame_len() + 2, 0);
+		buf->length = bench_frame_len();
+		bench_fill_frame(buf->data, i);
+		
+		phase->sent_at[i] = esp_timer_get_time();
+		tsend_and_block(transport, buf);
+		
+		if (one_at_a_time) {
+			bench_wait_for_phase(phase, i + 1);
+		}
+	}
+	
+	bench_wait_for_phase(phase, count);
+	current_phase = NULL;
+	
+	return bench_report(phase, !one_at_a_time);
+}
+
+// bench_bad_crc checks that a frame with a broken CRC gets counted and
+// thrown away rather than passed up.
+static bool bench_bad_crc(tt_emulator_t* emulator) {
+	bench_phase_t* phase = bench_new_phase("ingress bad CRC", 1);
+	uint8_t frame[3 + 5 + BENCH_MAX_PAYLOAD];
+	uint32_t crc_errors = stats.transport_in_errors__transport_localtalk__err_bad_crc;
+	
+	current_phase = phase;
+	bench_fill_frame(frame, 0);
+	tt_emulator_send_frame(emulator, frame, bench_frame_len(), true);
+	
+	int64_t deadline = esp_timer_get_time() + BENCH_SETTLE_US;
+	while (stats.transport_in_errors__transport_localtalk__err_bad_crc == crc_errors &&
+		esp_timer_get_time() < deadline) {
+		usleep(100);
+	}
+	current_phase = NULL;
+	
+	bool ok = stats.transport_in_errors__transport_localtalk__err_bad_crc == crc_errors + 1 &&
+		phase->received == 0;
+	printf("%-18s %s\n", phase->name, ok ? "dropped and counted" : "NOT HANDLED");
+	return ok;
+}
+
+static void usage(const char* argv0) {
+	fprintf(stderr, "usage: %s [-n frames] [-l latency_frames] [-s payload_bytes] [-b baud]\n", argv0);
+	fprintf(stderr, "  -b 0 runs the emulator as fast as the pty will go\n");
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	uint32_t count = 10000;
+	uint32_t latency_count = 1000;
+	uint32_t baud = 1000000;
+	int opt;
+	
+	while ((opt = getopt(argc, argv, "n:l:s:b:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				count = strtoul(optarg, NULL, 0);
+				break;
+			case 'l':
+				latency_count = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				payload_size = strtoul(optarg, NULL, 0);
+				break;
+			case 'b':
+				baud = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	
+	if (payload_size < BENCH_MIN_PAYLOAD || payload_size > BENCH_MAX_PAYLOAD) {
+		fprintf(stderr, "payload must be between %d and %d bytes\n",
+			BENCH_MIN_PAYLOAD, BENCH_MAX_PAYLOAD);
+		return 2;
+	}
+	
+	tt_emulator_t* emulator = tt_emulator_new(baud, &bench_on_emulator_frame, NULL);
+	if (emulator == NULL) {
+		return 1;
+	}
+	
+	packet_capture_init();
+	start_tashtalk(tt_uart_linux_backend(tt_emulator_device(emulator)));
+	transport_t* transport = tashtalk_get_transport();
+	wait_for_transport_ready(transport);
+	
+	// The RX task makes the state machine when it starts, and we can't
+	// enable the transport until it has.
+	while (rxstate == NULL) {
+		usleep(1000);
+	}
+	
+	enable_transport(transport);
+	set_transport_node_address(transport, BENCH_NODE_ADDRESS);
+	
+	int64_t deadline = esp_timer_get_time() + BENCH_SETTLE_US;
+	while (!tt_emulator_has_node_address(emulator, BENCH_NODE_ADDRESS)) {
+		if (esp_timer_get_time() > deadline) {
+			ESP_LOGE(TAG, "emulator never got our node address");
+			return 1;
+		}
+		usleep(1000);
+	}
+	
+	TaskHandle_t inbound_task = NULL;
+	xTaskCreate(&bench_inbound_runloop, "BENCH_RX", 4096, transport, 5, &inbound_task);
+	
+	printf("%u byte frames, %s\n", (unsigned)bench_frame_len(),
+		baud == 0 ? "unpaced" : "paced to the serial line");
+	
+	bool ok = true;
+	ok &= bench_bad_crc(emulator);
+	ok &= bench_ingress(emulator, "ingress throughput", count, false);
+	ok &= bench_ingress(emulator, "ingress latency", latency_count, true);
+	ok &= bench_egress(transport, "egress throughput", count, false);
+	ok &= bench_egress(transport, "egress latency", latency_count, true);
+	
+	if (tt_emulator_bad_commands(emulator) != 0) {
+		printf("emulator saw %u bytes it didn't understand\n",
+			(unsigned)tt_emulator_bad_commands(emulator));
+		ok = false;
+	}
+	
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+#include "emulator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "util/crc.h"
+
+static const char* TAG = "TT_EMU";
+
+// A data frame can be at most 600 bytes of LLAP header plus DDP, and then
+// there's the CRC.
+#define TT_EMULATOR_MAX_FRAME 605
+#define TT_EMULATOR_NODEBITS_LEN 32
+
+typedef enum {
+	EMU_IDLE,
+	EMU_IN_FRAME,
+	EMU_IN_NODEBITS,
+} tt_emulator_parse_state_t;
+
+struct tt_emulator_s {
+	int master_fd;
+	char* device;
+	uint32_t baud;
+	
+	tt_emulator_frame_handler handler;
+	void* ctx;
+	
+	pthread_t reader;
+	pthread_mutex_t nodebits_mutex;
+	uint8_t nodebits[TT_EMULATOR_NODEBITS_LEN];
+	_Atomic uint32_t bad_commands;
+	
+	// the parser's state, which only the reader thread touches
+	tt_emulator_parse_state_t state;
+	uint8_t frame[TT_EMULATOR_MAX_FRAME];
+	size_t frame_len;
+	size_t frame_expected;
+	uint8_t pending_nodebits[TT_EMULATOR_NODEBITS_LEN];
+	size_t nodebits_len;
+	
+	// when the emulated serial line will next be idle in each direction,
+	// in esp_timer_get_time() microseconds
+	int64_t rx_line_free_at;
+	int64_t tx_line_free_at;
+};
+
+// wait_for_line accounts for len bytes going over the line, and then
+// sleeps until they would have finished doing so.
+static void wait_for_line(tt_emulator_t* emulator, int64_t* line_free_at, size_t len) {
+	if (emulator->baud == 0) {
+		return;
+	}
+	
+	int64_t now = esp_timer_get_time();
+	if (*line_free_at < now) {
+		*line_free_at = now;
+	}
+	
+	// 8N1 framing means 10 bits on the wire for each byte
+	*line_free_at += ((int64_t)len * 10 * 1000000) / emulator->baud;
+	
+	int64_t delay = *line_free_at - now;
+	if (delay > 0) {
+		struct timespec ts = {
+			.tv_sec = delay / 1000000,
+			.tv_nsec = (delay % 1000000) * 1000,
+		};
+		while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+	}
+}
+
+// expected_frame_length works out how long a frame is from its LLAP header,
+// which is how TashTalk does it too.  It returns 0 if it can't tell yet.
+static size_t expected_frame_length(tt_emulator_t* emulator) {
+	if (emulator->frame_len < 3) {
+		return 0;
+	}
+	
+	// control frames are just the header and the CRC
+	if (emulator->frame[2] & 0x80) {
+		return 5;
+	}
+	
+	if (emulator->frame_len < 5) {
+		return 0;
+	}
+	
+	return (((emulator->frame[3] & 0x3) << 8) | emulator->frame[4]) + 5;
+}
+
+static void deliver_frame(tt_emulator_t* emulator) {
+	crc_state_t crc;
+	crc_state_init(&crc);
+	crc_state_append_all(&crc, emulator->frame, emulator->frame_len);
+	
+	emulator->handler(emulator->ctx, emulator->frame, emulator->frame_len, crc_state_ok(&crc));
+}
+
+static void parse_byte(tt_emulator_t* emulator, uint8_t byte) {
+	switch (emulator->state) {
+		case EMU_IDLE:
+			if (byte == 0x00) {
+				// no-op
+			} else if (byte == 0x01) {
+				emulator->state = EMU_IN_FRAME;
+				emulator->frame_len = 0;
+				emulator->frame_expected = 0;
+			} else if (byte == 0x02) {
+				emulator->state = EMU_IN_NODEBITS;
+				emulator->nodebits_len = 0;
+			} else {
+				emulator->bad_commands++;
+			}
+			break;
+			
+		case EMU_IN_FRAME:
+			emulator->frame[emulator->frame_len++] = byte;
+			if (emulator->frame_expected == 0) {
+				emulator->frame_expected = expected_frame_length(emulator);
+				if (emulator->frame_expected > TT_EMULATOR_MAX_FRAME) {
+					ESP_LOGE(TAG, "frame claims to be %d bytes long, ignoring it",
+						(int)emulator->frame_expected);
+					emulator->bad_commands++;
+					emulator->state = EMU_IDLE;
+					break;
+				}
+			}
+			
+			if (emulator->frame_expected != 0 && emulator->frame_len == emulator->frame_expected) {
+				deliver_frame(emulator);
+				emulator->state = EMU_IDLE;
+			}
+			break;
+			
+		case EMU_IN_NODEBITS:
+			emulator->pending_nodebits[emulator->nodebits_len++] = byte;
+			if (emulator->nodebits_len == TT_EMULATOR_NODEBITS_LEN) {
+				pthread_mutex_lock(&emulator->nodebits_mutex);
+				memcpy(emulator->nodebits, emulator->pending_nodebits, TT_EMULATOR_NODEBITS_LEN);
+				pthread_mutex_unlock(&emulator->nodebits_mutex);
+				emulator->state = EMU_IDLE;
+			}
+			break;
+	}
+}
+
+static void* tt_emulator_reader(void* arg) {
+	tt_emulator_t* emulator = (tt_emulator_t*)arg;
+	uint8_t buf[1024];
+	
+	while (1) {
+		ssize_t len = read(emulator->master_fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			
+			// EIO means the host has closed its end
+			if (errno != EIO) {
+				ESP_LOGE(TAG, "read failed: %s", strerror(errno));
+			}
+			usleep(1000);
+			continue;
+		}
+		
+		// Take the bytes at the speed the line would have delivered them,
+		// so that the pty fills up and pushes back on the host like CTS
+		// would.
+		wait_for_line(emulator, &emulator->rx_line_free_at, len);
+		
+		for (ssize_t i = 0; i < len; i++) {
+			parse_byte(emulator, buf[i]);
+		}
+	}
+	
+	return NULL;
+}
+
+static void write_all(int fd, const uint8_t* data, size_t len) {
+	while (len > 0) {
+		ssize_t written = write(fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			ESP_LOGE(TAG, "write failed: %s", strerror(errno));
+			return;
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+void tt_emulator_send_frame(tt_emulator_t* emulator, const uint8_t* frame, size_t len, bool corrupt_crc) {
+	// Worst case, every byte needs escaping, and then there's the CRC and
+	// the end of frame marker
+	uint8_t out[(TT_EMULATOR_MAX_FRAME + 2) * 2];
+	size_t out_len = 0;
+	
+	if (len > TT_EMULATOR_MAX_FRAME - 2) {
+		ESP_LOGE(TAG, "not sending a %d byte frame", (int)len);
+		return;
+	}
+	
+	crc_state_t crc;
+	crc_state_init(&crc);
+	crc_state_append_all(&crc, (unsigned char*)frame, len);
+	
+	uint8_t crc_bytes[2] = { crc_state_byte_1(&crc), crc_state_byte_2(&crc) };
+	if (corrupt_crc) {
+		crc_bytes[0] ^= 0xFF;
+	}
+	
+	for (size_t i = 0; i < len + 2; i++) {
+		uint8_t byte = i < len ? frame[i] : crc_bytes[i - len];
+		out[out_len++] = byte;
+		if (byte == 0x00) {
+			out[out_len++] = 0xFF;
+		}
+	}
+	
+	out[out_len++] = 0x00;
+	out[out_len++] = 0xFD;
+	
+	write_all(emulator->master_fd, out, out_len);
+	wait_for_line(emulator, &emulator->tx_line_free_at, out_len);
+}
+
+bool tt_emulator_has_node_address(tt_emulator_t* emulator, uint8_t addr) {
+	pthread_mutex_lock(&emulator->nodebits_mutex);
+	bool set = (emulator->nodebits[addr / 8] & (1 << (addr % 8))) != 0;
+	pthread_mutex_unlock(&emulator->nodebits_mutex);
+	return set;
+}
+
+uint32_t tt_emulator_bad_commands(tt_emulator_t* emulator) {
+	return emulator->bad_commands;
+}
+
+const char* tt_emulator_device(tt_emulator_t* emulator) {
+	return emulator->device;
+}
+
+tt_emulator_t* tt_emulator_new(uint32_t baud, tt_emulator_frame_handler handler, void* ctx) {
+	tt_emulator_t* emulator = calloc(1, sizeof(tt_emulator_t));
+	if (emulator == NULL) {
+		return NULL;
+	}
+	
+	emulator->baud = baud;
+	emulator->handler = handler;
+	emulator->ctx = ctx;
+	emulator->state = EMU_IDLE;
+	pthread_mutex_init(&emulator->nodebits_mutex, NULL);
+	
+	emulator->master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (emulator->master_fd < 0) {
+		ESP_LOGE(TAG, "posix_openpt failed: %s", strerror(errno));
+		goto err_cleanup;
+	}
+	
+	if (grantpt(emulator->master_fd) != 0 || unlockpt(emulator->master_fd) != 0) {
+		ESP_LOGE(TAG, "couldn't unlock pty: %s", strerror(errno));
+		goto err_cleanup;
+	}
+	
+	emulator->device = strdup(ptsname(emulator->master_fd));
+	
+	// Make the line raw from the start, so nothing we send before the host
+	// has set it up gets echoed back at us or cooked.
+	struct termios tio;
+	if (tcgetattr(emulator->master_fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		tcsetattr(emulator->master_fd, TCSANOW, &tio);
+	}
+	
+	if (pthread_create(&emulator->reader, NULL, &tt_emulator_reader, emulator) != 0) {
+		ESP_LOGE(TAG, "couldn't start reader thread");
+		goto err_cleanup;
+	}
+	pthread_detach(emulator->reader);
+	
+	ESP_LOGI(TAG, "TashTalk emulator on %s", emulator->device);
+	return emulator;
+	
+err_cleanup:
+	if (emulator->master_fd >= 0) {
+		close(emulator->master_fd);
+	}
+	free(emulator->device);
+	free(emulator);
+	return NULL;
+}
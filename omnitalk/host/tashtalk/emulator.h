@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The TashTalk emulator sits on the master side of a pty and pretends to
+// be a TashTalk on the end of a serial line, so that the real UART code can
+// talk to it through tt_uart_linux_backend.
+//
+// It speaks enough of the TashTalk protocol for OmniTalk: it understands
+// no-ops (0x00), frames to send (0x01 ...) and nodebits (0x02 + 32 bytes)
+// from the host, and it sends frames the other way escaped and terminated
+// the way TashTalk does.  It doesn't do anything about RTS/CTS or ENQs on
+// the LocalTalk side; frames are just handed to the frame handler.
+
+// tt_emulator_frame_handler is called, on the emulator's reader thread,
+// for each frame the host sends.  frame includes the two CRC bytes.
+typedef void (*tt_emulator_frame_handler)(void* ctx, const uint8_t* frame, size_t len, bool crc_ok);
+
+typedef struct tt_emulator_s tt_emulator_t;
+
+// tt_emulator_new opens a pty and starts the emulator reading from it.
+// If baud is not zero, both directions are paced to what a serial line
+// at that speed (with 8N1 framing) could carry.
+tt_emulator_t* tt_emulator_new(uint32_t baud, tt_emulator_frame_handler handler, void* ctx);
+
+// tt_emulator_device returns the path to the pty for the host to open.
+const char* tt_emulator_device(tt_emulator_t* emulator);
+
+// tt_emulator_send_frame sends a frame to the host, as if TashTalk had
+// received it from LocalTalk.  frame should not have a CRC on the end;
+// the emulator adds it.  If corrupt_crc is set, the CRC is deliberately
+// wrong.
+void tt_emulator_send_frame(tt_emulator_t* emulator, const uint8_t* frame, size_t len, bool corrupt_crc);
+
+// tt_emulator_has_node_address returns true if the host has set the
+// nodebit for addr.
+bool tt_emulator_has_node_address(tt_emulator_t* emulator, uint8_t addr);
+
+// tt_emulator_bad_commands returns how many bytes the emulator didn't
+// understand or frames it couldn't make sense of.
+uint32_t tt_emulator_bad_commands(tt_emulator_t* emulator);
@@ -0,0 +1,16 @@
+#include <stdio.h>
+
+#include "test.h"
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	
+	test_main();
+	
+	int failures = test_failure_count();
+	if (failures > 0) {
+		printf("%d test(s) failed\n", failures);
+		return 1;
+	}
+	return 0;
+}
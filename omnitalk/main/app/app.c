@@ -1,16 +1,20 @@
 #include "app/app.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
 #include "app/aep/aep.h"
 #include "app/nbp/nbp.h"
 #include "app/rtmp/rtmp.h"
 #include "app/sip/sip.h"
 #include "app/zip/zip.h"
 #include "net/common.h"
+#include "nbp_registry.h"
 
 app_t unicast_apps[] = {
 	{ .socket_number = 1, .name = "app/rtmp", .handler = &app_rtmp_handler, .idle = &app_rtmp_idle, .start = &app_rtmp_start },
-	{ .socket_number = 2, .name = "app/nbp", .handler = &app_nbp_handler, .start = &app_nbp_start },
-	{ .socket_number = 4, .handler = &app_aep_handler, .nbp_object_is_hostname = true, .nbp_type = "Workstation" },
+	{ .socket_number = 2, .name = "app/nbp", .handler = &app_nbp_handler, .start = &app_nbp_start, .queue_depth = 64 },
+	{ .socket_number = 4, .name = "app/aep", .handler = &app_aep_handler, .nbp_object_is_hostname = true, .nbp_type = "Workstation" },
 	{ .socket_number = 6, .name = "app/zip", .handler = &app_zip_handler, .idle = &app_zip_idle, .start = &app_zip_start },
 	
 	{ .socket_number = 253, .name = "app/sip", .handler = &app_sip_handler, .nbp_object_is_hostname = true, .nbp_type = "OmniTalk" },
@@ -20,8 +24,27 @@ app_t unicast_apps[] = {
 
 static char* my_hostname;
 
+void app_open_sockets(void) {
+	ddp_socket_init();
+	nbp_registry_init();
+	
+	for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
+		app_t* app = &unicast_apps[i];
+		
+		app->socket = ddp_socket_open(app->socket_number, app->name, app->queue_depth);
+		if (app->socket == NULL) {
+			continue;
+		}
+		if (app->nbp_object != NULL) {
+			ddp_socket_set_nbp_name(app->socket, app->nbp_object, app->nbp_type);
+		}
+		ddp_socket_bind(app->socket, app->handler);
+	}
+}
+
 void start_apps(void) {
 	my_hostname = generate_hostname();
+	
 	for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
 		// Do any apps want the hostname in their object?
 		if (unicast_apps[i].nbp_object_is_hostname) {
@@ -34,4 +57,6 @@ void start_apps(void) {
 			xTaskCreate(unicast_apps[i].idle, unicast_apps[i].name, 4096, NULL, tskIDLE_PRIORITY, NULL);
 		}
 	}
+	
+	app_open_sockets();
 }
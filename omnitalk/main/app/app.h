@@ -1,25 +1,35 @@
 #pragma once
 
 #include "mem/buffers.h"
+#include "ddp_socket.h"
 
 typedef void(*app_packet_handler)(buffer_t*);
 typedef void(*app_idle_task)(void*);
 typedef void(*app_start)(void);
 
-
-
 typedef struct {
 	uint8_t socket_number;
 	char* name;
 	app_packet_handler handler;
 	app_idle_task idle; 
 	app_start start;
+	// How many packets can be waiting for the handler before we drop them;
+	// DDP_SOCKET_DEFAULT_QUEUE_DEPTH if it's 0
+	size_t queue_depth;
 	
 	char* nbp_object;
 	bool nbp_object_is_hostname;
 	char* nbp_type;
+	
+	// Filled in by app_open_sockets
+	ddp_socket_t* socket;
 } app_t;
 
 extern app_t unicast_apps[];
 
+// app_open_sockets opens each app's socket and binds its handler to it.
+// start_apps does it; the simulator, which uses the apps without starting
+// them, does it itself.
+void app_open_sockets(void);
+
 void start_apps(void);
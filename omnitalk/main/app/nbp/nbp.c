@@ -1,8 +1,9 @@
 #include "app/nbp/nbp.h"
+#include "app/nbp/nbp_internal.h"
 
 #include <stdio.h>
+#include <string.h>
 
-#include "app/app.h"
 #include "mem/buffers.h"
 #include "net/common.h"
 #include "proto/ddp.h"
@@ -11,40 +12,106 @@
 #include "web/stats.h"
 #include "ddp_send.h"
 #include "global_state.h"
+#include "nbp_cache.h"
+#include "nbp_registry.h"
+#include "tunables.h"
 
-static void send_nbp_response(uint16_t dest_net, uint8_t dest_node, uint8_t dest_socket,
-								char* nbp_object, char* nbp_type, uint8_t socket, uint8_t their_id) {
-								
-	uint16_t my_network;
-	uint8_t my_node;
-	if (!lap_registry_get_best_address(global_lap_registry, &my_network, &my_node)) {
-		return;
+// A reply has room for 15 tuples, as many as its tuple count's four bits
+// can count
+#define NBP_MAX_REPLY_TUPLES 15
+
+static buffer_t *nbp_reply_new_packet(nbp_reply_t *reply) {
+	if (reply->count >= NBP_MAX_REPLY_PACKETS) {
+		return NULL;
 	}
-													
+	
 	buffer_t *buff = newbuf_ddp();
-	buf_expand_payload(buff, sizeof(nbp_packet_t) + sizeof(struct nbp_tuple_s));
-	((nbp_packet_t*)buff->ddp_payload)->nbp_id = their_id;
-	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count = (NBP_LKUP_REPLY << 4) | 1;
+	buf_expand_payload(buff, sizeof(nbp_packet_t));
+	((nbp_packet_t*)buff->ddp_payload)->nbp_id = NBP_PACKET_ID(reply->lookup);
+	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count = NBP_LKUP_REPLY << 4;
+	reply->packets[reply->count++] = buff;
+	return buff;
+}
+
+void app_nbp_reply_add(nbp_reply_t *reply, uint16_t network, uint8_t node, uint8_t socket,
+	uint8_t enumerator, const char* object, const char* type, pstring* zone) {
 	
-	// Set tuple fields
-	struct nbp_tuple_s *tuple = (struct nbp_tuple_s*)NBP_PACKET_TUPLES(buff);
-	NBP_TUPLE_SET_NETWORK(tuple, my_network);
-	NBP_TUPLE_SET_NODE(tuple, my_node);
-	NBP_TUPLE_SET_SOCKET(tuple, socket);
-	buffer_append_cstring_as_pstring(buff, nbp_object);
-	buffer_append_cstring_as_pstring(buff, nbp_type);
-	buf_append_pstring(buff, global_lap_registry->best_zone_cache);
+	size_t tuple_len = sizeof(struct nbp_tuple_s) + 1 + strlen(object) + 1 + strlen(type) + 1 +
+		zone->length;
+	
+	buffer_t *buff = reply->count > 0 ? reply->packets[reply->count - 1] : NULL;
+	if (buff == NULL ||
+		nbp_packet_tuple_count(buff) >= NBP_MAX_REPLY_TUPLES ||
+		buff->ddp_payload_length + tuple_len > DDP_MAX_PAYLOAD_LEN) {
 		
-	if (!ddp_send(buff, 2, dest_net, dest_node, dest_socket, 2)) {
-		stats.nbp_out_errors__type_reply__err_ddp_send_failed++;
-		freebuf(buff);
-		return;
+		buff = nbp_reply_new_packet(reply);
+		if (buff == NULL) {
+			stats.nbp_out_errors__type_reply__err_too_many_matches++;
+			return;
+		}
 	}
 	
-	stats.nbp_out_packets__function_LkUp_reply++;
+	size_t offset = buff->ddp_payload_length;
+	buf_expand_payload(buff, sizeof(struct nbp_tuple_s));
+	struct nbp_tuple_s *tuple = (struct nbp_tuple_s*)(buff->ddp_payload + offset);
+	NBP_TUPLE_SET_NETWORK(tuple, network);
+	NBP_TUPLE_SET_NODE(tuple, node);
+	NBP_TUPLE_SET_SOCKET(tuple, socket);
+	tuple->enumerator = enumerator;
+	buffer_append_cstring_as_pstring(buff, object);
+	buffer_append_cstring_as_pstring(buff, type);
+	buf_append_pstring(buff, zone);
+	
+	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count++;
+	stats.nbp_out_reply_tuples++;
+}
+
+// add_to_reply is called with each of our entities that matches the
+// lookup.  Our address goes in when the reply's sent.
+static void add_to_reply(void* pvt, const nbp_entity_t* entity) {
+	nbp_reply_t *reply = (nbp_reply_t*)pvt;
+	app_nbp_reply_add(reply, 0, 0, entity->socket, entity->enumerator, entity->object,
+		entity->type, global_lap_registry->best_zone_cache);
+}
+
+void app_nbp_reply_send(nbp_reply_t *reply) {
+	// Most lookups don't match anything, so we only work out our address
+	// for the ones that do
+	uint16_t my_network = 0;
+	uint8_t my_node = 0;
+	bool have_address = !reply->ours || (reply->count > 0 &&
+		lap_registry_get_best_address(global_lap_registry, &my_network, &my_node));
+	
+	// The address to send the reply to is the address information in the
+	// query tuple
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(reply->lookup);
+	
+	for (size_t i = 0; i < reply->count; i++) {
+		buffer_t *buff = reply->packets[i];
+		if (!have_address) {
+			freebuf(buff);
+			continue;
+		}
+		
+		for (struct nbp_tuple_s *ours = nbp_get_first_tuple(buff); reply->ours && ours != NULL;
+			ours = nbp_get_next_tuple(buff, ours)) {
+			
+			NBP_TUPLE_SET_NETWORK(ours, my_network);
+			NBP_TUPLE_SET_NODE(ours, my_node);
+		}
+		
+		if (!ddp_send(buff, DDP_SOCKET_NBP, NBP_TUPLE_NETWORK(tuple), NBP_TUPLE_NODE(tuple),
+			NBP_TUPLE_SOCKET(tuple), DDP_TYPE_NBP)) {
+			
+			stats.nbp_out_errors__type_reply__err_ddp_send_failed++;
+			freebuf(buff);
+			continue;
+		}
+		stats.nbp_out_packets__function_LkUp_reply++;
+	}
 }
 
-static void handle_nbp_lookup(buffer_t *packet) {
+void app_nbp_handle_lookup(buffer_t *packet) {
 	if (nbp_packet_tuple_count(packet) != 1) {
 		stats.nbp_in_errors__err_LkUp_with_too_many_tuples++;
 		// don't return, we'll try to limp on
@@ -57,13 +124,20 @@ static void handle_nbp_lookup(buffer_t *packet) {
 		return;
 	}
 	
+	// Until ZIP's told us what zone we're in, we can't say whether it's
+	// for us or not
+	if (global_lap_registry->best_zone_cache == NULL) {
+		stats.nbp_in_errors__err_zone_not_known_yet++;
+		return;
+	}
+	
 	// Is this LkUp for us?
 	pstring* zone = nbp_tuple_get_zone(tuple);
 	if (pstring_eq_cstring(zone, "*")) {
 		// A lookup for current zone.  We should only respond if the 
 		// "current zone" for that port is our own zone.
 		lap_t *packet_lap = packet->recv_chain.lap;
-		if (packet_lap == NULL) {
+		if (packet_lap == NULL || packet_lap->my_zone == NULL) {
 			return;
 		}
 		if (!pstring_eq_pstring(packet_lap->my_zone, global_lap_registry->best_zone_cache)) {
@@ -73,34 +147,14 @@ static void handle_nbp_lookup(buffer_t *packet) {
 		return;
 	}
 		
-	// Iterate through apps, see if we have anything that matches
-	for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
-		// Does it match the object being searched for?
-		if (unicast_apps[i].nbp_object == NULL ||
-		    !pstring_matches_cstring_nbp(nbp_tuple_get_object(tuple), unicast_apps[i].nbp_object)) {
-			
-			continue;		    
-		}
-		
-		// Does it match the type?
-		if (unicast_apps[i].nbp_type == NULL ||
-		    !pstring_matches_cstring_nbp(nbp_tuple_get_type(tuple), unicast_apps[i].nbp_type)) {
-			
-			continue;		    
-		}
-
-		send_nbp_response(
-			// The address to send the response to is the address information in the 
-			// query tuple
-			NBP_TUPLE_NETWORK(tuple), NBP_TUPLE_NODE(tuple), NBP_TUPLE_SOCKET(tuple),
-			
-			// The object, type and socket come out of the apps table
-			unicast_apps[i].nbp_object, unicast_apps[i].nbp_type, 
-			unicast_apps[i].socket_number,
-			
-			NBP_PACKET_ID(packet)
-		);
-	}
+	// See if any of our entities have a name that matches
+	nbp_reply_t reply = {
+		.lookup = packet,
+		.ours = true,
+	};
+	nbp_registry_lookup(nbp_tuple_get_object(tuple), nbp_tuple_get_type(tuple), &reply,
+		&add_to_reply);
+	app_nbp_reply_send(&reply);
 }
 
 void app_nbp_handler(buffer_t *packet) {
@@ -114,16 +168,33 @@ void app_nbp_handler(buffer_t *packet) {
 		break;
 	case NBP_BRRQ:
 		stats.nbp_in_packets__function_BrRq++;
+		if (app_nbp_is_duplicate(packet)) {
+			stats.nbp_in_duplicates__function_BrRq++;
+			break;
+		}
+		app_nbp_handle_brrq(packet);
 		break;
 	case NBP_LKUP:
 		stats.nbp_in_packets__function_LkUp++;
-		handle_nbp_lookup(packet);
+		if (app_nbp_is_duplicate(packet)) {
+			stats.nbp_in_duplicates__function_LkUp++;
+			break;
+		}
+		app_nbp_handle_lookup(packet);
 		break;
 	case NBP_LKUP_REPLY:
 		stats.nbp_in_packets__function_LkUp_reply++;
+		if (global_nbp_cache != NULL && packet->recv_chain.lap != NULL) {
+			nbp_cache_learn(global_nbp_cache, packet, packet->recv_chain.lap);
+		}
 		break;
 	case NBP_FWDREQ:
 		stats.nbp_in_packets__function_FwdReq++;
+		if (app_nbp_is_duplicate(packet)) {
+			stats.nbp_in_duplicates__function_FwdReq++;
+			break;
+		}
+		app_nbp_handle_fwdreq(packet);
 		break;
 	}
 	
@@ -132,4 +203,7 @@ cleanup:
 }
 
 void app_nbp_start() {
+#ifdef NBP_CACHE_ENTRIES
+	global_nbp_cache = nbp_cache_new(NBP_CACHE_ENTRIES, NBP_CACHE_TTL_SECONDS * 1000000LL);
+#endif
 }
@@ -0,0 +1,113 @@
+#include "app/nbp/nbp_internal.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_timer.h>
+
+#include "mem/buffers.h"
+#include "proto/ddp.h"
+#include "proto/nbp.h"
+#include "tunables.h"
+
+/* Clients retry a lookup every second or so with the same NBP ID, and a
+   broadcast lookup can reach us over more than one port (say Ethernet and
+   an LToUDP bridge), or come back round to us over another one.  Each copy
+   would be answered, or worse, forwarded, again.
+   
+   So we remember each request for NBP_DEDUPE_WINDOW_MS by who's asking (the
+   address in its tuple, which survives being rewritten and forwarded), its
+   NBP ID and a hash of its tuple, and drop any copies that turn up in that
+   time.  The window's shorter than clients' retry interval, so that a retry
+   of a lookup whose replies went astray is still answered.
+   
+   Only the NBP app's task looks at requests, so there's no locking. */
+
+#ifdef NBP_DEDUPE_ENTRIES
+
+typedef struct {
+	bool in_use;
+	int64_t expires_at;
+	
+	uint16_t network;
+	uint8_t node;
+	uint8_t socket;
+	uint8_t nbp_id;
+	uint32_t tuple_hash;
+} nbp_seen_t;
+
+static nbp_seen_t seen[NBP_DEDUPE_ENTRIES];
+
+// FNV-1a of the tuple, address, enumerator, name and all
+static uint32_t tuple_hash(buffer_t *packet, struct nbp_tuple_s *tuple) {
+	uint32_t hash = 2166136261u;
+	for (uint8_t *byte = (uint8_t*)tuple; byte < packet->ddp_payload + packet->ddp_payload_length;
+		byte++) {
+		
+		hash ^= *byte;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+bool app_nbp_is_duplicate(buffer_t *packet) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	if (tuple == NULL) {
+		return false;
+	}
+	
+	nbp_seen_t request = {
+		.in_use = true,
+		.network = NBP_TUPLE_NETWORK(tuple),
+		.node = NBP_TUPLE_NODE(tuple),
+		.socket = NBP_TUPLE_SOCKET(tuple),
+		.nbp_id = NBP_PACKET_ID(packet),
+		.tuple_hash = tuple_hash(packet, tuple),
+	};
+	
+	int64_t now = esp_timer_get_time();
+	nbp_seen_t *slot = NULL;
+	nbp_seen_t *oldest = &seen[0];
+	for (size_t i = 0; i < NBP_DEDUPE_ENTRIES; i++) {
+		nbp_seen_t *curr = &seen[i];
+		if (!curr->in_use || curr->expires_at <= now) {
+			if (slot == NULL) {
+				slot = curr;
+			}
+			continue;
+		}
+		if (curr->tuple_hash == request.tuple_hash && curr->nbp_id == request.nbp_id &&
+			curr->network == request.network && curr->node == request.node &&
+			curr->socket == request.socket) {
+			
+			// The window runs from the first copy, so that a client that
+			// retries faster than the window still gets answered now and
+			// then
+			return true;
+		}
+		if (curr->expires_at < oldest->expires_at) {
+			oldest = curr;
+		}
+	}
+	
+	request.expires_at = now + NBP_DEDUPE_WINDOW_MS * 1000LL;
+	*(slot != NULL ? slot : oldest) = request;
+	return false;
+}
+
+void app_nbp_forget_requests(void) {
+	for (size_t i = 0; i < NBP_DEDUPE_ENTRIES; i++) {
+		seen[i].in_use = false;
+	}
+}
+
+#else
+
+bool app_nbp_is_duplicate(buffer_t *packet) {
+	return false;
+}
+
+void app_nbp_forget_requests(void) {
+}
+
+#endif
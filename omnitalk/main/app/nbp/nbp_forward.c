@@ -0,0 +1,275 @@
+#include "app/nbp/nbp_internal.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lap/lap.h"
+#include "mem/buffers.h"
+#include "proto/ddp.h"
+#include "proto/nbp.h"
+#include "table/routing/route.h"
+#include "table/routing/table.h"
+#include "table/zip/table.h"
+#include "util/pstring.h"
+#include "web/stats.h"
+#include "ddp_send.h"
+#include "global_state.h"
+#include "nbp_cache.h"
+
+/* Router-side NBP.  A node looking up a name in another zone sends us a
+   BrRq; we send a FwdReq to every network in the zone, and the router on
+   each of those turns it into a LkUp that it broadcasts on the network.
+   Networks in the zone that are directly connected to us get the LkUp
+   straight away.  Only the networks in the zone ever see the LkUp, so the
+   rest of the internet (and especially its LocalTalk segments) is spared
+   it.
+   
+   Lookups we've broadcast on a port recently are answered from the NBP
+   cache instead of being broadcast again, if there is one.
+   
+   Zone multicast would spare the nodes on an extended network that aren't
+   in the zone too, but none of our transports do it yet, so LkUps go out
+   as broadcasts. */
+
+typedef struct {
+	uint16_t network;
+	uint8_t distance;
+	lap_t *lap;
+	rt_nexthop_t nexthop;
+} nbp_target_t;
+
+typedef struct {
+	nbp_target_t *targets;
+	size_t count;
+	size_t capacity;
+} nbp_targets_t;
+
+static bool collect_route(void* pvt, rt_route_t* route, enum rt_route_status status) {
+	nbp_targets_t *targets = (nbp_targets_t*)pvt;
+	
+	if (status == RT_BAD) {
+		return true;
+	}
+	
+	// Routes come best first, so a network we've already got has its best
+	// route already
+	for (size_t i = 0; i < targets->count; i++) {
+		if (targets->targets[i].network == route->range_start) {
+			return true;
+		}
+	}
+	
+	if (targets->count == targets->capacity) {
+		size_t capacity = targets->capacity == 0 ? 16 : targets->capacity * 2;
+		nbp_target_t *grown = realloc(targets->targets, capacity * sizeof(nbp_target_t));
+		if (grown == NULL) {
+			return false;
+		}
+		targets->targets = grown;
+		targets->capacity = capacity;
+	}
+	
+	targets->targets[targets->count++] = (nbp_target_t){
+		.network = route->range_start,
+		.distance = route->distance,
+		.lap = route->outbound_lap,
+		.nexthop = route->nexthop,
+	};
+	return true;
+}
+
+typedef struct {
+	pstring *zone;
+	bool found;
+} nbp_zone_search_t;
+
+static bool zone_matches(void* pvt, int idx, uint16_t network, pstring* zone) {
+	nbp_zone_search_t *search = (nbp_zone_search_t*)pvt;
+	
+	// Zone names are compared the way NBP compares them, case-insensitively
+	if (pstring_eq_pstring_mac_ci(search->zone, zone)) {
+		search->found = true;
+		return false;
+	}
+	return true;
+}
+
+static bool network_is_in_zone(uint16_t network, pstring *zone) {
+	nbp_zone_search_t search = { .zone = zone, .found = false };
+	zt_iterate_net(global_zip_table, &search, network, NULL, zone_matches, NULL);
+	return search.found;
+}
+
+// Sort FwdReqs by where they're going next, so that everything for one
+// next hop goes out together
+static int compare_targets(const void* a, const void* b) {
+	const nbp_target_t *ta = (const nbp_target_t*)a;
+	const nbp_target_t *tb = (const nbp_target_t*)b;
+	
+	if (ta->lap != tb->lap) {
+		return (uintptr_t)ta->lap < (uintptr_t)tb->lap ? -1 : 1;
+	}
+	if (ta->nexthop.network != tb->nexthop.network) {
+		return ta->nexthop.network < tb->nexthop.network ? -1 : 1;
+	}
+	if (ta->nexthop.node != tb->nexthop.node) {
+		return ta->nexthop.node < tb->nexthop.node ? -1 : 1;
+	}
+	return ta->network < tb->network ? -1 : ta->network > tb->network;
+}
+
+// nbp_rewrite makes a copy of the single-tuple NBP packet with a new
+// function, and the zone replaced.
+static buffer_t *nbp_rewrite(buffer_t *packet, nbp_function_t function, pstring *zone) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	
+	buffer_t *buff = newbuf_ddp();
+	buf_expand_payload(buff, sizeof(nbp_packet_t) + sizeof(struct nbp_tuple_s));
+	((nbp_packet_t*)buff->ddp_payload)->nbp_id = NBP_PACKET_ID(packet);
+	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count = (function << 4) | 1;
+	
+	// The tuple's address is the requester's, which is where replies go
+	struct nbp_tuple_s *new_tuple = (struct nbp_tuple_s*)NBP_PACKET_TUPLES(buff);
+	*new_tuple = *tuple;
+	buf_append_pstring(buff, nbp_tuple_get_object(tuple));
+	buf_append_pstring(buff, nbp_tuple_get_type(tuple));
+	buf_append_pstring(buff, zone);
+	
+	return buff;
+}
+
+typedef struct {
+	nbp_reply_t reply;
+	pstring *zone;
+} nbp_cached_reply_t;
+
+static void add_cached_to_reply(void* pvt, const nbp_cache_entry_t* entry) {
+	nbp_cached_reply_t *cached = (nbp_cached_reply_t*)pvt;
+	app_nbp_reply_add(&cached->reply, entry->network, entry->node, entry->socket,
+		entry->enumerator, entry->object, entry->type, cached->zone);
+}
+
+// answer_from_cache answers the lookup on behalf of the nodes on lap, if
+// we've broadcast it there recently, and returns false if we haven't.
+static bool answer_from_cache(buffer_t *packet, pstring *zone, lap_t *lap) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	nbp_cached_reply_t cached = {
+		.reply = { .lookup = packet },
+		.zone = zone,
+	};
+	
+	if (!nbp_cache_answer(global_nbp_cache, nbp_tuple_get_object(tuple),
+		nbp_tuple_get_type(tuple), zone, lap, &cached, &add_cached_to_reply)) {
+		
+		// Next time, we'll have the answers to this one
+		nbp_cache_note_lookup(global_nbp_cache, nbp_tuple_get_object(tuple),
+			nbp_tuple_get_type(tuple), zone, lap);
+		return false;
+	}
+	
+	app_nbp_reply_send(&cached.reply);
+	return true;
+}
+
+static void send_lookup_on(buffer_t *packet, pstring *zone, lap_t *lap) {
+	if (global_nbp_cache != NULL && answer_from_cache(packet, zone, lap)) {
+		return;
+	}
+	
+	buffer_t *lkup = nbp_rewrite(packet, NBP_LKUP, zone);
+	if (!ddp_send_via(lkup, DDP_SOCKET_NBP, 0, DDP_ADDR_BROADCAST, DDP_SOCKET_NBP,
+		DDP_TYPE_NBP, lap)) {
+		
+		stats.nbp_out_errors__type_LkUp__err_ddp_send_failed++;
+		freebuf(lkup);
+		return;
+	}
+	stats.nbp_out_packets__function_LkUp++;
+}
+
+static void send_fwdreq_to(buffer_t *packet, pstring *zone, nbp_target_t *target) {
+	buffer_t *fwdreq = nbp_rewrite(packet, NBP_FWDREQ, zone);
+	
+	// We've already looked the route up, so we don't go through ddp_send
+	fwdreq->send_chain.via_net = target->nexthop.network;
+	fwdreq->send_chain.via_node = target->nexthop.node;
+	if (!ddp_send_via(fwdreq, DDP_SOCKET_NBP, target->network, DDP_ADDR_ANY_ROUTER,
+		DDP_SOCKET_NBP, DDP_TYPE_NBP, target->lap)) {
+		
+		stats.nbp_out_errors__type_FwdReq__err_ddp_send_failed++;
+		freebuf(fwdreq);
+		return;
+	}
+	stats.nbp_out_packets__function_FwdReq++;
+}
+
+void app_nbp_handle_brrq(buffer_t *packet) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	if (tuple == NULL) {
+		stats.nbp_in_errors__err_no_tuple++;
+		return;
+	}
+	
+	// A zone of "*" (or nothing) is the requester's own zone, which is the
+	// zone of the port it came in on
+	pstring *zone = nbp_tuple_get_zone(tuple);
+	if (zone->length == 0 || pstring_eq_cstring(zone, "*")) {
+		lap_t *lap = packet->recv_chain.lap;
+		if (lap == NULL || lap->my_zone == NULL) {
+			stats.nbp_in_errors__err_zone_not_known_yet++;
+			return;
+		}
+		zone = lap->my_zone;
+	}
+	
+	// We might have the name ourselves
+	app_nbp_handle_lookup(packet);
+	
+	// Work out which networks are in the zone.  The routing table's lock is
+	// held while we go through the routes, so we take a copy and look at
+	// the zones afterwards.
+	nbp_targets_t targets = { 0 };
+	rt_iterate(global_routing_table, &targets, collect_route);
+	
+	size_t in_zone = 0;
+	for (size_t i = 0; i < targets.count; i++) {
+		if (network_is_in_zone(targets.targets[i].network, zone)) {
+			targets.targets[in_zone++] = targets.targets[i];
+		}
+	}
+	
+	if (in_zone == 0) {
+		stats.nbp_in_errors__err_BrRq_for_unknown_zone++;
+	}
+	
+	qsort(targets.targets, in_zone, sizeof(nbp_target_t), compare_targets);
+	for (size_t i = 0; i < in_zone; i++) {
+		nbp_target_t *target = &targets.targets[i];
+		if (target->distance == 0) {
+			send_lookup_on(packet, zone, target->lap);
+		} else {
+			send_fwdreq_to(packet, zone, target);
+		}
+	}
+	
+	free(targets.targets);
+}
+
+void app_nbp_handle_fwdreq(buffer_t *packet) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	if (tuple == NULL) {
+		stats.nbp_in_errors__err_no_tuple++;
+		return;
+	}
+	
+	// A FwdReq's for one of our directly connected networks, and we
+	// broadcast it there as a LkUp
+	rt_route_t route = { 0 };
+	if (!rt_lookup(global_routing_table, DDP_DSTNET(packet), &route) || route.distance != 0) {
+		stats.nbp_in_errors__err_FwdReq_for_distant_network++;
+		return;
+	}
+	
+	app_nbp_handle_lookup(packet);
+	send_lookup_on(packet, nbp_tuple_get_zone(tuple), route.outbound_lap);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem/buffers.h"
+#include "util/pstring.h"
+
+// How many reply packets one LkUp can get
+#define NBP_MAX_REPLY_PACKETS 8
+
+// An nbp_reply_t is the LkUp-Replies to a lookup, being put together.  The
+// tuples of a reply that's ours get our address when it's sent.
+typedef struct {
+	buffer_t *lookup;
+	bool ours;
+	
+	size_t count;
+	buffer_t *packets[NBP_MAX_REPLY_PACKETS];
+} nbp_reply_t;
+
+// app_nbp_reply_add adds a name to the reply, packing as many into each
+// packet as will fit.
+void app_nbp_reply_add(nbp_reply_t *reply, uint16_t network, uint8_t node, uint8_t socket,
+	uint8_t enumerator, const char* object, const char* type, pstring* zone);
+
+// app_nbp_reply_send sends the reply to the address in the lookup's tuple.
+void app_nbp_reply_send(nbp_reply_t *reply);
+
+// app_nbp_is_duplicate returns true if the request's a copy of one that
+// arrived in the last NBP_DEDUPE_WINDOW_MS, and so has been dealt with.
+bool app_nbp_is_duplicate(buffer_t *packet);
+
+// app_nbp_forget_requests forgets every request app_nbp_is_duplicate has
+// seen.
+void app_nbp_forget_requests(void);
+
+void app_nbp_handle_lookup(buffer_t *packet);
+void app_nbp_handle_brrq(buffer_t *packet);
+void app_nbp_handle_fwdreq(buffer_t *packet);
@@ -0,0 +1,355 @@
+#include "app/nbp/nbp_test.h"
+#include "app/nbp/nbp.h"
+#include "app/nbp/nbp_internal.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lap/lap.h"
+#include "lap/registry.h"
+#include "mem/buffers.h"
+#include "proto/ddp.h"
+#include "proto/nbp.h"
+#include "table/routing/route.h"
+#include "table/routing/table.h"
+#include "table/zip/table.h"
+#include "util/pstring.h"
+#include "web/stats.h"
+#include "global_state.h"
+#include "nbp_registry.h"
+
+#define MAX_SENT 8
+
+static int packets_sent;
+static buffer_t* sent[MAX_SENT];
+
+static bool lsend_record(lap_t* lap, buffer_t* buffer) {
+	if (packets_sent < MAX_SENT) {
+		sent[packets_sent] = buffer;
+	} else {
+		freebuf(buffer);
+	}
+	packets_sent++;
+	return true;
+}
+
+static void forget_sent(void) {
+	for (int i = 0; i < packets_sent && i < MAX_SENT; i++) {
+		freebuf(sent[i]);
+	}
+	packets_sent = 0;
+}
+
+static transport_t dummy_transport = { 0 };
+static lap_t dummy_lap = {
+	.transport = &dummy_transport,
+	.my_address = 1,
+	.my_network = 1,
+	.network_range_start = 1,
+	.network_range_end = 10
+};
+
+// setup_internet gives us a directly connected network, 1-10, in Zone1,
+// and beyond it networks 20, 30 and 40 in Zone2 and 50 in Zone3.
+static void setup_internet(void) {
+	global_routing_table = rt_new();
+	rt_touch_direct(global_routing_table, 1, 10, &dummy_lap);
+	rt_touch(global_routing_table, (rt_route_t){ .range_start = 20, .range_end = 20,
+		.outbound_lap = &dummy_lap, .nexthop = { .network = 1, .node = 5 }, .distance = 1 });
+	rt_touch(global_routing_table, (rt_route_t){ .range_start = 30, .range_end = 30,
+		.outbound_lap = &dummy_lap, .nexthop = { .network = 1, .node = 6 }, .distance = 1 });
+	rt_touch(global_routing_table, (rt_route_t){ .range_start = 40, .range_end = 40,
+		.outbound_lap = &dummy_lap, .nexthop = { .network = 1, .node = 5 }, .distance = 2 });
+	rt_touch(global_routing_table, (rt_route_t){ .range_start = 50, .range_end = 50,
+		.outbound_lap = &dummy_lap, .nexthop = { .network = 1, .node = 6 }, .distance = 1 });
+	
+	global_zip_table = zt_new();
+	zt_add_net_range(global_zip_table, 1, 10);
+	zt_add_zone_for(global_zip_table, 1, (pstring*)"\x05Zone1");
+	zt_add_net_range(global_zip_table, 20, 20);
+	zt_add_zone_for(global_zip_table, 20, (pstring*)"\x05Zone2");
+	zt_add_net_range(global_zip_table, 30, 30);
+	zt_add_zone_for(global_zip_table, 30, (pstring*)"\x05Zone2");
+	zt_add_net_range(global_zip_table, 40, 40);
+	zt_add_zone_for(global_zip_table, 40, (pstring*)"\x05Zone2");
+	zt_add_net_range(global_zip_table, 50, 50);
+	zt_add_zone_for(global_zip_table, 50, (pstring*)"\x05Zone3");
+	
+	// Our own names are only answered once ZIP's told us our zone
+	if (global_lap_registry == NULL) {
+		global_lap_registry = lap_registry_new();
+	}
+	
+	packets_sent = 0;
+	lap_lsend_mock = &lsend_record;
+}
+
+// nbp_request builds an NBP request from node 1.99, socket 253, for
+// =:type@zone
+static buffer_t* nbp_request(nbp_function_t function, const char* type, const char* zone) {
+	buffer_t *buff = newbuf_ddp();
+	ddp_set_srcnet(buff, 1);
+	ddp_set_src(buff, 99);
+	ddp_set_srcsock(buff, 253);
+	ddp_set_ddptype(buff, DDP_TYPE_NBP);
+	buf_expand_payload(buff, sizeof(nbp_packet_t) + sizeof(struct nbp_tuple_s));
+	((nbp_packet_t*)buff->ddp_payload)->nbp_id = 42;
+	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count = (function << 4) | 1;
+	
+	struct nbp_tuple_s *tuple = (struct nbp_tuple_s*)NBP_PACKET_TUPLES(buff);
+	NBP_TUPLE_SET_NETWORK(tuple, 1);
+	NBP_TUPLE_SET_NODE(tuple, 99);
+	NBP_TUPLE_SET_SOCKET(tuple, 253);
+	buffer_append_cstring_as_pstring(buff, "=");
+	buffer_append_cstring_as_pstring(buff, type);
+	buffer_append_cstring_as_pstring(buff, zone);
+	
+	buff->recv_chain.lap = &dummy_lap;
+	return buff;
+}
+
+// sent_is checks a packet we sent is the request rewritten as the given
+// function, for the given zone, with the requester's address intact
+static bool sent_is(buffer_t *packet, nbp_function_t function, const char* zone) {
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(packet);
+	return nbp_packet_function(packet) == function &&
+		nbp_packet_tuple_count(packet) == 1 &&
+		NBP_PACKET_ID(packet) == 42 &&
+		DDP_SRCSOCK(packet) == DDP_SOCKET_NBP &&
+		DDP_DSTSOCK(packet) == DDP_SOCKET_NBP &&
+		tuple != NULL &&
+		NBP_TUPLE_NETWORK(tuple) == 1 &&
+		NBP_TUPLE_NODE(tuple) == 99 &&
+		NBP_TUPLE_SOCKET(tuple) == 253 &&
+		pstring_eq_cstring(nbp_tuple_get_zone(tuple), zone);
+}
+
+TEST_FUNCTION(test_nbp_brrq_fans_out_fwdreqs) {
+	setup_internet();
+	
+	// Zone names are case-insensitive
+	buffer_t *brrq = nbp_request(NBP_BRRQ, "=", "zone2");
+	app_nbp_handle_brrq(brrq);
+	
+	// One FwdReq to the router on each network in the zone
+	TEST_ASSERT(packets_sent == 3);
+	uint16_t networks_seen = 0;
+	for (int i = 0; i < 3; i++) {
+		TEST_ASSERT(sent_is(sent[i], NBP_FWDREQ, "zone2"));
+		TEST_ASSERT(DDP_DST(sent[i]) == DDP_ADDR_ANY_ROUTER);
+		TEST_ASSERT(DDP_DSTNET(sent[i]) == 20 || DDP_DSTNET(sent[i]) == 30 ||
+			DDP_DSTNET(sent[i]) == 40);
+		networks_seen |= 1 << (DDP_DSTNET(sent[i]) / 10);
+	}
+	TEST_ASSERT(networks_seen == ((1<<2) | (1<<3) | (1<<4)));
+	
+	// The two via node 5 go out together, before the one via node 6
+	TEST_ASSERT(sent[0]->send_chain.via_node == 5);
+	TEST_ASSERT(sent[1]->send_chain.via_node == 5);
+	TEST_ASSERT(sent[2]->send_chain.via_node == 6);
+	forget_sent();
+	
+	// A zone nobody has gets nothing sent
+	freebuf(brrq);
+	brrq = nbp_request(NBP_BRRQ, "=", "Zone9");
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 0);
+	
+	freebuf(brrq);
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_brrq_for_connected_zone) {
+	setup_internet();
+	dummy_lap.my_zone = (pstring*)"\x05Zone1";
+	
+	// Our own network gets a LkUp broadcast on it, rather than a FwdReq
+	buffer_t *brrq = nbp_request(NBP_BRRQ, "=", "Zone1");
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(sent_is(sent[0], NBP_LKUP, "Zone1"));
+	TEST_ASSERT(DDP_DST(sent[0]) == DDP_ADDR_BROADCAST);
+	forget_sent();
+	freebuf(brrq);
+	
+	// As does the requester's own zone, which is the port's
+	brrq = nbp_request(NBP_BRRQ, "=", "*");
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(sent_is(sent[0], NBP_LKUP, "Zone1"));
+	forget_sent();
+	freebuf(brrq);
+	
+	dummy_lap.my_zone = NULL;
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_fwdreq_becomes_lkup) {
+	setup_internet();
+	
+	// A FwdReq for one of our networks is broadcast there as a LkUp
+	buffer_t *fwdreq = nbp_request(NBP_FWDREQ, "=", "Zone1");
+	ddp_set_dstnet(fwdreq, 5);
+	ddp_set_dst(fwdreq, DDP_ADDR_ANY_ROUTER);
+	app_nbp_handle_fwdreq(fwdreq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(sent_is(sent[0], NBP_LKUP, "Zone1"));
+	TEST_ASSERT(DDP_DST(sent[0]) == DDP_ADDR_BROADCAST);
+	forget_sent();
+	
+	// We don't pass FwdReqs on to networks further away
+	ddp_set_dstnet(fwdreq, 20);
+	app_nbp_handle_fwdreq(fwdreq);
+	TEST_ASSERT(packets_sent == 0);
+	
+	freebuf(fwdreq);
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
+
+// count_reply_tuples checks each packet we sent is a LkUp-Reply that fits
+// in a DDP packet, and returns how many tuples there were in all
+static int count_reply_tuples(void) {
+	int tuples = 0;
+	for (int i = 0; i < packets_sent && i < MAX_SENT; i++) {
+		if (nbp_packet_function(sent[i]) != NBP_LKUP_REPLY ||
+			sent[i]->ddp_payload_length > DDP_MAX_PAYLOAD_LEN) {
+			
+			return -1;
+		}
+		tuples += nbp_packet_tuple_count(sent[i]);
+	}
+	return tuples;
+}
+
+TEST_FUNCTION(test_nbp_lkup_replies_are_packed) {
+	setup_internet();
+	
+	// We need a zone and an address to answer anything
+	lap_registry_t *saved_registry = global_lap_registry;
+	global_lap_registry = lap_registry_new();
+	dummy_lap.my_zone = (pstring*)"\x05Zone1";
+	lap_registry_register(global_lap_registry, &dummy_lap);
+	lap_registry_update_zone_cache(global_lap_registry);
+	
+	char object[40];
+	for (int i = 0; i < 20; i++) {
+		snprintf(object, sizeof(object), "service %d", i);
+		TEST_ASSERT(nbp_registry_register(object, "Packed", 220));
+	}
+	
+	// 20 matches go in two replies, as a reply can only count 15 tuples
+	buffer_t *lkup = nbp_request(NBP_LKUP, "Packed", "Zone1");
+	app_nbp_handle_lookup(lkup);
+	TEST_ASSERT(packets_sent == 2);
+	TEST_ASSERT(count_reply_tuples() == 20);
+	TEST_ASSERT(nbp_packet_tuple_count(sent[0]) == 15);
+	forget_sent();
+	nbp_registry_unregister_socket(220);
+	
+	// Names as long as they can be only fit seven to a packet
+	const char* long_type = "Packed service with a long type!";
+	for (int i = 0; i < 10; i++) {
+		snprintf(object, sizeof(object), "a service with a very long name%d", i);
+		TEST_ASSERT(nbp_registry_register(object, long_type, 220));
+	}
+	freebuf(lkup);
+	lkup = nbp_request(NBP_LKUP, long_type, "Zone1");
+	app_nbp_handle_lookup(lkup);
+	TEST_ASSERT(packets_sent == 2);
+	TEST_ASSERT(count_reply_tuples() == 10);
+	forget_sent();
+	nbp_registry_unregister_socket(220);
+	
+	freebuf(lkup);
+	dummy_lap.my_zone = NULL;
+	global_lap_registry = saved_registry;
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_duplicate_requests_are_dropped) {
+	setup_internet();
+	app_nbp_forget_requests();
+	
+	buffer_t *brrq = nbp_request(NBP_BRRQ, "=", "Zone2");
+	app_nbp_handler(buf_clone(brrq));
+	TEST_ASSERT(packets_sent == 3);
+	forget_sent();
+	
+	// A retry, or the same request come round another way, is dropped
+	prometheus_counter_t duplicates = stats.nbp_in_duplicates__function_BrRq;
+	app_nbp_handler(buf_clone(brrq));
+	TEST_ASSERT(packets_sent == 0);
+	TEST_ASSERT(stats.nbp_in_duplicates__function_BrRq == duplicates + 1);
+	
+	// Even once it's been rewritten as another function
+	buffer_t *fwdreq = buf_clone(brrq);
+	((nbp_packet_t*)fwdreq->ddp_payload)->function_and_tuple_count = (NBP_FWDREQ << 4) | 1;
+	ddp_set_dstnet(fwdreq, 5);
+	ddp_set_dst(fwdreq, DDP_ADDR_ANY_ROUTER);
+	app_nbp_handler(fwdreq);
+	TEST_ASSERT(packets_sent == 0);
+	
+	// A new request from the same client has a new NBP ID
+	((nbp_packet_t*)brrq->ddp_payload)->nbp_id++;
+	app_nbp_handler(buf_clone(brrq));
+	TEST_ASSERT(packets_sent == 3);
+	forget_sent();
+	
+	// Once it's been forgotten, the same request is dealt with again
+	app_nbp_forget_requests();
+	app_nbp_handler(buf_clone(brrq));
+	TEST_ASSERT(packets_sent == 3);
+	forget_sent();
+	
+	freebuf(brrq);
+	app_nbp_forget_requests();
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_lookups_answered_from_cache) {
+	setup_internet();
+	dummy_lap.my_zone = (pstring*)"\x05Zone1";
+	nbp_cache_t *saved_cache = global_nbp_cache;
+	global_nbp_cache = nbp_cache_new(8, 10 * 1000000LL);
+	
+	buffer_t *brrq = nbp_request(NBP_BRRQ, "LaserWriter", "Zone1");
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(sent_is(sent[0], NBP_LKUP, "Zone1"));
+	forget_sent();
+	
+	// We've not seen any replies, so the lookup goes out again
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(sent_is(sent[0], NBP_LKUP, "Zone1"));
+	forget_sent();
+	
+	// Once we have, we answer for the printer instead
+	buffer_t *reply = nbp_request(NBP_LKUP_REPLY, "LaserWriter", "*");
+	struct nbp_tuple_s *tuple = nbp_get_first_tuple(reply);
+	NBP_TUPLE_SET_NODE(tuple, 20);
+	NBP_TUPLE_SET_SOCKET(tuple, 129);
+	nbp_cache_learn(global_nbp_cache, reply, &dummy_lap);
+	freebuf(reply);
+	
+	app_nbp_handle_brrq(brrq);
+	TEST_ASSERT(packets_sent == 1);
+	TEST_ASSERT(nbp_packet_function(sent[0]) == NBP_LKUP_REPLY);
+	TEST_ASSERT(DDP_DST(sent[0]) == 99);
+	tuple = nbp_get_first_tuple(sent[0]);
+	TEST_ASSERT(NBP_TUPLE_NODE(tuple) == 20);
+	TEST_ASSERT(NBP_TUPLE_SOCKET(tuple) == 129);
+	forget_sent();
+	
+	freebuf(brrq);
+	global_nbp_cache = saved_cache;
+	dummy_lap.my_zone = NULL;
+	lap_lsend_mock = NULL;
+	TEST_OK();
+}
@@ -0,0 +1,9 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_nbp_brrq_fans_out_fwdreqs);
+TEST_FUNCTION(test_nbp_brrq_for_connected_zone);
+TEST_FUNCTION(test_nbp_fwdreq_becomes_lkup);
+TEST_FUNCTION(test_nbp_lkup_replies_are_packed);
+TEST_FUNCTION(test_nbp_duplicate_requests_are_dropped);
+TEST_FUNCTION(test_nbp_lookups_answered_from_cache);
@@ -4,9 +4,8 @@
 #include "proto/atp.h"
 #include "proto/ddp.h"
 #include "proto/sip.h"
-#include "util/require/goto.h"
 #include "web/stats.h"
-#include "ddp_send.h"
+#include "atp_responder.h"
 
 static sip_response_t response = {
 	.response_type = SIP_ACK,
@@ -28,21 +27,19 @@ static sip_response_t response = {
 	.responder_link = 1
 };
 
-void app_sip_handler(buffer_t *packet) {
-	buffer_t *reply = NULL;
-
-	// Is this an ATP request?
-	REQUIRE(DDP_TYPE(packet) == 3, cleanup);
-	REQUIRE(packet->ddp_payload_length >= sizeof(atp_packet_t), cleanup);
-	
+static bool sip_handle_request(buffer_t *packet, atp_response_t *atp_response) {
 	atp_packet_t *atp = (atp_packet_t*)(packet->ddp_payload);
-	REQUIRE(atp->user_data[3] == SIP_SYSTEMINFO, cleanup);
+	if (atp->user_data[3] != SIP_SYSTEMINFO) {
+		return false;
+	}
 	
 	stats.sip_in_packets__function_SystemInfo++;
 	
 	// Yes, let's prepare a reply
-	reply = newbuf_atp();
-	REQUIRE(reply != NULL, cleanup);
+	buffer_t *reply = atp_response_add_packet(atp_response);
+	if (reply == NULL) {
+		return false;
+	}
 	
 	// Trim the user bytes off: 
 	buf_trim_payload(reply, 4);
@@ -54,25 +51,18 @@ void app_sip_handler(buffer_t *packet) {
 	uint16_t afp_vers = 0;
 	buf_append_all(reply, (uint8_t*)&afp_vers, 2);
 	buffer_append_cstring_as_pstring(reply, "No AFP");
-
 	
-	// Fake our ATP credentials, taking a trick from XNU and A/UX
-	atp_packet_set_function(reply, ATP_TRESP);
-	atp_packet_set_eom(reply, true);
-	uint16_t tid = atp_packet_get_transaction_id(packet);
-	atp_packet_set_transaction_id(reply, tid);
-		
-	if (!ddp_send(reply, 253, DDP_SRCNET(packet), DDP_SRC(packet),
-	    DDP_SRCSOCK(packet), 3)) {
-		stats.sip_out_errors__function_Ack__err_ddp_send_failed++;
-	} else {
-		stats.sip_out_packets__function_Ack++;
-		reply = NULL; // no longer our problem if ddp_reply returns true
-	}
+	return true;
+}
 
-cleanup:
-	if (reply != NULL) {
-		freebuf(reply);
-	}
+static atp_responder_t responder = {
+	.socket = 253,
+	.handler = &sip_handle_request,
+	.sent = &stats.sip_out_packets__function_Ack,
+	.send_failed = &stats.sip_out_errors__function_Ack__err_ddp_send_failed,
+};
+
+void app_sip_handler(buffer_t *packet) {
+	atp_responder_handle(&responder, packet);
 	freebuf(packet);
 }
@@ -13,6 +13,7 @@
 #include "table/routing/table.h"
 #include "table/zip/table.h"
 #include "web/stats.h"
+#include "atp_responder.h"
 #include "ddp_send.h"
 #include "global_state.h"
 
@@ -205,18 +206,28 @@ void app_zip_handle_query(buffer_t *packet) {
 	}
 }
 
-void app_zip_handle_atp(buffer_t *packet) {
+static bool app_zip_handle_atp_request(buffer_t *packet, atp_response_t *response) {
 	uint8_t *user_data = atp_packet_get_user_data(packet);
 	uint8_t command = user_data[0];
 	
 	if (command == 7 || command == 8 || command == 9) {
-		app_zip_handle_get_zone_list(packet);
+		return app_zip_handle_get_zone_list(packet, response);
 	} else {
 		stats.zip_in_errors__err_unknown_atp_packet_command++;
+		return false;
 	}
-	
 }
 
+// GetZoneList and friends come in over ATP.  Slow LocalTalk clients retry
+// them aggressively, so the responder's cache saves us walking the zone
+// table again for every retry.
+static atp_responder_t zip_atp_responder = {
+	.socket = DDP_SOCKET_ZIP,
+	.handler = &app_zip_handle_atp_request,
+	.sent = &stats.zip_out_replies__kind_getzonelist,
+	.send_failed = &stats.zip_out_errors__err_ddp_send_failed,
+};
+
 void app_zip_handler(buffer_t *packet) {
 	if (DDP_TYPE(packet) == DDP_TYPE_ZIP && 
 	    packet->ddp_payload_length >= sizeof(zip_packet_t) &&
@@ -241,7 +252,7 @@ void app_zip_handler(buffer_t *packet) {
 	} else if (DDP_TYPE(packet) == DDP_TYPE_ATP &&
 	    packet->ddp_payload_length >= sizeof(atp_packet_t)) {
 	 	
-	  app_zip_handle_atp(packet);
+	  atp_responder_handle(&zip_atp_responder, packet);
 	}
 
 	freebuf(packet);
@@ -320,6 +331,15 @@ static void zip_send_requests_if_necessary(rt_route_t *route) {
 	}
 }
 
+void app_zip_route_touched(rt_route_t *route) {
+	zt_add_net_range(global_zip_table, route->range_start, route->range_end);
+	zip_send_requests_if_necessary(route);
+}
+
+void app_zip_network_deleted(rt_route_t *route) {
+	zt_delete_network(global_zip_table, route->range_start);
+}
+
 void app_zip_idle(void*) {
 	zip_internal_command_t* cmd = NULL;
 	
@@ -334,11 +354,10 @@ void app_zip_idle(void*) {
 		if (ret == pdTRUE) {
 			switch (cmd->cmd) {
 				case ZIP_NETWORK_TOUCHED:
-					zt_add_net_range(global_zip_table, cmd->route.range_start, cmd->route.range_end);
-					zip_send_requests_if_necessary(&cmd->route);
+					app_zip_route_touched(&cmd->route);
 					break;
 				case ZIP_NETWORK_DELETED:
-					zt_delete_network(global_zip_table, cmd->route.range_start);
+					app_zip_network_deleted(&cmd->route);
 					break;
 			}
 			free(cmd);
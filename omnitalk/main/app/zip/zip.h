@@ -1,7 +1,15 @@
 #pragma once
 
 #include "mem/buffers.h"
+#include "table/routing/route.h"
 
 void app_zip_handler(buffer_t *packet);
 void app_zip_idle(void*);
 void app_zip_start(void);
+
+// What the idle task does when the routing table tells it a route's been
+// touched or a network's gone: keep the ZIP table's networks in step with
+// the routing table's, and ask about zones for networks it doesn't know
+// all of yet.  The simulator (host/sim) calls these directly.
+void app_zip_route_touched(rt_route_t *route);
+void app_zip_network_deleted(rt_route_t *route);
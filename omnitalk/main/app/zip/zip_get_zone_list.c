@@ -8,8 +8,8 @@
 #include "table/zip/table.h"
 #include "util/pstring.h"
 #include "web/stats.h"
+#include "atp_responder.h"
 #include "global_state.h"
-#include "ddp_send.h"
 
 int zone_count_in_packet;
 bool only_return_first_zone;
@@ -33,7 +33,7 @@ static bool add_zone_name_to_buffer(void* bufferp, pstring* zone) {
 	}
 }
 
-void app_zip_handle_get_zone_list(buffer_t *packet) {
+bool app_zip_handle_get_zone_list(buffer_t *packet, atp_response_t *response) {
 	zone_count_in_packet = 0;
 	only_return_first_zone = false;
 	
@@ -50,7 +50,7 @@ void app_zip_handle_get_zone_list(buffer_t *packet) {
 		only_return_first_zone = true;
 	} else {
 		stats.zip_in_errors__err_atp_dispatch_error++;
-		return;
+		return false;
 	}
 	
 	uint16_t start_index;
@@ -71,11 +71,15 @@ void app_zip_handle_get_zone_list(buffer_t *packet) {
 		if (!zt_network_is_complete(global_zip_table, local_net)) {
 			// The network is missing or incomplete
 			stats.zip_in_errors__err_getzonelist_incomplete_net++;
-			return;
+			return false;
 		}
 	}
 	
-	buffer_t *buffer = newbuf_atp();
+	buffer_t *buffer = atp_response_add_packet(response);
+	if (buffer == NULL) {
+		return false;
+	}
+	
 	bool done_something_sensible;
 	if (only_local_zones) {
 		done_something_sensible = zt_iterate_zone_names_for_net(global_zip_table, buffer, 
@@ -86,23 +90,12 @@ void app_zip_handle_get_zone_list(buffer_t *packet) {
 	}
 	
 	if (!done_something_sensible) {
-		freebuf(buffer);
-		return;
+		// The responder frees the packet
+		return false;
 	}
 	
-	// Fake our ATP credentials, taking a trick from XNU and A/UX
-	atp_packet_set_function(buffer, ATP_TRESP);
-	atp_packet_set_eom(buffer, true);
-	uint16_t tid = atp_packet_get_transaction_id(packet);
-	atp_packet_set_transaction_id(buffer, tid);
-	
 	uint8_t* reply_user_data = atp_packet_get_user_data(buffer);
 	*((uint16_t*)&reply_user_data[2]) = htons(zone_count_in_packet);
 	
-	if (!ddp_send(buffer, 6, DDP_SRCNET(packet), DDP_SRC(packet), DDP_SRCSOCK(packet), DDP_TYPE_ATP)) {
-		stats.zip_out_errors__err_ddp_send_failed++;
-		freebuf(buffer);
-	} else {
-		stats.zip_out_replies__kind_getzonelist++;
-	}
+	return true;
 }
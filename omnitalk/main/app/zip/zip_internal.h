@@ -2,7 +2,9 @@
 
 #include <stdint.h>
 
+#include "mem/buffers.h"
 #include "table/routing/route.h"
+#include "atp_responder.h"
 
 typedef enum {
 	ZIP_NETWORK_TOUCHED,
@@ -14,6 +16,6 @@ typedef struct {
 	rt_route_t route;
 } zip_internal_command_t;
 
-void app_zip_handle_get_zone_list(buffer_t *packet);
+bool app_zip_handle_get_zone_list(buffer_t *packet, atp_response_t *response);
 void app_zip_handle_get_net_info(buffer_t *packet);
 void app_zip_handle_query(buffer_t *packet);
@@ -6,11 +6,14 @@
 
 #include "lap/lap.h"
 #include "mem/buffers.h"
+#include "proto/atp.h"
+#include "proto/ddp.h"
 #include "table/routing/route.h"
 #include "table/routing/table.h"
 #include "table/zip/table.h"
 #include "proto/zip.h"
 #include "table/zip/table.h"
+#include "web/stats.h"
 #include "global_state.h"
 
 static int replies_sent = 0;
@@ -26,6 +29,13 @@ static bool lsend_record(lap_t* lap, buffer_t* buffer) {
 	return true;
 }
 
+static bool lsend_fail(lap_t* lap, buffer_t* buffer) {
+	replies_sent++;
+	
+	// ddp_send's caller still owns the buffer when it fails
+	return false;
+}
+
 static bool lsend_multinetwork_hook(lap_t* lap, buffer_t* reply_buffer) {
 	SET_TEST_NAME(test_name);
 	replies_sent++;
@@ -215,5 +225,70 @@ TEST_FUNCTION(test_zip_queries) {
 	TEST_ASSERT(networks_seen == ((1<<1) | (1<<11)));
 	
 	
+	TEST_OK();
+}
+
+static buffer_t* get_zone_list_request(uint16_t tid) {
+	buffer_t *buff = newbuf_atp();
+	ddp_set_src(buff, 1);
+	ddp_set_srcnet(buff, 1);
+	ddp_set_srcsock(buff, 200);
+	ddp_set_ddptype(buff, DDP_TYPE_ATP);
+	
+	atp_packet_set_function(buff, ATP_TREQ);
+	atp_packet_set_transaction_id(buff, tid);
+	((atp_packet_t*)buff->ddp_payload)->bitmap = 0x01;
+	
+	uint8_t *user_data = atp_packet_get_user_data(buff);
+	user_data[0] = 8; // GetZoneList
+	user_data[1] = 0;
+	*((uint16_t*)&user_data[2]) = htons(1);
+	return buff;
+}
+
+TEST_FUNCTION(test_zip_get_zone_list_counts_sends) {
+	transport_t dummy_transport = { 0 };
+	lap_t dummy_lap = {
+		.transport = &dummy_transport,
+		.my_address = 1,
+		.my_network = 1,
+	};
+	
+	global_routing_table = rt_new();
+	rt_route_t catchall = {
+		.range_start = 0,
+		.range_end = 256,
+		.outbound_lap = &dummy_lap,
+		.distance = 0
+	};
+	rt_touch(global_routing_table, catchall);
+	
+	global_zip_table = zt_new();
+	zt_add_net_range(global_zip_table, 11, 20);
+	zt_add_zone_for(global_zip_table, 11, (pstring*)"\x05Zone1");
+	zt_mark_network_complete(global_zip_table, 11);
+	
+	unsigned long sent = stats.zip_out_replies__kind_getzonelist;
+	unsigned long failed = stats.zip_out_errors__err_ddp_send_failed;
+	
+	// A reply that goes out is counted as sent
+	replies_sent = 0;
+	lap_lsend_mock = &lsend_record;
+	app_zip_handler(get_zone_list_request(0x4321));
+	TEST_ASSERT(replies_sent == 1);
+	TEST_ASSERT(stats.zip_out_replies__kind_getzonelist == sent + 1);
+	TEST_ASSERT(stats.zip_out_errors__err_ddp_send_failed == failed);
+	freebuf(reply_buffer);
+	
+	// and one that doesn't as an error, not as sent
+	replies_sent = 0;
+	lap_lsend_mock = &lsend_fail;
+	app_zip_handler(get_zone_list_request(0x4322));
+	TEST_ASSERT(replies_sent == 1);
+	TEST_ASSERT(stats.zip_out_replies__kind_getzonelist == sent + 1);
+	TEST_ASSERT(stats.zip_out_errors__err_ddp_send_failed == failed + 1);
+	
+	lap_lsend_mock = NULL;
+	
 	TEST_OK();
 }
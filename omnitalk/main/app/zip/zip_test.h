@@ -2,3 +2,4 @@
 #include "test.h"
 
 TEST_FUNCTION(test_zip_queries);
+TEST_FUNCTION(test_zip_get_zone_list_counts_sends);
@@ -0,0 +1,220 @@
+#include "atp_responder.h"
+
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include "mem/buffers.h"
+#include "proto/atp.h"
+#include "proto/ddp.h"
+#include "web/stats.h"
+#include "ddp_send.h"
+
+buffer_t *atp_response_add_packet(atp_response_t *response) {
+	if (response->count >= response->max_packets) {
+		return NULL;
+	}
+	
+	buffer_t *packet = newbuf_atp();
+	if (packet == NULL) {
+		return NULL;
+	}
+	response->packets[response->count++] = packet;
+	return packet;
+}
+
+static void atp_response_free(atp_response_t *response) {
+	for (size_t i = 0; i < response->count; i++) {
+		freebuf(response->packets[i]);
+	}
+	response->count = 0;
+}
+
+static void atp_transaction_release(atp_transaction_t *transaction) {
+	for (size_t i = 0; i < transaction->count; i++) {
+		freebuf(transaction->packets[i]);
+	}
+	memset(transaction, 0, sizeof(atp_transaction_t));
+}
+
+static bool atp_transaction_is_for(atp_transaction_t *transaction, buffer_t *packet) {
+	return transaction->in_use &&
+		transaction->transaction_id == atp_packet_get_transaction_id(packet) &&
+		transaction->network == DDP_SRCNET(packet) &&
+		transaction->node == DDP_SRC(packet) &&
+		transaction->socket == DDP_SRCSOCK(packet);
+}
+
+static atp_transaction_t *atp_responder_find(atp_responder_t *responder, buffer_t *packet) {
+	for (int i = 0; i < ATP_RESPONDER_CACHE_SIZE; i++) {
+		if (atp_transaction_is_for(&responder->cache[i], packet)) {
+			return &responder->cache[i];
+		}
+	}
+	return NULL;
+}
+
+// atp_responder_expire releases transactions whose release timers have run
+// out.  There's no timer task: it's done whenever a packet arrives, which
+// is the only time anyone would notice.
+static void atp_responder_expire(atp_responder_t *responder, int64_t now) {
+	for (int i = 0; i < ATP_RESPONDER_CACHE_SIZE; i++) {
+		atp_transaction_t *transaction = &responder->cache[i];
+		if (transaction->in_use && transaction->expires_at <= now) {
+			atp_transaction_release(transaction);
+			stats.atp_transactions_released__reason_timeout++;
+		}
+	}
+}
+
+// atp_responder_slot finds a free slot in the cache, releasing the
+// transaction that would have expired soonest if there isn't one
+static atp_transaction_t *atp_responder_slot(atp_responder_t *responder) {
+	atp_transaction_t *soonest = &responder->cache[0];
+	for (int i = 0; i < ATP_RESPONDER_CACHE_SIZE; i++) {
+		atp_transaction_t *transaction = &responder->cache[i];
+		if (!transaction->in_use) {
+			return transaction;
+		}
+		if (transaction->expires_at < soonest->expires_at) {
+			soonest = transaction;
+		}
+	}
+	
+	atp_transaction_release(soonest);
+	stats.atp_transactions_released__reason_evicted++;
+	return soonest;
+}
+
+static int64_t atp_release_timeout_us(buffer_t *request) {
+	if (!atp_packet_get_xo(request)) {
+		return ATP_ALO_RELEASE_US;
+	}
+	
+	// 30 seconds, doubling with each step up to 8 minutes
+	atp_timeout_indicator indicator = atp_packet_get_timeout_indicator(request);
+	if (indicator > ATP_8MIN) {
+		indicator = ATP_30SEC;
+	}
+	return ATP_ALO_RELEASE_US << indicator;
+}
+
+// atp_responder_send sends a copy of each packet of the transaction the
+// bitmap asks for; the originals stay in the cache for retries.
+static void atp_responder_send(atp_responder_t *responder, atp_transaction_t *transaction,
+	uint8_t bitmap) {
+	
+	for (size_t i = 0; i < transaction->count; i++) {
+		if ((bitmap & (1 << i)) == 0) {
+			continue;
+		}
+		
+		buffer_t *packet = buf_clone(transaction->packets[i]);
+		if (!ddp_send(packet, responder->socket, transaction->network, transaction->node,
+			transaction->socket, DDP_TYPE_ATP)) {
+			
+			stats.atp_out_errors__err_ddp_send_failed++;
+			if (responder->send_failed != NULL) {
+				(*responder->send_failed)++;
+			}
+			freebuf(packet);
+			continue;
+		}
+		stats.atp_out_responses++;
+		if (responder->sent != NULL) {
+			(*responder->sent)++;
+		}
+	}
+}
+
+static void atp_responder_handle_request(atp_responder_t *responder, buffer_t *request) {
+	uint8_t bitmap = ((atp_packet_t*)request->ddp_payload)->bitmap;
+	if (bitmap == 0) {
+		stats.atp_in_errors__err_empty_bitmap++;
+		return;
+	}
+	
+	int64_t now = esp_timer_get_time();
+	atp_responder_expire(responder, now);
+	
+	// A retry gets whatever it's still missing from the cache
+	atp_transaction_t *transaction = atp_responder_find(responder, request);
+	if (transaction != NULL) {
+		stats.atp_in_requests__kind_retry++;
+		transaction->expires_at = now + atp_release_timeout_us(request);
+		atp_responder_send(responder, transaction, bitmap);
+		return;
+	}
+	stats.atp_in_requests__kind_new++;
+	
+	// The requester has room for as many packets as its highest bit says
+	atp_response_t response = { 0 };
+	for (int i = 0; i < ATP_MAX_RESPONSE_PACKETS; i++) {
+		if (bitmap & (1 << i)) {
+			response.max_packets = i + 1;
+		}
+	}
+	
+	if (!responder->handler(request, &response) || response.count == 0) {
+		atp_response_free(&response);
+		return;
+	}
+	
+	uint16_t tid = atp_packet_get_transaction_id(request);
+	for (size_t i = 0; i < response.count; i++) {
+		buffer_t *packet = response.packets[i];
+		atp_packet_set_function(packet, ATP_TRESP);
+		atp_packet_set_eom(packet, i == response.count - 1);
+		atp_packet_set_transaction_id(packet, tid);
+		((atp_packet_t*)packet->ddp_payload)->bitmap = i;
+	}
+	
+	transaction = atp_responder_slot(responder);
+	transaction->in_use = true;
+	transaction->network = DDP_SRCNET(request);
+	transaction->node = DDP_SRC(request);
+	transaction->socket = DDP_SRCSOCK(request);
+	transaction->transaction_id = tid;
+	transaction->expires_at = now + atp_release_timeout_us(request);
+	transaction->count = response.count;
+	memcpy(transaction->packets, response.packets, sizeof(response.packets));
+	
+	atp_responder_send(responder, transaction, bitmap);
+}
+
+static void atp_responder_handle_release(atp_responder_t *responder, buffer_t *release) {
+	stats.atp_in_releases++;
+	
+	atp_transaction_t *transaction = atp_responder_find(responder, release);
+	if (transaction != NULL) {
+		atp_transaction_release(transaction);
+		stats.atp_transactions_released__reason_TRel++;
+	}
+}
+
+void atp_responder_handle(atp_responder_t *responder, buffer_t *packet) {
+	if (DDP_TYPE(packet) != DDP_TYPE_ATP || packet->ddp_payload_length < sizeof(atp_packet_t)) {
+		return;
+	}
+	
+	switch (atp_packet_get_function(packet)) {
+	case ATP_TREQ:
+		atp_responder_handle_request(responder, packet);
+		break;
+	case ATP_TREL:
+		atp_responder_handle_release(responder, packet);
+		break;
+	default:
+		// We don't make requests, so we shouldn't be getting responses
+		stats.atp_in_errors__err_unexpected_function++;
+		break;
+	}
+}
+
+void atp_responder_flush(atp_responder_t *responder) {
+	for (int i = 0; i < ATP_RESPONDER_CACHE_SIZE; i++) {
+		if (responder->cache[i].in_use) {
+			atp_transaction_release(&responder->cache[i]);
+		}
+	}
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem/buffers.h"
+#include "web/stats.h"
+
+// atp_responder answers ATP requests on behalf of an app.  The app's
+// request handler builds the response, one packet at a time, and the
+// responder fills in the ATP header of each, sends the ones the request's
+// bitmap asks for, and keeps them in its transaction cache.
+//
+// A retransmitted request, with the same source address and transaction
+// ID, gets the packets it asks for out of the cache without the handler
+// running again.  XO transactions stay in the cache until the requester
+// sends a TRel, or the release timer the request asked for runs out; ALO
+// transactions are kept for ATP_ALO_RELEASE_US, just long enough to see
+// off a client's retries.
+//
+// A responder isn't thread safe: it belongs to the app whose socket's
+// task it runs on.
+
+// ATP responses are at most eight packets, one per bit of the bitmap
+#define ATP_MAX_RESPONSE_PACKETS 8
+
+#define ATP_RESPONDER_CACHE_SIZE 16
+
+// The shortest of the XO release timers
+#define ATP_ALO_RELEASE_US (30 * 1000000LL)
+
+typedef struct {
+	// How many packets the requester has asked for
+	size_t max_packets;
+	
+	size_t count;
+	buffer_t *packets[ATP_MAX_RESPONSE_PACKETS];
+} atp_response_t;
+
+// atp_response_add_packet returns a new packet on the end of the response,
+// with the ATP header in place and the payload empty, or NULL if the
+// requester doesn't have room for any more.
+buffer_t *atp_response_add_packet(atp_response_t *response);
+
+// An atp_request_handler builds the response to a TReq with
+// atp_response_add_packet, and returns true if it should be sent; if it
+// returns false, nothing is sent or cached, and a retry of the request
+// runs the handler again.  The request still belongs to the caller.
+typedef bool (*atp_request_handler)(buffer_t *request, atp_response_t *response);
+
+typedef struct {
+	bool in_use;
+	
+	// Who asked
+	uint16_t network;
+	uint8_t node;
+	uint8_t socket;
+	uint16_t transaction_id;
+	
+	int64_t expires_at;
+	
+	size_t count;
+	buffer_t *packets[ATP_MAX_RESPONSE_PACKETS];
+} atp_transaction_t;
+
+typedef struct {
+	// The socket responses are sent from
+	uint8_t socket;
+	atp_request_handler handler;
+	
+	// If they're set, sent is counted up for each response packet that's
+	// actually sent, as well as atp_out_responses, and send_failed for
+	// each that couldn't be, as well as atp_out_errors
+	prometheus_counter_t *sent;
+	prometheus_counter_t *send_failed;
+	
+	atp_transaction_t cache[ATP_RESPONDER_CACHE_SIZE];
+} atp_responder_t;
+
+// atp_responder_handle deals with an ATP packet that's arrived on the
+// responder's socket: a TReq is answered, from the cache if it can be, and
+// a TRel releases its transaction.  The packet still belongs to the caller.
+void atp_responder_handle(atp_responder_t *responder, buffer_t *packet);
+
+// atp_responder_flush releases every transaction in the cache.
+void atp_responder_flush(atp_responder_t *responder);
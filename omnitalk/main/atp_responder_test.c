@@ -0,0 +1,273 @@
+#include "atp_responder_test.h"
+#include "atp_responder.h"
+
+#include <stdbool.h>
+
+#include "lap/lap.h"
+#include "mem/buffers.h"
+#include "net/transport.h"
+#include "proto/atp.h"
+#include "proto/ddp.h"
+#include "table/routing/route.h"
+#include "table/routing/table.h"
+#include "web/stats.h"
+#include "global_state.h"
+#include "test.h"
+
+static int handler_calls;
+static size_t packets_to_add;
+
+static size_t sent_count;
+static buffer_t *sent[ATP_MAX_RESPONSE_PACKETS];
+
+static bool lsend_record(lap_t* lap, buffer_t* buffer) {
+	if (sent_count < ATP_MAX_RESPONSE_PACKETS) {
+		sent[sent_count++] = buffer;
+	} else {
+		freebuf(buffer);
+	}
+	return true;
+}
+
+static void forget_sent(void) {
+	for (size_t i = 0; i < sent_count; i++) {
+		freebuf(sent[i]);
+	}
+	sent_count = 0;
+}
+
+// count_and_respond adds packets_to_add packets to the response, each with
+// its index as its only byte of payload
+static bool count_and_respond(buffer_t *request, atp_response_t *response) {
+	handler_calls++;
+	
+	for (size_t i = 0; i < packets_to_add; i++) {
+		buffer_t *packet = atp_response_add_packet(response);
+		if (packet == NULL) {
+			break;
+		}
+		buf_append_all(packet, (uint8_t*)&i, 1);
+	}
+	return true;
+}
+
+static buffer_t* atp_packet(atp_function_t function, bool xo, uint8_t bitmap, uint16_t tid) {
+	buffer_t *buff = newbuf_atp();
+	ddp_set_srcnet(buff, 1);
+	ddp_set_src(buff, 42);
+	ddp_set_srcsock(buff, 200);
+	ddp_set_ddptype(buff, DDP_TYPE_ATP);
+	
+	atp_packet_set_function(buff, function);
+	atp_packet_set_xo(buff, xo);
+	atp_packet_set_transaction_id(buff, tid);
+	((atp_packet_t*)buff->ddp_payload)->bitmap = bitmap;
+	return buff;
+}
+
+// Requests go out of a pretend interface, into sent
+static transport_t dummy_transport = { 0 };
+static lap_t dummy_lap = {
+	.transport = &dummy_transport,
+	.my_address = 1,
+	.my_network = 1,
+};
+static rt_routing_table_t *saved_table;
+
+static void atp_test_setup(void) {
+	saved_table = global_routing_table;
+	global_routing_table = rt_new();
+	rt_route_t catchall = {
+		.range_start = 0,
+		.range_end = 256,
+		.outbound_lap = &dummy_lap,
+		.distance = 0
+	};
+	rt_touch(global_routing_table, catchall);
+	
+	lap_lsend_mock = &lsend_record;
+	handler_calls = 0;
+	sent_count = 0;
+}
+
+static void atp_test_teardown(void) {
+	forget_sent();
+	lap_lsend_mock = NULL;
+	global_routing_table = saved_table;
+}
+
+TEST_FUNCTION(test_atp_responder_retries_from_cache) {
+	atp_responder_t responder = {
+		.socket = 6,
+		.handler = &count_and_respond,
+	};
+	atp_test_setup();
+	packets_to_add = 1;
+	
+	// The first request runs the handler
+	buffer_t *request = atp_packet(ATP_TREQ, false, 0x01, 0x1234);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 1);
+	TEST_ASSERT(sent_count == 1);
+	TEST_ASSERT(atp_packet_get_function(sent[0]) == ATP_TRESP);
+	TEST_ASSERT(atp_packet_get_eom(sent[0]));
+	TEST_ASSERT(atp_packet_get_transaction_id(sent[0]) == 0x1234);
+	TEST_ASSERT(DDP_DST(sent[0]) == 42);
+	TEST_ASSERT(DDP_DSTSOCK(sent[0]) == 200);
+	TEST_ASSERT(DDP_SRCSOCK(sent[0]) == 6);
+	forget_sent();
+	
+	// A retry gets the same answer without the handler running again
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 1);
+	TEST_ASSERT(sent_count == 1);
+	TEST_ASSERT(atp_packet_get_transaction_id(sent[0]) == 0x1234);
+	forget_sent();
+	
+	// but a new transaction does
+	freebuf(request);
+	request = atp_packet(ATP_TREQ, false, 0x01, 0x1235);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 2);
+	TEST_ASSERT(sent_count == 1);
+	forget_sent();
+	
+	// Once it's expired, it's gone from the cache
+	unsigned long timeouts = stats.atp_transactions_released__reason_timeout;
+	for (int i = 0; i < ATP_RESPONDER_CACHE_SIZE; i++) {
+		responder.cache[i].expires_at = 0;
+	}
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 3);
+	TEST_ASSERT(stats.atp_transactions_released__reason_timeout == timeouts + 2);
+	
+	freebuf(request);
+	atp_responder_flush(&responder);
+	atp_test_teardown();
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_atp_responder_bitmap) {
+	atp_responder_t responder = {
+		.socket = 6,
+		.handler = &count_and_respond,
+	};
+	atp_test_setup();
+	
+	// Three packets, when there's room for eight
+	packets_to_add = 3;
+	buffer_t *request = atp_packet(ATP_TREQ, true, 0xff, 1);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(sent_count == 3);
+	for (size_t i = 0; i < 3; i++) {
+		// Each has its sequence number in the bitmap field, and only the last
+		// is the end of the message
+		TEST_ASSERT(((atp_packet_t*)sent[i]->ddp_payload)->bitmap == i);
+		TEST_ASSERT(atp_packet_get_payload(sent[i])[0] == i);
+		TEST_ASSERT(atp_packet_get_eom(sent[i]) == (i == 2));
+	}
+	forget_sent();
+	
+	// The requester only missed the second, so that's all it gets again
+	freebuf(request);
+	request = atp_packet(ATP_TREQ, true, 0x02, 1);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 1);
+	TEST_ASSERT(sent_count == 1);
+	TEST_ASSERT(((atp_packet_t*)sent[0]->ddp_payload)->bitmap == 1);
+	forget_sent();
+	
+	// The handler can't add more packets than the bitmap has room for
+	packets_to_add = 8;
+	freebuf(request);
+	request = atp_packet(ATP_TREQ, true, 0x03, 2);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(sent_count == 2);
+	TEST_ASSERT(atp_packet_get_eom(sent[1]));
+	forget_sent();
+	
+	// and an empty bitmap doesn't get anything
+	freebuf(request);
+	request = atp_packet(ATP_TREQ, true, 0x00, 3);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 2);
+	TEST_ASSERT(sent_count == 0);
+	
+	freebuf(request);
+	atp_responder_flush(&responder);
+	atp_test_teardown();
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_atp_responder_release) {
+	atp_responder_t responder = {
+		.socket = 6,
+		.handler = &count_and_respond,
+	};
+	atp_test_setup();
+	long active_allocs = stats.mem_all_allocs - stats.mem_all_frees;
+	packets_to_add = 2;
+	
+	buffer_t *request = atp_packet(ATP_TREQ, true, 0xff, 7);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 1);
+	forget_sent();
+	
+	// A TRel releases the transaction, so the same TID's a new one
+	unsigned long releases = stats.atp_transactions_released__reason_TRel;
+	buffer_t *release = atp_packet(ATP_TREL, false, 0, 7);
+	atp_responder_handle(&responder, release);
+	TEST_ASSERT(stats.atp_transactions_released__reason_TRel == releases + 1);
+	
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(handler_calls == 2);
+	forget_sent();
+	
+	// When the cache is full, the transaction that would have expired
+	// soonest makes way
+	unsigned long evictions = stats.atp_transactions_released__reason_evicted;
+	for (uint16_t tid = 100; tid < 100 + ATP_RESPONDER_CACHE_SIZE; tid++) {
+		freebuf(request);
+		request = atp_packet(ATP_TREQ, true, 0xff, tid);
+		atp_responder_handle(&responder, request);
+		forget_sent();
+	}
+	TEST_ASSERT(stats.atp_transactions_released__reason_evicted == evictions + 1);
+	
+	freebuf(request);
+	freebuf(release);
+	atp_responder_flush(&responder);
+	atp_test_teardown();
+	TEST_ASSERT(active_allocs == (stats.mem_all_allocs - stats.mem_all_frees));
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_atp_responder_counts_sent) {
+	prometheus_counter_t sent_packets = 0;
+	atp_responder_t responder = {
+		.socket = 6,
+		.handler = &count_and_respond,
+		.sent = &sent_packets,
+	};
+	atp_test_setup();
+	packets_to_add = 3;
+	
+	// Only the packets asked for count, each time they're sent
+	buffer_t *request = atp_packet(ATP_TREQ, false, 0x05, 0x2345);
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(sent_count == 2);
+	TEST_ASSERT(sent_packets == 2);
+	forget_sent();
+	
+	atp_responder_handle(&responder, request);
+	TEST_ASSERT(sent_packets == 4);
+	
+	freebuf(request);
+	atp_responder_flush(&responder);
+	atp_test_teardown();
+	
+	TEST_OK();
+}
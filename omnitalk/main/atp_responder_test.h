@@ -0,0 +1,8 @@
+#pragma once
+
+#include "test.h"
+
+TEST_FUNCTION(test_atp_responder_retries_from_cache);
+TEST_FUNCTION(test_atp_responder_bitmap);
+TEST_FUNCTION(test_atp_responder_release);
+TEST_FUNCTION(test_atp_responder_counts_sent);
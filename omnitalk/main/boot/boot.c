@@ -0,0 +1,177 @@
+#include "boot/boot.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include "web/stats.h"
+
+static const char* TAG = "BOOT";
+
+typedef struct {
+	boot_phase_t* phase;
+	EventBits_t bit;
+	EventBits_t waits_for;
+} boot_worker_t;
+
+// Each phase sets its bit in phases_done when it's finished
+static EventGroupHandle_t phases_done;
+static boot_worker_t workers[BOOT_MAX_PHASES];
+
+static int boot_find_phase(boot_phase_t* phases, size_t count, const char* name) {
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(phases[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// boot_resolve works out which bits each phase has to wait for, and
+// checks that every phase will get to run.
+static bool boot_resolve(boot_phase_t* phases, size_t count) {
+	if (count > BOOT_MAX_PHASES) {
+		ESP_LOGE(TAG, "too many phases (%zu)", count);
+		return false;
+	}
+	
+	EventBits_t all = 0;
+	for (size_t i = 0; i < count; i++) {
+		workers[i].phase = &phases[i];
+		workers[i].bit = (EventBits_t)1 << i;
+		workers[i].waits_for = 0;
+		all |= workers[i].bit;
+		
+		for (int j = 0; j < BOOT_MAX_AFTER && phases[i].after[j] != NULL; j++) {
+			int after = boot_find_phase(phases, count, phases[i].after[j]);
+			if (after < 0) {
+				ESP_LOGE(TAG, "%s comes after %s, which isn't a phase", phases[i].name,
+					phases[i].after[j]);
+				return false;
+			}
+			workers[i].waits_for |= (EventBits_t)1 << after;
+		}
+	}
+	
+	// Keep picking off phases whose dependencies have all run; if we run
+	// out before we get to all of them, the rest are waiting on each other
+	EventBits_t runnable = 0;
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		for (size_t i = 0; i < count; i++) {
+			if ((runnable & workers[i].bit) == 0 && (workers[i].waits_for & ~runnable) == 0) {
+				runnable |= workers[i].bit;
+				progress = true;
+			}
+		}
+	}
+	
+	if (runnable != all) {
+		for (size_t i = 0; i < count; i++) {
+			if ((runnable & workers[i].bit) == 0) {
+				ESP_LOGE(TAG, "%s can never start: its phases come after each other in a loop",
+					phases[i].name);
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+static void boot_phase_runloop(void* param) {
+	boot_worker_t* worker = (boot_worker_t*)param;
+	boot_phase_t* phase = worker->phase;
+	
+	if (worker->waits_for != 0) {
+		xEventGroupWaitBits(phases_done, worker->waits_for, pdFALSE, pdTRUE, portMAX_DELAY);
+	}
+	
+	phase->started_at = esp_timer_get_time();
+	phase->start();
+	phase->finished_at = esp_timer_get_time();
+	
+	xEventGroupSetBits(phases_done, worker->bit);
+	vTaskDelete(NULL);
+}
+
+bool boot_run(boot_phase_t* phases, size_t count) {
+	if (!boot_resolve(phases, count)) {
+		return false;
+	}
+	
+	if (phases_done == NULL) {
+		phases_done = xEventGroupCreate();
+	}
+	xEventGroupClearBits(phases_done, ~(EventBits_t)0);
+	
+	EventBits_t all = 0;
+	for (size_t i = 0; i < count; i++) {
+		phases[i].started_at = 0;
+		phases[i].finished_at = 0;
+		all |= workers[i].bit;
+	}
+	
+	for (size_t i = 0; i < count; i++) {
+		if (xTaskCreate(&boot_phase_runloop, phases[i].name, BOOT_PHASE_STACK_SIZE, &workers[i],
+			BOOT_PHASE_PRIORITY, NULL) != pdPASS) {
+			
+			// We're out of memory before we've even started
+			ESP_LOGE(TAG, "couldn't create a task for %s", phases[i].name);
+			abort();
+		}
+	}
+	
+	xEventGroupWaitBits(phases_done, all, pdFALSE, pdTRUE, portMAX_DELAY);
+	return true;
+}
+
+void boot_report(boot_phase_t* phases, size_t count) {
+	ESP_LOGI(TAG, "%-12s %8s %8s %8s", "phase", "start ms", "end ms", "took ms");
+	
+	int64_t last = 0;
+	for (size_t i = 0; i < count; i++) {
+		ESP_LOGI(TAG, "%-12s %8" PRId64 " %8" PRId64 " %8" PRId64, phases[i].name,
+			phases[i].started_at / 1000, phases[i].finished_at / 1000,
+			(phases[i].finished_at - phases[i].started_at) / 1000);
+		if (phases[i].finished_at > last) {
+			last = phases[i].finished_at;
+		}
+	}
+	ESP_LOGI(TAG, "started in %" PRId64 " ms", last / 1000);
+	
+	char* fmt = "boot_phase_started_milliseconds{phase=\"%s\"} %" PRId64 "\n"
+		"boot_phase_finished_milliseconds{phase=\"%s\"} %" PRId64 "\n";
+	
+	// Each phase has its name twice and two numbers that'll fit in 20 digits
+	size_t len = strlen("boot_finished_milliseconds 12345678901234567890\n");
+	for (size_t i = 0; i < count; i++) {
+		len += strlen(fmt) + 2 * (strlen(phases[i].name) + 20);
+	}
+	
+	// +1 for the null.
+	char* new_stats = malloc(len + 1);
+	if (new_stats == NULL) {
+		return;
+	}
+	
+	char* cursor = new_stats;
+	for (size_t i = 0; i < count; i++) {
+		cursor += sprintf(cursor, fmt, phases[i].name, phases[i].started_at / 1000,
+			phases[i].name, phases[i].finished_at / 1000);
+	}
+	sprintf(cursor, "boot_finished_milliseconds %" PRId64 "\n", last / 1000);
+	
+	char* old_stats = atomic_exchange(&stats_boot_phases, new_stats);
+	if (old_stats != NULL) {
+		free(old_stats);
+	}
+}
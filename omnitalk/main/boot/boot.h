@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// boot starts the router as a set of phases, each of which comes after
+// the phases it names in its after list.  Every phase gets a task of its
+// own, which waits for the ones it comes after and then runs the phase,
+// so phases that don't depend on each other run at the same time: one
+// blocked on a slow piece of hardware doesn't hold up the rest.
+//
+// Each phase's start and finish times are recorded, in microseconds since
+// boot, and boot_report prints them and publishes them as metrics.
+
+// One bit of a FreeRTOS event group each
+#define BOOT_MAX_PHASES 24
+#define BOOT_MAX_AFTER 8
+
+#define BOOT_PHASE_STACK_SIZE 4096
+#define BOOT_PHASE_PRIORITY 1
+
+typedef struct {
+	const char* name;
+	void (*start)(void);
+	// The names of the phases that have to have finished first
+	const char* after[BOOT_MAX_AFTER];
+
+	// Filled in by boot_run
+	int64_t started_at;
+	int64_t finished_at;
+} boot_phase_t;
+
+// boot_run runs the phases and returns once they've all finished.  It
+// returns false, having run none of them, if a phase comes after one that
+// isn't there, or the phases come after each other in a loop.  Only one
+// boot_run can be running at a time.
+bool boot_run(boot_phase_t* phases, size_t count);
+
+// boot_report logs how long each phase took and publishes the timings
+// for /metrics.
+void boot_report(boot_phase_t* phases, size_t count);
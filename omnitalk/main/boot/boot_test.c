@@ -0,0 +1,70 @@
+#include "boot/boot_test.h"
+#include "boot/boot.h"
+
+#include <stdatomic.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "test.h"
+
+static atomic_int phases_run;
+
+static void boot_test_quick(void) {
+	phases_run++;
+}
+
+static void boot_test_slow(void) {
+	vTaskDelay(50 / portTICK_PERIOD_MS);
+	phases_run++;
+}
+
+TEST_FUNCTION(test_boot_runs_phases_in_order) {
+	boot_phase_t phases[] = {
+		{ .name = "last", .start = &boot_test_quick, .after = { "slow_a", "slow_b" } },
+		{ .name = "slow_a", .start = &boot_test_slow, .after = { "first" } },
+		{ .name = "slow_b", .start = &boot_test_slow, .after = { "first" } },
+		{ .name = "first", .start = &boot_test_quick },
+	};
+	boot_phase_t *last = &phases[0], *slow_a = &phases[1], *slow_b = &phases[2], *first = &phases[3];
+	
+	phases_run = 0;
+	TEST_ASSERT(boot_run(phases, 4));
+	TEST_ASSERT(phases_run == 4);
+	
+	// Everything waited for what it comes after
+	TEST_ASSERT(slow_a->started_at >= first->finished_at);
+	TEST_ASSERT(slow_b->started_at >= first->finished_at);
+	TEST_ASSERT(last->started_at >= slow_a->finished_at);
+	TEST_ASSERT(last->started_at >= slow_b->finished_at);
+	
+	// and the two slow phases ran at the same time
+	TEST_ASSERT(slow_a->started_at < slow_b->finished_at);
+	TEST_ASSERT(slow_b->started_at < slow_a->finished_at);
+	
+	// It can go again
+	TEST_ASSERT(boot_run(phases, 4));
+	TEST_ASSERT(phases_run == 8);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_boot_rejects_bad_graphs) {
+	boot_phase_t missing[] = {
+		{ .name = "a", .start = &boot_test_quick },
+		{ .name = "b", .start = &boot_test_quick, .after = { "a", "nowhere" } },
+	};
+	boot_phase_t loop[] = {
+		{ .name = "a", .start = &boot_test_quick },
+		{ .name = "b", .start = &boot_test_quick, .after = { "a", "d" } },
+		{ .name = "c", .start = &boot_test_quick, .after = { "b" } },
+		{ .name = "d", .start = &boot_test_quick, .after = { "c" } },
+	};
+	
+	phases_run = 0;
+	TEST_ASSERT(!boot_run(missing, 2));
+	TEST_ASSERT(!boot_run(loop, 4));
+	TEST_ASSERT(phases_run == 0);
+	
+	TEST_OK();
+}
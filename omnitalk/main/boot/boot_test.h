@@ -0,0 +1,5 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_boot_runs_phases_in_order);
+TEST_FUNCTION(test_boot_rejects_bad_graphs);
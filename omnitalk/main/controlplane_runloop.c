@@ -1,55 +1,73 @@
 #include "controlplane_runloop.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/task.h>
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 
-#include "app/app.h"
+#include "ddp_socket.h"
 #include "mem/buffers.h"
 #include "proto/ddp.h"
+#include "web/stats.h"
 
 static const char* TAG = "CTRL";
 static QueueHandle_t inbound;
 
+void controlplane_dispatch(buffer_t *packet) {
+	ddp_socket_handler handler = NULL;
+	
+	if (!packet->ddp_ready) {
+		goto cleanup;
+	}
+	
+	handler = ddp_socket_handler_for(DDP_DSTSOCK(packet));
+	if (handler != NULL) {
+		handler(packet);
+		return;
+	}
+	stats.controlplane_drops__reason_no_app++;
+	
+cleanup:
+	freebuf(packet);
+}
+
+static void controlplane_publish_stats(void) {
+	char* new_stats = ddp_socket_stats();
+	char* old_stats = atomic_exchange(&stats_ddp_sockets, new_stats);
+	if (old_stats != NULL) {
+		free(old_stats);
+	}
+}
+
+// The control plane runloop doesn't run the sockets' handlers itself: it
+// hands each packet to the queue of the socket it's for, so that every
+// socket gets on with its own packets
 static void controlplane_runloop(void* dummy) {
 	buffer_t *packet;
+	int64_t last_published = 0;
+	
 	while(1) {
 		// receive a packet
-		xQueueReceive(inbound, &packet, portMAX_DELAY);
-		if (packet == NULL) {
-			continue;
-		}
+		BaseType_t received = xQueueReceive(inbound, &packet,
+			CONTROLPLANE_STATS_INTERVAL_MS / portTICK_PERIOD_MS);
 		
-		if (!packet->ddp_ready) {
-			goto cleanup;
+		if (received == pdTRUE && packet != NULL) {
+			ddp_socket_deliver(packet);
 		}
 		
-		// dispatch it to an application.  For the moment we pretend everything is
-		// unicast
-		uint8_t dstsock = DDP_DSTSOCK(packet);
-		bool handled = false;
-		for (int i = 0; unicast_apps[i].socket_number != 0; i++) {
-			if (unicast_apps[i].socket_number == dstsock) {
-				unicast_apps[i].handler(packet);
-				handled = true;
-				break;
-			}
-		}
-		if (!handled) {
-			goto cleanup;
+		int64_t now = esp_timer_get_time();
+		if (now - last_published >= CONTROLPLANE_STATS_INTERVAL_MS * 1000LL) {
+			controlplane_publish_stats();
+			last_published = now;
 		}
-		
-		
-		// free it otherwise
-		continue;
-	cleanup:
-		freebuf(packet);
 	}
-
+	
 	vTaskDelay(portMAX_DELAY);
 }
 
@@ -60,7 +78,7 @@ runloop_info_t start_controlplane_runloop(void) {
 	inbound = xQueueCreate(CONTROLPLANE_QUEUE_DEPTH, sizeof(buffer_t*));
 	info.incoming_packet_queue = inbound;
 	xTaskCreate(&controlplane_runloop, "CTRL", 8192, NULL, 5, &info.task);
-
+	
 	printf("start control plane\n");
 	return info;
 }
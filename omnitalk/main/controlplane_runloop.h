@@ -1,7 +1,17 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "mem/buffers.h"
 #include "runloop.h"
 
 #define CONTROLPLANE_QUEUE_DEPTH 60
+#define CONTROLPLANE_STATS_INTERVAL_MS 5000
 
 runloop_info_t start_controlplane_runloop(void);
+
+// controlplane_dispatch hands a packet for the router itself straight to
+// the handler bound to its destination socket, and takes ownership of it.
+// The control plane runloop queues packets for the sockets' own tasks
+// instead; this is for when there aren't any, as in the simulator.
+void controlplane_dispatch(buffer_t *packet);
@@ -0,0 +1,361 @@
+#include "ddp_socket.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include "proto/ddp.h"
+#include "nbp_registry.h"
+#include "web/stats.h"
+
+static const char* TAG = "SOCKET";
+
+// owners is indexed by socket number.  It and the listeners list are
+// guarded by sockets_mutex; owners can be peeked at without it, to see if
+// a packet's worth passing on, but listeners can't.
+static ddp_socket_t* _Atomic owners[256];
+static ddp_socket_t* listeners;
+static SemaphoreHandle_t sockets_mutex;
+
+// Where to start looking for a free dynamic socket, so that a socket
+// that's just been closed isn't handed straight out again
+static uint8_t next_dynamic = DDP_SOCKET_DYNAMIC_FIRST;
+
+void ddp_socket_init(void) {
+	if (sockets_mutex == NULL) {
+		sockets_mutex = xSemaphoreCreateMutex();
+	}
+}
+
+static void ddp_socket_lock(void) {
+	while (xSemaphoreTake(sockets_mutex, portMAX_DELAY) != pdTRUE) {}
+}
+
+static void ddp_socket_unlock(void) {
+	xSemaphoreGive(sockets_mutex);
+}
+
+static ddp_socket_t* ddp_socket_new(uint8_t number, const char* name, size_t queue_depth) {
+	ddp_socket_t* socket = calloc(1, sizeof(ddp_socket_t));
+	assert(socket != NULL);
+	
+	socket->number = number;
+	snprintf(socket->name, sizeof(socket->name), "%s", name);
+	socket->inbound = xQueueCreate(queue_depth != 0 ? queue_depth : DDP_SOCKET_DEFAULT_QUEUE_DEPTH,
+		sizeof(buffer_t*));
+	return socket;
+}
+
+static void ddp_socket_free(ddp_socket_t* socket) {
+	buffer_t* packet;
+	while (xQueueReceive(socket->inbound, &packet, 0) == pdTRUE) {
+		if (packet != NULL) {
+			freebuf(packet);
+		}
+	}
+	vQueueDelete(socket->inbound);
+	free(socket);
+}
+
+ddp_socket_t* ddp_socket_open(uint8_t number, const char* name, size_t queue_depth) {
+	ddp_socket_lock();
+	
+	if (number == 0) {
+		for (int i = 0; i <= DDP_SOCKET_DYNAMIC_LAST - DDP_SOCKET_DYNAMIC_FIRST; i++) {
+			uint8_t candidate = next_dynamic;
+			next_dynamic = next_dynamic == DDP_SOCKET_DYNAMIC_LAST ? DDP_SOCKET_DYNAMIC_FIRST :
+				next_dynamic + 1;
+			
+			if (owners[candidate] == NULL) {
+				number = candidate;
+				break;
+			}
+		}
+	}
+	
+	// Socket 0 isn't a socket, and 255 is reserved
+	if (number == 0 || number == 255 || owners[number] != NULL) {
+		ddp_socket_unlock();
+		ESP_LOGW(TAG, "%s couldn't have socket %d", name, (int)number);
+		return NULL;
+	}
+	
+	ddp_socket_t* socket = ddp_socket_new(number, name, queue_depth);
+	owners[number] = socket;
+	
+	ddp_socket_unlock();
+	return socket;
+}
+
+ddp_socket_t* ddp_socket_listen(uint8_t number, const char* name, size_t queue_depth) {
+	if (number == 0 || number == 255) {
+		return NULL;
+	}
+	
+	ddp_socket_t* socket = ddp_socket_new(number, name, queue_depth);
+	socket->listener = true;
+	
+	ddp_socket_lock();
+	socket->next_listener = listeners;
+	listeners = socket;
+	ddp_socket_unlock();
+	
+	return socket;
+}
+
+static void ddp_socket_runloop(void* param) {
+	ddp_socket_t* socket = (ddp_socket_t*)param;
+	buffer_t* packet;
+	
+	while (1) {
+		xQueueReceive(socket->inbound, &packet, portMAX_DELAY);
+		
+		// ddp_socket_close sends a NULL once nothing else can arrive
+		if (packet == NULL) {
+			break;
+		}
+		socket->handler(packet);
+	}
+	
+	ddp_socket_free(socket);
+	vTaskDelete(NULL);
+}
+
+bool ddp_socket_bind(ddp_socket_t* socket, ddp_socket_handler handler) {
+	socket->handler = handler;
+	if (xTaskCreate(&ddp_socket_runloop, socket->name, DDP_SOCKET_STACK_SIZE, socket,
+		DDP_SOCKET_PRIORITY, NULL) != pdPASS) {
+		
+		socket->handler = NULL;
+		return false;
+	}
+	return true;
+}
+
+buffer_t* ddp_socket_recv(ddp_socket_t* socket, TickType_t wait) {
+	buffer_t* packet = NULL;
+	if (xQueueReceive(socket->inbound, &packet, wait) != pdTRUE) {
+		return NULL;
+	}
+	return packet;
+}
+
+bool ddp_socket_set_nbp_name(ddp_socket_t* socket, const char* object, const char* type) {
+	// A listener's number belongs to someone else, and so do its names
+	if (socket->listener) {
+		return false;
+	}
+	
+	nbp_registry_unregister_socket(socket->number);
+	if (object == NULL || type == NULL) {
+		return true;
+	}
+	return nbp_registry_register(object, type, socket->number);
+}
+
+void ddp_socket_close(ddp_socket_t* socket) {
+	ddp_socket_lock();
+	if (socket->listener) {
+		for (ddp_socket_t** curr = &listeners; *curr != NULL; curr = &(*curr)->next_listener) {
+			if (*curr == socket) {
+				*curr = socket->next_listener;
+				break;
+			}
+		}
+	} else if (owners[socket->number] == socket) {
+		owners[socket->number] = NULL;
+	}
+	ddp_socket_unlock();
+	
+	if (!socket->listener) {
+		nbp_registry_unregister_socket(socket->number);
+	}
+	
+	// Nothing more can arrive now, so the socket's task can have the
+	// NULL that tells it to stop once it's got through the rest
+	if (socket->handler != NULL) {
+		buffer_t* stop = NULL;
+		xQueueSendToBack(socket->inbound, &stop, portMAX_DELAY);
+	} else {
+		ddp_socket_free(socket);
+	}
+}
+
+static bool ddp_packet_is_broadcast(buffer_t* packet) {
+	return DDP_DST(packet) == DDP_ADDR_BROADCAST;
+}
+
+bool ddp_socket_accepts(buffer_t* packet) {
+	if (!packet->ddp_ready) {
+		return false;
+	}
+	
+	uint8_t number = DDP_DSTSOCK(packet);
+	if (owners[number] != NULL) {
+		return true;
+	}
+	
+	if (!ddp_packet_is_broadcast(packet)) {
+		return false;
+	}
+	
+	ddp_socket_lock();
+	bool listened_for = false;
+	for (ddp_socket_t* curr = listeners; curr != NULL; curr = curr->next_listener) {
+		if (curr->number == number) {
+			listened_for = true;
+			break;
+		}
+	}
+	ddp_socket_unlock();
+	return listened_for;
+}
+
+static void ddp_socket_enqueue(ddp_socket_t* socket, buffer_t* packet) {
+	if (xQueueSendToBack(socket->inbound, &packet, 0) != pdTRUE) {
+		socket->drops++;
+		freebuf(packet);
+		return;
+	}
+	
+	socket->packets++;
+	unsigned long queued = uxQueueMessagesWaiting(socket->inbound);
+	if (queued > socket->max_queued) {
+		socket->max_queued = queued;
+	}
+}
+
+void ddp_socket_deliver(buffer_t* packet) {
+	if (!packet->ddp_ready) {
+		freebuf(packet);
+		return;
+	}
+	
+	uint8_t number = DDP_DSTSOCK(packet);
+	bool delivered = false;
+	
+	ddp_socket_lock();
+	
+	// Listeners get copies, so that each can be freed by whoever's done
+	// with it
+	if (listeners != NULL && ddp_packet_is_broadcast(packet)) {
+		for (ddp_socket_t* curr = listeners; curr != NULL; curr = curr->next_listener) {
+			if (curr->number == number) {
+				ddp_socket_enqueue(curr, buf_clone(packet));
+				delivered = true;
+			}
+		}
+	}
+	
+	ddp_socket_t* owner = owners[number];
+	if (owner != NULL) {
+		ddp_socket_enqueue(owner, packet);
+		delivered = true;
+	} else {
+		freebuf(packet);
+	}
+	
+	ddp_socket_unlock();
+	
+	if (!delivered) {
+		stats.controlplane_drops__reason_no_app++;
+	}
+}
+
+ddp_socket_handler ddp_socket_handler_for(uint8_t number) {
+	ddp_socket_t* owner = owners[number];
+	return owner != NULL ? owner->handler : NULL;
+}
+
+// The metrics ddp_socket_stats reports for each socket, each with its
+// #TYPE line and then a line per socket
+typedef enum {
+	DDP_SOCKET_METRIC_PACKETS = 0,
+	DDP_SOCKET_METRIC_DROPS,
+	DDP_SOCKET_METRIC_QUEUED,
+	DDP_SOCKET_METRIC_MAX_QUEUED,
+	DDP_SOCKET_METRIC_COUNT,
+} ddp_socket_metric_t;
+
+static const char* ddp_socket_metric_headers[DDP_SOCKET_METRIC_COUNT] = {
+	"#TYPE ddp_socket_packets counter\n",
+	"#TYPE ddp_socket_drops counter\n",
+	"#TYPE ddp_socket_queued gauge\n",
+	"#TYPE ddp_socket_max_queued gauge\n",
+};
+
+static const char* ddp_socket_metric_fmts[DDP_SOCKET_METRIC_COUNT] = {
+	"ddp_socket_packets{socket=\"%u\", name=\"%s\"} %lu\n",
+	"ddp_socket_drops{socket=\"%u\", name=\"%s\"} %lu\n",
+	"ddp_socket_queued{socket=\"%u\", name=\"%s\"} %lu\n",
+	"ddp_socket_max_queued{socket=\"%u\", name=\"%s\"} %lu\n",
+};
+
+static unsigned long ddp_socket_metric_value(ddp_socket_t* socket, ddp_socket_metric_t metric) {
+	switch (metric) {
+	case DDP_SOCKET_METRIC_PACKETS:
+		return socket->packets;
+	case DDP_SOCKET_METRIC_DROPS:
+		return socket->drops;
+	case DDP_SOCKET_METRIC_QUEUED:
+		return (unsigned long)uxQueueMessagesWaiting(socket->inbound);
+	default:
+		return socket->max_queued;
+	}
+}
+
+static size_t ddp_socket_stats_len(ddp_socket_t* socket, ddp_socket_metric_t metric) {
+	// The socket's name, a socket number that'll fit in 3 digits and a
+	// number that'll fit in 20
+	return strlen(ddp_socket_metric_fmts[metric]) + strlen(socket->name) + 3 + 20;
+}
+
+static char* ddp_socket_stats_append(char* cursor, ddp_socket_t* socket, ddp_socket_metric_t metric) {
+	return cursor + sprintf(cursor, ddp_socket_metric_fmts[metric], (unsigned int)socket->number,
+		socket->name, ddp_socket_metric_value(socket, metric));
+}
+
+char* ddp_socket_stats(void) {
+	ddp_socket_lock();
+	
+	size_t len = 0;
+	for (int m = 0; m < DDP_SOCKET_METRIC_COUNT; m++) {
+		len += strlen(ddp_socket_metric_headers[m]);
+		for (int i = 1; i < 255; i++) {
+			if (owners[i] != NULL) {
+				len += ddp_socket_stats_len(owners[i], m);
+			}
+		}
+		for (ddp_socket_t* curr = listeners; curr != NULL; curr = curr->next_listener) {
+			len += ddp_socket_stats_len(curr, m);
+		}
+	}
+	
+	// +1 for the null.
+	char* strbuf = malloc(len + 1);
+	assert(strbuf != NULL);
+	
+	char* cursor = strbuf;
+	*cursor = '\0';
+	for (int m = 0; m < DDP_SOCKET_METRIC_COUNT; m++) {
+		cursor = stpcpy(cursor, ddp_socket_metric_headers[m]);
+		for (int i = 1; i < 255; i++) {
+			if (owners[i] != NULL) {
+				cursor = ddp_socket_stats_append(cursor, owners[i], m);
+			}
+		}
+		for (ddp_socket_t* curr = listeners; curr != NULL; curr = curr->next_listener) {
+			cursor = ddp_socket_stats_append(cursor, curr, m);
+		}
+	}
+	
+	ddp_socket_unlock();
+	return strbuf;
+}
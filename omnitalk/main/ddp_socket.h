@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+#include "mem/buffers.h"
+
+// ddp_socket is where packets for the router itself end up: each DDP
+// socket that's open has a queue of packets waiting for whoever opened it.
+//
+// Whoever opens a socket either binds a handler to it, which gets a task
+// of its own that hands it each packet in turn, or takes packets off the
+// queue themselves with ddp_socket_recv.  Either way, a socket that's slow
+// to deal with its packets only holds up its own: once its queue's full,
+// packets for it are dropped and counted.
+//
+// One socket owns each socket number and gets every packet sent to it.
+// Others can listen to the same number too, and get a copy of each
+// broadcast sent to it, so that something can keep an eye on RTMP or NBP
+// broadcasts without getting in the way of the app that answers them.
+//
+// A socket can have an NBP name, which goes in the NBP registry for the
+// NBP app to answer lookups for.
+
+// Inside AppleTalk's dynamically assigned sockets
+#define DDP_SOCKET_DYNAMIC_FIRST 128
+#define DDP_SOCKET_DYNAMIC_LAST 254
+
+#define DDP_SOCKET_DEFAULT_QUEUE_DEPTH 32
+#define DDP_SOCKET_STACK_SIZE 6144
+#define DDP_SOCKET_PRIORITY 5
+
+typedef void(*ddp_socket_handler)(buffer_t*);
+
+typedef struct ddp_socket_s ddp_socket_t;
+
+struct ddp_socket_s {
+	uint8_t number;
+	char name[16];
+	bool listener;
+	
+	QueueHandle_t inbound;
+	ddp_socket_handler handler;
+	
+	_Atomic unsigned long packets;
+	_Atomic unsigned long drops;
+	_Atomic unsigned long max_queued;
+	
+	ddp_socket_t* next_listener;
+};
+
+// ddp_socket_init sets up the socket table's lock.  It's called by
+// app_open_sockets, and before the unit tests, before anything else can
+// touch the table; calling it again does nothing.
+void ddp_socket_init(void);
+
+// ddp_socket_open opens a socket, with room for queue_depth packets
+// (DDP_SOCKET_DEFAULT_QUEUE_DEPTH if it's 0) to wait in its queue.  If
+// number is 0, it picks a free socket from the dynamic range.  It returns
+// NULL if the socket's already open, or there are no free ones.
+ddp_socket_t* ddp_socket_open(uint8_t number, const char* name, size_t queue_depth);
+
+// ddp_socket_listen opens a socket that gets a copy of every broadcast to
+// the socket number, whether or not someone else has it open.
+ddp_socket_t* ddp_socket_listen(uint8_t number, const char* name, size_t queue_depth);
+
+// ddp_socket_bind starts a task that hands each packet that arrives on
+// the socket to the handler, which takes ownership of it.  Don't call
+// ddp_socket_recv on a bound socket.
+bool ddp_socket_bind(ddp_socket_t* socket, ddp_socket_handler handler);
+
+// ddp_socket_recv returns the next packet to arrive on the socket, waiting
+// for up to wait ticks; NULL if nothing turned up.  The caller owns the
+// packet.
+buffer_t* ddp_socket_recv(ddp_socket_t* socket, TickType_t wait);
+
+// ddp_socket_set_nbp_name gives the socket an NBP name in place of any
+// names it had, or just takes them away if object is NULL.  It returns
+// false if the name couldn't be registered; listeners can't have names.
+bool ddp_socket_set_nbp_name(ddp_socket_t* socket, const char* object, const char* type);
+
+// ddp_socket_close stops the socket getting packets, throws away any it
+// hadn't got to, and frees it.  It mustn't be called from the socket's own
+// handler.
+void ddp_socket_close(ddp_socket_t* socket);
+
+// ddp_socket_accepts says whether any socket would take the packet.  LAPs
+// check before they pass packets on, so the control plane never sees
+// packets nobody wants.
+bool ddp_socket_accepts(buffer_t* packet);
+
+// ddp_socket_deliver puts the packet on the queue of the socket it's for,
+// and copies of it on those of any listeners if it's a broadcast.  It
+// takes ownership of the packet.
+void ddp_socket_deliver(buffer_t* packet);
+
+// ddp_socket_handler_for returns the handler bound to the socket number,
+// for the simulator, which calls handlers itself rather than leave it to
+// the sockets' tasks.
+ddp_socket_handler ddp_socket_handler_for(uint8_t number);
+
+// ddp_socket_stats returns each socket's packet, drop and queue metrics,
+// for /metrics.  The caller frees it.
+char* ddp_socket_stats(void);
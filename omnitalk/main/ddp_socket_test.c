@@ -0,0 +1,207 @@
+#include "ddp_socket_test.h"
+#include "ddp_socket.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mem/buffers.h"
+#include "mem/buffers_test.h"
+#include "proto/ddp.h"
+#include "util/pstring.h"
+#include "web/stats.h"
+#include "nbp_registry.h"
+#include "test.h"
+
+// packet_to makes an NBP packet with a short DDP header, sent to the node
+// and socket given
+static buffer_t* packet_to(uint8_t node, uint8_t socket) {
+	buffer_t *buf = buf_from_string("\xff\x01\x01\x00\x0a\x02\x02\x02\x21\x00\x01\xfe\x02", 3, 13);
+	buf->data[0] = node;
+	buf->data[5] = socket;
+	buf_setup_ddp(buf, 3, BUF_SHORT_HEADER);
+	return buf;
+}
+
+TEST_FUNCTION(test_ddp_socket_open) {
+	ddp_socket_t* fixed = ddp_socket_open(200, "test/fixed", 0);
+	TEST_ASSERT(fixed != NULL);
+	TEST_ASSERT(fixed->number == 200);
+	TEST_ASSERT(strcmp(fixed->name, "test/fixed") == 0);
+	
+	// Only one socket can have a number
+	TEST_ASSERT(ddp_socket_open(200, "test/again", 0) == NULL);
+	
+	// Neither 0 nor 255 are sockets anyone can open
+	TEST_ASSERT(ddp_socket_open(255, "test/255", 0) == NULL);
+	
+	// Dynamic sockets come out of the dynamic range, and skip the ones
+	// that are already open
+	ddp_socket_t* first = ddp_socket_open(0, "test/dynamic", 0);
+	ddp_socket_t* second = ddp_socket_open(0, "test/dynamic", 0);
+	TEST_ASSERT(first != NULL && second != NULL);
+	TEST_ASSERT(first->number >= DDP_SOCKET_DYNAMIC_FIRST && first->number <= DDP_SOCKET_DYNAMIC_LAST);
+	TEST_ASSERT(second->number >= DDP_SOCKET_DYNAMIC_FIRST && second->number <= DDP_SOCKET_DYNAMIC_LAST);
+	TEST_ASSERT(first->number != second->number);
+	TEST_ASSERT(first->number != 200 && second->number != 200);
+	
+	// Once it's closed, the number's free again
+	ddp_socket_close(fixed);
+	fixed = ddp_socket_open(200, "test/again", 0);
+	TEST_ASSERT(fixed != NULL);
+	
+	ddp_socket_close(fixed);
+	ddp_socket_close(first);
+	ddp_socket_close(second);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_ddp_socket_delivery) {
+	long active_allocs = stats.mem_all_allocs - stats.mem_all_frees;
+	unsigned long no_app = stats.controlplane_drops__reason_no_app;
+	ddp_socket_t* socket = ddp_socket_open(200, "test/delivery", 2);
+	buffer_t *buf;
+	
+	// The first two wait for whoever's reading the socket, and the third's
+	// dropped
+	for (int i = 0; i < 3; i++) {
+		buf = packet_to(1, 200);
+		TEST_ASSERT(ddp_socket_accepts(buf));
+		ddp_socket_deliver(buf);
+	}
+	TEST_ASSERT(socket->packets == 2);
+	TEST_ASSERT(socket->drops == 1);
+	TEST_ASSERT(socket->max_queued == 2);
+	
+	buf = ddp_socket_recv(socket, 0);
+	TEST_ASSERT(buf != NULL && DDP_DSTSOCK(buf) == 200);
+	freebuf(buf);
+	buf = ddp_socket_recv(socket, 0);
+	TEST_ASSERT(buf != NULL);
+	freebuf(buf);
+	TEST_ASSERT(ddp_socket_recv(socket, 0) == NULL);
+	
+	// Nobody has socket 201, so its packets go nowhere
+	buf = packet_to(1, 201);
+	TEST_ASSERT(!ddp_socket_accepts(buf));
+	ddp_socket_deliver(buf);
+	TEST_ASSERT(stats.controlplane_drops__reason_no_app == no_app + 1);
+	
+	// Closing a socket throws away whatever's waiting on it
+	ddp_socket_deliver(packet_to(1, 200));
+	ddp_socket_close(socket);
+	TEST_ASSERT(active_allocs == (stats.mem_all_allocs - stats.mem_all_frees));
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_ddp_socket_broadcast_listeners) {
+	long active_allocs = stats.mem_all_allocs - stats.mem_all_frees;
+	unsigned long no_app = stats.controlplane_drops__reason_no_app;
+	ddp_socket_t* owner = ddp_socket_open(200, "test/owner", 0);
+	ddp_socket_t* listener = ddp_socket_listen(200, "test/listener", 0);
+	ddp_socket_t* other = ddp_socket_listen(201, "test/other", 0);
+	buffer_t *owned, *copy;
+	
+	// A broadcast goes to the owner, and a copy of it to the listener
+	ddp_socket_deliver(packet_to(DDP_ADDR_BROADCAST, 200));
+	owned = ddp_socket_recv(owner, 0);
+	copy = ddp_socket_recv(listener, 0);
+	TEST_ASSERT(owned != NULL && copy != NULL);
+	TEST_ASSERT(owned != copy);
+	TEST_ASSERT(owned->length == copy->length);
+	TEST_ASSERT(memcmp(owned->data, copy->data, owned->length) == 0);
+	TEST_ASSERT(ddp_socket_recv(other, 0) == NULL);
+	freebuf(owned);
+	freebuf(copy);
+	
+	// Packets sent to us alone go only to the owner
+	ddp_socket_deliver(packet_to(1, 200));
+	TEST_ASSERT(ddp_socket_recv(listener, 0) == NULL);
+	owned = ddp_socket_recv(owner, 0);
+	TEST_ASSERT(owned != NULL);
+	freebuf(owned);
+	
+	// A listener's enough to take a broadcast nobody owns, but not a
+	// packet sent to us alone
+	buffer_t *buf = packet_to(DDP_ADDR_BROADCAST, 201);
+	TEST_ASSERT(ddp_socket_accepts(buf));
+	ddp_socket_deliver(buf);
+	copy = ddp_socket_recv(other, 0);
+	TEST_ASSERT(copy != NULL);
+	freebuf(copy);
+	TEST_ASSERT(stats.controlplane_drops__reason_no_app == no_app);
+	
+	buf = packet_to(1, 201);
+	TEST_ASSERT(!ddp_socket_accepts(buf));
+	ddp_socket_deliver(buf);
+	TEST_ASSERT(stats.controlplane_drops__reason_no_app == no_app + 1);
+	
+	ddp_socket_close(listener);
+	ddp_socket_close(other);
+	ddp_socket_close(owner);
+	TEST_ASSERT(active_allocs == (stats.mem_all_allocs - stats.mem_all_frees));
+	
+	TEST_OK();
+}
+
+static void count_name(void* pvt, const nbp_entity_t* entity) {
+	if (entity->socket == 200) {
+		(*(int*)pvt)++;
+	}
+}
+
+TEST_FUNCTION(test_ddp_socket_nbp_names) {
+	ddp_socket_t* socket = ddp_socket_open(200, "test/named", 0);
+	pstring* object = (pstring*)"\x08omnitalk";
+	pstring* type = (pstring*)"\x04Test";
+	int seen = 0;
+	
+	// Sockets don't have names until they're given one
+	nbp_registry_lookup(object, type, &seen, &count_name);
+	TEST_ASSERT(seen == 0);
+	
+	TEST_ASSERT(ddp_socket_set_nbp_name(socket, "omnitalk", "Test"));
+	nbp_registry_lookup(object, type, &seen, &count_name);
+	TEST_ASSERT(seen == 1);
+	
+	// and can have it taken away again
+	seen = 0;
+	ddp_socket_set_nbp_name(socket, NULL, NULL);
+	nbp_registry_lookup(object, type, &seen, &count_name);
+	TEST_ASSERT(seen == 0);
+	
+	// Closing a socket takes its names with it
+	ddp_socket_set_nbp_name(socket, "omnitalk", "Test");
+	ddp_socket_close(socket);
+	nbp_registry_lookup(object, type, &seen, &count_name);
+	TEST_ASSERT(seen == 0);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_ddp_socket_stats) {
+	ddp_socket_t* owner = ddp_socket_open(201, "test/stats", 0);
+	ddp_socket_t* listener = ddp_socket_listen(202, "test/listener", 0);
+	ddp_socket_deliver(packet_to(5, 201));
+	
+	// Each metric's lines come together, after its #TYPE line
+	char* text = ddp_socket_stats();
+	char* packets = strstr(text, "#TYPE ddp_socket_packets counter\n");
+	char* drops = strstr(text, "#TYPE ddp_socket_drops counter\n");
+	char* queued = strstr(text, "#TYPE ddp_socket_queued gauge\n");
+	char* max_queued = strstr(text, "#TYPE ddp_socket_max_queued gauge\n");
+	TEST_ASSERT(packets != NULL && drops != NULL && queued != NULL && max_queued != NULL);
+	TEST_ASSERT(packets < drops && drops < queued && queued < max_queued);
+	
+	char* line = strstr(text, "ddp_socket_packets{socket=\"201\", name=\"test/stats\"} 1\n");
+	TEST_ASSERT(line > packets && line < drops);
+	line = strstr(text, "ddp_socket_queued{socket=\"202\", name=\"test/listener\"} 0\n");
+	TEST_ASSERT(line > queued && line < max_queued);
+	
+	free(text);
+	ddp_socket_close(owner);
+	ddp_socket_close(listener);
+	
+	TEST_OK();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "test.h"
+
+TEST_FUNCTION(test_ddp_socket_open);
+TEST_FUNCTION(test_ddp_socket_delivery);
+TEST_FUNCTION(test_ddp_socket_broadcast_listeners);
+TEST_FUNCTION(test_ddp_socket_nbp_names);
+TEST_FUNCTION(test_ddp_socket_stats);
@@ -3,3 +3,5 @@
 rt_routing_table_t *global_routing_table;
 zt_zip_table_t *global_zip_table;
 lap_registry_t *global_lap_registry;
+aarp_table_t *global_aarp_table;
+nbp_cache_t *global_nbp_cache;
@@ -1,11 +1,17 @@
 #pragma once
 
 #include "lap/registry.h"
+#include "table/aarp/table.h"
 #include "table/routing/table.h"
 #include "table/zip/table.h"
+#include "nbp_cache.h"
 
 // Yeah, yeah, global state is icky, but it's easier to have a single routing table
 // here.
 extern rt_routing_table_t *global_routing_table;
 extern zt_zip_table_t *global_zip_table;
 extern lap_registry_t *global_lap_registry;
+extern aarp_table_t *global_aarp_table;
+
+// NULL unless NBP_CACHE_ENTRIES is defined in tunables.h
+extern nbp_cache_t *global_nbp_cache;
@@ -1,18 +1,16 @@
 #pragma once
 
-#include <freertos/FreeRTOSConfig.h>
+#include "tunables.h"
 
-// Look, don't blame me, blame FreeRTOS.  Quoth the manual:
-// "The number of bits (or flags) implemented within an event group is 8 if 
-// configUSE_16_BIT_TICKS is set to 1, or 24 if configUSE_16_BIT_TICKS is set to 0."
+// MAX_LAP_COUNT is how many LAPs we can have, which is really only limited
+// by how much space we want to set aside for their metadata in stats.  It
+// used to be tied to the width of a FreeRTOS event group; it isn't any more.
+#define MAX_LAP_COUNT 64
 
-#if configUSE_16_BIT_TICKS == 0
-#define MAX_LAP_COUNT 24
-#elif configUSE_16_BIT_TICKS == 1
-#define MAX_LAP_COUNT 8
-#else
-#error what have you done to configUSE_16_BIT_TICKS?
-#endif
+// IDs start at 1, and every LLAP port needs one: LocalTalk, each LToUDP
+// group and the load generator
+_Static_assert(MAX_UDP_TRANSPORTS + 2 < MAX_LAP_COUNT,
+	"MAX_UDP_TRANSPORTS LToUDP ports won't all fit in MAX_LAP_COUNT");
 
-// gets a unique ID for a LAP.
+// gets a unique ID for a LAP, or -1 if there are already MAX_LAP_COUNT - 1.
 int get_next_lap_id(void);
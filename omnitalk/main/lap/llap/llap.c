@@ -13,20 +13,23 @@
 #include "lap/registry.h"
 #include "mem/buffers.h"
 #include "net/transport.h"
+#include "persist/persist.h"
 #include "table/routing/table.h"
 #include "proto/ddp.h"
 #include "proto/llap.h"
 #include "proto/rtmp.h"
 #include "util/require/goto.h"
 #include "web/stats.h"
+#include "ddp_socket.h"
 #include "global_state.h"
+#include "nbp_cache.h"
 #include "runloop.h"
 
 static const char* TAG = "LLAP";
 
 bool llap_extract_ddp_packet(buffer_t *buf) {
 	llap_hdr_t *llap_hdr;
-
+	
 	// Does the packet have room for an LLAP header?
 	if (buf->length < sizeof(llap_hdr_t)) {
 		return false;
@@ -45,90 +48,56 @@ bool llap_extract_ddp_packet(buffer_t *buf) {
 	return buf_setup_ddp(buf, 3, buf_type);
 }
 
-void llap_acquire_address(lap_t *lap) {
-	transport_t *transport = lap->transport;
-	llap_info_t *info = (llap_info_t*)lap->info;
-	buffer_t *enq_buffer = NULL;
-	buffer_t *ack_buffer = NULL;
-	
-	ESP_LOGI(TAG, "starting address acquisition");
+static void llap_note_phase_done(llap_info_t *info, prometheus_counter_t *count,
+	prometheus_counter_t *milliseconds) {
 	
-	uint8_t candidate;
-	bool got_ack;
+	int64_t now = esp_timer_get_time();
+	(*count)++;
+	*milliseconds += (now - info->phase_started) / 1000;
+	info->phase_started = now;
+}
 
-	do {
-		got_ack = false;
-		
-		// Pick a random address
-		candidate = (uint8_t)(esp_random() % 127);
-		candidate += 128; // server addresses go 128 and above
-						
-		// send a burst of ENQs
-		for (int i = 0; i < 10; i++) {
-			enq_buffer = newbuf(5, 0);
-			enq_buffer->length = 3;
-			((llap_hdr_t*)enq_buffer->data)->src = candidate;
-			((llap_hdr_t*)enq_buffer->data)->dst = candidate;
-			((llap_hdr_t*)enq_buffer->data)->llap_type = LLAP_TYPE_ENQ;
-					
-			if (!tsend_and_block(transport, enq_buffer)) {
-				// TODO: stat tickup
-				freebuf(enq_buffer);
-			}
-		}
+static uint8_t llap_random_address(void) {
+	uint8_t candidate = (uint8_t)(esp_random() % 127);
+	return candidate + 128; // server addresses go 128 and above
+}
+
+// llap_send_enqs sends a burst of ENQs for an address we'd like
+static void llap_send_enqs(lap_t *lap, uint8_t candidate) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	buffer_t *enqs[LLAP_ENQ_BURST];
 	
+	info->node_addr = candidate;
 	
-		// Wait for reply
-		int64_t start_time = esp_timer_get_time();
-		while (esp_timer_get_time() < start_time + 100000) {
-			ack_buffer = trecv_with_timeout(transport, 1);
-			if (ack_buffer == NULL) {
-				continue;
-			}
-			
-			// Is the packet we got actually an ack?
-		
-			if (ack_buffer->length != 3) {
-				goto ack_loop_continue;
-			}
-			llap_hdr_t *hdr = (llap_hdr_t*)ack_buffer->data;
-		
-			if (hdr->llap_type != LLAP_TYPE_ACK || hdr->src != candidate ||
-				hdr->dst != candidate) {
-		
-				goto ack_loop_continue;	
-			}
-		
-			// bummer, someone's got our address.  try again with another.
-			got_ack = true;
-		
-		ack_loop_continue:
-			free(ack_buffer);
-		}
-	} while (got_ack);
+	for (int i = 0; i < LLAP_ENQ_BURST; i++) {
+		enqs[i] = newbuf(5, 0);
+		enqs[i]->length = 3;
+		((llap_hdr_t*)enqs[i]->data)->src = candidate;
+		((llap_hdr_t*)enqs[i]->data)->dst = candidate;
+		((llap_hdr_t*)enqs[i]->data)->llap_type = LLAP_TYPE_ENQ;
+	}
 	
-	ESP_LOGI(TAG, "got address %d", (int)candidate);
+	// If they don't all fit on the transport's queue, the ones that do are
+	// enough of a burst
+	size_t sent = tsend_batch(lap->transport, enqs, LLAP_ENQ_BURST);
+	for (size_t i = sent; i < LLAP_ENQ_BURST; i++) {
+		freebuf(enqs[i]);
+	}
 	
-	info->node_addr = candidate;
-	ESP_ERROR_CHECK(set_transport_node_address(transport, candidate));
-	stats_lap_metadata[lap->id].node_address=candidate;
-	stats_lap_metadata[lap->id].state="acquiring network info";
-	info->state = LLAP_ACQUIRING_NETINFO;
+	info->deadline = esp_timer_get_time() + LLAP_ENQ_WAIT_US;
 }
 
-void llap_acquire_netinfo(lap_t *lap) {
-	transport_t *transport = lap->transport;
+// llap_send_rtmp_requests asks any router on the network what the network
+// number is.  See Inside Appletalk p5-17 et seq
+static void llap_send_rtmp_requests(lap_t *lap) {
 	llap_info_t *info = (llap_info_t*)lap->info;
-
-	buffer_t *rtmp_req;
-	buffer_t *rtmp_resp;
-
-	// Send a few RTMP requests.  See Inside Appletalk p5-17 et seq
-	for (int i = 0; i < 5; i++) {
-		rtmp_req = newbuf(sizeof(ddp_short_header_t) + 3, 0);
-		rtmp_req->length = rtmp_req->capacity - 2;
+	buffer_t *reqs[LLAP_RTMP_REQUEST_BURST];
+	
+	for (int i = 0; i < LLAP_RTMP_REQUEST_BURST; i++) {
+		reqs[i] = newbuf(sizeof(ddp_short_header_t) + 3, 0);
+		reqs[i]->length = reqs[i]->capacity - 2;
 		
-		ddp_short_header_t* hdr = (ddp_short_header_t*)rtmp_req->data;
+		ddp_short_header_t* hdr = (ddp_short_header_t*)reqs[i]->data;
 		
 		hdr->dst = DDP_ADDR_BROADCAST; // broadcast
 		hdr->src = info->node_addr;
@@ -138,60 +107,64 @@ void llap_acquire_netinfo(lap_t *lap) {
 		hdr->src_sock = DDP_SOCKET_RTMP;
 		hdr->ddp_type = 5;
 		hdr->body[0] = 1;
+	}
 	
-		if (!tsend_and_block(transport, rtmp_req)) {
-			// TODO: stat tickup
-			ESP_LOGE(TAG, "couldn't send rtmp");
-			freebuf(rtmp_req);
+	size_t sent = tsend_batch(lap->transport, reqs, LLAP_RTMP_REQUEST_BURST);
+	if (sent < LLAP_RTMP_REQUEST_BURST) {
+		ESP_LOGE(TAG, "[%s] couldn't send all our rtmp requests", lap->name);
+		for (size_t i = sent; i < LLAP_RTMP_REQUEST_BURST; i++) {
+			freebuf(reqs[i]);
 		}
 	}
+	
+	info->deadline = esp_timer_get_time() + LLAP_NETINFO_WAIT_US;
+}
 
-	// Wait for reply
-	int64_t start_time = esp_timer_get_time();
-	while (esp_timer_get_time() < start_time + 1000000) {
-		rtmp_resp = trecv_with_timeout(transport, 1);
-		if (rtmp_resp == NULL) {
-			continue;
-		}
-		
-		if (!llap_extract_ddp_packet(rtmp_resp)) {
-			goto discard;
-		}
-		
-		// Is the payload long enough?
-		if (rtmp_resp->ddp_payload_length < sizeof(rtmp_response_t)) {
-			goto discard;
-		}
-		
-		REQUIRE(DDP_DST(rtmp_resp) == info->node_addr, discard);
-		REQUIRE(DDP_DSTSOCK(rtmp_resp) == 1, discard);
-		REQUIRE(DDP_SRCSOCK(rtmp_resp) == 1, discard);
-		REQUIRE(DDP_TYPE(rtmp_resp) == 1, discard);
-
-		// Playing a bit fast and loose, we'll ignore the datagram length,
-		// we've already checked the packet buffer size above and meh.
-		rtmp_response_t *body = (rtmp_response_t*)(rtmp_resp->ddp_payload);
-		
-		// It's addressed to us, and it claims to be an RTMP response.  Hooray
-		if (body->id_length_bits != 8) {
-			ESP_LOGE(TAG, "got rtmp reply with invalid id_length_bits, wut?");
-			// TODO: tick stats up here
-			goto discard;
-		}
-		
-		info->discovered_net = ntohs(body->senders_network);
-		info->discovered_seeding_node = body->node_id;
-		free(rtmp_resp);
-		break;
+void llap_start_acquisition(lap_t *lap) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	
+	ESP_LOGI(TAG, "[%s] starting address acquisition", lap->name);
 	
-	discard:
-		free(rtmp_resp);
+	info->state = LLAP_ACQUIRING_ADDRESS;
+	info->phase_started = esp_timer_get_time();
+	
+	// Try the address we had before first, so anything that remembers us
+	// still finds us
+	info->have_remembered = persist_get_lap(lap, &info->remembered);
+	if (info->have_remembered && info->remembered.node >= 128 && info->remembered.node < 255) {
+		llap_send_enqs(lap, info->remembered.node);
+	} else {
+		llap_send_enqs(lap, llap_random_address());
 	}
+}
+
+static void llap_address_acquired(lap_t *lap) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	
+	ESP_LOGI(TAG, "[%s] got address %d", lap->name, (int)info->node_addr);
+	
+	ESP_ERROR_CHECK(set_transport_node_address(lap->transport, info->node_addr));
+	stats_lap_metadata[lap->id].node_address=info->node_addr;
+	stats_lap_metadata[lap->id].state="acquiring network info";
+	llap_note_phase_done(info, &stats.llap_acquisitions__phase_address,
+		&stats.llap_acquisition_milliseconds__phase_address);
+	
+	info->state = LLAP_ACQUIRING_NETINFO;
+	llap_send_rtmp_requests(lap);
+}
+
+static void llap_netinfo_acquired(lap_t *lap, uint16_t network, uint8_t seeding_node) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	
+	info->discovered_net = network;
+	info->discovered_seeding_node = seeding_node;
 	
 	ESP_LOGI(TAG, "[%s] got network 0x%x (%d)", lap->name, (int)info->discovered_net,  (int)info->discovered_net);
 	
 	stats_lap_metadata[lap->id].discovered_network=info->discovered_net;
 	stats_lap_metadata[lap->id].state="running";
+	llap_note_phase_done(info, &stats.llap_acquisitions__phase_netinfo,
+		&stats.llap_acquisition_milliseconds__phase_netinfo);
 	
 	lap->my_address = info->node_addr;
 	lap->my_network = info->discovered_net;
@@ -202,61 +175,177 @@ void llap_acquire_netinfo(lap_t *lap) {
 		rt_touch_direct(global_routing_table, lap->my_network, lap->my_network, lap);
 	}
 	
+	persist_lap_acquired(lap);
+	
+	info->deadline = 0;
 	info->state = LLAP_RUNNING;
 }
 
-void llap_run_for_a_while(lap_t *lap) {
-	transport_t *transport = lap->transport;
+void llap_handle_deadline(lap_t *lap) {
 	llap_info_t *info = (llap_info_t*)lap->info;
-	buffer_t *recvbuf;
 	
-	int64_t start_time = esp_timer_get_time();
-	while (esp_timer_get_time() < start_time + 15000000) {
-		recvbuf = trecv_with_timeout(transport, 1000 / portTICK_PERIOD_MS);
-		if (recvbuf == NULL) {
-			continue;
+	info->deadline = 0;
+	switch (info->state) {
+	case LLAP_ACQUIRING_ADDRESS:
+		// Nobody's objected to the address, so it's ours
+		llap_address_acquired(lap);
+		break;
+	case LLAP_ACQUIRING_NETINFO:
+		// No router's answered; carry on with the network we were on
+		// before, if we know it, or without one
+		if (info->have_remembered) {
+			llap_netinfo_acquired(lap, info->remembered.network, 0);
+		} else {
+			llap_netinfo_acquired(lap, 0, 0);
 		}
+		break;
+	case LLAP_RUNNING:
+		break;
+	}
+}
+
+// llap_handle_control_frame deals with an ENQ or ACK
+static void llap_handle_control_frame(lap_t *lap, buffer_t *frame) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	llap_hdr_t *hdr = (llap_hdr_t*)frame->data;
+	
+	if (hdr->dst != info->node_addr) {
+		stats.llap_in_drops__reason_control_frame++;
+		freebuf(frame);
+		return;
+	}
+	
+	if (info->state == LLAP_ACQUIRING_ADDRESS) {
+		// Someone already has the address we're after (they ACKed), or is
+		// after it too (they sent an ENQ); either way, try another
+		stats.llap_address_conflicts++;
+		freebuf(frame);
+		llap_send_enqs(lap, llap_random_address());
+		return;
+	}
+	
+	if (hdr->llap_type != LLAP_TYPE_ENQ) {
+		stats.llap_in_drops__reason_control_frame++;
+		freebuf(frame);
+		return;
+	}
+	
+	ESP_LOGI(TAG, "someone's trying to steal our address, we should do something about that");
+	
+	// turn our received ENQ into an ACK
+	hdr->llap_type = LLAP_TYPE_ACK;
+	if (!tsend_first_and_block(lap->transport, frame)) {
+		ESP_LOGE(TAG, "failed to push ack");
+		freebuf(frame);
+	}
+}
+
+// llap_netinfo_from looks for the network number in an RTMP packet: either
+// a response to our request or a router's regular broadcast will do.  A
+// router that says network 0 doesn't know any better than we do.
+static bool llap_netinfo_from(lap_t *lap, buffer_t *packet) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	
+	REQUIRE(packet->ddp_payload_length >= sizeof(rtmp_response_t), nope);
+	REQUIRE(DDP_DST(packet) == info->node_addr || DDP_DST(packet) == DDP_ADDR_BROADCAST, nope);
+	REQUIRE(DDP_DSTSOCK(packet) == DDP_SOCKET_RTMP, nope);
+	REQUIRE(DDP_SRCSOCK(packet) == DDP_SOCKET_RTMP, nope);
+	REQUIRE(DDP_TYPE(packet) == 1, nope);
+	
+	// Playing a bit fast and loose, we'll ignore the datagram length,
+	// we've already checked the packet buffer size above and meh.
+	rtmp_response_t *body = (rtmp_response_t*)(packet->ddp_payload);
+	if (body->id_length_bits != 8) {
+		ESP_LOGE(TAG, "got rtmp packet with invalid id_length_bits, wut?");
+		goto nope;
+	}
+	REQUIRE(body->senders_network != 0, nope);
+	
+	llap_netinfo_acquired(lap, ntohs(body->senders_network), body->node_id);
+	return true;
+	
+nope:
+	return false;
+}
+
+// llap_is_for_any_router_here returns true for a packet addressed to any
+// router on one of our directly connected networks, not just this LAP's:
+// a FwdReq from a router across the backbone comes in on one port for a
+// network on another.
+static bool llap_is_for_any_router_here(buffer_t *packet) {
+	if (packet->ddp_type != BUF_LONG_HEADER || DDP_DST(packet) != DDP_ADDR_ANY_ROUTER ||
+		global_routing_table == NULL) {
 		
-		// update the receive chain for the packet so we know where it came from
-		recvbuf->recv_chain.transport = transport;
-		recvbuf->recv_chain.lap = lap;
-		
-		llap_hdr_t *hdr = ((llap_hdr_t*)recvbuf->data);
-		
-		// is this an ENQ?
-		if (recvbuf->length == 3 && hdr->llap_type == LLAP_TYPE_ENQ && hdr->dst == info->node_addr) {
-			ESP_LOGI(TAG, "someone's trying to steal our address, we should do something about that");
-			
-			// turn our received ENQ into an ACK
-			hdr->llap_type = LLAP_TYPE_ACK;
-			BaseType_t err = xQueueSendToFront(transport->outbound, &recvbuf, portMAX_DELAY);
-			if (err == pdTRUE) {
-				continue;
-			} else {
-				ESP_LOGE(TAG, "failed to push ack");
-				goto discard;
-			}
-		}
+		return false;
+	}
+	
+	rt_route_t route;
+	return rt_lookup(global_routing_table, DDP_DSTNET(packet), &route) && route.distance == 0;
+}
+
+void llap_handle_frame(lap_t *lap, buffer_t *frame) {
+	llap_info_t *info = (llap_info_t*)lap->info;
+	
+	// update the receive chain for the packet so we know where it came from
+	frame->recv_chain.transport = lap->transport;
+	frame->recv_chain.lap = lap;
+	
+	llap_hdr_t *hdr = ((llap_hdr_t*)frame->data);
+	
+	// is this an ENQ or an ACK?
+	if (frame->length == sizeof(llap_hdr_t) &&
+		(hdr->llap_type == LLAP_TYPE_ENQ || hdr->llap_type == LLAP_TYPE_ACK)) {
 		
-		// Extract DDP packet
-		if (!llap_extract_ddp_packet(recvbuf)) {
-			goto discard;
+		llap_handle_control_frame(lap, frame);
+		return;
+	}
+	
+	// Until we've got an address, nothing's for us
+	if (info->state == LLAP_ACQUIRING_ADDRESS) {
+		stats.llap_in_drops__reason_not_for_us++;
+		goto discard;
+	}
+	
+	// Extract DDP packet
+	if (!llap_extract_ddp_packet(frame)) {
+		if (frame->length >= sizeof(llap_hdr_t) && (hdr->llap_type & 0x80) != 0) {
+			stats.llap_in_drops__reason_control_frame++;
+		} else {
+			stats.llap_in_drops__reason_malformed++;
 		}
-				
-		if (ddp_packet_is_mine(lap, recvbuf)) {
-			// do something
-			
-			if (rlsend(lap->controlplane, recvbuf)) {
-				continue;
-			} else {
-				stats.controlplane_inbound_queue_full++;
-			}
+		goto discard;
+	}
+	
+	// The packet that tells us our network number goes on to the control
+	// plane like anything else, so an RTMP broadcast's routes aren't wasted
+	if (info->state == LLAP_ACQUIRING_NETINFO) {
+		llap_netinfo_from(lap, frame);
+	}
+	
+	if (!ddp_packet_is_mine(lap, frame) && !llap_is_for_any_router_here(frame)) {
+		// Other nodes' answers to lookups are worth a look on their way
+		// past, so that we can answer the same lookup next time
+		if (global_nbp_cache != NULL && DDP_TYPE(frame) == DDP_TYPE_NBP) {
+			nbp_cache_learn(global_nbp_cache, frame, lap);
 		}
-		
-	discard:
-		// TODO: tick stat up
-		freebuf(recvbuf);
+		stats.llap_in_drops__reason_not_for_us++;
+		goto discard;
+	}
+	
+	// Don't bother the control plane with packets nothing's listening for
+	if (!ddp_socket_accepts(frame)) {
+		stats.controlplane_drops__reason_no_app++;
+		goto discard;
+	}
+	
+	if (rlsend(lap->controlplane, frame)) {
+		return;
+	} else {
+		stats.controlplane_inbound_queue_full++;
 	}
+	
+discard:
+	freebuf(frame);
 }
 
 void llap_inbound_runloop(void* lapParam) {
@@ -265,18 +354,25 @@ void llap_inbound_runloop(void* lapParam) {
 	llap_info_t *info = (llap_info_t*)lap->info;
 	
 	wait_for_transport_ready(transport);
+	llap_start_acquisition(lap);
 	
 	while(1) {
-		if (info->state == LLAP_ACQUIRING_ADDRESS) {
-			llap_acquire_address(lap);
-			continue;
-		}
-		if (info->state == LLAP_ACQUIRING_NETINFO) {
-			llap_acquire_netinfo(lap);
-			continue;
+		TickType_t wait = portMAX_DELAY;
+		
+		if (info->deadline != 0) {
+			int64_t remaining = info->deadline - esp_timer_get_time();
+			if (remaining <= 0) {
+				llap_handle_deadline(lap);
+				continue;
+			}
+			
+			// Round up, so we don't wake up just before the deadline
+			wait = (TickType_t)((remaining / 1000 + portTICK_PERIOD_MS) / portTICK_PERIOD_MS);
 		}
-		if (info->state == LLAP_RUNNING) {
-			llap_run_for_a_while(lap);
+		
+		buffer_t *frame = trecv_with_timeout(transport, wait);
+		if (frame != NULL) {
+			llap_handle_frame(lap, frame);
 		}
 	}
 }
@@ -285,7 +381,7 @@ void llap_outbound_runloop(void* lapParam) {
 	buffer_t *packet = NULL;
 	lap_t *lap = (lap_t*)lapParam;
 	transport_t *transport = lap->transport;
-
+	
 	wait_for_transport_ready(transport);
 	
 	while (1) {
@@ -333,12 +429,19 @@ void llap_outbound_runloop(void* lapParam) {
 	cleanup:
 		freebuf(packet);
 	}
-
+	
 	vTaskDelay(portMAX_DELAY);
 }
 
 
 lap_t *start_llap(char* name, transport_t *transport, lap_registry_t *registry, runloop_info_t *controlplane, runloop_info_t *dataplane) {
+	// Its ID is where its metadata goes in stats, so no ID, no LAP
+	int id = get_next_lap_id();
+	if (id < 0) {
+		ESP_LOGE(TAG, "[%s] too many LAPs, at most %d", name, MAX_LAP_COUNT - 1);
+		return NULL;
+	}
+	
 	lap_t *lap = calloc(1, sizeof(lap_t));
 	if (lap == NULL) {
 		return NULL;
@@ -351,7 +454,7 @@ lap_t *start_llap(char* name, transport_t *transport, lap_registry_t *registry,
 	}
 	
 	// fill in LAP fields
-	lap->id = get_next_lap_id();
+	lap->id = id;
 	lap->info = (void*)info;
 	lap->name = name;
 	lap->kind = "llap";
@@ -375,11 +478,13 @@ lap_t *start_llap(char* name, transport_t *transport, lap_registry_t *registry,
 	// start runloop
 	char* task_name;
 	asprintf(&task_name, "llap:%s:inbound", name);
-	xTaskCreate(&llap_inbound_runloop, task_name, 2048, (void*)lap, 5, NULL);
+	// The inbound task reads and writes NVS through persist when the LAP
+	// gets its address, which needs more stack than handling frames
+	xTaskCreate(&llap_inbound_runloop, task_name, 4096, (void*)lap, 5, NULL);
 	// do NOT free task_name, freertos will be holding onto a reference to it
 	asprintf(&task_name, "llap:%s:outbound", name);
 	xTaskCreate(&llap_outbound_runloop, task_name, 2048, (void*)lap, 5, NULL);
 	// freertos will hold onto a reference to this string, too
-
+	
 	return lap;
 }
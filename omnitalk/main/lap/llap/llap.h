@@ -4,10 +4,21 @@
 
 #include "lap/lap.h"
 #include "lap/registry.h"
+#include "persist/persist.h"
 #include "runloop_types.h"
 
 #define LLAP_OUTBOUND_QUEUE_SIZE 60
 
+// How many ENQs we send for an address, and how long we give anyone who
+// has it to say so
+#define LLAP_ENQ_BURST 10
+#define LLAP_ENQ_WAIT_US 100000
+
+// How many RTMP requests we send for the network number, and how long we
+// wait for a router to answer before going on without one
+#define LLAP_RTMP_REQUEST_BURST 5
+#define LLAP_NETINFO_WAIT_US 1000000
+
 typedef enum {
 	LLAP_ACQUIRING_ADDRESS = 0,
 	LLAP_ACQUIRING_NETINFO,
@@ -20,6 +31,24 @@ typedef struct {
 	_Atomic uint8_t node_addr;
 	_Atomic uint16_t discovered_net;
 	_Atomic uint16_t discovered_seeding_node;
+	
+	// When the current phase started, and when it runs out of time, by
+	// esp_timer_get_time; 0 when there's nothing to wait for.  Only the
+	// inbound runloop touches these.
+	int64_t phase_started;
+	int64_t deadline;
+	
+	// What we had before the last reboot, if we know
+	bool have_remembered;
+	persist_lap_record_t remembered;
 } llap_info_t;
 
+// The inbound runloop is a state machine driven by the frames it receives
+// and the deadline in the LAP's info.  llap_start_acquisition starts it
+// off, llap_handle_frame takes ownership of a frame that's arrived, and
+// llap_handle_deadline is called once the deadline has passed.
+void llap_start_acquisition(lap_t *lap);
+void llap_handle_frame(lap_t *lap, buffer_t *frame);
+void llap_handle_deadline(lap_t *lap);
+
 lap_t *start_llap(char* name, transport_t *transport, lap_registry_t *registry, runloop_info_t *controlplane, runloop_info_t *dataplane);
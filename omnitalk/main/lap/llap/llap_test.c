@@ -1,8 +1,19 @@
 #include "lap/llap/llap_test.h"
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "lap/llap/llap.h"
 #include "mem/buffers.h"
 #include "mem/buffers_test.h"
+#include "net/transport.h"
 #include "proto/ddp.h"
+#include "proto/llap.h"
+#include "table/routing/table.h"
+#include "web/stats.h"
+#include "ddp_socket.h"
+#include "global_state.h"
+#include "runloop_types.h"
 #include "test.h"
 
 bool llap_extract_ddp_packet(buffer_t *buf);
@@ -31,7 +42,7 @@ TEST_FUNCTION(test_llap_extract_ddp_packet) {
 	packet_len=37;
 	buf = buf_from_string(packet, 3, packet_len);
 	result = llap_extract_ddp_packet(buf);
-
+	
 	TEST_ASSERT(result);
 	TEST_ASSERT(DDP_DSTSOCK(buf) == 4);
 	TEST_ASSERT(DDP_DST(buf) == 135);
@@ -46,7 +57,7 @@ TEST_FUNCTION(test_llap_extract_ddp_packet) {
 	result = llap_extract_ddp_packet(buf);
 	TEST_ASSERT(!result);
 	freebuf(buf);
-
+	
 
 	// Bad LLAP type
 	packet="\xff\x01\x04\x00\x18\x01\x01\x01\x00\x0c\x08\x01\x00\x00\x82\x00\x03\x80\x00\x0a\x82\x00\x0b\x00\x00\x0c\x00";
@@ -59,3 +70,156 @@ TEST_FUNCTION(test_llap_extract_ddp_packet) {
 	
 	TEST_OK();
 }
+
+// drain_queue throws away what's on a queue and says how many there were,
+// or -1 if any of them wasn't an LLAP frame of the given type
+static int drain_queue(QueueHandle_t queue, uint8_t llap_type) {
+	buffer_t *buf;
+	int count = 0;
+	bool all_right = true;
+	
+	while (xQueueReceive(queue, &buf, 0) == pdTRUE) {
+		if (buf->length < sizeof(llap_hdr_t) || buf->data[2] != llap_type) {
+			all_right = false;
+		}
+		count++;
+		freebuf(buf);
+	}
+	return all_right ? count : -1;
+}
+
+TEST_FUNCTION(test_llap_acquisition) {
+	transport_t transport = {
+		.inbound = xQueueCreate(16, sizeof(buffer_t*)),
+		.outbound = xQueueCreate(32, sizeof(buffer_t*)),
+	};
+	runloop_info_t controlplane = {
+		.incoming_packet_queue = xQueueCreate(4, sizeof(buffer_t*)),
+	};
+	llap_info_t info = { 0 };
+	lap_t lap = {
+		.id = MAX_LAP_COUNT - 1,
+		.name = "test",
+		.info = &info,
+		.transport = &transport,
+		.controlplane = &controlplane,
+	};
+	rt_routing_table_t *saved_table = global_routing_table;
+	global_routing_table = rt_new();
+	unsigned long conflicts = stats.llap_address_conflicts;
+	unsigned long acquisitions = stats.llap_acquisitions__phase_netinfo;
+	rt_route_t route;
+	buffer_t *buf;
+	
+	// The LAP only passes on packets for sockets that are open
+	ddp_socket_t* rtmp = ddp_socket_open(DDP_SOCKET_RTMP, "test/rtmp", 0);
+	TEST_ASSERT(rtmp != NULL);
+	
+	// We start off with a burst of ENQs for a server address
+	llap_start_acquisition(&lap);
+	TEST_ASSERT(info.state == LLAP_ACQUIRING_ADDRESS);
+	TEST_ASSERT(info.deadline != 0);
+	TEST_ASSERT(info.node_addr >= 128 && info.node_addr < 255);
+	TEST_ASSERT(drain_queue(transport.outbound, LLAP_TYPE_ENQ) == LLAP_ENQ_BURST);
+	
+	// Someone ACKs it, so we try another
+	uint8_t candidate = info.node_addr;
+	buf = buf_from_string("\x00\x00\x82", 3, 3);
+	buf->data[0] = candidate;
+	buf->data[1] = candidate;
+	llap_handle_frame(&lap, buf);
+	TEST_ASSERT(stats.llap_address_conflicts == conflicts + 1);
+	TEST_ASSERT(info.state == LLAP_ACQUIRING_ADDRESS);
+	TEST_ASSERT(drain_queue(transport.outbound, LLAP_TYPE_ENQ) == LLAP_ENQ_BURST);
+	
+	// Nobody objects to that one, so we ask for the network number
+	candidate = info.node_addr;
+	llap_handle_deadline(&lap);
+	TEST_ASSERT(info.state == LLAP_ACQUIRING_NETINFO);
+	TEST_ASSERT(info.node_addr == candidate);
+	TEST_ASSERT(drain_queue(transport.outbound, LLAP_TYPE_DDP_SHORT) == LLAP_RTMP_REQUEST_BURST);
+	
+	// A router's RTMP broadcast tells us it's network 0x1234, and goes on to
+	// the control plane
+	buf = buf_from_string("\xff\x01\x01\x00\x0c\x01\x01\x01\x12\x34\x08\x01\x00\x00\x82", 3, 15);
+	llap_handle_frame(&lap, buf);
+	TEST_ASSERT(info.state == LLAP_RUNNING);
+	TEST_ASSERT(info.deadline == 0);
+	TEST_ASSERT(info.discovered_net == 0x1234);
+	TEST_ASSERT(info.discovered_seeding_node == 1);
+	TEST_ASSERT(lap.my_network == 0x1234);
+	TEST_ASSERT(lap.my_address == candidate);
+	TEST_ASSERT(stats.llap_acquisitions__phase_netinfo == acquisitions + 1);
+	TEST_ASSERT(rt_lookup(global_routing_table, 0x1234, &route) && route.outbound_lap == &lap);
+	TEST_ASSERT(drain_queue(controlplane.incoming_packet_queue, LLAP_TYPE_DDP_SHORT) == 1);
+	
+	// Now the address is ours, we ACK anyone else's ENQ for it
+	buf = buf_from_string("\x00\x00\x81", 3, 3);
+	buf->data[0] = candidate;
+	buf->data[1] = candidate;
+	llap_handle_frame(&lap, buf);
+	TEST_ASSERT(stats.llap_address_conflicts == conflicts + 1);
+	TEST_ASSERT(drain_queue(transport.outbound, LLAP_TYPE_ACK) == 1);
+	
+	ddp_socket_close(rtmp);
+	global_routing_table = saved_table;
+	vQueueDelete(transport.inbound);
+	vQueueDelete(transport.outbound);
+	vQueueDelete(controlplane.incoming_packet_queue);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_llap_fwdreq_for_another_network) {
+	transport_t transport = { 0 };
+	runloop_info_t controlplane = {
+		.incoming_packet_queue = xQueueCreate(4, sizeof(buffer_t*)),
+	};
+	llap_info_t info = { .state = LLAP_RUNNING };
+	lap_t lap = {
+		.id = MAX_LAP_COUNT - 1,
+		.name = "test",
+		.info = &info,
+		.transport = &transport,
+		.controlplane = &controlplane,
+		.my_address = 5,
+		.my_network = 1,
+		.network_range_start = 1,
+		.network_range_end = 1,
+	};
+	lap_t other_lap = { .name = "other" };
+	rt_routing_table_t *saved_table = global_routing_table;
+	global_routing_table = rt_new();
+	rt_touch_direct(global_routing_table, 1, 1, &lap);
+	rt_touch_direct(global_routing_table, 7, 7, &other_lap);
+	rt_touch(global_routing_table, (rt_route_t){ .range_start = 30, .range_end = 30,
+		.outbound_lap = &lap, .nexthop = { .network = 1, .node = 9 }, .distance = 1 });
+	
+	ddp_socket_t* nbp = ddp_socket_open(DDP_SOCKET_NBP, "test/nbp", 0);
+	TEST_ASSERT(nbp != NULL);
+	
+	// A router across this network sends us a FwdReq for network 7, which
+	// is on another of our ports: it's addressed to any router there
+	char* packet = "\x05\x09\x02\x00\x11\x00\x00\x00\x07\x00\x01\x00\x09\x02\x02\x02"
+		"\x41\x2a\x00\x00";
+	buffer_t *buf = buf_from_string(packet, 3, 20);
+	llap_handle_frame(&lap, buf);
+	TEST_ASSERT(uxQueueMessagesWaiting(controlplane.incoming_packet_queue) == 1);
+	
+	// One for a network that isn't directly connected isn't for us
+	unsigned long not_for_us = stats.llap_in_drops__reason_not_for_us;
+	buf = buf_from_string(packet, 3, 20);
+	buf->data[8] = 30;
+	llap_handle_frame(&lap, buf);
+	TEST_ASSERT(stats.llap_in_drops__reason_not_for_us == not_for_us + 1);
+	TEST_ASSERT(uxQueueMessagesWaiting(controlplane.incoming_packet_queue) == 1);
+	
+	while (xQueueReceive(controlplane.incoming_packet_queue, &buf, 0) == pdTRUE) {
+		freebuf(buf);
+	}
+	ddp_socket_close(nbp);
+	global_routing_table = saved_table;
+	vQueueDelete(controlplane.incoming_packet_queue);
+	
+	TEST_OK();
+}
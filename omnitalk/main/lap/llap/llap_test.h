@@ -2,3 +2,5 @@
 #include "test.h"
 
 TEST_FUNCTION(test_llap_extract_ddp_packet);
+TEST_FUNCTION(test_llap_acquisition);
+TEST_FUNCTION(test_llap_fwdreq_for_another_network);
@@ -2,16 +2,15 @@
 
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <freertos/FreeRTOS.h>
-#include <freertos/event_groups.h>
 #include <freertos/semphr.h>
 
 #include "web/stats.h"
 
 lap_registry_t* lap_registry_new() {
 	lap_registry_t *reg = calloc(1, sizeof(*reg));
-	reg->ready_laps = xEventGroupCreate();
 	reg->mutex = xSemaphoreCreateMutex();
 	reg->root.dummy = true;
 	
@@ -44,9 +43,6 @@ int lap_registry_lap_count(lap_registry_t *registry) {
 void lap_registry_register(lap_registry_t* registry, lap_t *lap) {
 	while (xSemaphoreTake(registry->mutex, portMAX_DELAY) != pdTRUE) {}
 	
-	// Add this LAP to the bitfield
-	registry->registered_laps = registry->registered_laps | (1 << lap->id);
-	
 	bool lap_exists = false;
 	
 	// And to the list, sorting by LAP quality
@@ -95,6 +91,23 @@ lap_t* lap_registry_highest_quality_lap(lap_registry_t* registry) {
 	return lap;
 }
 
+lap_t* lap_registry_find_by_name(lap_registry_t* registry, const char* name) {
+	lap_t *lap = NULL;
+	
+	while (xSemaphoreTake(registry->mutex, portMAX_DELAY) != pdTRUE) {}
+	
+	for (struct lap_registry_node_s *curr = &registry->root; curr != NULL; curr = curr->next) {
+		if (!curr->dummy && curr->lap->name != NULL && strcmp(curr->lap->name, name) == 0) {
+			lap = curr->lap;
+			break;
+		}
+	}
+	
+	xSemaphoreGive(registry->mutex);
+	
+	return lap;
+}
+
 void lap_registry_update_zone_cache(lap_registry_t *registry) {
 	while (xSemaphoreTake(registry->mutex, portMAX_DELAY) != pdTRUE) {}
 
@@ -7,9 +7,9 @@ TEST_FUNCTION(test_lap_registry_ordering) {
 	lap_registry_t *reg = lap_registry_new();
 	TEST_ASSERT(reg != NULL);
 	
-	lap_t good_lap = { .id = 3, .quality = 1 };
-	lap_t better_lap = { .id = 2, .quality = 2 };
-	lap_t best_lap = { .id = 1, .quality = 3 };
+	lap_t good_lap = { .id = 3, .quality = 1, .name = "good" };
+	lap_t better_lap = { .id = 2, .quality = 2, .name = "better" };
+	lap_t best_lap = { .id = 1, .quality = 3, .name = "best" };
 
 	// Register the middle LAP first
 	lap_registry_register(reg, &better_lap);
@@ -26,6 +26,11 @@ TEST_FUNCTION(test_lap_registry_ordering) {
 	TEST_ASSERT(lap_registry_highest_quality_lap(reg) == &best_lap);
 	TEST_ASSERT(lap_registry_lap_count(reg) == 3);
 	
+	// They can be found by name, whatever order they're in
+	TEST_ASSERT(lap_registry_find_by_name(reg, "good") == &good_lap);
+	TEST_ASSERT(lap_registry_find_by_name(reg, "best") == &best_lap);
+	TEST_ASSERT(lap_registry_find_by_name(reg, "worst") == NULL);
+	
 	TEST_OK();
 }
 
@@ -52,3 +57,20 @@ TEST_FUNCTION(test_lap_registry_zone_cache) {
 	
 	TEST_OK();
 }
+
+TEST_FUNCTION(test_lap_registry_many_laps) {
+	lap_registry_t *reg = lap_registry_new();
+	TEST_ASSERT(reg != NULL);
+	
+	// More LAPs than a FreeRTOS event group has bits
+	static lap_t laps[40];
+	for (int i = 0; i < 40; i++) {
+		laps[i] = (lap_t){ .id = i + 1, .quality = i };
+		lap_registry_register(reg, &laps[i]);
+	}
+	
+	TEST_ASSERT(lap_registry_lap_count(reg) == 40);
+	TEST_ASSERT(lap_registry_highest_quality_lap(reg) == &laps[39]);
+	
+	TEST_OK();
+}
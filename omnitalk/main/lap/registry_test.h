@@ -4,3 +4,4 @@
 
 TEST_FUNCTION(test_lap_registry_ordering);
 TEST_FUNCTION(test_lap_registry_zone_cache);
+TEST_FUNCTION(test_lap_registry_many_laps);
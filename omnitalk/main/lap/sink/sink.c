@@ -15,7 +15,7 @@ static void sink_rx_runloop(void* tp) {
 	ESP_ERROR_CHECK(enable_transport(transport));
 	ESP_LOGI(TAG, "started sink for %s", transport->kind);
 	while(1) {
-		xQueueReceive(transport->inbound, &buff, portMAX_DELAY);
+		buff = trecv(transport);
 		if (buff != NULL) {
 			//ESP_LOGI(TAG, "sink %s: received frame of %zu bytes", transport->kind, buff->length);
 			freebuf(buff);
@@ -1,11 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "app/app.h"
+#include "boot/boot.h"
 #include "net/net.h"
+#include "persist/persist.h"
 #include "web/stats.h"
 #include "web/web.h"
 #include "controlplane_runloop.h"
@@ -13,29 +16,50 @@
 #include "test.h"
 #include "tunables.h"
 
+static runloop_info_t controlplane;
+static runloop_info_t router;
+
+static void start_runloops(void) {
+	controlplane = start_controlplane_runloop();
+	router = start_router_runloop();
+}
+
+static void start_laps(void) {
+	start_net_laps(&controlplane, &router);
+}
+
+// The TashTalk's UART and the Ethernet PHY are the slow bits, and don't
+// need each other, so they come up at the same time
+static boot_phase_t boot_phases[] = {
+	{ .name = "stats", .start = &start_stats },
+	{ .name = "runloops", .start = &start_runloops },
+	{ .name = "apps", .start = &start_apps, .after = { "runloops" } },
+	{ .name = "persist", .start = &start_persist },
+	{ .name = "netif", .start = &start_net_common },
+	{ .name = "ethernet", .start = &start_net_ethernet, .after = { "netif" } },
+	{ .name = "mdns", .start = &start_net_mdns, .after = { "ethernet" } },
+	{ .name = "tashtalk", .start = &start_net_tashtalk },
+	{ .name = "udp", .start = &start_net_udp, .after = { "netif" } },
+	{ .name = "laps", .start = &start_laps,
+		.after = { "runloops", "apps", "persist", "ethernet", "tashtalk", "udp" } },
+	{ .name = "warm_start", .start = &persist_warm_start, .after = { "laps" } },
+	{ .name = "web", .start = &start_web, .after = { "netif", "apps", "laps" } },
+};
+
 void app_main(void)
 {
-	runloop_info_t controlplane;
-	runloop_info_t router;
-	
 #ifdef RUN_TESTS
 	test_main();
 #endif
 
 	printf("Welcome to OmniTalk\n");
 	printf("Version: %s built on %s\n", GIT_VERSION, BUILD_TIMESTAMP);
-	start_stats();
-	
-	controlplane = start_controlplane_runloop();
-	router = start_router_runloop();
 	
-	start_apps();
-
-	start_net(&controlplane, &router);	
-	start_web();
-	
-	controlplane=controlplane;
-	router = router;
+	size_t phase_count = sizeof(boot_phases) / sizeof(boot_phase_t);
+	if (!boot_run(boot_phases, phase_count)) {
+		abort();
+	}
+	boot_report(boot_phases, phase_count);
 	
 	while(1) {
 		vTaskDelay(portMAX_DELAY);
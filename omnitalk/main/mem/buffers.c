@@ -53,6 +53,30 @@ buffer_t *wrapbuf(void* data, size_t length) {
 	return buff;
 }
 
+buffer_t *buf_clone(buffer_t *buffer) {
+	// The buffer's memory runs from mem_top to the end of its capacity
+	size_t headroom = buffer->data - buffer->mem_top;
+	size_t size = headroom + buffer->capacity;
+	
+	uint8_t *mem = (uint8_t*)malloc(size);
+	buffer_t *clone = (buffer_t*)malloc(sizeof(buffer_t));
+	assert(mem != NULL && clone != NULL);
+	
+	memcpy(mem, buffer->mem_top, size);
+	memcpy(clone, buffer, sizeof(buffer_t));
+	
+	clone->mem_top = mem;
+	clone->data = mem + headroom;
+	if (buffer->ddp_data != NULL) {
+		clone->ddp_data = mem + (buffer->ddp_data - buffer->mem_top);
+	}
+	if (buffer->ddp_payload != NULL) {
+		clone->ddp_payload = mem + (buffer->ddp_payload - buffer->mem_top);
+	}
+	
+	return clone;
+}
+
 void buf_trim_l2_hdr_bytes(buffer_t *buffer, size_t bytes) {
 	assert(bytes <= buffer->capacity);
 	buffer->data += bytes;
@@ -57,6 +57,9 @@ buffer_t *newbuf(size_t data_capacity, size_t l2_hdr_len);
 buffer_t *newbuf_ddp();
 void freebuf(buffer_t *buffer_t);
 buffer_t *wrapbuf(void* data, size_t length);
+// buf_clone makes a copy of a buffer, headroom and all, that can be freed
+// separately
+buffer_t *buf_clone(buffer_t *buffer);
 bool buf_setup_ddp(buffer_t *buf, size_t l2_hdr_len, buffer_ddp_type_t ddp_header_type);
 void printbuf(buffer_t *buffer);
 void printbuf_as_c_literal(buffer_t *buffer);
@@ -106,7 +109,7 @@ static inline bool buf_append_pstring(buffer_t *buffer, pstring *str) {
 	return buf_append_all(buffer, (uint8_t*)str, ((size_t)str->length) + 1);
 }
 
-static inline bool buffer_append_cstring_as_pstring(buffer_t *buffer, char *str) {
+static inline bool buffer_append_cstring_as_pstring(buffer_t *buffer, const char *str) {
 	if (buffer == NULL || buffer->data == NULL) {
 		return false;
 	}
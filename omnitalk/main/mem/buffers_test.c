@@ -251,3 +251,32 @@ TEST_FUNCTION(test_buf_append) {
 	free(gibberish);
 	TEST_OK();
 }
+
+TEST_FUNCTION(test_buf_clone) {
+	long active_allocs = stats.mem_all_allocs - stats.mem_all_frees;
+	
+	// An NBP LkUp with a short DDP header, behind an LLAP header
+	buffer_t *buf = buf_from_string("\xff\x01\x01\x00\x0a\x02\x02\x02\x21\x00\x01\xfe\x02", 3, 13);
+	TEST_ASSERT(buf_setup_ddp(buf, 3, BUF_SHORT_HEADER));
+	
+	buffer_t *clone = buf_clone(buf);
+	TEST_ASSERT(clone->mem_top != buf->mem_top);
+	TEST_ASSERT(clone->length == buf->length);
+	TEST_ASSERT(clone->data - clone->mem_top == buf->data - buf->mem_top);
+	TEST_ASSERT(clone->ddp_data - clone->data == buf->ddp_data - buf->data);
+	TEST_ASSERT(clone->ddp_payload - clone->data == buf->ddp_payload - buf->data);
+	TEST_ASSERT(DDP_DSTSOCK(clone) == 2);
+	TEST_ASSERT(memcmp(clone->data, buf->data, buf->length) == 0);
+	
+	// Changing one doesn't change the other
+	clone->ddp_payload[0] = 0x31;
+	TEST_ASSERT(buf->ddp_payload[0] == 0x21);
+	
+	// and they can be freed separately, without leaking
+	freebuf(buf);
+	TEST_ASSERT(clone->ddp_payload[1] == 0x00);
+	freebuf(clone);
+	TEST_ASSERT(active_allocs == (stats.mem_all_allocs - stats.mem_all_frees));
+	
+	TEST_OK();
+}
@@ -9,3 +9,4 @@ TEST_FUNCTION(test_newbuf);
 TEST_FUNCTION(test_buf_l2hdr_shenanigans);
 TEST_FUNCTION(test_buf_ddp_setup);
 TEST_FUNCTION(test_buf_append);
+TEST_FUNCTION(test_buf_clone);
@@ -0,0 +1,234 @@
+#include "nbp_cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+
+#include "proto/nbp.h"
+#include "web/stats.h"
+
+nbp_cache_t* nbp_cache_new(size_t capacity, int64_t ttl_us) {
+	nbp_cache_t* cache = calloc(1, sizeof(nbp_cache_t));
+	assert(cache != NULL);
+	
+	cache->mutex = xSemaphoreCreateMutex();
+	cache->ttl_us = ttl_us;
+	cache->capacity = capacity;
+	cache->entries = calloc(capacity, sizeof(nbp_cache_entry_t));
+	cache->queries = calloc(capacity, sizeof(nbp_cache_query_t));
+	assert(cache->entries != NULL && cache->queries != NULL);
+	
+	return cache;
+}
+
+static void nbp_cache_lock(nbp_cache_t* cache) {
+	while (xSemaphoreTake(cache->mutex, portMAX_DELAY) != pdTRUE) {}
+}
+
+static void nbp_cache_unlock(nbp_cache_t* cache) {
+	xSemaphoreGive(cache->mutex);
+}
+
+static bool nbp_cache_copy_part(char* dst, char* folded, pstring* src) {
+	if (src->length >= NBP_CACHE_PART_LEN) {
+		return false;
+	}
+	memcpy(dst, src->str, src->length);
+	dst[src->length] = '\0';
+	nbp_fold(folded, src->str, src->length);
+	return true;
+}
+
+// nbp_cache_slot finds the entry for a name if we've got one, or somewhere
+// to put it if we haven't, throwing out whatever's closest to expiring if
+// the cache is full.
+static nbp_cache_entry_t* nbp_cache_slot(nbp_cache_t* cache, nbp_cache_entry_t* name,
+	int64_t now) {
+	
+	nbp_cache_entry_t* free_slot = NULL;
+	nbp_cache_entry_t* soonest = &cache->entries[0];
+	for (size_t i = 0; i < cache->capacity; i++) {
+		nbp_cache_entry_t* entry = &cache->entries[i];
+		if (!entry->in_use || entry->expires_at <= now) {
+			if (free_slot == NULL) {
+				free_slot = entry;
+			}
+			continue;
+		}
+		if (entry->lap == name->lap &&
+			strcmp(entry->folded_object, name->folded_object) == 0 &&
+			strcmp(entry->folded_type, name->folded_type) == 0 &&
+			strcmp(entry->folded_zone, name->folded_zone) == 0) {
+			
+			return entry;
+		}
+		if (entry->expires_at < soonest->expires_at) {
+			soonest = entry;
+		}
+	}
+	
+	if (free_slot != NULL) {
+		return free_slot;
+	}
+	stats.nbp_cache_names_evicted++;
+	return soonest;
+}
+
+void nbp_cache_learn(nbp_cache_t* cache, buffer_t* reply, lap_t* lap) {
+	if (nbp_packet_function(reply) != NBP_LKUP_REPLY || cache->capacity == 0) {
+		return;
+	}
+	
+	int64_t now = esp_timer_get_time();
+	nbp_cache_lock(cache);
+	
+	for (struct nbp_tuple_s* tuple = nbp_get_first_tuple(reply); tuple != NULL;
+		tuple = nbp_get_next_tuple(reply, tuple)) {
+		
+		// Nodes usually leave it to us to know what zone they're in
+		pstring* zone = nbp_tuple_get_zone(tuple);
+		if (zone->length == 0 || pstring_eq_cstring(zone, "*")) {
+			zone = lap->my_zone;
+			if (zone == NULL) {
+				continue;
+			}
+		}
+		
+		nbp_cache_entry_t name = {
+			.in_use = true,
+			.expires_at = now + cache->ttl_us,
+			.lap = lap,
+			.network = NBP_TUPLE_NETWORK(tuple),
+			.node = NBP_TUPLE_NODE(tuple),
+			.socket = NBP_TUPLE_SOCKET(tuple),
+			.enumerator = tuple->enumerator,
+		};
+		if (!nbp_cache_copy_part(name.object, name.folded_object, nbp_tuple_get_object(tuple)) ||
+			!nbp_cache_copy_part(name.type, name.folded_type, nbp_tuple_get_type(tuple)) ||
+			!nbp_cache_copy_part(name.zone, name.folded_zone, zone)) {
+			
+			continue;
+		}
+		
+		*nbp_cache_slot(cache, &name, now) = name;
+		stats.nbp_cache_names_learned++;
+	}
+	
+	nbp_cache_unlock(cache);
+}
+
+static bool nbp_cache_query_fold(nbp_cache_query_t* query, pstring* object, pstring* type,
+	pstring* zone) {
+	
+	if (object->length >= NBP_CACHE_PART_LEN || type->length >= NBP_CACHE_PART_LEN ||
+		zone->length >= NBP_CACHE_PART_LEN) {
+		
+		return false;
+	}
+	nbp_fold(query->folded_object, object->str, object->length);
+	nbp_fold(query->folded_type, type->str, type->length);
+	nbp_fold(query->folded_zone, zone->str, zone->length);
+	return true;
+}
+
+static bool nbp_cache_queries_equal(nbp_cache_query_t* a, nbp_cache_query_t* b) {
+	return a->lap == b->lap &&
+		strcmp(a->folded_object, b->folded_object) == 0 &&
+		strcmp(a->folded_type, b->folded_type) == 0 &&
+		strcmp(a->folded_zone, b->folded_zone) == 0;
+}
+
+void nbp_cache_note_lookup(nbp_cache_t* cache, pstring* object, pstring* type, pstring* zone,
+	lap_t* lap) {
+	
+	nbp_cache_query_t lookup = { .in_use = true, .lap = lap };
+	if (cache->capacity == 0 || !nbp_cache_query_fold(&lookup, object, type, zone)) {
+		return;
+	}
+	
+	int64_t now = esp_timer_get_time();
+	lookup.expires_at = now + cache->ttl_us;
+	
+	nbp_cache_lock(cache);
+	
+	// The same lookup again replaces the old one; otherwise it goes in a
+	// free slot, or the one closest to expiring
+	nbp_cache_query_t* slot = NULL;
+	nbp_cache_query_t* soonest = &cache->queries[0];
+	for (size_t i = 0; i < cache->capacity; i++) {
+		nbp_cache_query_t* query = &cache->queries[i];
+		if (!query->in_use || query->expires_at <= now) {
+			if (slot == NULL) {
+				slot = query;
+			}
+			continue;
+		}
+		if (nbp_cache_queries_equal(query, &lookup)) {
+			slot = query;
+			break;
+		}
+		if (query->expires_at < soonest->expires_at) {
+			soonest = query;
+		}
+	}
+	*(slot != NULL ? slot : soonest) = lookup;
+	
+	nbp_cache_unlock(cache);
+}
+
+bool nbp_cache_answer(nbp_cache_t* cache, pstring* object, pstring* type, pstring* zone,
+	lap_t* lap, void* pvt, nbp_cache_iterator iterator) {
+	
+	nbp_cache_query_t lookup = { .in_use = true, .lap = lap };
+	if (cache->capacity == 0 || !nbp_cache_query_fold(&lookup, object, type, zone)) {
+		return false;
+	}
+	
+	int64_t now = esp_timer_get_time();
+	nbp_cache_lock(cache);
+	
+	bool asked = false;
+	for (size_t i = 0; i < cache->capacity; i++) {
+		nbp_cache_query_t* query = &cache->queries[i];
+		if (query->in_use && query->expires_at > now && nbp_cache_queries_equal(query, &lookup)) {
+			asked = true;
+			break;
+		}
+	}
+	
+	if (!asked) {
+		nbp_cache_unlock(cache);
+		stats.nbp_cache_lookups__result_miss++;
+		return false;
+	}
+	
+	nbp_pattern_t object_pattern;
+	nbp_pattern_t type_pattern;
+	nbp_pattern_from(&object_pattern, object);
+	nbp_pattern_from(&type_pattern, type);
+	
+	// Nothing learnt means the replies went node to node without passing
+	// us, so the lookup has to go out again
+	size_t found = 0;
+	for (size_t i = 0; i < cache->capacity; i++) {
+		nbp_cache_entry_t* entry = &cache->entries[i];
+		if (entry->in_use && entry->expires_at > now && entry->lap == lap &&
+			strcmp(entry->folded_zone, lookup.folded_zone) == 0 &&
+			nbp_pattern_matches(&type_pattern, entry->folded_type) &&
+			nbp_pattern_matches(&object_pattern, entry->folded_object)) {
+			
+			iterator(pvt, entry);
+			found++;
+		}
+	}
+	
+	nbp_cache_unlock(cache);
+	if (found == 0) {
+		stats.nbp_cache_lookups__result_miss++;
+		return false;
+	}
+	stats.nbp_cache_lookups__result_hit++;
+	return true;
+}
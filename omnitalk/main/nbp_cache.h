@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "lap/lap.h"
+#include "mem/buffers.h"
+#include "util/pstring.h"
+
+// nbp_cache saves LocalTalk the LkUp broadcasts that the Chooser and
+// printing clients cause by asking the same thing every second or so.
+//
+// It learns names and addresses from the LkUp-Replies it sees on each
+// port, and remembers which lookups the router's broadcast on each port.
+// When the router's about to broadcast a lookup on a port that it's already
+// broadcast there in the last ttl_us, it answers from what it learnt
+// instead.  Anything that didn't answer the first time won't be found
+// until the lookup's forgotten, so the TTL is kept short.
+
+// NBP objects, types and zones are at most 32 characters
+#define NBP_CACHE_PART_LEN 33
+
+typedef struct {
+	bool in_use;
+	int64_t expires_at;
+	
+	// Where the replies were seen
+	lap_t* lap;
+	
+	uint16_t network;
+	uint8_t node;
+	uint8_t socket;
+	uint8_t enumerator;
+	
+	char object[NBP_CACHE_PART_LEN];
+	char type[NBP_CACHE_PART_LEN];
+	char zone[NBP_CACHE_PART_LEN];
+	
+	char folded_object[NBP_CACHE_PART_LEN];
+	char folded_type[NBP_CACHE_PART_LEN];
+	char folded_zone[NBP_CACHE_PART_LEN];
+} nbp_cache_entry_t;
+
+// A lookup the router's broadcast, as it was asked: the object and type
+// can be wildcards.
+typedef struct {
+	bool in_use;
+	int64_t expires_at;
+	
+	lap_t* lap;
+	char folded_object[NBP_CACHE_PART_LEN];
+	char folded_type[NBP_CACHE_PART_LEN];
+	char folded_zone[NBP_CACHE_PART_LEN];
+} nbp_cache_query_t;
+
+typedef struct {
+	SemaphoreHandle_t mutex;
+	int64_t ttl_us;
+	
+	size_t capacity;
+	nbp_cache_entry_t* entries;
+	nbp_cache_query_t* queries;
+} nbp_cache_t;
+
+// nbp_cache_new makes a cache of up to capacity names, and as many
+// lookups, each remembered for ttl_us.
+nbp_cache_t* nbp_cache_new(size_t capacity, int64_t ttl_us);
+
+// nbp_cache_learn remembers the names in a LkUp-Reply that's arrived on
+// lap.  A tuple whose zone is "*" is in the zone of the port.  The packet
+// still belongs to the caller.
+void nbp_cache_learn(nbp_cache_t* cache, buffer_t* reply, lap_t* lap);
+
+// nbp_cache_note_lookup remembers that the router's broadcast a lookup on
+// lap.
+void nbp_cache_note_lookup(nbp_cache_t* cache, pstring* object, pstring* type, pstring* zone,
+	lap_t* lap);
+
+// nbp_cache_iterator is called with each cached name that answers a
+// lookup.  It's called with the cache locked, so it mustn't call back into
+// the cache.
+typedef void (*nbp_cache_iterator)(void* pvt, const nbp_cache_entry_t* entry);
+
+// nbp_cache_answer returns true if the lookup's been broadcast on lap
+// recently enough, and some of the names it learnt since match, calling
+// the iterator with each of them.  It returns false, and calls nothing, if
+// the lookup has to be broadcast.
+bool nbp_cache_answer(nbp_cache_t* cache, pstring* object, pstring* type, pstring* zone,
+	lap_t* lap, void* pvt, nbp_cache_iterator iterator);
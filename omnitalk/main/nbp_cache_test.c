@@ -0,0 +1,162 @@
+#include "nbp_cache_test.h"
+#include "nbp_cache.h"
+
+#include <string.h>
+
+#include "lap/lap.h"
+#include "mem/buffers.h"
+#include "proto/ddp.h"
+#include "proto/nbp.h"
+#include "util/pstring.h"
+#include "web/stats.h"
+#include "test.h"
+
+static lap_t port_a = { .my_zone = (pstring*)"\x05Zone1" };
+static lap_t port_b = { .my_zone = (pstring*)"\x05Zone2" };
+
+typedef struct {
+	int count;
+	uint16_t network;
+	uint8_t node;
+	uint8_t socket;
+	char object[NBP_CACHE_PART_LEN];
+} answered_t;
+
+static void see_answer(void* pvt, const nbp_cache_entry_t* entry) {
+	answered_t* answered = (answered_t*)pvt;
+	
+	answered->count++;
+	answered->network = entry->network;
+	answered->node = entry->node;
+	answered->socket = entry->socket;
+	strcpy(answered->object, entry->object);
+}
+
+// lkup_reply builds a LkUp-Reply with one tuple, object:LaserWriter@zone,
+// for node 5.node, socket 129
+static buffer_t* lkup_reply(const char* object, uint8_t node, const char* zone) {
+	buffer_t *buff = newbuf_ddp();
+	ddp_set_ddptype(buff, DDP_TYPE_NBP);
+	buf_expand_payload(buff, sizeof(nbp_packet_t) + sizeof(struct nbp_tuple_s));
+	((nbp_packet_t*)buff->ddp_payload)->nbp_id = 42;
+	((nbp_packet_t*)buff->ddp_payload)->function_and_tuple_count = (NBP_LKUP_REPLY << 4) | 1;
+	
+	struct nbp_tuple_s *tuple = (struct nbp_tuple_s*)NBP_PACKET_TUPLES(buff);
+	NBP_TUPLE_SET_NETWORK(tuple, 5);
+	NBP_TUPLE_SET_NODE(tuple, node);
+	NBP_TUPLE_SET_SOCKET(tuple, 129);
+	buffer_append_cstring_as_pstring(buff, object);
+	buffer_append_cstring_as_pstring(buff, "LaserWriter");
+	buffer_append_cstring_as_pstring(buff, zone);
+	return buff;
+}
+
+static int answer(nbp_cache_t* cache, const char* object, const char* zone, lap_t* lap,
+	answered_t* answered) {
+	
+	char object_buf[256];
+	char zone_buf[256];
+	object_buf[0] = strlen(object);
+	memcpy(&object_buf[1], object, object_buf[0]);
+	zone_buf[0] = strlen(zone);
+	memcpy(&zone_buf[1], zone, zone_buf[0]);
+	
+	memset(answered, 0, sizeof(answered_t));
+	if (!nbp_cache_answer(cache, (pstring*)object_buf, (pstring*)"\x0bLaserWriter",
+		(pstring*)zone_buf, lap, answered, &see_answer)) {
+		
+		return -1;
+	}
+	return answered->count;
+}
+
+static void note_lookup(nbp_cache_t* cache, const char* zone, lap_t* lap) {
+	char zone_buf[256];
+	zone_buf[0] = strlen(zone);
+	memcpy(&zone_buf[1], zone, zone_buf[0]);
+	nbp_cache_note_lookup(cache, (pstring*)"\x01=", (pstring*)"\x0bLaserWriter",
+		(pstring*)zone_buf, lap);
+}
+
+TEST_FUNCTION(test_nbp_cache_answers_repeated_lookups) {
+	nbp_cache_t* cache = nbp_cache_new(8, 10 * 1000000LL);
+	answered_t answered;
+	
+	buffer_t *reply = lkup_reply("Printer One", 20, "*");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	reply = lkup_reply("Printer Two", 21, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	
+	// Until the router's broadcast the lookup itself, it can't know the
+	// cache has every answer, so it mustn't answer from it
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == -1);
+	
+	// Once it has, the same lookup is answered from the cache; a reply in
+	// zone "*" was for the zone of the port it came in on
+	note_lookup(cache, "zone1", &port_a);
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == 2);
+	
+	// A different lookup still has to be broadcast, even if the cache
+	// could answer it, in case it turns up something new
+	TEST_ASSERT(answer(cache, "Printer Two", "Zone1", &port_a, &answered) == -1);
+	
+	// Names are only found on the port they were seen on
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_b, &answered) == -1);
+	note_lookup(cache, "Zone1", &port_b);
+	
+	// and if nothing's been learnt there, the lookup has to be broadcast
+	// again: the replies might have gone straight to the requester
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_b, &answered) == -1);
+	
+	// A name that's seen again is updated, not added
+	reply = lkup_reply("PRINTER TWO", 22, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == 2);
+	TEST_ASSERT(answered.network == 5);
+	TEST_ASSERT(answered.node == 22);
+	TEST_ASSERT(answered.socket == 129);
+	TEST_ASSERT(strcmp(answered.object, "PRINTER TWO") == 0);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_cache_expiry_and_eviction) {
+	nbp_cache_t* cache = nbp_cache_new(2, 10 * 1000000LL);
+	answered_t answered;
+	
+	buffer_t *reply = lkup_reply("Printer One", 20, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	note_lookup(cache, "Zone1", &port_a);
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == 1);
+	
+	// Once the lookup's expired, it's broadcast again
+	cache->queries[0].expires_at = 0;
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == -1);
+	note_lookup(cache, "Zone1", &port_a);
+	
+	// Expired names aren't answered
+	cache->entries[0].expires_at = 0;
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == -1);
+	
+	// When the cache is full, the name closest to expiring makes room
+	reply = lkup_reply("Printer Two", 21, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	reply = lkup_reply("Printer Three", 22, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	cache->entries[0].expires_at -= 1000;
+	prometheus_counter_t evicted = stats.nbp_cache_names_evicted;
+	reply = lkup_reply("Printer Four", 23, "Zone1");
+	nbp_cache_learn(cache, reply, &port_a);
+	freebuf(reply);
+	TEST_ASSERT(stats.nbp_cache_names_evicted == evicted + 1);
+	TEST_ASSERT(answer(cache, "=", "Zone1", &port_a, &answered) == 2);
+	TEST_ASSERT(cache->entries[0].node == 23);
+	
+	TEST_OK();
+}
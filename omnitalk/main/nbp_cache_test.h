@@ -0,0 +1,5 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_nbp_cache_answers_repeated_lookups);
+TEST_FUNCTION(test_nbp_cache_expiry_and_eviction);
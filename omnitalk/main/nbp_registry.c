@@ -0,0 +1,316 @@
+#include "nbp_registry.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "proto/nbp.h"
+#include "util/pstring.h"
+
+typedef struct nbp_type_s nbp_type_t;
+
+struct nbp_type_s {
+	char folded[NBP_REGISTRY_PART_LEN];
+	uint32_t hash;
+	
+	// In the order they were registered, so that lookups are answered in
+	// that order too
+	nbp_entity_t* entities;
+	
+	nbp_type_t* next_in_bucket;
+	nbp_type_t* next;
+};
+
+// Everything here is guarded by registry_mutex
+static nbp_type_t* type_buckets[NBP_REGISTRY_BUCKETS];
+static nbp_type_t* types;
+static nbp_entity_t* entity_buckets[NBP_REGISTRY_BUCKETS];
+static size_t entity_count;
+static SemaphoreHandle_t registry_mutex;
+
+void nbp_registry_init(void) {
+	if (registry_mutex == NULL) {
+		registry_mutex = xSemaphoreCreateMutex();
+	}
+}
+
+static void nbp_registry_lock(void) {
+	while (xSemaphoreTake(registry_mutex, portMAX_DELAY) != pdTRUE) {}
+}
+
+static void nbp_registry_unlock(void) {
+	xSemaphoreGive(registry_mutex);
+}
+
+// FNV-1a, carrying on from hash, so that an entity's hash can be its
+// type's with the object added
+static uint32_t nbp_hash(uint32_t hash, const char* str) {
+	for (; *str != '\0'; str++) {
+		hash ^= (uint8_t)*str;
+		hash *= 16777619;
+	}
+	return hash;
+}
+
+#define NBP_HASH_INIT 2166136261u
+
+static uint32_t nbp_entity_hash(nbp_type_t* type, const char* folded_object) {
+	// The separator stops "ab"+"c" hashing the same as "a"+"bc"
+	return nbp_hash(nbp_hash(type->hash, ":"), folded_object);
+}
+
+static nbp_type_t* nbp_find_type(const char* folded, uint32_t hash) {
+	for (nbp_type_t* curr = type_buckets[hash % NBP_REGISTRY_BUCKETS]; curr != NULL;
+		curr = curr->next_in_bucket) {
+		
+		if (curr->hash == hash && strcmp(curr->folded, folded) == 0) {
+			return curr;
+		}
+	}
+	return NULL;
+}
+
+static nbp_entity_t* nbp_find_entity(nbp_type_t* type, const char* folded_object) {
+	uint32_t hash = nbp_entity_hash(type, folded_object);
+	for (nbp_entity_t* curr = entity_buckets[hash % NBP_REGISTRY_BUCKETS]; curr != NULL;
+		curr = curr->next_in_bucket) {
+		
+		if (curr->hash == hash && curr->of_type == type &&
+			strcmp(curr->folded_object, folded_object) == 0) {
+			
+			return curr;
+		}
+	}
+	return NULL;
+}
+
+// nbp_free_enumerator finds the lowest enumerator that none of the
+// socket's names has yet
+static uint8_t nbp_free_enumerator(uint8_t socket) {
+	uint32_t used[256 / 32] = { 0 };
+	for (nbp_type_t* type = types; type != NULL; type = type->next) {
+		for (nbp_entity_t* curr = type->entities; curr != NULL; curr = curr->next_of_type) {
+			if (curr->socket == socket) {
+				used[curr->enumerator / 32] |= 1u << (curr->enumerator % 32);
+			}
+		}
+	}
+	
+	for (int i = 0; i < 256; i++) {
+		if ((used[i / 32] & (1u << (i % 32))) == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+bool nbp_registry_register(const char* object, const char* type_name, uint8_t socket) {
+	size_t object_len = strlen(object);
+	size_t type_len = strlen(type_name);
+	if (object_len == 0 || object_len >= NBP_REGISTRY_PART_LEN ||
+		type_len == 0 || type_len >= NBP_REGISTRY_PART_LEN) {
+		
+		return false;
+	}
+	
+	nbp_entity_t* entity = calloc(1, sizeof(nbp_entity_t));
+	if (entity == NULL) {
+		return false;
+	}
+	memcpy(entity->object, object, object_len + 1);
+	memcpy(entity->type, type_name, type_len + 1);
+	entity->socket = socket;
+	nbp_fold(entity->folded_object, object, object_len);
+	
+	char folded_type[NBP_REGISTRY_PART_LEN];
+	nbp_fold(folded_type, type_name, type_len);
+	uint32_t type_hash = nbp_hash(NBP_HASH_INIT, folded_type);
+	
+	nbp_registry_lock();
+	
+	nbp_type_t* type = nbp_find_type(folded_type, type_hash);
+	if (type != NULL && nbp_find_entity(type, entity->folded_object) != NULL) {
+		nbp_registry_unlock();
+		free(entity);
+		return false;
+	}
+	
+	if (type == NULL) {
+		type = calloc(1, sizeof(nbp_type_t));
+		if (type == NULL) {
+			nbp_registry_unlock();
+			free(entity);
+			return false;
+		}
+		memcpy(type->folded, folded_type, type_len + 1);
+		type->hash = type_hash;
+		type->next_in_bucket = type_buckets[type_hash % NBP_REGISTRY_BUCKETS];
+		type_buckets[type_hash % NBP_REGISTRY_BUCKETS] = type;
+		
+		nbp_type_t** tail = &types;
+		while (*tail != NULL) {
+			tail = &(*tail)->next;
+		}
+		*tail = type;
+	}
+	
+	entity->enumerator = nbp_free_enumerator(socket);
+	entity->of_type = type;
+	entity->hash = nbp_entity_hash(type, entity->folded_object);
+	entity->next_in_bucket = entity_buckets[entity->hash % NBP_REGISTRY_BUCKETS];
+	entity_buckets[entity->hash % NBP_REGISTRY_BUCKETS] = entity;
+	
+	nbp_entity_t** tail = &type->entities;
+	while (*tail != NULL) {
+		tail = &(*tail)->next_of_type;
+	}
+	*tail = entity;
+	entity_count++;
+	
+	nbp_registry_unlock();
+	return true;
+}
+
+static void nbp_remove_entity(nbp_entity_t* entity) {
+	nbp_type_t* type = entity->of_type;
+	
+	for (nbp_entity_t** curr = &entity_buckets[entity->hash % NBP_REGISTRY_BUCKETS]; *curr != NULL;
+		curr = &(*curr)->next_in_bucket) {
+		
+		if (*curr == entity) {
+			*curr = entity->next_in_bucket;
+			break;
+		}
+	}
+	for (nbp_entity_t** curr = &type->entities; *curr != NULL; curr = &(*curr)->next_of_type) {
+		if (*curr == entity) {
+			*curr = entity->next_of_type;
+			break;
+		}
+	}
+	free(entity);
+	entity_count--;
+	
+	// Types go once they've no entities left, so that wildcard lookups
+	// don't have to wade through them
+	if (type->entities != NULL) {
+		return;
+	}
+	for (nbp_type_t** curr = &type_buckets[type->hash % NBP_REGISTRY_BUCKETS]; *curr != NULL;
+		curr = &(*curr)->next_in_bucket) {
+		
+		if (*curr == type) {
+			*curr = type->next_in_bucket;
+			break;
+		}
+	}
+	for (nbp_type_t** curr = &types; *curr != NULL; curr = &(*curr)->next) {
+		if (*curr == type) {
+			*curr = type->next;
+			break;
+		}
+	}
+	free(type);
+}
+
+void nbp_registry_unregister(const char* object, const char* type_name) {
+	size_t object_len = strlen(object);
+	size_t type_len = strlen(type_name);
+	if (object_len >= NBP_REGISTRY_PART_LEN || type_len >= NBP_REGISTRY_PART_LEN) {
+		return;
+	}
+	
+	char folded_object[NBP_REGISTRY_PART_LEN];
+	char folded_type[NBP_REGISTRY_PART_LEN];
+	nbp_fold(folded_object, object, object_len);
+	nbp_fold(folded_type, type_name, type_len);
+	
+	nbp_registry_lock();
+	nbp_type_t* type = nbp_find_type(folded_type, nbp_hash(NBP_HASH_INIT, folded_type));
+	if (type != NULL) {
+		nbp_entity_t* entity = nbp_find_entity(type, folded_object);
+		if (entity != NULL) {
+			nbp_remove_entity(entity);
+		}
+	}
+	nbp_registry_unlock();
+}
+
+void nbp_registry_unregister_socket(uint8_t socket) {
+	nbp_registry_lock();
+	nbp_type_t* type = types;
+	while (type != NULL) {
+		// Removing a type's last entity frees the type, so find the next
+		// one first
+		nbp_type_t* next_type = type->next;
+		nbp_entity_t* curr = type->entities;
+		while (curr != NULL) {
+			nbp_entity_t* next = curr->next_of_type;
+			if (curr->socket == socket) {
+				nbp_remove_entity(curr);
+			}
+			curr = next;
+		}
+		type = next_type;
+	}
+	nbp_registry_unlock();
+}
+
+static size_t nbp_lookup_in_type(nbp_type_t* type, nbp_pattern_t* object, void* pvt,
+	nbp_registry_iterator iterator) {
+	
+	if (nbp_pattern_is_exact(object)) {
+		nbp_entity_t* entity = nbp_find_entity(type, object->str);
+		if (entity == NULL) {
+			return 0;
+		}
+		iterator(pvt, entity);
+		return 1;
+	}
+	
+	size_t found = 0;
+	for (nbp_entity_t* curr = type->entities; curr != NULL; curr = curr->next_of_type) {
+		if (nbp_pattern_matches(object, curr->folded_object)) {
+			iterator(pvt, curr);
+			found++;
+		}
+	}
+	return found;
+}
+
+size_t nbp_registry_lookup(pstring* object, pstring* type_name, void* pvt,
+	nbp_registry_iterator iterator) {
+	
+	nbp_pattern_t object_pattern;
+	nbp_pattern_t type_pattern;
+	nbp_pattern_from(&object_pattern, object);
+	nbp_pattern_from(&type_pattern, type_name);
+	
+	size_t found = 0;
+	nbp_registry_lock();
+	
+	if (nbp_pattern_is_exact(&type_pattern)) {
+		nbp_type_t* type = nbp_find_type(type_pattern.str, nbp_hash(NBP_HASH_INIT, type_pattern.str));
+		if (type != NULL) {
+			found = nbp_lookup_in_type(type, &object_pattern, pvt, iterator);
+		}
+	} else {
+		for (nbp_type_t* type = types; type != NULL; type = type->next) {
+			if (nbp_pattern_matches(&type_pattern, type->folded)) {
+				found += nbp_lookup_in_type(type, &object_pattern, pvt, iterator);
+			}
+		}
+	}
+	
+	nbp_registry_unlock();
+	return found;
+}
+
+size_t nbp_registry_count(void) {
+	nbp_registry_lock();
+	size_t count = entity_count;
+	nbp_registry_unlock();
+	return count;
+}
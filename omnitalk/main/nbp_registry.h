@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/pstring.h"
+
+// nbp_registry holds the NBP names of the entities the router hosts, for
+// the NBP app to answer lookups from.
+//
+// Names are indexed by their case-folded type, and by type and object
+// together, so a lookup for an exact name goes straight to it, and one with
+// a wildcard object only looks at the entities of its type.  Only a
+// wildcard type has to look at every type, and even then it doesn't look
+// at the entities of types that don't match.
+
+#define NBP_REGISTRY_BUCKETS 64
+
+// NBP objects and types are at most 32 characters
+#define NBP_REGISTRY_PART_LEN 33
+
+typedef struct nbp_entity_s nbp_entity_t;
+struct nbp_type_s;
+
+struct nbp_entity_s {
+	char object[NBP_REGISTRY_PART_LEN];
+	char type[NBP_REGISTRY_PART_LEN];
+	uint8_t socket;
+	uint8_t enumerator;
+	
+	// For the index
+	struct nbp_type_s* of_type;
+	char folded_object[NBP_REGISTRY_PART_LEN];
+	uint32_t hash;
+	
+	nbp_entity_t* next_in_bucket;
+	nbp_entity_t* next_of_type;
+};
+
+// nbp_registry_init sets up the registry's lock.  It's called by
+// app_open_sockets, and before the unit tests, before anything else can
+// touch the registry; calling it again does nothing.
+void nbp_registry_init(void);
+
+// nbp_registry_register names an entity on the socket.  A socket can have
+// any number of names, told apart by their enumerators.  It returns false
+// if the name's too long, or already taken: NBP names have to be unique.
+bool nbp_registry_register(const char* object, const char* type, uint8_t socket);
+
+// nbp_registry_unregister removes a name.
+void nbp_registry_unregister(const char* object, const char* type);
+
+// nbp_registry_unregister_socket removes every name on the socket.
+void nbp_registry_unregister_socket(uint8_t socket);
+
+// nbp_registry_iterator is called with each entity that matches a lookup.
+// It's called with the registry locked, so it mustn't register or
+// unregister anything.
+typedef void (*nbp_registry_iterator)(void* pvt, const nbp_entity_t* entity);
+
+// nbp_registry_lookup calls the iterator with each entity matching the
+// object and type from an NBP tuple, which can be "=" or contain the
+// partial wildcard.  It returns how many matched.
+size_t nbp_registry_lookup(pstring* object, pstring* type, void* pvt,
+	nbp_registry_iterator iterator);
+
+// nbp_registry_count returns how many names are registered.
+size_t nbp_registry_count(void);
@@ -0,0 +1,133 @@
+#include "nbp_registry_test.h"
+#include "nbp_registry.h"
+
+#include <string.h>
+
+#include "util/pstring.h"
+#include "test.h"
+
+// The tests use sockets 210 and up, which nothing else names
+#define FIRST_SOCKET 210
+
+typedef struct {
+	int count;
+	uint8_t socket;
+	uint8_t enumerator;
+	char object[NBP_REGISTRY_PART_LEN];
+} seen_t;
+
+static void see_entity(void* pvt, const nbp_entity_t* entity) {
+	seen_t* seen = (seen_t*)pvt;
+	
+	if (entity->socket < FIRST_SOCKET) {
+		return;
+	}
+	seen->count++;
+	seen->socket = entity->socket;
+	seen->enumerator = entity->enumerator;
+	strcpy(seen->object, entity->object);
+}
+
+static int lookup(const char* object, const char* type) {
+	char object_buf[256];
+	char type_buf[256];
+	object_buf[0] = strlen(object);
+	memcpy(&object_buf[1], object, object_buf[0]);
+	type_buf[0] = strlen(type);
+	memcpy(&type_buf[1], type, type_buf[0]);
+	
+	seen_t seen = { 0 };
+	nbp_registry_lookup((pstring*)object_buf, (pstring*)type_buf, &seen, &see_entity);
+	return seen.count;
+}
+
+TEST_FUNCTION(test_nbp_registry_exact_lookup) {
+	size_t before = nbp_registry_count();
+	
+	TEST_ASSERT(nbp_registry_register("Printer One", "LaserWriter", FIRST_SOCKET));
+	TEST_ASSERT(nbp_registry_register("Printer Two", "LaserWriter", FIRST_SOCKET));
+	TEST_ASSERT(nbp_registry_count() == before + 2);
+	
+	// Names are compared without regard to case, so a name can't be taken
+	// twice by changing its case
+	TEST_ASSERT(!nbp_registry_register("PRINTER ONE", "laserwriter", FIRST_SOCKET + 1));
+	TEST_ASSERT(nbp_registry_count() == before + 2);
+	
+	// Names that won't fit in a tuple can't be registered
+	TEST_ASSERT(!nbp_registry_register("This object name is far too long for NBP", "LaserWriter",
+		FIRST_SOCKET));
+	
+	seen_t seen = { 0 };
+	nbp_registry_lookup((pstring*)"\x0bprinter two", (pstring*)"\x0bLASERWRITER", &seen,
+		&see_entity);
+	TEST_ASSERT(seen.count == 1);
+	TEST_ASSERT(seen.socket == FIRST_SOCKET);
+	TEST_ASSERT(strcmp(seen.object, "Printer Two") == 0);
+	
+	// Each name on a socket has its own enumerator
+	TEST_ASSERT(seen.enumerator == 1);
+	
+	TEST_ASSERT(lookup("Printer Three", "LaserWriter") == 0);
+	TEST_ASSERT(lookup("Printer One", "ImageWriter") == 0);
+	
+	nbp_registry_unregister_socket(FIRST_SOCKET);
+	TEST_ASSERT(nbp_registry_count() == before);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_registry_wildcards) {
+	nbp_registry_register("alpha", "Server", FIRST_SOCKET);
+	nbp_registry_register("beta", "Server", FIRST_SOCKET + 1);
+	nbp_registry_register("alphabet", "Server", FIRST_SOCKET + 2);
+	nbp_registry_register("alpha", "Workstation", FIRST_SOCKET + 3);
+	nbp_registry_register("gamma", "ServerClone", FIRST_SOCKET + 4);
+	
+	// Whole wildcards
+	TEST_ASSERT(lookup("=", "Server") == 3);
+	TEST_ASSERT(lookup("alpha", "=") == 2);
+	TEST_ASSERT(lookup("=", "=") == 5);
+	
+	// Partial wildcards, at the start, middle and end, and matching nothing
+	TEST_ASSERT(lookup("ALPHA" NBP_PARTIAL_WILDCARD_STR, "server") == 2);
+	TEST_ASSERT(lookup(NBP_PARTIAL_WILDCARD_STR "ta", "Server") == 1);
+	TEST_ASSERT(lookup("a" NBP_PARTIAL_WILDCARD_STR "t", "Server") == 1);
+	TEST_ASSERT(lookup("alpha" NBP_PARTIAL_WILDCARD_STR, "Workstation") == 1);
+	TEST_ASSERT(lookup("=", "Server" NBP_PARTIAL_WILDCARD_STR) == 4);
+	TEST_ASSERT(lookup("g" NBP_PARTIAL_WILDCARD_STR, "Serv" NBP_PARTIAL_WILDCARD_STR) == 1);
+	TEST_ASSERT(lookup("alphabets" NBP_PARTIAL_WILDCARD_STR, "Server") == 0);
+	
+	for (int i = 0; i < 5; i++) {
+		nbp_registry_unregister_socket(FIRST_SOCKET + i);
+	}
+	TEST_ASSERT(lookup("=", "=") == 0);
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_nbp_registry_unregister) {
+	nbp_registry_register("one", "Thing", FIRST_SOCKET);
+	nbp_registry_register("two", "Thing", FIRST_SOCKET);
+	nbp_registry_register("three", "Other", FIRST_SOCKET);
+	
+	nbp_registry_unregister("TWO", "thing");
+	TEST_ASSERT(lookup("=", "Thing") == 1);
+	TEST_ASSERT(lookup("two", "Thing") == 0);
+	
+	// An enumerator that's been given up is handed out again
+	nbp_registry_register("four", "Thing", FIRST_SOCKET);
+	seen_t seen = { 0 };
+	nbp_registry_lookup((pstring*)"\x04""four", (pstring*)"\x05Thing", &seen, &see_entity);
+	TEST_ASSERT(seen.count == 1);
+	TEST_ASSERT(seen.enumerator == 1);
+	
+	// The name can be taken again now it's free
+	TEST_ASSERT(nbp_registry_register("two", "Thing", FIRST_SOCKET + 1));
+	
+	nbp_registry_unregister_socket(FIRST_SOCKET);
+	TEST_ASSERT(lookup("=", "=") == 1);
+	nbp_registry_unregister_socket(FIRST_SOCKET + 1);
+	TEST_ASSERT(lookup("=", "=") == 0);
+	
+	TEST_OK();
+}
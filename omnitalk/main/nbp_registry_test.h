@@ -0,0 +1,6 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_nbp_registry_exact_lookup);
+TEST_FUNCTION(test_nbp_registry_wildcards);
+TEST_FUNCTION(test_nbp_registry_unregister);
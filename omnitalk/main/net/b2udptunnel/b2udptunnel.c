@@ -1,32 +1,59 @@
 #include "net/b2udptunnel/b2udptunnel.h"
 
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <esp_log.h>
 #include <esp_netif.h>
 #include <esp_netif_types.h>
+#include <esp_timer.h>
 #include <lwip/prot/ethernet.h>
 #include <lwip/err.h>
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
 
 #include "mem/buffers.h"
+#include "net/b2udptunnel/peers.h"
 #include "net/common.h"
 #include "net/transport.h"
+#include "net/udp_reactor.h"
 #include "proto/SNAP.h"
 #include "web/stats.h"
 #include "tunables.h"
 
 static char* TAG="b2eth";
 
-static _Atomic int b2_udp_sock = -1;
-static _Atomic bool b2_transport_enabled = false;
-static transport_t b2_transport;
+// b2_state_t is the private data for a B2 tunnel transport.  Each tunnel
+// has its own UDP port and its own set of peers.
+typedef struct b2_state_s {
+	uint16_t port;
+	char name[6];
+	
+	_Atomic bool enabled;
+	
+	b2_peer_table_t *peers;
+	int64_t last_subnet_broadcast;
+	
+	// local_addr is our own IPv4 address, in network byte order, as of when
+	// the socket was opened, so that our own broadcasts can be spotted when
+	// they come back to us.  It's 0 if we don't know it.
+	uint32_t local_addr;
+	
+	// recv_buf is kept between reads, so we don't allocate one every time
+	// the reactor asks us to read and there's nothing there.
+	buffer_t *recv_buf;
+	
+	// next links all the tunnels together so the peers task can find them
+	struct b2_state_s *next;
+} b2_state_t;
 
-QueueHandle_t b2_outbound_queue = NULL;
-QueueHandle_t b2_inbound_queue = NULL;
-TaskHandle_t b2_outbound_task = NULL;
-TaskHandle_t b2_inbound_task = NULL;
+// b2_tunnels is the list of all the tunnels we've started; it's only ever
+// added to, at startup.
+static b2_state_t *_Atomic b2_tunnels = NULL;
+static TaskHandle_t b2_peers_task = NULL;
 
 static bool macaddr_is_appletalk_broadcast(uint8_t *addr) {
 	return addr[0] == 0x09 && addr[1] == 0x00 && addr[2] == 0x07 && addr[3] == 0xff && addr[4] == 0xff && addr[5] == 0xff;
@@ -40,18 +67,56 @@ static bool macaddr_is_b2_unicast(uint8_t *addr) {
 	return addr[0] == 'B' && addr[1] == '2';
 }
 
-static void init_b2udptunnel(void) {
+// b2_add_configured_peers adds peers from a comma-separated list of IPv4
+// addresses to a tunnel's peer table.
+static void b2_add_configured_peers(b2_state_t *state, const char* peer_list) {
+	if (peer_list == NULL) {
+		return;
+	}
+	
+	char *peers = strdup(peer_list);
+	char *saveptr = NULL;
+	
+	for (char *tok = strtok_r(peers, ", ", &saveptr); tok != NULL;
+		tok = strtok_r(NULL, ", ", &saveptr)) {
+		
+		struct in_addr addr;
+		if (inet_aton(tok, &addr) == 0) {
+			ESP_LOGE(TAG, "configured peer '%s' isn't an IPv4 address", tok);
+			continue;
+		}
+		
+		if (!b2_peer_add_configured(state->peers, addr.s_addr)) {
+			ESP_LOGE(TAG, "peer table full adding configured peer '%s'", tok);
+		}
+	}
+	
+	free(peers);
+}
+
+// b2_open sets up the tunnel's socket.  It's called by the UDP reactor, and
+// again if the socket breaks.
+static int b2_open(transport_t *transport) {
+	b2_state_t *state = (b2_state_t*)transport->private_data;
 	int sock = -1;
 	struct sockaddr_in saddr = { 0 };
 	
 	sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
 	if (sock < 0) {
 		ESP_LOGE(TAG, "socket() failed.  error: %d", errno);
-		return;
+		return -1;
 	}
-
+	
+	esp_netif_ip_info_t ip_info = { 0 };
+	esp_netif_t *netif = active_ip_net_if;
+	if (netif != NULL && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
+		state->local_addr = ip_info.ip.addr;
+	} else {
+		state->local_addr = 0;
+	}
+	
 	saddr.sin_family = AF_INET;
-	saddr.sin_port = htons(6066);
+	saddr.sin_port = htons(state->port);
 	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
 	int err = bind(sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
 	if (err < 0) {
@@ -65,15 +130,14 @@ static void init_b2udptunnel(void) {
 		ESP_LOGE(TAG, "setsockopt(...SO_BROADCAST...) failed, error: %d", errno);
 		goto err_cleanup;
 	}
-
-	b2_udp_sock = sock;
-	mark_transport_ready(&b2_transport);
 	
-	return;
+	mark_transport_ready(transport);
 	
+	return sock;
+
 err_cleanup:
 	close(sock);
-	return;
+	return -1;
 }
 
 static bool sanity_check_incoming_frame(buffer_t *buf) {
@@ -90,160 +154,224 @@ static bool sanity_check_incoming_frame(buffer_t *buf) {
 		stats.transport_in_errors__transport_b2udp__err_invalid_source_MAC++;
 		return false;
 	}
-
+	
 	return true;
 }
 
-static void b2udptunnel_inbound_runloop(void* dummy) {
-	init_b2udptunnel();
+// b2_read reads one frame from the tunnel and puts it on the inbound queue.
+static udp_io_result_t b2_read(transport_t *transport, int sock) {
+	b2_state_t *state = (b2_state_t*)transport->private_data;
+	struct sockaddr_storage cliaddr = { 0 };
+	socklen_t clilen = sizeof(cliaddr);
 	
-	while (1) {
-		while(b2_udp_sock == -1) {
-			ESP_LOGE(TAG, "setting up b2udptunnel listener failed.  Retrying...");
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-			init_b2udptunnel();
+	if (state->recv_buf == NULL) {
+		state->recv_buf = newbuf(ETHERNET_FRAME_LEN, sizeof(struct eth_hdr) + sizeof(snap_hdr_t));
+	}
+	buffer_t *buf = state->recv_buf;
+	
+	int len = recvfrom(sock, buf->data, buf->capacity, 0,
+		(struct sockaddr*)&cliaddr, &clilen);
+	
+	if (len == 0) {
+		return UDP_IO_MORE;
+	}
+	
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return UDP_IO_IDLE;
 		}
-
-		buffer_t *buf = NULL;
-		struct sockaddr_storage cliaddr = { 0 };
-		socklen_t clilen = sizeof(cliaddr);
-		while (1) {
-			buf = newbuf(ETHERNET_FRAME_LEN, sizeof(struct eth_hdr) + sizeof(snap_hdr_t));
-			
-			int len = recvfrom(b2_udp_sock, buf->data, buf->capacity, 0,
-				(struct sockaddr*)&cliaddr, &clilen);
-				
-			if (len == 0) {
-				goto free_and_continue;
-			}
-						
-			if (len < 0) {
-				stats.transport_in_errors__transport_b2udp__err_recvfrom_failed++;
-				goto free_and_continue;
-			}
-			
-			stats.transport_in_octets__transport_b2udp += len;
-			stats.transport_in_frames__transport_b2udp++;
-			
-			// TODO: sanity check sender IP address
-						
-			buf->length = len;
-						
-			if (!sanity_check_incoming_frame(buf)) {
-				goto free_and_continue;
-			}		
-				
-			if (b2_transport_enabled) {
-				BaseType_t err = xQueueSendToBack(b2_inbound_queue, &buf, (TickType_t)0);
-				if (err != pdTRUE) {
-					stats.transport_in_errors__transport_b2udp__err_lap_queue_full++;
-					goto free_and_continue;
-				}
-			} else {
-				goto free_and_continue;
+		stats.transport_in_errors__transport_b2udp__err_recvfrom_failed++;
+		return UDP_IO_BROKEN;
+	}
+	
+	stats.transport_in_octets__transport_b2udp += len;
+	stats.transport_in_frames__transport_b2udp++;
+	
+	buf->length = len;
+	
+	// Our subnet broadcasts come back to us.  If we learnt ourselves as a
+	// peer, we'd send every broadcast to ourselves too.
+	if (cliaddr.ss_family == AF_INET && state->local_addr != 0 &&
+		((struct sockaddr_in*)&cliaddr)->sin_addr.s_addr == state->local_addr) {
+		
+		stats.transport_in_filtered__transport_b2udp__reason_own_packet++;
+		return UDP_IO_MORE;
+	}
+	
+	if (!sanity_check_incoming_frame(buf)) {
+		return UDP_IO_MORE;
+	}
+	
+	// Remember who sent it so that we can send broadcasts their way
+	if (cliaddr.ss_family == AF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in*)&cliaddr;
+		bool newly_dropped = false;
+		if (!b2_peer_heard_from(state->peers, sin->sin_addr.s_addr, len, &newly_dropped)) {
+			stats.transport_in_errors__transport_b2udp__err_peer_table_full++;
+			if (newly_dropped) {
+				stats.b2udp_peers_dropped++;
 			}
-			
-			continue;
-			
-		free_and_continue:
-			freebuf(buf);
 		}
 	}
+	
+	if (!state->enabled) {
+		return UDP_IO_MORE;
+	}
+	
+	// The buffer's the queue's problem now, whether or not it gets on
+	state->recv_buf = NULL;
+	if (!tdeliver(transport, buf)) {
+		stats.transport_in_errors__transport_b2udp__err_lap_queue_full++;
+		freebuf(buf);
+	}
+	
+	return UDP_IO_MORE;
 }
 
-static void b2udptunnel_outbound_runloop(void* dummy) {
-	buffer_t *buf;
+// b2_sendto sends a frame to a single peer, keeping count as it goes.
+static void b2_sendto(b2_state_t *state, int sock, buffer_t *buf, uint32_t addr) {
 	struct sockaddr_in dest_addr = {0};
 	
 	dest_addr.sin_family = AF_INET;
-	dest_addr.sin_port = htons(6066);
+	dest_addr.sin_port = htons(state->port);
+	dest_addr.sin_addr.s_addr = addr;
+	
+	bool ok = sendto(sock, buf->data, buf->length, 0,
+		(struct sockaddr*)&dest_addr, sizeof(dest_addr)) >= 0;
+	
+	if (!ok) {
+		stats.transport_out_errors__transport_b2udp__err_sendto_failed++;
+	} else {
+		stats.transport_out_octets__transport_b2udp+=buf->length;
+		stats.transport_out_frames__transport_b2udp++;
+	}
+	
+	b2_peer_sent_to(state->peers, addr, buf->length, ok);
+}
 
-	while(1) {
-		xQueueReceive(b2_outbound_queue, &buf, portMAX_DELAY);
-		if (buf == NULL) {
-			continue;
-		}
+// b2_send_broadcast sends a broadcast frame to each peer we know about by
+// unicast.  We still send to the subnet broadcast address now and again, so
+// that new peers on this subnet can hear us and learn about us, and every
+// time while there are peers we've no room for, so they still hear it.
+static void b2_send_broadcast(b2_state_t *state, int sock, buffer_t *buf) {
+	uint32_t peers[B2_PEER_MAX_COUNT];
+	
+	size_t peer_count = b2_peer_addresses(state->peers, peers, B2_PEER_MAX_COUNT);
+	for (size_t i = 0; i < peer_count; i++) {
+		b2_sendto(state, sock, buf, peers[i]);
+	}
+	stats.b2udp_broadcasts_replicated += peer_count;
+	
+	int64_t now = esp_timer_get_time();
+	if (peer_count == 0 || b2_peer_overflowing(state->peers) ||
+		now - state->last_subnet_broadcast > B2UDPTUNNEL_DISCOVERY_INTERVAL_MS * 1000LL) {
+		b2_sendto(state, sock, buf, htonl(INADDR_BROADCAST));
+		state->last_subnet_broadcast = now;
+	}
+}
+
+// b2_write works out where a frame should go from its destination MAC and
+// sends it there.
+static void b2_write(transport_t *transport, int sock, buffer_t *buf) {
+	b2_state_t *state = (b2_state_t*)transport->private_data;
+	
+	// Is the packet long enough?
+	if (buf->length < sizeof(struct eth_hdr) + sizeof(snap_hdr_t)) {
+		stats.transport_out_errors__transport_b2udp__err_frame_too_short++;
+		return;
+	}
+	
+	// Work out destination IP
+	struct eth_hdr *hdr = (struct eth_hdr*)buf->data;
+	if (macaddr_is_appletalk_broadcast(hdr->dest.addr) ||
+		macaddr_is_ethernet_broadcast(hdr->dest.addr)) {
 		
-		if (b2_udp_sock == -1) {
-			goto skip_processing;
-		}
+		b2_send_broadcast(state, sock, buf);
+	} else if (macaddr_is_b2_unicast(hdr->dest.addr)) {
+		uint32_t dest = (hdr->dest.addr[2] << 24) | (hdr->dest.addr[3] << 16) |
+		                (hdr->dest.addr[4] << 8) | hdr->dest.addr[5];
+		b2_sendto(state, sock, buf, htonl(dest));
+	} else {
+		stats.transport_out_errors__transport_b2udp__err_invalid_dst_MAC++;
+	}
+}
+
+// b2udptunnel_peers_runloop ages out peers we've stopped hearing from and
+// publishes the per-peer stats for every tunnel.
+static void b2udptunnel_peers_runloop(void* dummy) {
+	while (1) {
+		vTaskDelay(B2UDPTUNNEL_PEER_PRUNE_INTERVAL_MS / portTICK_PERIOD_MS);
 		
-		// Is the packet long enough?
-		if (buf->length < sizeof(struct eth_hdr) + sizeof(snap_hdr_t)) {
-			stats.transport_out_errors__transport_b2udp__err_frame_too_short++;
-			goto skip_processing;
+		// Glue together the stats from each tunnel
+		size_t total_len = 0;
+		char* tunnel_stats[B2UDPTUNNEL_MAX_TUNNELS] = { 0 };
+		int i = 0;
+		for (b2_state_t *curr = b2_tunnels; curr != NULL && i < B2UDPTUNNEL_MAX_TUNNELS; curr = curr->next, i++) {
+			tunnel_stats[i] = b2_peer_stats(curr->peers, curr->name);
+			total_len += strlen(tunnel_stats[i]);
 		}
 		
-		// Work out destination IP
-		struct eth_hdr *hdr = (struct eth_hdr*)buf->data;
-		if (macaddr_is_appletalk_broadcast(hdr->dest.addr) ||
-			macaddr_is_ethernet_broadcast(hdr->dest.addr)) {
-		
-			dest_addr.sin_addr.s_addr = INADDR_BROADCAST;
-		} else if (macaddr_is_b2_unicast(hdr->dest.addr)) {
-			uint32_t dest = (hdr->dest.addr[2] << 24) | (hdr->dest.addr[3] << 16) | 
-			                (hdr->dest.addr[4] << 8) | hdr->dest.addr[5];
-			dest_addr.sin_addr.s_addr = htonl(dest);
-		} else {
-			stats.transport_out_errors__transport_b2udp__err_invalid_dst_MAC++;
-			goto skip_processing;
+		char* new_stats = malloc(total_len + 1);
+		char* cursor = new_stats;
+		*cursor = '\0';
+		for (i = 0; i < B2UDPTUNNEL_MAX_TUNNELS && tunnel_stats[i] != NULL; i++) {
+			cursor = stpcpy(cursor, tunnel_stats[i]);
+			free(tunnel_stats[i]);
 		}
 		
-		if (sendto(b2_udp_sock, buf, buf->length, 0,
-			(struct sockaddr*)&dest_addr, sizeof(dest_addr)) < 0) {
-		
-			stats.transport_out_errors__transport_b2udp__err_sendto_failed++;
-		} else {
-			stats.transport_out_octets__transport_b2udp+=buf->length;
-			stats.transport_out_frames__transport_b2udp++;
+		char* old_stats = atomic_exchange(&stats_b2_peers, new_stats);
+		if (old_stats != NULL) {
+			free(old_stats);
 		}
 		
-	skip_processing:
-		freebuf(buf);
+		for (b2_state_t *curr = b2_tunnels; curr != NULL; curr = curr->next) {
+			b2_peer_prune(curr->peers);
+		}
 	}
 }
 
-void start_b2udptunnel(void) {
-	b2_transport.ready_event = xEventGroupCreate();
-	b2_outbound_queue = xQueueCreate(B2UDPTUNNEL_QUEUE_DEPTH, sizeof(buffer_t*));;
-	b2_inbound_queue = xQueueCreate(B2UDPTUNNEL_QUEUE_DEPTH, sizeof(buffer_t*));;
-	xTaskCreate(&b2udptunnel_inbound_runloop, "B2UDP-rx", 4096, NULL, 5, &b2_inbound_task);
-	xTaskCreate(&b2udptunnel_outbound_runloop, "B2UDP-tx", 4096, NULL, 5, &b2_outbound_task);
-}
-
-esp_err_t b2_transport_enable(transport_t* dummy) {
-	b2_transport_enabled = true;
+static esp_err_t b2_transport_enable(transport_t* transport) {
+	b2_state_t *state = (b2_state_t*)transport->private_data;
+	state->enabled = true;
 	return ESP_OK;
 }
 
-esp_err_t b2_transport_disable(transport_t* dummy) {
-	b2_transport_enabled = false;
+static esp_err_t b2_transport_disable(transport_t* transport) {
+	b2_state_t *state = (b2_state_t*)transport->private_data;
+	state->enabled = false;
 	return ESP_OK;
 }
 
-static transport_t b2_transport = {
-	.quality = QUALITY_B2ETH,
-
-	.kind = "b2",
-	.private_data = NULL,
+transport_t* start_b2udptunnel(uint16_t port, const char* peers) {
+	transport_t *transport = calloc(1, sizeof(transport_t));
+	b2_state_t *state = calloc(1, sizeof(b2_state_t));
 	
-	.enable = &b2_transport_enable,
-	.disable = &b2_transport_disable,
-};
-
-transport_t* b2_get_transport(void) {
-	// warn if we do something silly and attempt to get multiple
-	// transports for this interface
-	static int attempts = 0;
-	if (attempts > 0) {
-		ESP_LOGE(TAG, "multiple transports requested for b2; beware - there can be only one!");
-	}
-	attempts++;
+	state->port = port;
+	snprintf(state->name, sizeof(state->name), "%u", (unsigned int)port);
+	state->peers = b2_peer_table_new();
+	b2_add_configured_peers(state, peers);
+	
+	transport->quality = QUALITY_B2ETH;
+	transport->kind = "b2";
+	transport->framing = TRANSPORT_FRAMING_ETHERNET;
+	transport->private_data = state;
+	transport->enable = &b2_transport_enable;
+	transport->disable = &b2_transport_disable;
 	
-	b2_transport.inbound = b2_inbound_queue;
-	b2_transport.outbound = b2_outbound_queue;
+	transport->ready_event = xEventGroupCreate();
+	transport->outbound = xQueueCreate(B2UDPTUNNEL_QUEUE_DEPTH, sizeof(buffer_t*));
+	transport->inbound = xQueueCreate(B2UDPTUNNEL_QUEUE_DEPTH, sizeof(buffer_t*));
+	udp_reactor_add(transport, &b2_open, &b2_read, &b2_write);
 	
-	return &b2_transport;
+	// Push this tunnel on the front of the list.  Tunnels only get started
+	// from one task, so we don't need to worry about anyone else doing this
+	// at the same time.
+	state->next = b2_tunnels;
+	b2_tunnels = state;
 	
+	if (b2_peers_task == NULL) {
+		xTaskCreate(&b2udptunnel_peers_runloop, "B2UDP-peers", 2048, NULL, tskIDLE_PRIORITY, &b2_peers_task);
+	}
+	
+	return transport;
 }
-
@@ -1,8 +1,25 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "net/transport.h"
 
 #define B2UDPTUNNEL_QUEUE_DEPTH 60
 
-void start_b2udptunnel(void);
-transport_t* b2_get_transport(void);
\ No newline at end of file
+// The port B2 tunnels use unless told otherwise
+#define B2UDPTUNNEL_DEFAULT_PORT 6066
+
+// How many tunnels we'll report peer stats for
+#define B2UDPTUNNEL_MAX_TUNNELS 8
+
+// How often we forget about quiet peers and update peer stats
+#define B2UDPTUNNEL_PEER_PRUNE_INTERVAL_MS (30 * 1000)
+
+// How often broadcasts also go to the subnet broadcast address once we
+// know about some peers.  If we know of none, they always do.
+#define B2UDPTUNNEL_DISCOVERY_INTERVAL_MS (10 * 1000)
+
+// start_b2udptunnel starts a B2 tunnel on the given UDP port and returns its
+// transport.  peers is a comma-separated list of IPv4 addresses of peers
+// to always send to, or NULL.  Each tunnel needs its own port.
+transport_t* start_b2udptunnel(uint16_t port, const char* peers);
\ No newline at end of file
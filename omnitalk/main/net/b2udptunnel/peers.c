@@ -0,0 +1,269 @@
+#include "net/b2udptunnel/peers.h"
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <lwip/inet.h>
+
+b2_peer_table_t* b2_peer_table_new(void) {
+	b2_peer_table_t* table = calloc(1, sizeof(b2_peer_table_t));
+
+	table->mutex = xSemaphoreCreateMutex();
+	table->root.dummy = true;
+
+	return table;
+}
+
+static size_t b2_peer_count_unguarded(b2_peer_table_t* table) {
+	size_t count = 0;
+
+	for (struct b2_peer_s *curr = &table->root; curr != NULL; curr = curr->next) {
+		if (!curr->dummy) {
+			count++;
+		}
+	}
+
+	return count;
+}
+
+size_t b2_peer_count(b2_peer_table_t* table) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	size_t count = b2_peer_count_unguarded(table);
+	xSemaphoreGive(table->mutex);
+
+	return count;
+}
+
+static struct b2_peer_s *b2_peer_find_unguarded(b2_peer_table_t* table, uint32_t addr) {
+	for (struct b2_peer_s *curr = &table->root; curr != NULL; curr = curr->next) {
+		if (!curr->dummy && curr->addr == addr) {
+			return curr;
+		}
+	}
+
+	return NULL;
+}
+
+// b2_peer_find_or_add_unguarded returns the peer for addr, adding it to the
+// end of the list if it's not there already.  It returns NULL if the table
+// is full.
+static struct b2_peer_s *b2_peer_find_or_add_unguarded(b2_peer_table_t* table, uint32_t addr) {
+	struct b2_peer_s *prev = NULL;
+	size_t count = 0;
+
+	for (struct b2_peer_s *curr = &table->root; curr != NULL; prev = curr, curr = curr->next) {
+		if (curr->dummy) {
+			continue;
+		}
+
+		if (curr->addr == addr) {
+			return curr;
+		}
+		count++;
+	}
+
+	if (count >= B2_PEER_MAX_COUNT) {
+		return NULL;
+	}
+
+	struct b2_peer_s *new_peer = calloc(1, sizeof(struct b2_peer_s));
+	new_peer->addr = addr;
+
+	// prev is the tail of the list here
+	prev->next = new_peer;
+
+	return new_peer;
+}
+
+bool b2_peer_add_configured(b2_peer_table_t* table, uint32_t addr) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+
+	struct b2_peer_s *peer = b2_peer_find_or_add_unguarded(table, addr);
+	if (peer != NULL) {
+		peer->configured = true;
+	}
+
+	xSemaphoreGive(table->mutex);
+	return peer != NULL;
+}
+
+// b2_peer_note_dropped_unguarded remembers that we had no room for addr,
+// returning true if it's not one we already knew about.
+static bool b2_peer_note_dropped_unguarded(b2_peer_table_t* table, uint32_t addr) {
+	table->overflow_prunes_left = B2_PEER_MAX_QUIET_PRUNES;
+
+	for (size_t i = 0; i < B2_PEER_MAX_COUNT; i++) {
+		if (table->dropped[i] == addr) {
+			return false;
+		}
+	}
+
+	table->dropped[table->dropped_next] = addr;
+	table->dropped_next = (table->dropped_next + 1) % B2_PEER_MAX_COUNT;
+	return true;
+}
+
+bool b2_peer_heard_from(b2_peer_table_t* table, uint32_t addr, size_t octets,
+	bool* newly_dropped) {
+
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+
+	struct b2_peer_s *peer = b2_peer_find_or_add_unguarded(table, addr);
+	if (peer != NULL) {
+		peer->last_heard_timestamp = esp_timer_get_time();
+		peer->quiet_prunes = 0;
+		peer->in_frames++;
+		peer->in_octets += octets;
+	} else {
+		bool is_new = b2_peer_note_dropped_unguarded(table, addr);
+		if (newly_dropped != NULL) {
+			*newly_dropped = is_new;
+		}
+	}
+
+	xSemaphoreGive(table->mutex);
+	return peer != NULL;
+}
+
+bool b2_peer_overflowing(b2_peer_table_t* table) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	bool overflowing = table->overflow_prunes_left > 0;
+	xSemaphoreGive(table->mutex);
+
+	return overflowing;
+}
+
+void b2_peer_sent_to(b2_peer_table_t* table, uint32_t addr, size_t octets, bool ok) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+
+	// We don't learn peers from sending; if someone's unicasting to an
+	// address we don't know, that's their business.
+	struct b2_peer_s *peer = b2_peer_find_unguarded(table, addr);
+	if (peer != NULL) {
+		if (ok) {
+			peer->out_frames++;
+			peer->out_octets += octets;
+		} else {
+			peer->out_errors++;
+		}
+	}
+
+	xSemaphoreGive(table->mutex);
+}
+
+size_t b2_peer_addresses(b2_peer_table_t* table, uint32_t* out, size_t max) {
+	size_t count = 0;
+
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+
+	for (struct b2_peer_s *curr = &table->root; curr != NULL && count < max; curr = curr->next) {
+		if (curr->dummy) {
+			continue;
+		}
+
+		out[count] = curr->addr;
+		count++;
+	}
+
+	xSemaphoreGive(table->mutex);
+	return count;
+}
+
+static void b2_peer_prune_unguarded(b2_peer_table_t* table) {
+	struct b2_peer_s *prev = NULL;
+	struct b2_peer_s *curr = &table->root;
+
+	if (table->overflow_prunes_left > 0) {
+		table->overflow_prunes_left--;
+	}
+
+	while (curr != NULL) {
+		if (curr->dummy || curr->configured) {
+			goto next_item;
+		}
+
+		curr->quiet_prunes++;
+		if (curr->quiet_prunes > B2_PEER_MAX_QUIET_PRUNES) {
+			// unlink and free it, leaving prev where it is
+			prev->next = curr->next;
+			free(curr);
+			curr = prev->next;
+			continue;
+		}
+
+	next_item:
+		prev = curr;
+		curr = curr->next;
+	}
+}
+
+void b2_peer_prune(b2_peer_table_t* table) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	b2_peer_prune_unguarded(table);
+	xSemaphoreGive(table->mutex);
+}
+
+char* b2_peer_stats(b2_peer_table_t* table, const char* tunnel) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+
+	char* fmt = "b2udp_peer_in_frames{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %lu\n"
+		"b2udp_peer_in_octets{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %lu\n"
+		"b2udp_peer_out_frames{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %lu\n"
+		"b2udp_peer_out_octets{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %lu\n"
+		"b2udp_peer_out_errors{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %lu\n"
+		"b2udp_peer_last_heard_seconds_ago{tunnel=\"%s\", peer=\"%s\", configured=\"%s\"} %" PRId64 "\n";
+
+	// Each of the six lines has the tunnel name, an address (at most 15
+	// chars), a "false" and a number that'll fit in 20 digits.
+	int peer_str_len = strlen(fmt) + (6 * (strlen(tunnel) + 15 + 5 + 20));
+	size_t peer_count = b2_peer_count_unguarded(table);
+
+	// +1 for the null.
+	char* strbuf = malloc((peer_str_len * peer_count) + 1);
+	assert(strbuf != NULL);
+
+	char* cursor = strbuf;
+	*cursor = '\0';
+
+	int64_t now = esp_timer_get_time();
+
+	for (struct b2_peer_s *curr = &table->root; curr != NULL; curr = curr->next) {
+		if (curr->dummy) {
+			continue;
+		}
+
+		char addr[16];
+		uint32_t host_addr = ntohl(curr->addr);
+		snprintf(addr, sizeof(addr), "%u.%u.%u.%u",
+			(unsigned int)((host_addr >> 24) & 0xff), (unsigned int)((host_addr >> 16) & 0xff),
+			(unsigned int)((host_addr >> 8) & 0xff), (unsigned int)(host_addr & 0xff));
+		char* configured = curr->configured ? "true" : "false";
+
+		// Configured peers we've never heard from report -1
+		int64_t ago = -1;
+		if (curr->last_heard_timestamp != 0) {
+			ago = (now - curr->last_heard_timestamp) / 1000000;
+		}
+
+		int len = sprintf(cursor, fmt,
+			tunnel, addr, configured, curr->in_frames,
+			tunnel, addr, configured, curr->in_octets,
+			tunnel, addr, configured, curr->out_frames,
+			tunnel, addr, configured, curr->out_octets,
+			tunnel, addr, configured, curr->out_errors,
+			tunnel, addr, configured, ago
+		);
+		cursor += len;
+	}
+
+	xSemaphoreGive(table->mutex);
+	return strbuf;
+}
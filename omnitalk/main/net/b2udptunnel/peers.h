@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// The B2 peer table keeps track of the other ends of the tunnel that
+// we've heard from (or been told about), so that broadcasts can go to
+// each of them by unicast rather than being sprayed at the subnet
+// broadcast address.  Subnet broadcast on wifi is slow and lossy, and it
+// doesn't get across routers at all.
+//
+// This is a linked list with a dummy root node, like everything else.
+// There won't be many peers.
+
+#define B2_PEER_MAX_COUNT 32
+
+// Learned peers that we've not heard from for this many prunes get
+// forgotten about.  Configured peers stay forever.
+#define B2_PEER_MAX_QUIET_PRUNES 4
+
+struct b2_peer_s {
+	bool dummy;
+
+	// addr is an IPv4 address in network byte order
+	uint32_t addr;
+	bool configured;
+	int64_t last_heard_timestamp;
+	int quiet_prunes;
+
+	unsigned long in_frames;
+	unsigned long in_octets;
+	unsigned long out_frames;
+	unsigned long out_octets;
+	unsigned long out_errors;
+
+	struct b2_peer_s *next;
+};
+
+typedef struct {
+	SemaphoreHandle_t mutex;
+	struct b2_peer_s root;
+
+	// The last few peers we had no room for, so each is only counted as
+	// dropped once, and how many more prunes until we stop saying the
+	// table's overflowing
+	uint32_t dropped[B2_PEER_MAX_COUNT];
+	size_t dropped_next;
+	int overflow_prunes_left;
+} b2_peer_table_t;
+
+b2_peer_table_t* b2_peer_table_new(void);
+size_t b2_peer_count(b2_peer_table_t* table);
+
+// b2_peer_add_configured adds a peer that never ages out.
+bool b2_peer_add_configured(b2_peer_table_t* table, uint32_t addr);
+
+// b2_peer_heard_from records a frame of the given length arriving from addr,
+// learning it as a new peer if we didn't know about it.  Returns false if
+// the table is full and the peer couldn't be added, in which case, if
+// newly_dropped isn't NULL, it says whether that's the first we've seen of
+// this peer.
+bool b2_peer_heard_from(b2_peer_table_t* table, uint32_t addr, size_t octets,
+	bool* newly_dropped);
+
+// b2_peer_overflowing says whether we've heard from a peer we had no room
+// for since the last B2_PEER_MAX_QUIET_PRUNES prunes.  If we have, there
+// are peers that won't get broadcasts by unicast.
+bool b2_peer_overflowing(b2_peer_table_t* table);
+
+// b2_peer_sent_to records an attempt to send a frame to addr.
+void b2_peer_sent_to(b2_peer_table_t* table, uint32_t addr, size_t octets, bool ok);
+
+// b2_peer_addresses copies up to max peer addresses into out and returns how
+// many it copied, so that callers can send to them without holding the lock.
+size_t b2_peer_addresses(b2_peer_table_t* table, uint32_t* out, size_t max);
+
+// b2_peer_prune forgets learned peers we've not heard from since the last
+// B2_PEER_MAX_QUIET_PRUNES calls to it.
+void b2_peer_prune(b2_peer_table_t* table);
+
+// b2_peer_stats returns a malloced string of prometheus metrics for each
+// peer, labelled with the given tunnel name.
+char* b2_peer_stats(b2_peer_table_t* table, const char* tunnel);
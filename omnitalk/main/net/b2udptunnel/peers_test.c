@@ -0,0 +1,99 @@
+#include "net/b2udptunnel/peers_test.h"
+#include "net/b2udptunnel/peers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <lwip/inet.h>
+
+#include "test.h"
+
+TEST_FUNCTION(test_b2_peer_learning) {
+	b2_peer_table_t* table = b2_peer_table_new();
+	uint32_t addrs[4];
+	size_t count;
+
+	TEST_ASSERT(table != NULL);
+	TEST_ASSERT(b2_peer_count(table) == 0);
+
+	// Hearing from someone should learn them
+	TEST_ASSERT(b2_peer_heard_from(table, htonl(0x0a000001), 100, NULL));
+	TEST_ASSERT(b2_peer_count(table) == 1);
+
+	// ... but only once
+	TEST_ASSERT(b2_peer_heard_from(table, htonl(0x0a000001), 100, NULL));
+	TEST_ASSERT(b2_peer_count(table) == 1);
+
+	TEST_ASSERT(b2_peer_add_configured(table, htonl(0x0a000002)));
+	TEST_ASSERT(b2_peer_count(table) == 2);
+
+	count = b2_peer_addresses(table, addrs, 4);
+	TEST_ASSERT(count == 2);
+	TEST_ASSERT(addrs[0] == htonl(0x0a000001));
+	TEST_ASSERT(addrs[1] == htonl(0x0a000002));
+
+	// We mustn't overrun a short output array
+	count = b2_peer_addresses(table, addrs, 1);
+	TEST_ASSERT(count == 1);
+
+	// Sending to someone we don't know shouldn't add them
+	b2_peer_sent_to(table, htonl(0x0a000003), 100, true);
+	TEST_ASSERT(b2_peer_count(table) == 2);
+
+	// The table should fill up rather than growing without bound
+	for (uint32_t i = 0; i < B2_PEER_MAX_COUNT * 2; i++) {
+		b2_peer_heard_from(table, htonl(0x0b000000 + i), 1, NULL);
+	}
+	TEST_ASSERT(b2_peer_count(table) == B2_PEER_MAX_COUNT);
+	TEST_ASSERT(b2_peer_overflowing(table));
+
+	// Each peer we've no room for is only dropped once, however often we
+	// hear from it
+	bool newly_dropped = false;
+	TEST_ASSERT(!b2_peer_heard_from(table, htonl(0x0c000000), 1, &newly_dropped));
+	TEST_ASSERT(newly_dropped);
+	TEST_ASSERT(!b2_peer_heard_from(table, htonl(0x0c000000), 1, &newly_dropped));
+	TEST_ASSERT(!newly_dropped);
+
+	// Once they've gone quiet, the table's not overflowing any more
+	for (int i = 0; i < B2_PEER_MAX_QUIET_PRUNES; i++) {
+		TEST_ASSERT(b2_peer_overflowing(table));
+		b2_peer_prune(table);
+	}
+	TEST_ASSERT(!b2_peer_overflowing(table));
+
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_b2_peer_aging) {
+	b2_peer_table_t* table = b2_peer_table_new();
+
+	b2_peer_heard_from(table, htonl(0x0a000001), 100, NULL);
+	b2_peer_heard_from(table, htonl(0x0a000002), 100, NULL);
+	b2_peer_add_configured(table, htonl(0x0a000003));
+
+	// Peers we keep hearing from should stick around
+	for (int i = 0; i < B2_PEER_MAX_QUIET_PRUNES * 2; i++) {
+		b2_peer_prune(table);
+		b2_peer_heard_from(table, htonl(0x0a000001), 100, NULL);
+	}
+	TEST_ASSERT(b2_peer_count(table) == 2);
+
+	// And once they go quiet, they should go away, but configured peers
+	// shouldn't
+	for (int i = 0; i < B2_PEER_MAX_QUIET_PRUNES + 1; i++) {
+		b2_peer_prune(table);
+	}
+	TEST_ASSERT(b2_peer_count(table) == 1);
+
+	// Stats should mention the configured peer
+	char* stats = b2_peer_stats(table, "6066");
+	TEST_ASSERT(stats != NULL);
+	TEST_ASSERT(strstr(stats, "b2udp_peer_in_frames{tunnel=\"6066\", peer=\"10.0.0.3\", configured=\"true\"} 0\n") != NULL);
+	TEST_ASSERT(strstr(stats, "10.0.0.1") == NULL);
+	free(stats);
+
+	TEST_OK();
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "test.h"
+
+TEST_FUNCTION(test_b2_peer_learning);
+TEST_FUNCTION(test_b2_peer_aging);
@@ -4,33 +4,42 @@
 #include <stdbool.h>
 
 #include <esp_err.h>
-#include <esp_eth.h>
-#include <esp_system.h>
 #include <esp_log.h>
-#include <esp_netif.h>
-#include <esp_netif_types.h>
-#include <driver/gpio.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
 #include <lwip/prot/ethernet.h>
 #include <lwip/def.h>
 
 #include "mem/buffers.h"
-#include "net/ethernet/ethernet_output.h"
-#include "net/common.h"
+#include "net/ethernet/ethernet_driver.h"
 #include "net/transport.h"
+#include "proto/aarp.h"
+#include "proto/ddp.h"
 #include "proto/SNAP.h"
+#include "table/aarp/table.h"
 #include "web/stats.h"
-#include "hw.h"
+#include "global_state.h"
 #include "tunables.h"
 
 #define REQUIRE(x) if(!(x)) { return false; }
 
-_Atomic bool ethernet_transport_enabled = false;
-static transport_t ethertalkv2_transport; 
+// ethertalkv2_state_t is the private data for an EtherTalk transport.
+typedef struct {
+	_Atomic bool enabled;
+	
+	ethernet_driver_t *driver;
+	struct eth_addr my_hwaddr;
+	
+	// AppleTalk broadcasts go to a multicast address rather than to the
+	// Ethernet broadcast address.  We build its header once, up front.
+	uint8_t broadcast_hdr_template[ELAP_HDR_LEN];
+	
+	TaskHandle_t outbound_task;
+} ethertalkv2_state_t;
 
-TaskHandle_t ethertalkv2_inbound_task = NULL;
-TaskHandle_t ethertalkv2_outbound_task = NULL;
-QueueHandle_t ethertalkv2_inbound_queue = NULL;
-QueueHandle_t ethertalkv2_outbound_queue = NULL;
+static const struct eth_addr elap_broadcast_hwaddr = {{0x09, 0x00, 0x07, 0xFF, 0xFF, 0xFF}};
 
 static const char* TAG = "ETHERNET";
 
@@ -86,151 +95,207 @@ bool is_aarp_frame(uint8_t *buffer, uint32_t length) {
 	return true;
 }
 
-// ethernet_input_path is the callback that will get called whenever
-// we get a packet.  For most things, it just passes it straight through
-// to esp_netif.
-//
-// Technically this is a bit naughty and we should do this with a tap,
-// but I'm too tired.
-esp_err_t ethernet_input_path(esp_eth_handle_t eth_handle, uint8_t *buffer, uint32_t length, void *priv) {
-	// Let's not break L2 TAP
-#if CONFIG_ESP_NETIF_L2_TAP
-    esp_err_t ret = ESP_OK;
-    ret = esp_vfs_l2tap_eth_filter_frame(eth_handle, buffer, (size_t *)&length, info);
-    if (length == 0) {
-        return ret;
-    }
-#endif
+void ethertalkv2_learn_hwaddr(aarp_table_t* table, uint8_t *buffer, uint32_t length,
+	bool aarp) {
+	
+	struct eth_hdr *eth_hdr = (struct eth_hdr*)buffer;
+	
+	if (aarp) {
+		if (length < ELAP_HDR_LEN + sizeof(aarp_packet_t)) {
+			return;
+		}
+		
+		// A probe's address is only a candidate, which someone else may
+		// already have
+		aarp_packet_t *packet = (aarp_packet_t*)(buffer + ELAP_HDR_LEN);
+		uint16_t function = ntohs(packet->function);
+		if (packet->hardware_addr_len != sizeof(struct eth_addr) ||
+			packet->protocol_addr_len != 4 ||
+			(function != AARP_FUNCTION_REQUEST && function != AARP_FUNCTION_RESPONSE)) {
+			
+			return;
+		}
+		
+		aarp_touch(table, ntohs(packet->src_network), packet->src_node, packet->src_hwaddr);
+		stats.eth_aarp_learned__source_aarp++;
+		return;
+	}
+	
+	if (length < ELAP_HDR_LEN + sizeof(ddp_long_header_t)) {
+		return;
+	}
+	
+	// Only a packet that hasn't been through a router came from the node
+	// that sent the frame
+	ddp_long_header_t *hdr = (ddp_long_header_t*)(buffer + ELAP_HDR_LEN);
+	if (((ntohs(hdr->hop_count_and_datagram_length) >> 10) & 0xF) != 0) {
+		return;
+	}
+	
+	aarp_touch(table, ntohs(hdr->src_network), hdr->src, eth_hdr->src);
+	stats.eth_aarp_learned__source_elap++;
+}
 
+bool ethertalkv2_input(transport_t* transport, uint8_t *buffer, uint32_t length) {
+	ethertalkv2_state_t *state = (ethertalkv2_state_t*)transport->private_data;
+	
 	stats.transport_in_octets__transport_ethernet += (unsigned long)length;
 	stats.transport_in_frames__transport_ethernet++;
-
-	// Is this an AppleTalk frame?
-	if (is_appletalk_frame(buffer, length)) {
+	
+	bool appletalk = is_appletalk_frame(buffer, length);
+	bool aarp = !appletalk && is_aarp_frame(buffer, length);
+	
+	if (appletalk) {
 		stats.eth_recv_elap_frames++;
 	}
-	if (is_aarp_frame(buffer, length)) {
+	if (aarp) {
 		stats.eth_recv_aarp_frames++;
 	}
 	
-	if (is_appletalk_frame(buffer, length) || is_aarp_frame(buffer, length)) {
-		// We intercept appletalk and aarp frames
-		if (ethernet_transport_enabled) {
-			buffer_t *buff = wrapbuf(buffer, length);
-			BaseType_t err = xQueueSendToBack(ethertalkv2_inbound_queue,
-				&buff, (TickType_t)0);
-				
-			if (err != pdTRUE) {
-				stats.transport_in_errors__transport_ethernet__err_lap_queue_full++;
-				freebuf(buff);
-			}
-			
-			return ESP_OK;
-		} else {
-			// We have no ethernet transport, quietly drop buffer on the floor
-			free(buffer);
-			return ESP_OK;
+	if (!appletalk && !aarp) {
+		return false;
+	}
+	
+	// Whoever sent it is someone we can send to without asking
+	if (global_aarp_table != NULL) {
+		ethertalkv2_learn_hwaddr(global_aarp_table, buffer, length, aarp);
+	}
+	
+	// We intercept appletalk and aarp frames
+	if (state->enabled) {
+		buffer_t *buff = wrapbuf(buffer, length);
+		if (!tdeliver(transport, buff)) {
+			stats.transport_in_errors__transport_ethernet__err_lap_queue_full++;
+			freebuf(buff);
 		}
 	} else {
-
-	// if we intercept buffer, we have to free it
-
-    return esp_netif_receive((esp_netif_t *)priv, buffer, length, NULL);
-    }
-}
-
-static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
-                                 int32_t event_id, void *event_data) {
-	mark_ip_ready();
-}
-
-void start_ethernet(void) {
-	ethertalkv2_transport.ready_event = xEventGroupCreate();
-
-	/* set up ESP32 internal MAC */
-	eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
-	mac_config.sw_reset_timeout_ms = 1000;
-
-	eth_esp32_emac_config_t emac_config = ETH_ESP32_EMAC_DEFAULT_CONFIG();
-	emac_config.clock_config.rmii.clock_mode = EMAC_CLK_EXT_IN;
-	emac_config.clock_config.rmii.clock_gpio = EMAC_CLK_IN_GPIO;
-	emac_config.smi_gpio.mdc_num = ETH_MAC_MDC;
-	emac_config.smi_gpio.mdio_num = ETH_MAC_MDIO;
+		// We have no ethernet transport, quietly drop buffer on the floor
+		free(buffer);
+	}
 	
-	esp_eth_mac_t *mac = esp_eth_mac_new_esp32(&emac_config, &mac_config);
-
-	/* set up PHY */
-	eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
-	phy_config.phy_addr = 1;
-	phy_config.reset_gpio_num = -1;
-	esp_eth_phy_t *phy = esp_eth_phy_new_lan87xx(&phy_config);
+	return true;
+}
 
-	// Enable external oscillator (pulled down at boot to allow IO0 strapping)
-	ESP_ERROR_CHECK(gpio_set_direction(ETH_50MHZ_EN, GPIO_MODE_OUTPUT));
-	ESP_ERROR_CHECK(gpio_set_level(ETH_50MHZ_EN, 1));
+// elap_hdr_for_packet fills hdr with the ELAP header that will get packet to
+// its next hop, or returns false if we don't know where that is yet.
+static bool elap_hdr_for_packet(ethertalkv2_state_t *state, buffer_t *packet, uint8_t *hdr) {
+	uint16_t net = packet->send_chain.via_net;
+	uint8_t node = packet->send_chain.via_node;
 	
-	ESP_LOGD(TAG, "Starting Ethernet interface...");
-
-	// Install and start Ethernet driver
-	esp_eth_config_t eth_config = ETH_DEFAULT_CONFIG(mac, phy);
-	esp_eth_handle_t eth_handle = NULL;
-	ESP_ERROR_CHECK(esp_eth_driver_install(&eth_config, &eth_handle));
-
-	esp_netif_config_t const netif_config = ESP_NETIF_DEFAULT_ETH();
-	esp_netif_t *global_netif = esp_netif_new(&netif_config);
-	esp_eth_netif_glue_handle_t eth_netif_glue = esp_eth_new_netif_glue(eth_handle);
-	ESP_ERROR_CHECK(esp_netif_attach(global_netif, eth_netif_glue));
-	char* hostname = generate_hostname();
-	ESP_ERROR_CHECK(esp_netif_set_hostname(global_netif, hostname));
-	free(hostname);
+	// No router to go via means the destination is on this network
+	if (net == 0 && node == 0) {
+		net = DDP_DSTNET(packet);
+		node = DDP_DST(packet);
+	}
 	
-	// Install our custom input and output path
-	ESP_ERROR_CHECK(esp_eth_update_input_path(eth_handle, ethernet_input_path, global_netif));
-	munge_ethernet_output_path(eth_handle, global_netif);
+	if (node == DDP_ADDR_BROADCAST) {
+		memcpy(hdr, state->broadcast_hdr_template, ELAP_HDR_LEN);
+		return true;
+	}
 	
-	// register handler for when we get an IP
-	ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
+	return aarp_lookup_hdr_template(global_aarp_table, net, node,
+		&state->my_hwaddr, hdr);
+}
 
-	ESP_ERROR_CHECK(esp_eth_start(eth_handle));
-	
-	active_ip_net_if = eth_handle;
-	mark_transport_ready(&ethertalkv2_transport);
+// ethertalkv2_outbound_runloop puts packets handed to us by the LAP onto
+// the wire.  DDP packets don't get an L2 header written into them: instead,
+// the header is sent from a template as a separate segment, so we don't
+// need to build it or shuffle the packet around for every frame.  Anything
+// else (AARP, say) is assumed to have its headers on already.
+static void ethertalkv2_outbound_runloop(void* tp) {
+	transport_t *transport = (transport_t*)tp;
+	ethertalkv2_state_t *state = (ethertalkv2_state_t*)transport->private_data;
+	buffer_t *packet = NULL;
+	uint8_t hdr[ELAP_HDR_LEN];
+	esp_err_t err;
 	
-	ethertalkv2_inbound_queue = xQueueCreate(ETHERNET_QUEUE_DEPTH, sizeof(buffer_t*));
-	ethertalkv2_outbound_queue = xQueueCreate(ETHERNET_QUEUE_DEPTH, sizeof(buffer_t*));
+	while (1) {
+		xQueueReceive(transport->outbound, &packet, portMAX_DELAY);
+		
+		if (!state->enabled) {
+			goto cleanup;
+		}
+		
+		if (!packet->ddp_ready) {
+			err = state->driver->send(state->driver, packet->data, packet->length);
+		} else {
+			// ELAP only does long headers; something has gone wrong upstream
+			if (packet->ddp_type != BUF_LONG_HEADER) {
+				stats.transport_out_errors__transport_ethernet__err_not_long_header++;
+				goto cleanup;
+			}
+		
+			if (!elap_hdr_for_packet(state, packet, hdr)) {
+				stats.transport_out_errors__transport_ethernet__err_no_aarp_entry++;
+				goto cleanup;
+			}
+			
+			snap_set_appletalk_hdr_length(hdr, packet->ddp_length);
+			err = state->driver->send_segments(state->driver, hdr, ELAP_HDR_LEN,
+				packet->ddp_data, packet->ddp_length);
+			
+			if (err == ESP_OK) {
+				stats.eth_send_elap_frames++;
+			}
+		}
+		
+		if (err != ESP_OK) {
+			stats.transport_out_errors__transport_ethernet__err_transmit_failed++;
+		}
+		
+	cleanup:
+		freebuf(packet);
+	}
 }
 
-esp_err_t ethertalkv2_transport_enable(transport_t* dummy) {
-	ethernet_transport_enabled = true;
+static esp_err_t ethertalkv2_transport_enable(transport_t* transport) {
+	ethertalkv2_state_t *state = (ethertalkv2_state_t*)transport->private_data;
+	state->enabled = true;
 	return ESP_OK;
 }
 
-esp_err_t ethertalkv2_transport_disable(transport_t* dummy) {
-	ethernet_transport_enabled = false;
+static esp_err_t ethertalkv2_transport_disable(transport_t* transport) {
+	ethertalkv2_state_t *state = (ethertalkv2_state_t*)transport->private_data;
+	state->enabled = false;
 	return ESP_OK;
 }
 
-static transport_t ethertalkv2_transport = {
-	.quality = QUALITY_ETHERNET,
-
-	.kind = "ethertalk_v2",
-	.private_data = NULL,
+transport_t* start_ethernet(ethernet_driver_t* driver) {
+	transport_t *transport = calloc(1, sizeof(transport_t));
+	ethertalkv2_state_t *state = calloc(1, sizeof(ethertalkv2_state_t));
 	
-	.enable = &ethertalkv2_transport_enable,
-	.disable = &ethertalkv2_transport_disable,
-};
-
-transport_t* ethertalkv2_get_transport(void) {
-	// warn if we do something silly and attempt to get multiple
-	// transports for this interface
-	static int attempts = 0;
-	if (attempts > 0) {
-		ESP_LOGE(TAG, "multiple transports requested for ethertalkv2; beware - there can be only one!");
-	}
-	attempts++;
+	transport->quality = QUALITY_ETHERNET;
+	transport->kind = "ethertalk_v2";
+	transport->framing = TRANSPORT_FRAMING_ETHERNET;
+	transport->private_data = state;
+	transport->enable = &ethertalkv2_transport_enable;
+	transport->disable = &ethertalkv2_transport_disable;
+	
+	transport->ready_event = xEventGroupCreate();
+	transport->inbound = xQueueCreate(ETHERNET_QUEUE_DEPTH, sizeof(buffer_t*));
+	transport->outbound = xQueueCreate(ETHERNET_QUEUE_DEPTH, sizeof(buffer_t*));
 	
-	ethertalkv2_transport.inbound = ethertalkv2_inbound_queue;
-	ethertalkv2_transport.outbound = ethertalkv2_outbound_queue;
+	state->driver = driver;
+	
+	ESP_LOGD(TAG, "Starting %s Ethernet interface...", driver->kind);
+	if (driver->start(driver, transport) != ESP_OK) {
+		ESP_LOGE(TAG, "couldn't start %s Ethernet interface", driver->kind);
 		
-	return &ethertalkv2_transport;
+		vQueueDelete(transport->outbound);
+		vQueueDelete(transport->inbound);
+		vEventGroupDelete(transport->ready_event);
+		free(state);
+		free(transport);
+		return NULL;
+	}
+	
+	state->my_hwaddr = driver->hwaddr;
+	snap_fill_appletalk_hdr(state->broadcast_hdr_template, &elap_broadcast_hwaddr,
+		&state->my_hwaddr);
+	
+	mark_transport_ready(transport);
+	
+	xTaskCreate(&ethertalkv2_outbound_runloop, "ETH-tx", 4096, transport, 5, &state->outbound_task);
+	
+	return transport;
 }
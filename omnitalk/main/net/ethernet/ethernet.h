@@ -1,8 +1,28 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "net/ethernet/ethernet_driver.h"
 #include "net/transport.h"
+#include "table/aarp/table.h"
 
 #define ETHERNET_QUEUE_DEPTH 60
 
-void start_ethernet(void);
-transport_t* ethertalkv2_get_transport(void);
+// start_ethernet brings up an ethernet driver and returns an EtherTalk
+// transport on it.  Only start each driver once.
+transport_t* start_ethernet(ethernet_driver_t* driver);
+
+// ethertalkv2_input is called by the driver for every frame it receives.
+// If it's an AppleTalk or AARP frame, the transport takes it (and its
+// buffer) and it returns true.  Otherwise it returns false, and the frame
+// is still the driver's problem.
+bool ethertalkv2_input(transport_t* transport, uint8_t* buffer, uint32_t length);
+
+// ethertalkv2_learn_hwaddr notes the hardware address of the node that sent
+// an AARP request or response, or a DDP packet that hasn't come through a
+// router, in the AARP table.
+void ethertalkv2_learn_hwaddr(aarp_table_t* table, uint8_t* buffer, uint32_t length, bool aarp);
+
+bool is_appletalk_frame(uint8_t* buffer, uint32_t length);
+bool is_aarp_frame(uint8_t* buffer, uint32_t length);
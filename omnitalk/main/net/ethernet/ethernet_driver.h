@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <esp_err.h>
+#include <lwip/prot/ethernet.h>
+
+#include "net/transport.h"
+
+// An ethernet_driver_t is the thing that actually puts frames on and takes
+// frames off an Ethernet.  On the device it's the ESP32's EMAC; on a Linux
+// box it's a packet socket or a TAP interface.
+//
+// The EtherTalk transport in ethernet.c sits on top of a driver and does
+// everything AppleTalk-shaped.
+
+typedef struct ethernet_driver_s ethernet_driver_t;
+
+struct ethernet_driver_s {
+	char* kind;
+	void* private_data;
+	
+	// hwaddr is our MAC address, valid once start has returned
+	struct eth_addr hwaddr;
+	
+	// start brings the interface up and starts handing received frames to
+	// ethertalkv2_input for the transport.  Frames handed over are
+	// malloc()ed, and ethertalkv2_input takes them if it returns true.
+	esp_err_t (*start)(ethernet_driver_t* driver, transport_t* transport);
+	
+	// send sends a whole frame
+	esp_err_t (*send)(ethernet_driver_t* driver, void* buf, size_t length);
+	
+	// send_segments sends a frame made of a header and a payload that live
+	// in different places, without gluing them together first if it can
+	// help it.
+	esp_err_t (*send_segments)(ethernet_driver_t* driver, void* hdr, size_t hdr_length,
+		void* payload, size_t payload_length);
+};
+
+// ethernet_esp_driver returns the driver for the ESP32's own EMAC and PHY,
+// wired up as described in hw.h.
+ethernet_driver_t* ethernet_esp_driver(void);
+
+// ethernet_packet_driver returns a driver that uses an AF_PACKET socket on
+// an existing Linux interface.
+ethernet_driver_t* ethernet_packet_driver(const char* ifname);
+
+// ethernet_tap_driver returns a driver that creates (or attaches to) a
+// Linux TAP interface and sits on the far end of it.
+ethernet_driver_t* ethernet_tap_driver(const char* ifname);
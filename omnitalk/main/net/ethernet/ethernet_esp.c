@@ -0,0 +1,141 @@
+#include "net/ethernet/ethernet_driver.h"
+
+#include <stdlib.h>
+
+#include <esp_err.h>
+#include <esp_eth.h>
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_netif.h>
+#include <esp_netif_types.h>
+#include <driver/gpio.h>
+
+#include "net/ethernet/ethernet.h"
+#include "net/ethernet/ethernet_output.h"
+#include "net/common.h"
+#include "hw.h"
+
+static const char* TAG = "ETHERNET_ESP";
+
+typedef struct {
+	esp_eth_handle_t eth_handle;
+	esp_netif_t *netif;
+	transport_t *transport;
+} esp_ethernet_state_t;
+
+// ethernet_input_path is the callback that will get called whenever
+// we get a packet.  AppleTalk goes to the EtherTalk transport, and
+// everything else goes straight through to esp_netif.
+//
+// Technically this is a bit naughty and we should do this with a tap,
+// but I'm too tired.
+//
+// priv is our driver.
+static esp_err_t ethernet_input_path(esp_eth_handle_t eth_handle, uint8_t *buffer, uint32_t length, void *priv) {
+	ethernet_driver_t *driver = (ethernet_driver_t*)priv;
+	esp_ethernet_state_t *state = (esp_ethernet_state_t*)driver->private_data;
+	
+	// Let's not break L2 TAP
+#if CONFIG_ESP_NETIF_L2_TAP
+    esp_err_t ret = ESP_OK;
+    ret = esp_vfs_l2tap_eth_filter_frame(eth_handle, buffer, (size_t *)&length, info);
+    if (length == 0) {
+        return ret;
+    }
+#endif
+
+	if (ethertalkv2_input(state->transport, buffer, length)) {
+		return ESP_OK;
+	}
+	
+	return esp_netif_receive(state->netif, buffer, length, NULL);
+}
+
+static void got_ip_event_handler(void *arg, esp_event_base_t event_base,
+                                 int32_t event_id, void *event_data) {
+	mark_ip_ready();
+}
+
+static esp_err_t esp_ethernet_start(ethernet_driver_t* driver, transport_t* transport) {
+	esp_ethernet_state_t *state = (esp_ethernet_state_t*)driver->private_data;
+	
+	state->transport = transport;
+	
+	/* set up ESP32 internal MAC */
+	eth_mac_config_t mac_config = ETH_MAC_DEFAULT_CONFIG();
+	mac_config.sw_reset_timeout_ms = 1000;
+	
+	eth_esp32_emac_config_t emac_config = ETH_ESP32_EMAC_DEFAULT_CONFIG();
+	emac_config.clock_config.rmii.clock_mode = EMAC_CLK_EXT_IN;
+	emac_config.clock_config.rmii.clock_gpio = EMAC_CLK_IN_GPIO;
+	emac_config.smi_gpio.mdc_num = ETH_MAC_MDC;
+	emac_config.smi_gpio.mdio_num = ETH_MAC_MDIO;
+	
+	esp_eth_mac_t *mac = esp_eth_mac_new_esp32(&emac_config, &mac_config);
+	
+	/* set up PHY */
+	eth_phy_config_t phy_config = ETH_PHY_DEFAULT_CONFIG();
+	phy_config.phy_addr = 1;
+	phy_config.reset_gpio_num = -1;
+	esp_eth_phy_t *phy = esp_eth_phy_new_lan87xx(&phy_config);
+	
+	// Enable external oscillator (pulled down at boot to allow IO0 strapping)
+	ESP_ERROR_CHECK(gpio_set_direction(ETH_50MHZ_EN, GPIO_MODE_OUTPUT));
+	ESP_ERROR_CHECK(gpio_set_level(ETH_50MHZ_EN, 1));
+	
+	// Install and start Ethernet driver
+	esp_eth_config_t eth_config = ETH_DEFAULT_CONFIG(mac, phy);
+	esp_eth_handle_t eth_handle = NULL;
+	ESP_ERROR_CHECK(esp_eth_driver_install(&eth_config, &eth_handle));
+	state->eth_handle = eth_handle;
+	
+	ESP_ERROR_CHECK(esp_eth_ioctl(eth_handle, ETH_CMD_G_MAC_ADDR, driver->hwaddr.addr));
+	
+	esp_netif_config_t const netif_config = ESP_NETIF_DEFAULT_ETH();
+	esp_netif_t *global_netif = esp_netif_new(&netif_config);
+	esp_eth_netif_glue_handle_t eth_netif_glue = esp_eth_new_netif_glue(eth_handle);
+	ESP_ERROR_CHECK(esp_netif_attach(global_netif, eth_netif_glue));
+	char* hostname = generate_hostname();
+	ESP_ERROR_CHECK(esp_netif_set_hostname(global_netif, hostname));
+	free(hostname);
+	state->netif = global_netif;
+	
+	// Install our custom input and output path
+	ESP_ERROR_CHECK(esp_eth_update_input_path(eth_handle, ethernet_input_path, driver));
+	munge_ethernet_output_path(eth_handle, global_netif);
+	
+	// register handler for when we get an IP
+	ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &got_ip_event_handler, NULL));
+	
+	ESP_ERROR_CHECK(esp_eth_start(eth_handle));
+	
+	active_ip_net_if = global_netif;
+	
+	ESP_LOGI(TAG, "ethernet started");
+	return ESP_OK;
+}
+
+static esp_err_t esp_ethernet_send(ethernet_driver_t* driver, void* buf, size_t length) {
+	esp_ethernet_state_t *state = (esp_ethernet_state_t*)driver->private_data;
+	return send_ethernet(state->eth_handle, buf, length);
+}
+
+static esp_err_t esp_ethernet_send_segments(ethernet_driver_t* driver, void* hdr, size_t hdr_length,
+	void* payload, size_t payload_length) {
+	
+	esp_ethernet_state_t *state = (esp_ethernet_state_t*)driver->private_data;
+	return send_ethernet_segments(state->eth_handle, hdr, hdr_length, payload, payload_length);
+}
+
+ethernet_driver_t* ethernet_esp_driver(void) {
+	ethernet_driver_t *driver = calloc(1, sizeof(ethernet_driver_t));
+	esp_ethernet_state_t *state = calloc(1, sizeof(esp_ethernet_state_t));
+	
+	driver->kind = "esp32";
+	driver->private_data = state;
+	driver->start = &esp_ethernet_start;
+	driver->send = &esp_ethernet_send;
+	driver->send_segments = &esp_ethernet_send_segments;
+	
+	return driver;
+}
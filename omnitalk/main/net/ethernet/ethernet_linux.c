@@ -0,0 +1,275 @@
+#include "net/ethernet/ethernet_driver.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <esp_log.h>
+#include <esp_random.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "net/ethernet/ethernet.h"
+#include "net/common.h"
+#include "web/stats.h"
+
+// This is only built for the host build; the device uses ethernet_esp.c.
+//
+// There are two flavours.  The packet driver opens an AF_PACKET socket on
+// a real interface and shares it with the host's own IP stack, which
+// doesn't want anything to do with AppleTalk anyway.  The TAP driver makes
+// a TAP interface and sits on the far end of it, as if it were another
+// machine plugged into the host, which is handy for bridging or for
+// running several routers on one box.
+
+static const char* TAG = "ETHERNET_LINUX";
+
+typedef struct {
+	char* ifname;
+	int fd;
+	bool is_tap;
+	int ifindex;
+	transport_t *transport;
+	TaskHandle_t inbound_task;
+} linux_ethernet_state_t;
+
+static void linux_ethernet_inbound_runloop(void* param) {
+	ethernet_driver_t *driver = (ethernet_driver_t*)param;
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	
+	while (1) {
+		uint8_t *buffer = malloc(ETHERNET_FRAME_LEN);
+		ssize_t length;
+		
+		if (buffer == NULL) {
+			vTaskDelay(10 / portTICK_PERIOD_MS);
+			continue;
+		}
+		
+		if (state->is_tap) {
+			length = read(state->fd, buffer, ETHERNET_FRAME_LEN);
+		} else {
+			// Packet sockets see what we send as well as what we receive;
+			// we only want the latter.
+			struct sockaddr_ll from;
+			socklen_t fromlen = sizeof(from);
+			length = recvfrom(state->fd, buffer, ETHERNET_FRAME_LEN, 0,
+				(struct sockaddr*)&from, &fromlen);
+			if (length > 0 && from.sll_pkttype == PACKET_OUTGOING) {
+				free(buffer);
+				continue;
+			}
+		}
+		
+		if (length <= 0) {
+			if (length < 0 && errno != EINTR && errno != EAGAIN) {
+				ESP_LOGE(TAG, "read from %s failed: %s", state->ifname, strerror(errno));
+				vTaskDelay(100 / portTICK_PERIOD_MS);
+			}
+			free(buffer);
+			continue;
+		}
+		
+		if (!ethertalkv2_input(state->transport, buffer, length)) {
+			// Not AppleTalk, so the host's IP stack can have it
+			free(buffer);
+		}
+	}
+}
+
+static esp_err_t linux_ethernet_open_packet(ethernet_driver_t* driver) {
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	struct ifreq ifr = { 0 };
+	
+	// ETH_P_802_2 gets us 802.3 frames with an LLC header, which is what
+	// both ELAP and AARP are
+	state->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_802_2));
+	if (state->fd < 0) {
+		ESP_LOGE(TAG, "socket(AF_PACKET) failed: %s", strerror(errno));
+		return ESP_FAIL;
+	}
+	
+	strncpy(ifr.ifr_name, state->ifname, IFNAMSIZ - 1);
+	if (ioctl(state->fd, SIOCGIFINDEX, &ifr) < 0) {
+		ESP_LOGE(TAG, "no interface called %s: %s", state->ifname, strerror(errno));
+		goto err_cleanup;
+	}
+	state->ifindex = ifr.ifr_ifindex;
+	
+	if (ioctl(state->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		ESP_LOGE(TAG, "couldn't get MAC address of %s: %s", state->ifname, strerror(errno));
+		goto err_cleanup;
+	}
+	memcpy(driver->hwaddr.addr, ifr.ifr_hwaddr.sa_data, ETH_HWADDR_LEN);
+	
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_802_2),
+		.sll_ifindex = state->ifindex,
+	};
+	if (bind(state->fd, (struct sockaddr*)&sll, sizeof(sll)) < 0) {
+		ESP_LOGE(TAG, "bind to %s failed: %s", state->ifname, strerror(errno));
+		goto err_cleanup;
+	}
+	
+	// AppleTalk broadcasts and zone multicasts both go to multicast
+	// addresses, so we need to hear all of them
+	struct packet_mreq mreq = {
+		.mr_ifindex = state->ifindex,
+		.mr_type = PACKET_MR_ALLMULTI,
+	};
+	if (setsockopt(state->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+		ESP_LOGE(TAG, "couldn't listen to multicasts on %s: %s", state->ifname, strerror(errno));
+		goto err_cleanup;
+	}
+	
+	return ESP_OK;
+
+err_cleanup:
+	close(state->fd);
+	state->fd = -1;
+	return ESP_FAIL;
+}
+
+static esp_err_t linux_ethernet_open_tap(ethernet_driver_t* driver) {
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	struct ifreq ifr = { 0 };
+	
+	state->fd = open("/dev/net/tun", O_RDWR);
+	if (state->fd < 0) {
+		ESP_LOGE(TAG, "couldn't open /dev/net/tun: %s", strerror(errno));
+		return ESP_FAIL;
+	}
+	
+	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	strncpy(ifr.ifr_name, state->ifname, IFNAMSIZ - 1);
+	if (ioctl(state->fd, TUNSETIFF, &ifr) < 0) {
+		ESP_LOGE(TAG, "couldn't set up TAP interface %s: %s", state->ifname, strerror(errno));
+		close(state->fd);
+		state->fd = -1;
+		return ESP_FAIL;
+	}
+	
+	// We're on the far end of the TAP, so we're a different machine to
+	// the host and need our own MAC address: a random, locally
+	// administered one.
+	uint32_t r = esp_random();
+	driver->hwaddr.addr[0] = 0x02;
+	driver->hwaddr.addr[1] = 0x00;
+	memcpy(&driver->hwaddr.addr[2], &r, sizeof(r));
+	
+	return ESP_OK;
+}
+
+static esp_err_t linux_ethernet_start(ethernet_driver_t* driver, transport_t* transport) {
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	esp_err_t err;
+	
+	state->transport = transport;
+	
+	if (state->is_tap) {
+		err = linux_ethernet_open_tap(driver);
+	} else {
+		err = linux_ethernet_open_packet(driver);
+	}
+	if (err != ESP_OK) {
+		return err;
+	}
+	
+	ESP_LOGI(TAG, "%s on %s, MAC %02x:%02x:%02x:%02x:%02x:%02x", driver->kind, state->ifname,
+		driver->hwaddr.addr[0], driver->hwaddr.addr[1], driver->hwaddr.addr[2],
+		driver->hwaddr.addr[3], driver->hwaddr.addr[4], driver->hwaddr.addr[5]);
+	
+	xTaskCreate(&linux_ethernet_inbound_runloop, "ETH-rx", 4096, driver, 5, &state->inbound_task);
+	return ESP_OK;
+}
+
+static esp_err_t linux_ethernet_sendv(linux_ethernet_state_t *state, struct iovec *iov, int iovcnt, size_t length) {
+	ssize_t sent;
+	
+	stats.transport_out_octets__transport_ethernet += length;
+	stats.transport_out_frames__transport_ethernet++;
+	
+	if (state->is_tap) {
+		sent = writev(state->fd, iov, iovcnt);
+	} else {
+		struct sockaddr_ll sll = {
+			.sll_family = AF_PACKET,
+			.sll_ifindex = state->ifindex,
+			.sll_halen = ETH_HWADDR_LEN,
+		};
+		
+		// The destination is in the frame, but sendmsg wants it too
+		memcpy(sll.sll_addr, iov[0].iov_base, ETH_HWADDR_LEN);
+		
+		struct msghdr msg = {
+			.msg_name = &sll,
+			.msg_namelen = sizeof(sll),
+			.msg_iov = iov,
+			.msg_iovlen = iovcnt,
+		};
+		sent = sendmsg(state->fd, &msg, 0);
+	}
+	
+	if (sent < 0 || (size_t)sent != length) {
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+static esp_err_t linux_ethernet_send(ethernet_driver_t* driver, void* buf, size_t length) {
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	struct iovec iov[1] = {
+		{ .iov_base = buf, .iov_len = length },
+	};
+	
+	return linux_ethernet_sendv(state, iov, 1, length);
+}
+
+static esp_err_t linux_ethernet_send_segments(ethernet_driver_t* driver, void* hdr, size_t hdr_length,
+	void* payload, size_t payload_length) {
+	
+	linux_ethernet_state_t *state = (linux_ethernet_state_t*)driver->private_data;
+	struct iovec iov[2] = {
+		{ .iov_base = hdr, .iov_len = hdr_length },
+		{ .iov_base = payload, .iov_len = payload_length },
+	};
+	
+	return linux_ethernet_sendv(state, iov, 2, hdr_length + payload_length);
+}
+
+static ethernet_driver_t* linux_ethernet_driver(const char* ifname, bool is_tap) {
+	ethernet_driver_t *driver = calloc(1, sizeof(ethernet_driver_t));
+	linux_ethernet_state_t *state = calloc(1, sizeof(linux_ethernet_state_t));
+	
+	state->ifname = strdup(ifname);
+	state->fd = -1;
+	state->is_tap = is_tap;
+	
+	driver->kind = is_tap ? "tap" : "af_packet";
+	driver->private_data = state;
+	driver->start = &linux_ethernet_start;
+	driver->send = &linux_ethernet_send;
+	driver->send_segments = &linux_ethernet_send_segments;
+	
+	return driver;
+}
+
+ethernet_driver_t* ethernet_packet_driver(const char* ifname) {
+	return linux_ethernet_driver(ifname, false);
+}
+
+ethernet_driver_t* ethernet_tap_driver(const char* ifname) {
+	return linux_ethernet_driver(ifname, true);
+}
@@ -1,9 +1,12 @@
 #include "net/ethernet/ethernet_output.h"
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <esp_err.h>
 #include <esp_eth.h>
+#include <esp_idf_version.h>
 #include <esp_netif.h>
 #include <esp_netif_types.h>
 
@@ -17,6 +20,32 @@ esp_err_t send_ethernet(esp_eth_handle_t hdl, void *buf, size_t length) {
 	return esp_eth_transmit(hdl, buf, length);
 }
 
+esp_err_t send_ethernet_segments(esp_eth_handle_t hdl, void *hdr, size_t hdr_length, void *payload, size_t payload_length) {
+	size_t length = hdr_length + payload_length;
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+	stats.transport_out_octets__transport_ethernet += length;
+	stats.transport_out_frames__transport_ethernet++;
+
+	// argc here is the number of buffers, not the number of arguments
+	return esp_eth_transmit_vargs(hdl, 2, hdr, (uint32_t)hdr_length,
+		payload, (uint32_t)payload_length);
+#else
+	// No vectored transmit, so glue it together on the stack.  This is only
+	// ever called from one task, which has the stack space for it.
+	uint8_t frame[ETH_MAX_PACKET_SIZE];
+	
+	if (length > sizeof(frame)) {
+		return ESP_ERR_INVALID_SIZE;
+	}
+	
+	memcpy(frame, hdr, hdr_length);
+	memcpy(frame + hdr_length, payload, payload_length);
+	
+	return send_ethernet(hdl, frame, length);
+#endif
+}
+
 // a free shim, needed for the interface configuration evil
 static void eth_l2_free(void *h, void* buffer)
 {
@@ -16,5 +16,10 @@
 // ifOutOctets
 esp_err_t send_ethernet(esp_eth_handle_t hdl, void *buf, size_t length);
 
+// send_ethernet_segments sends a frame made of a header and a payload that
+// live in different places.  If the driver can take a list of buffers, they
+// go straight to it; otherwise they're copied together once here.
+esp_err_t send_ethernet_segments(esp_eth_handle_t hdl, void *hdr, size_t hdr_length, void *payload, size_t payload_length);
+
 void munge_ethernet_output_path(esp_eth_handle_t eth_driver, esp_netif_t *esp_netif);
 
@@ -0,0 +1,86 @@
+#include "net/ethernet/ethernet_test.h"
+#include "net/ethernet/ethernet.h"
+
+#include <string.h>
+
+#include <lwip/inet.h>
+#include <lwip/prot/ethernet.h>
+
+#include "proto/aarp.h"
+#include "proto/ddp.h"
+#include "proto/SNAP.h"
+#include "table/aarp/table.h"
+#include "test.h"
+
+static const struct eth_addr sender = {{0x02, 0x00, 0x00, 0x00, 0x00, 0x07}};
+static const struct eth_addr us = {{0x02, 0x00, 0x00, 0x00, 0x00, 0x01}};
+
+// aarp_frame builds an AARP packet from 0x1234.56 at sender
+static size_t aarp_frame(uint8_t *frame, uint16_t function) {
+	memset(frame, 0, ELAP_HDR_LEN + sizeof(aarp_packet_t));
+	snap_fill_appletalk_hdr(frame, &us, &sender);
+	snap_hdr_t *snap_hdr = GET_SNAP_HDR(frame);
+	snap_hdr->proto_discriminator_top_byte = 0x00;
+	snap_hdr->proto_discriminator_bottom_bytes = PP_HTONL(0x000080F3);
+	
+	aarp_packet_t *packet = (aarp_packet_t*)(frame + ELAP_HDR_LEN);
+	packet->hardware_type = htons(1);
+	packet->protocol_type = htons(0x809B);
+	packet->hardware_addr_len = 6;
+	packet->protocol_addr_len = 4;
+	packet->function = htons(function);
+	packet->src_hwaddr = sender;
+	packet->src_network = htons(0x1234);
+	packet->src_node = 0x56;
+	return ELAP_HDR_LEN + sizeof(aarp_packet_t);
+}
+
+// ddp_frame builds a DDP packet from 0x1234.57, by way of sender
+static size_t ddp_frame(uint8_t *frame, uint8_t hops) {
+	memset(frame, 0, ELAP_HDR_LEN + sizeof(ddp_long_header_t));
+	snap_fill_appletalk_hdr(frame, &us, &sender);
+	
+	ddp_long_header_t *hdr = (ddp_long_header_t*)(frame + ELAP_HDR_LEN);
+	hdr->hop_count_and_datagram_length = htons((hops << 10) | sizeof(ddp_long_header_t));
+	hdr->src_network = htons(0x1234);
+	hdr->src = 0x57;
+	return ELAP_HDR_LEN + sizeof(ddp_long_header_t);
+}
+
+TEST_FUNCTION(test_ethertalk_learns_hwaddrs) {
+	aarp_table_t *table = aarp_new_table();
+	uint8_t frame[64];
+	struct eth_addr hwaddr;
+	size_t length;
+	
+	// Probes are for addresses that might be someone else's
+	length = aarp_frame(frame, AARP_FUNCTION_PROBE);
+	TEST_ASSERT(is_aarp_frame(frame, length));
+	ethertalkv2_learn_hwaddr(table, frame, length, true);
+	TEST_ASSERT(aarp_table_entry_count(table) == 0);
+	
+	// Requests and responses are for the sender's own
+	length = aarp_frame(frame, AARP_FUNCTION_REQUEST);
+	ethertalkv2_learn_hwaddr(table, frame, length, true);
+	TEST_ASSERT(aarp_lookup(table, 0x1234, 0x56, &hwaddr));
+	TEST_ASSERT(eth_addr_cmp(&hwaddr, &sender));
+	
+	// A DDP packet that's been routed came from further away than the
+	// router that sent it
+	length = ddp_frame(frame, 1);
+	TEST_ASSERT(is_appletalk_frame(frame, length));
+	ethertalkv2_learn_hwaddr(table, frame, length, false);
+	TEST_ASSERT(!aarp_lookup(table, 0x1234, 0x57, &hwaddr));
+	
+	length = ddp_frame(frame, 0);
+	ethertalkv2_learn_hwaddr(table, frame, length, false);
+	TEST_ASSERT(aarp_lookup(table, 0x1234, 0x57, &hwaddr));
+	TEST_ASSERT(eth_addr_cmp(&hwaddr, &sender));
+	
+	// Runts are ignored
+	ethertalkv2_learn_hwaddr(table, frame, ELAP_HDR_LEN, false);
+	ethertalkv2_learn_hwaddr(table, frame, ELAP_HDR_LEN, true);
+	TEST_ASSERT(aarp_table_entry_count(table) == 2);
+	
+	TEST_OK();
+}
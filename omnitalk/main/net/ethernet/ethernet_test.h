@@ -0,0 +1,4 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_ethertalk_learns_hwaddrs);
@@ -0,0 +1,619 @@
+#include "net/loadgen/loadgen.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "mem/buffers.h"
+#include "net/common.h"
+#include "net/transport.h"
+#include "proto/ddp.h"
+#include "proto/llap.h"
+#include "proto/nbp.h"
+#include "proto/zip.h"
+#include "tunables.h"
+
+static const char* TAG = "LOADGEN";
+
+#define LLAP_HDR_LEN 3
+#define LONG_FRAME_HDR_LEN (LLAP_HDR_LEN + sizeof(ddp_long_header_t))
+#define SHORT_FRAME_HDR_LEN sizeof(ddp_short_header_t)
+
+#define DDP_TYPE_RTMP_DATA 1
+#define DDP_TYPE_NBP 2
+#define DDP_TYPE_AEP 4
+#define DDP_TYPE_RTMP_REQUEST 5
+
+#define DDP_SOCKET_NBP 2
+#define DDP_SOCKET_AEP 4
+
+#define AEP_REQUEST 1
+#define AEP_REPLY 2
+
+// An AEP request is the function byte and the time it was sent
+#define LOADGEN_AEP_MIN_SIZE (1 + sizeof(int64_t))
+
+// RTMP data has the sender's address and two tuples before the routes, and
+// a nonextended tuple is three bytes
+#define LOADGEN_RTMP_ROUTES_PER_FRAME ((DDP_MAX_PAYLOAD_LEN - 10) / 3)
+
+// Client nodes stay under 128, since that's where servers (including the
+// router's LLAP LAP) pick their addresses from
+#define LOADGEN_MAX_CLIENT_NODE 127
+
+typedef struct {
+	uint16_t network;
+	_Atomic uint8_t node_address;
+	
+	// the mutex covers everything below it
+	SemaphoreHandle_t mutex;
+	loadgen_config_t config;
+	// seq counts frames generated since the generator was last configured
+	uint32_t seq;
+	loadgen_counters_t counters;
+	
+	// When we sent NBP LkUps, by NBP ID, and ZIP queries, by node; 0 if
+	// we're not waiting for a reply
+	int64_t nbp_sent_at[256];
+	int64_t zip_sent_at[LOADGEN_MAX_CLIENT_NODE + 1];
+} loadgen_state_t;
+
+static transport_t* loadgen_transport = NULL;
+
+static const char* traffic_names[] = {
+	[LOADGEN_AEP] = "aep",
+	[LOADGEN_NBP] = "nbp",
+	[LOADGEN_RTMP] = "rtmp",
+	[LOADGEN_ZIP] = "zip",
+};
+
+const char* loadgen_traffic_name(loadgen_traffic_t traffic) {
+	if (traffic > LOADGEN_ZIP) {
+		return "unknown";
+	}
+	return traffic_names[traffic];
+}
+
+bool loadgen_traffic_from_name(const char* name, loadgen_traffic_t* traffic) {
+	for (size_t i = 0; i < sizeof(traffic_names) / sizeof(traffic_names[0]); i++) {
+		if (strcmp(name, traffic_names[i]) == 0) {
+			*traffic = (loadgen_traffic_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static inline void put_be16(uint8_t* p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+// long_frame writes an LLAP header and long DDP header for a packet from
+// src to dst on network, and returns where the body goes
+static uint8_t* long_frame(uint8_t* f, uint16_t network, uint8_t dst, uint8_t src,
+	uint8_t dst_sock, uint8_t src_sock, uint8_t ddp_type) {
+	
+	f[0] = dst;
+	f[1] = src;
+	f[2] = LLAP_TYPE_DDP_LONG;
+	
+	ddp_long_header_t* hdr = (ddp_long_header_t*)(f + LLAP_HDR_LEN);
+	hdr->ddp_checksum = 0;
+	hdr->dst_network = htons(network);
+	hdr->src_network = htons(network);
+	hdr->dst = dst;
+	hdr->src = src;
+	hdr->dst_sock = dst_sock;
+	hdr->src_sock = src_sock;
+	hdr->ddp_type = ddp_type;
+	return hdr->body;
+}
+
+static size_t finish_long_frame(uint8_t* f, size_t body_len) {
+	ddp_long_header_t* hdr = (ddp_long_header_t*)(f + LLAP_HDR_LEN);
+	hdr->hop_count_and_datagram_length = htons(sizeof(ddp_long_header_t) + body_len);
+	return LONG_FRAME_HDR_LEN + body_len;
+}
+
+static uint8_t* short_frame(uint8_t* f, uint8_t dst, uint8_t src, uint8_t dst_sock,
+	uint8_t src_sock, uint8_t ddp_type) {
+	
+	ddp_short_header_t* hdr = (ddp_short_header_t*)f;
+	hdr->dst = dst;
+	hdr->src = src;
+	hdr->always_one = LLAP_TYPE_DDP_SHORT;
+	hdr->dst_sock = dst_sock;
+	hdr->src_sock = src_sock;
+	hdr->ddp_type = ddp_type;
+	return hdr->body;
+}
+
+static size_t finish_short_frame(uint8_t* f, size_t body_len) {
+	ddp_short_header_t* hdr = (ddp_short_header_t*)f;
+	hdr->datagram_length = htons(sizeof(ddp_short_header_t) - LLAP_HDR_LEN + body_len);
+	return SHORT_FRAME_HDR_LEN + body_len;
+}
+
+static size_t put_pstring(uint8_t* p, const char* s) {
+	size_t len = strlen(s);
+	p[0] = len;
+	memcpy(p + 1, s, len);
+	return len + 1;
+}
+
+// spread picks a number from 0 to n-1 for the seq'th frame.  It needs to
+// be the same every time for the tests, and cheap, so it's a hash rather
+// than esp_random.
+static uint32_t spread(uint32_t seq, uint32_t n) {
+	uint32_t x = seq * 2654435761u;
+	x ^= x >> 15;
+	return n == 0 ? 0 : x % n;
+}
+
+static size_t build_aep(loadgen_config_t* config, uint16_t network, uint8_t router_node,
+	uint8_t node, uint32_t seq, int64_t now, uint8_t* f) {
+	
+	size_t size = config->size_min + spread(seq, config->size_max - config->size_min + 1);
+	uint8_t* body = long_frame(f, network, router_node, node, DDP_SOCKET_AEP, LOADGEN_SOCKET, DDP_TYPE_AEP);
+	
+	body[0] = AEP_REQUEST;
+	memcpy(body + 1, &now, sizeof(now));
+	for (size_t i = LOADGEN_AEP_MIN_SIZE; i < size; i++) {
+		body[i] = i & 0xff;
+	}
+	return finish_long_frame(f, size);
+}
+
+static size_t build_nbp(uint16_t network, uint8_t router_node, uint8_t node, uint32_t seq, uint8_t* f) {
+	uint8_t* body = long_frame(f, network, router_node, node, DDP_SOCKET_NBP, LOADGEN_SOCKET, DDP_TYPE_NBP);
+	size_t len = 0;
+	
+	body[len++] = (NBP_LKUP << 4) | 1;
+	body[len++] = seq & 0xff;
+	put_be16(body + len, network);
+	len += 2;
+	body[len++] = node;
+	body[len++] = LOADGEN_SOCKET;
+	body[len++] = 0;
+	len += put_pstring(body + len, "=");
+	len += put_pstring(body + len, "Workstation");
+	len += put_pstring(body + len, "*");
+	return finish_long_frame(f, len);
+}
+
+static size_t build_rtmp(loadgen_config_t* config, uint16_t network, uint32_t seq, uint8_t* f) {
+	uint8_t* body = short_frame(f, DDP_ADDR_BROADCAST, LOADGEN_SEED_NODE, DDP_SOCKET_RTMP,
+		DDP_SOCKET_RTMP, DDP_TYPE_RTMP_DATA);
+	size_t len = 0;
+	
+	put_be16(body, network);
+	body[2] = 8;
+	body[3] = LOADGEN_SEED_NODE;
+	len = 4;
+	
+	// The version tuple, then our own network, then the routes
+	put_be16(body + len, 0);
+	body[len + 2] = 0x82;
+	put_be16(body + len + 3, network);
+	body[len + 5] = 0;
+	len += 6;
+	
+	// If there are too many routes for one frame, take turns
+	uint32_t frames = (config->routes + LOADGEN_RTMP_ROUTES_PER_FRAME - 1) / LOADGEN_RTMP_ROUTES_PER_FRAME;
+	uint32_t first = frames == 0 ? 0 : (seq % frames) * LOADGEN_RTMP_ROUTES_PER_FRAME;
+	for (uint32_t i = first; i < config->routes && i < first + LOADGEN_RTMP_ROUTES_PER_FRAME; i++) {
+		put_be16(body + len, network + 1 + i);
+		body[len + 2] = 1;
+		len += 3;
+	}
+	return finish_short_frame(f, len);
+}
+
+static size_t build_zip(loadgen_config_t* config, uint16_t network, uint8_t router_node,
+	uint8_t node, uint8_t* f) {
+	
+	uint8_t* body = long_frame(f, network, router_node, node, DDP_SOCKET_ZIP, LOADGEN_SOCKET, DDP_TYPE_ZIP);
+	size_t count = config->routes + 1;
+	if (count > 255) {
+		count = 255;
+	}
+	
+	body[0] = ZIP_QUERY;
+	body[1] = count;
+	for (size_t i = 0; i < count; i++) {
+		put_be16(body + 2 + i * 2, network + i);
+	}
+	return finish_long_frame(f, 2 + count * 2);
+}
+
+size_t loadgen_build_frame(loadgen_config_t* config, uint16_t network, uint8_t router_node,
+	uint32_t seq, int64_t now, uint8_t* buf) {
+	
+	uint8_t node = config->node_base + spread(seq, config->node_spread);
+	
+	switch (config->traffic) {
+		case LOADGEN_AEP:
+			return build_aep(config, network, router_node, node, seq, now, buf);
+		case LOADGEN_NBP:
+			return build_nbp(network, router_node, node, seq, buf);
+		case LOADGEN_RTMP:
+			return build_rtmp(config, network, seq, buf);
+		case LOADGEN_ZIP:
+			return build_zip(config, network, router_node, node, buf);
+	}
+	return 0;
+}
+
+static void loadgen_record_rtt(loadgen_counters_t* counters, int64_t rtt) {
+	if (rtt < 0) {
+		rtt = 0;
+	}
+	
+	int bucket = 0;
+	while (bucket < LOADGEN_RTT_BUCKETS - 1 && rtt >= (2LL << bucket)) {
+		bucket++;
+	}
+	
+	counters->replies++;
+	counters->rtt_sum += rtt;
+	if ((uint64_t)rtt > counters->rtt_max) {
+		counters->rtt_max = rtt;
+	}
+	counters->rtt_histogram[bucket]++;
+}
+
+uint64_t loadgen_rtt_percentile(loadgen_counters_t* counters, unsigned percentile) {
+	uint64_t total = 0;
+	for (int i = 0; i < LOADGEN_RTT_BUCKETS; i++) {
+		total += counters->rtt_histogram[i];
+	}
+	if (total == 0) {
+		return 0;
+	}
+	
+	uint64_t wanted = (total * percentile + 99) / 100;
+	uint64_t seen = 0;
+	for (int i = 0; i < LOADGEN_RTT_BUCKETS - 1; i++) {
+		seen += counters->rtt_histogram[i];
+		if (seen >= wanted) {
+			return (2ULL << i) - 1;
+		}
+	}
+	return counters->rtt_max;
+}
+
+static void loadgen_inject(transport_t* transport, uint8_t* frame, size_t len) {
+	buffer_t* buf = newbuf(ETHERNET_FRAME_LEN, LLAP_HDR_LEN);
+	memcpy(buf->data, frame, len);
+	buf->length = len;
+	
+	if (!tdeliver(transport, buf)) {
+		freebuf(buf);
+	}
+}
+
+// loadgen_answer_rtmp_request plays the seed router to a node looking for
+// its network
+static void loadgen_answer_rtmp_request(transport_t* transport, loadgen_state_t* state, uint8_t requester) {
+	uint8_t f[SHORT_FRAME_HDR_LEN + 4];
+	uint8_t* body = short_frame(f, requester, LOADGEN_SEED_NODE, DDP_SOCKET_RTMP,
+		DDP_SOCKET_RTMP, DDP_TYPE_RTMP_DATA);
+	
+	put_be16(body, state->network);
+	body[2] = 8;
+	body[3] = LOADGEN_SEED_NODE;
+	loadgen_inject(transport, f, finish_short_frame(f, 4));
+}
+
+// loadgen_answer_zip_query tells the router every network it asks about
+// is in LOADGEN_ZONE
+static void loadgen_answer_zip_query(transport_t* transport, loadgen_state_t* state,
+	uint8_t requester, const uint8_t* query, size_t len) {
+	
+	uint8_t f[LONG_FRAME_HDR_LEN + DDP_MAX_PAYLOAD_LEN];
+	uint8_t* body = long_frame(f, state->network, requester, LOADGEN_SEED_NODE,
+		DDP_SOCKET_ZIP, DDP_SOCKET_ZIP, DDP_TYPE_ZIP);
+	size_t tuple_len = 2 + 1 + strlen(LOADGEN_ZONE);
+	size_t count = query[1];
+	size_t body_len = 2;
+	
+	body[0] = ZIP_REPLY;
+	body[1] = 0;
+	for (size_t i = 0; i < count && 2 + i * 2 + 2 <= len; i++) {
+		if (body_len + tuple_len > DDP_MAX_PAYLOAD_LEN) {
+			loadgen_inject(transport, f, finish_long_frame(f, body_len));
+			body[1] = 0;
+			body_len = 2;
+		}
+		memcpy(body + body_len, query + 2 + i * 2, 2);
+		put_pstring(body + body_len + 2, LOADGEN_ZONE);
+		body_len += tuple_len;
+		body[1]++;
+	}
+	if (body[1] > 0) {
+		loadgen_inject(transport, f, finish_long_frame(f, body_len));
+	}
+}
+
+// loadgen_match_reply works out whether a DDP packet from the router is a
+// reply to something we sent, and if so how long it took.  The state's
+// mutex must be held.
+static void loadgen_match_reply(loadgen_state_t* state, uint8_t dst, uint8_t dst_sock,
+	uint8_t ddp_type, const uint8_t* body, size_t len, int64_t now) {
+	
+	if (dst_sock != LOADGEN_SOCKET || dst > LOADGEN_MAX_CLIENT_NODE || len < 2) {
+		return;
+	}
+	
+	if (ddp_type == DDP_TYPE_AEP && body[0] == AEP_REPLY && len >= LOADGEN_AEP_MIN_SIZE) {
+		int64_t sent_at;
+		memcpy(&sent_at, body + 1, sizeof(sent_at));
+		loadgen_record_rtt(&state->counters, now - sent_at);
+	} else if (ddp_type == DDP_TYPE_NBP && (body[0] >> 4) == NBP_LKUP_REPLY &&
+		state->nbp_sent_at[body[1]] != 0) {
+		
+		loadgen_record_rtt(&state->counters, now - state->nbp_sent_at[body[1]]);
+		state->nbp_sent_at[body[1]] = 0;
+	} else if (ddp_type == DDP_TYPE_ZIP && (body[0] == ZIP_REPLY || body[0] == ZIP_EXTENDED_REPLY) &&
+		state->zip_sent_at[dst] != 0) {
+		
+		loadgen_record_rtt(&state->counters, now - state->zip_sent_at[dst]);
+		state->zip_sent_at[dst] = 0;
+	} else {
+		state->counters.unmatched++;
+	}
+}
+
+// loadgen_outbound_runloop takes what the LAP sends and works out what it
+// was: requests to the seed router get answered, and replies to the
+// generator's requests get timed.  Everything else is just counted.
+static void loadgen_outbound_runloop(void* param) {
+	transport_t* transport = (transport_t*)param;
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	buffer_t* buf = NULL;
+	
+	while (1) {
+		xQueueReceive(transport->outbound, &buf, portMAX_DELAY);
+		if (buf == NULL) {
+			continue;
+		}
+		
+		int64_t now = esp_timer_get_time();
+		const uint8_t* f = buf->data;
+		const uint8_t* body = NULL;
+		size_t body_len = 0;
+		uint8_t dst = 0, src = 0, dst_sock = 0, ddp_type = 0;
+		
+		if (buf->length >= SHORT_FRAME_HDR_LEN && f[2] == LLAP_TYPE_DDP_SHORT) {
+			dst = f[0];
+			src = f[1];
+			dst_sock = f[5];
+			ddp_type = f[7];
+			body = f + SHORT_FRAME_HDR_LEN;
+			body_len = buf->length - SHORT_FRAME_HDR_LEN;
+		} else if (buf->length >= LONG_FRAME_HDR_LEN && f[2] == LLAP_TYPE_DDP_LONG) {
+			dst = f[11];
+			src = f[12];
+			dst_sock = f[13];
+			ddp_type = f[15];
+			body = f + LONG_FRAME_HDR_LEN;
+			body_len = buf->length - LONG_FRAME_HDR_LEN;
+		}
+		
+		while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+		state->counters.received++;
+		state->counters.received_octets += buf->length;
+		if (body != NULL) {
+			loadgen_match_reply(state, dst, dst_sock, ddp_type, body, body_len, now);
+		}
+		xSemaphoreGive(state->mutex);
+		
+		// Things for the seed router
+		if (body != NULL && ddp_type == DDP_TYPE_RTMP_REQUEST && dst_sock == DDP_SOCKET_RTMP) {
+			loadgen_answer_rtmp_request(transport, state, src);
+		} else if (body != NULL && ddp_type == DDP_TYPE_ZIP && dst_sock == DDP_SOCKET_ZIP &&
+			(dst == LOADGEN_SEED_NODE || dst == DDP_ADDR_BROADCAST) && body_len >= 2 &&
+			body[0] == ZIP_QUERY) {
+			
+			loadgen_answer_zip_query(transport, state, src, body, body_len);
+		}
+		
+		freebuf(buf);
+	}
+}
+
+// loadgen_send_one makes the next frame and hands it to the LAP, returning
+// false if the generator's done
+static bool loadgen_send_one(transport_t* transport, loadgen_state_t* state, uint8_t router_node) {
+	buffer_t* buf = newbuf(ETHERNET_FRAME_LEN, LLAP_HDR_LEN);
+	int64_t now = esp_timer_get_time();
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	if (state->config.rate == 0 ||
+		(state->config.count != 0 && state->seq >= state->config.count)) {
+		
+		state->config.rate = 0;
+		xSemaphoreGive(state->mutex);
+		freebuf(buf);
+		return false;
+	}
+	
+	uint32_t seq = state->seq++;
+	buf->length = loadgen_build_frame(&state->config, state->network, router_node, seq, now, buf->data);
+	
+	if (state->config.traffic == LOADGEN_NBP) {
+		state->nbp_sent_at[seq & 0xff] = now;
+	} else if (state->config.traffic == LOADGEN_ZIP) {
+		state->zip_sent_at[buf->data[1]] = now;
+	}
+	xSemaphoreGive(state->mutex);
+	
+	size_t length = buf->length;
+	bool queued = tdeliver(transport, buf);
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	if (queued) {
+		state->counters.sent++;
+		state->counters.sent_octets += length;
+	} else {
+		state->counters.queue_full++;
+	}
+	xSemaphoreGive(state->mutex);
+	
+	if (!queued) {
+		freebuf(buf);
+	}
+	return true;
+}
+
+// loadgen_runloop sends frames at the configured rate.  It wakes up every
+// tick and sends however many frames are due, so at high rates they go
+// out in small bursts.
+static void loadgen_runloop(void* param) {
+	transport_t* transport = (transport_t*)param;
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	
+	// credit is in frame-microseconds: a million of them is one frame
+	uint64_t credit = 0;
+	int64_t last = esp_timer_get_time();
+	
+	while (1) {
+		vTaskDelay(1);
+		
+		int64_t now = esp_timer_get_time();
+		int64_t elapsed = now - last;
+		last = now;
+		
+		while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+		uint32_t rate = state->config.rate;
+		xSemaphoreGive(state->mutex);
+		
+		uint8_t router_node = state->node_address;
+		if (rate == 0 || router_node == 0) {
+			credit = 0;
+			continue;
+		}
+		
+		credit += (uint64_t)elapsed * rate;
+		if (credit > (uint64_t)LOADGEN_MAX_BURST * 1000000) {
+			credit = (uint64_t)LOADGEN_MAX_BURST * 1000000;
+		}
+		
+		while (credit >= 1000000) {
+			credit -= 1000000;
+			if (!loadgen_send_one(transport, state, router_node)) {
+				credit = 0;
+				break;
+			}
+		}
+	}
+}
+
+bool loadgen_configure(transport_t* transport, loadgen_config_t* config) {
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	
+	if (config->traffic > LOADGEN_ZIP || config->node_base < 2 || config->node_spread == 0 ||
+		config->node_base + config->node_spread - 1 > LOADGEN_MAX_CLIENT_NODE ||
+		config->size_min < LOADGEN_AEP_MIN_SIZE || config->size_max < config->size_min ||
+		config->size_max > DDP_MAX_PAYLOAD_LEN ||
+		(uint32_t)state->network + config->routes >= 0xff00) {
+		
+		return false;
+	}
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	state->config = *config;
+	state->seq = 0;
+	memset(state->nbp_sent_at, 0, sizeof(state->nbp_sent_at));
+	memset(state->zip_sent_at, 0, sizeof(state->zip_sent_at));
+	xSemaphoreGive(state->mutex);
+	
+	ESP_LOGI(TAG, "%s at %u frames/s", loadgen_traffic_name(config->traffic), (unsigned)config->rate);
+	return true;
+}
+
+void loadgen_get_config(transport_t* transport, loadgen_config_t* config) {
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	*config = state->config;
+	xSemaphoreGive(state->mutex);
+}
+
+void loadgen_get_counters(transport_t* transport, loadgen_counters_t* counters) {
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	*counters = state->counters;
+	xSemaphoreGive(state->mutex);
+}
+
+void loadgen_reset_counters(transport_t* transport) {
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	
+	while (xSemaphoreTake(state->mutex, portMAX_DELAY) != pdTRUE) {}
+	memset(&state->counters, 0, sizeof(state->counters));
+	xSemaphoreGive(state->mutex);
+}
+
+static esp_err_t loadgen_transport_enable(transport_t* transport) {
+	return ESP_OK;
+}
+
+static esp_err_t loadgen_transport_disable(transport_t* transport) {
+	return ESP_OK;
+}
+
+static esp_err_t loadgen_set_node_address(transport_t* transport, uint8_t addr) {
+	loadgen_state_t* state = (loadgen_state_t*)transport->private_data;
+	state->node_address = addr;
+	return ESP_OK;
+}
+
+transport_t* loadgen_get_transport(void) {
+	return loadgen_transport;
+}
+
+transport_t* start_loadgen(uint16_t network) {
+	transport_t* transport = calloc(1, sizeof(transport_t));
+	loadgen_state_t* state = calloc(1, sizeof(loadgen_state_t));
+	
+	state->network = network;
+	state->mutex = xSemaphoreCreateMutex();
+	state->config = (loadgen_config_t) {
+		.traffic = LOADGEN_AEP,
+		.size_min = 64,
+		.size_max = 64,
+		.routes = 16,
+		.node_base = 2,
+		.node_spread = 16,
+	};
+	
+	transport->quality = QUALITY_LOCALTALK;
+	transport->kind = "loadgen";
+	transport->private_data = state;
+	transport->enable = &loadgen_transport_enable;
+	transport->disable = &loadgen_transport_disable;
+	transport->set_node_address = &loadgen_set_node_address;
+	
+	transport->ready_event = xEventGroupCreate();
+	transport->inbound = xQueueCreate(LOADGEN_QUEUE_DEPTH, sizeof(buffer_t*));
+	transport->outbound = xQueueCreate(LOADGEN_QUEUE_DEPTH, sizeof(buffer_t*));
+	
+	xTaskCreate(&loadgen_outbound_runloop, "LOADGEN-out", 4096, transport, 5, NULL);
+	xTaskCreate(&loadgen_runloop, "LOADGEN-gen", 4096, transport, 5, NULL);
+	
+	loadgen_transport = transport;
+	mark_transport_ready(transport);
+	
+	return transport;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem/buffers.h"
+#include "net/transport.h"
+
+// The load generator is a transport that pretends to be a busy LocalTalk
+// network, for finding out how much the router can take on the device
+// itself.  Put an LLAP LAP on it and it'll play the network's seed router
+// (answering the LAP's RTMP requests and the router's ZIP queries, so the
+// LAP gets going), then throw DDP traffic at the router at a set rate:
+//
+//   LOADGEN_AEP   AEP echo requests, with payloads of a random size
+//                 between size_min and size_max
+//   LOADGEN_NBP   NBP LkUps for =:Workstation@*
+//   LOADGEN_RTMP  RTMP data from the seed router, advertising routes
+//                 routes (which the router will ZIP query for)
+//   LOADGEN_ZIP   ZIP queries for routes networks at once
+//
+// Requests come from node_spread different nodes, starting at node_base.
+// What the router sends back is matched up with the request it answers,
+// and the round trip time put into a histogram: AEP echoes carry their
+// send time in the payload, NBP replies are matched by NBP ID, and ZIP
+// replies by which node asked.
+//
+// There's only one load generator; web/loadgen.c controls it.
+
+#define LOADGEN_QUEUE_DEPTH 60
+
+// The seed router node the generator plays
+#define LOADGEN_SEED_NODE 1
+
+// The zone every network the generator knows about is in
+#define LOADGEN_ZONE "Loadgen"
+
+// Requests come from this socket on each node
+#define LOADGEN_SOCKET 0xfd
+
+// Round trip times go into power-of-two buckets of microseconds, from
+// under 2us up to 2^(LOADGEN_RTT_BUCKETS - 1)us and over
+#define LOADGEN_RTT_BUCKETS 24
+
+// How many frames can go out at once if the generator falls behind
+#define LOADGEN_MAX_BURST 16
+
+typedef enum {
+	LOADGEN_AEP = 0,
+	LOADGEN_NBP,
+	LOADGEN_RTMP,
+	LOADGEN_ZIP,
+} loadgen_traffic_t;
+
+typedef struct {
+	loadgen_traffic_t traffic;
+
+	// rate is frames per second; 0 stops the generator
+	uint32_t rate;
+	// count is how many frames to send before stopping; 0 goes on forever
+	uint32_t count;
+
+	// size_min and size_max bound the AEP payload length
+	uint16_t size_min;
+	uint16_t size_max;
+
+	// routes is how many routes RTMP data has, or networks ZIP queries ask
+	// about
+	uint16_t routes;
+
+	uint8_t node_base;
+	uint8_t node_spread;
+} loadgen_config_t;
+
+typedef struct {
+	uint64_t sent;
+	uint64_t sent_octets;
+	// queue_full is frames the LAP didn't have room for
+	uint64_t queue_full;
+
+	uint64_t received;
+	uint64_t received_octets;
+	uint64_t replies;
+	// unmatched is replies that didn't answer anything we were waiting on
+	uint64_t unmatched;
+
+	uint64_t rtt_sum;
+	uint64_t rtt_max;
+	uint64_t rtt_histogram[LOADGEN_RTT_BUCKETS];
+} loadgen_counters_t;
+
+// start_loadgen starts the load generator, stopped, pretending the network
+// it's on is the given number.
+transport_t* start_loadgen(uint16_t network);
+transport_t* loadgen_get_transport(void);
+
+// loadgen_configure changes what the generator's doing, and returns false
+// if the configuration doesn't make sense.  Counters aren't reset.
+bool loadgen_configure(transport_t* transport, loadgen_config_t* config);
+void loadgen_get_config(transport_t* transport, loadgen_config_t* config);
+
+void loadgen_get_counters(transport_t* transport, loadgen_counters_t* counters);
+void loadgen_reset_counters(transport_t* transport);
+
+// loadgen_rtt_percentile works out roughly what the given percentile of
+// the round trip times is from the histogram, in microseconds; it's the
+// top of the bucket the percentile falls in.
+uint64_t loadgen_rtt_percentile(loadgen_counters_t* counters, unsigned percentile);
+
+// loadgen_traffic_name and loadgen_traffic_from_name convert between
+// traffic kinds and their names ("aep", "nbp", "rtmp" and "zip").
+const char* loadgen_traffic_name(loadgen_traffic_t traffic);
+bool loadgen_traffic_from_name(const char* name, loadgen_traffic_t* traffic);
+
+// loadgen_build_frame writes the seq'th request frame for the given
+// configuration into buf, as an LLAP frame, and returns its length.  buf
+// must be at least ETHERNET_FRAME_LEN long.  now goes into AEP requests.
+size_t loadgen_build_frame(loadgen_config_t* config, uint16_t network, uint8_t router_node,
+	uint32_t seq, int64_t now, uint8_t* buf);
@@ -0,0 +1,111 @@
+#include "net/loadgen/loadgen_test.h"
+#include "net/loadgen/loadgen.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "net/common.h"
+#include "proto/llap.h"
+#include "test.h"
+
+static uint16_t get_be16(const uint8_t* p) {
+	return ((uint16_t)p[0] << 8) | p[1];
+}
+
+TEST_FUNCTION(test_loadgen_build_frame) {
+	uint8_t* f = calloc(1, ETHERNET_FRAME_LEN);
+	loadgen_config_t config = {
+		.traffic = LOADGEN_AEP,
+		.size_min = 20,
+		.size_max = 40,
+		.routes = 300,
+		.node_base = 10,
+		.node_spread = 5,
+	};
+	size_t len;
+	loadgen_traffic_t traffic;
+	
+	TEST_ASSERT(loadgen_traffic_from_name("nbp", &traffic) && traffic == LOADGEN_NBP);
+	TEST_ASSERT(!loadgen_traffic_from_name("ddos", &traffic));
+	TEST_ASSERT(strcmp(loadgen_traffic_name(LOADGEN_ZIP), "zip") == 0);
+	
+	// AEP requests go to the router, from the spread of nodes, with the
+	// sizes spread out too and the time they went in the payload
+	bool seen_min = false, seen_max = false;
+	for (uint32_t seq = 0; seq < 500; seq++) {
+		len = loadgen_build_frame(&config, 1000, 200, seq, 123456789, f);
+		size_t payload = len - 16;
+		TEST_ASSERT(payload >= 20 && payload <= 40);
+		TEST_ASSERT(get_be16(f + 3) == len - 3);
+		seen_min |= payload == 20;
+		seen_max |= payload == 40;
+		
+		TEST_ASSERT(f[0] == 200 && f[2] == LLAP_TYPE_DDP_LONG);
+		TEST_ASSERT(f[12] >= 10 && f[12] < 15);
+		TEST_ASSERT(get_be16(f + 7) == 1000 && f[11] == 200 && f[13] == 4 && f[15] == 4);
+		TEST_ASSERT(f[16] == 1);
+		
+		int64_t sent_at;
+		memcpy(&sent_at, f + 17, sizeof(sent_at));
+		TEST_ASSERT(sent_at == 123456789);
+	}
+	TEST_ASSERT(seen_min && seen_max);
+	
+	// NBP LkUps have the sequence number as their ID
+	config.traffic = LOADGEN_NBP;
+	len = loadgen_build_frame(&config, 1000, 200, 0x1234, 0, f);
+	TEST_ASSERT(f[13] == 2 && f[15] == 2);
+	TEST_ASSERT(f[16] == 0x21 && f[17] == 0x34);
+	TEST_ASSERT(get_be16(f + 18) == 1000 && f[20] == f[12] && f[21] == LOADGEN_SOCKET);
+	TEST_ASSERT(len == 16 + 7 + 2 + 12 + 2);
+	
+	// RTMP data comes from the seed router, and if there are too many
+	// routes for one frame, frames take turns
+	config.traffic = LOADGEN_RTMP;
+	len = loadgen_build_frame(&config, 1000, 200, 0, 0, f);
+	TEST_ASSERT(f[0] == 0xff && f[1] == LOADGEN_SEED_NODE && f[2] == LLAP_TYPE_DDP_SHORT);
+	TEST_ASSERT(f[7] == 1);
+	TEST_ASSERT(get_be16(f + 8) == 1000 && f[11] == LOADGEN_SEED_NODE);
+	TEST_ASSERT(get_be16(f + 15) == 1000 && f[17] == 0);
+	TEST_ASSERT(get_be16(f + 18) == 1001 && f[20] == 1);
+	size_t first_routes = (len - 18) / 3;
+	TEST_ASSERT(len <= 3 + 5 + 586);
+	
+	len = loadgen_build_frame(&config, 1000, 200, 1, 0, f);
+	TEST_ASSERT(get_be16(f + 18) == 1001 + first_routes);
+	TEST_ASSERT(first_routes + (len - 18) / 3 == 300);
+	
+	// ZIP queries ask about our network and the routes, up to 255 of them
+	config.traffic = LOADGEN_ZIP;
+	len = loadgen_build_frame(&config, 1000, 200, 0, 0, f);
+	TEST_ASSERT(f[13] == 6 && f[15] == 6 && f[16] == 1 && f[17] == 255);
+	TEST_ASSERT(get_be16(f + 18) == 1000 && get_be16(f + 20) == 1001);
+	TEST_ASSERT(len == 16 + 2 + 255 * 2);
+	
+	free(f);
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_loadgen_rtt_percentile) {
+	loadgen_counters_t counters = { 0 };
+	
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 50) == 0);
+	
+	// 90 replies in the 64-127us bucket, 10 in the 1024-2047us one
+	counters.rtt_histogram[6] = 90;
+	counters.rtt_histogram[10] = 10;
+	counters.rtt_max = 1500;
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 50) == 127);
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 90) == 127);
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 91) == 2047);
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 100) == 2047);
+	
+	// The last bucket has no top, so it's the biggest we've seen
+	counters.rtt_histogram[LOADGEN_RTT_BUCKETS - 1] = 1000;
+	counters.rtt_max = 99999999;
+	TEST_ASSERT(loadgen_rtt_percentile(&counters, 99) == 99999999);
+	
+	TEST_OK();
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_loadgen_build_frame);
+TEST_FUNCTION(test_loadgen_rtt_percentile);
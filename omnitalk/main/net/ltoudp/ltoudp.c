@@ -1,8 +1,15 @@
 #include "net/ltoudp/ltoudp.h"
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <esp_log.h>
 #include <esp_netif.h>
 #include <esp_netif_types.h>
+#include <esp_random.h>
 #include <lwip/err.h>
 #include <lwip/sockets.h>
 #include <lwip/sys.h>
@@ -10,43 +17,99 @@
 #include "mem/buffers.h"
 #include "net/common.h"
 #include "net/transport.h"
+#include "net/udp_reactor.h"
+#include "proto/ddp.h"
+#include "proto/llap.h"
 #include "web/stats.h"
+#include "global_state.h"
 #include "tunables.h"
 
 static const char* TAG = "LTOUDP";
 
-static _Atomic int udp_sock = -1;
-TaskHandle_t udp_rx_task = NULL;
-TaskHandle_t udp_tx_task = NULL;
+#define LTOUDP_HDR_LEN 4
 
-QueueHandle_t ltoudp_outbound_queue = NULL;
-QueueHandle_t ltoudp_inbound_queue = NULL;
+// ltoudp_state_t is the private data for an LToUDP transport; there's one
+// of these per multicast group.
+typedef struct {
+	struct in_addr group;
+	
+	_Atomic bool enabled;
+	
+	// sender_id goes in the header of everything we send, so that we can
+	// spot our own packets coming back to us off the multicast group.  It's
+	// picked once at startup, in network byte order.
+	uint32_t sender_id;
+	
+	// node_address is our LLAP node address, or 0 if we don't have one
+	// yet.  Until we do, we let everything through, since the LAP needs to
+	// see replies to the ENQs it sends while it's picking one.
+	_Atomic uint8_t node_address;
+	
+	// recv_buf is kept between reads, so we don't have to allocate a new
+	// one every time we get a packet we're going to throw away.
+	buffer_t *recv_buf;
+} ltoudp_state_t;
+
+// ltoudp_is_nbp returns true if an LLAP frame carries an NBP packet.
+static bool ltoudp_is_nbp(uint8_t *frame, size_t len) {
+	llap_hdr_t *hdr = (llap_hdr_t*)frame;
+	
+	if (hdr->llap_type == LLAP_TYPE_DDP_SHORT && len >= sizeof(ddp_short_header_t)) {
+		return ((ddp_short_header_t*)frame)->ddp_type == DDP_TYPE_NBP;
+	}
+	if (hdr->llap_type == LLAP_TYPE_DDP_LONG && len >= sizeof(llap_hdr_t) + sizeof(ddp_long_header_t)) {
+		return ((ddp_long_header_t*)(frame + sizeof(llap_hdr_t)))->ddp_type == DDP_TYPE_NBP;
+	}
+	return false;
+}
 
-static transport_t ltoudp_transport;
-static _Atomic bool ltoudp_transport_enabled = false;
+// ltoudp_should_drop checks an incoming datagram (LToUDP header and all) and
+// returns true if it's one we sent or one that isn't for us, so that we
+// can throw it away before it gets anywhere near a queue.  Other nodes' NBP
+// packets get through if there's an NBP cache, for the LAP to learn from.
+static bool ltoudp_should_drop(ltoudp_state_t *state, uint8_t *data, size_t len) {
+	if (memcmp(data, &state->sender_id, LTOUDP_HDR_LEN) == 0) {
+		stats.transport_in_filtered__transport_ltoudp__reason_own_packet++;
+		return true;
+	}
+	
+	uint8_t node = state->node_address;
+	uint8_t llap_dst = data[LTOUDP_HDR_LEN];
+	bool cacheable = global_nbp_cache != NULL && ltoudp_is_nbp(data + LTOUDP_HDR_LEN, len - LTOUDP_HDR_LEN);
+	if (node != 0 && llap_dst != node && llap_dst != 0xFF && !cacheable) {
+		stats.transport_in_filtered__transport_ltoudp__reason_not_for_us++;
+		return true;
+	}
+	
+	return false;
+}
 
-void init_udp(void) {
+// ltoudp_open sets up the multicast socket.  It's called by the UDP reactor
+// once we've got an IP address, and again if the socket breaks.
+static int ltoudp_open(transport_t *transport) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
 	struct sockaddr_in saddr = { 0 };
 	int sock = -1;
 	int err = 0;
 	struct in_addr outgoing_addr = { 0 };
 	esp_netif_ip_info_t ip_info = { 0 };
 	
-	ESP_LOGI(TAG, "waiting for IP connectivity");
-	wait_for_ip_ready();
+	// Whatever happens, the LAP can get going; it'll just not hear
+	// anything until we've got a socket.
+	mark_transport_ready(transport);
 	
 	/* bail out early if we don't have a wifi network interface yet */
 	
 	if (active_ip_net_if == NULL) {
 		ESP_LOGW(TAG, "no underlying network interface yet.");
-		return;
+		return -1;
 	}
 		
 	/* or if we can't get its IP */
 	err = esp_netif_get_ip_info(active_ip_net_if, &ip_info);
 	if (err != ESP_OK) {
 		ESP_LOGE(TAG, "network interface wouldn't tell us its IP.");
-		return;
+		return -1;
 	}
 	
 	inet_addr_from_ip4addr(&outgoing_addr, &ip_info.ip);
@@ -56,12 +119,21 @@ void init_udp(void) {
 	sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
 	if (sock < 0) {
 		ESP_LOGE(TAG, "socket() failed.  error: %d", errno);
-		return;
+		return -1;
+	}
+	
+	// We bind to the group address rather than INADDR_ANY, so that
+	// several of us can share the port and each only hear its own group.
+	int reuse = 1;
+	err = setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	if (err < 0) {
+		ESP_LOGE(TAG, "setsockopt(...SO_REUSEADDR...) failed, error: %d", errno);
+		goto err_cleanup;
 	}
 	
 	saddr.sin_family = PF_INET;
-	saddr.sin_port = htons(1954);
-	saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	saddr.sin_port = htons(LTOUDP_PORT);
+	saddr.sin_addr = state->group;
 	err = bind(sock, (struct sockaddr *)&saddr, sizeof(struct sockaddr_in));
 	if (err < 0) {
 		ESP_LOGE(TAG, "bind() failed, error: %d", errno);
@@ -84,11 +156,7 @@ void init_udp(void) {
 
 	struct ip_mreq imreq = { 0 };
 	imreq.imr_interface.s_addr = IPADDR_ANY;
-	err = inet_aton("239.192.76.84", &imreq.imr_multiaddr.s_addr);
-	if (err != 1) {
-		ESP_LOGE(TAG, "inet_aton failed, error: %d", errno);
-		goto err_cleanup;
-	}
+	imreq.imr_multiaddr = state->group;
 
 	err = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
 						 &imreq, sizeof(struct ip_mreq));
@@ -97,155 +165,136 @@ void init_udp(void) {
 		goto err_cleanup;
 	}
 	 
-	udp_sock = sock;
-	
-	ESP_LOGI(TAG, "multicast socket now ready.");
+	ESP_LOGI(TAG, "multicast socket for %s now ready.", inet_ntoa(state->group));
 						
-	return;
+	return sock;
 
 	
 err_cleanup:
 	close(sock);
-	return;
+	return -1;
 
 }
 
-void udp_rx_runloop(void *pvParameters) {
-	ESP_LOGI(TAG, "starting LToUDP listener");
-	init_udp();
-	
-	mark_transport_ready(&ltoudp_transport);
-	
-	buffer_t *recv_buf = NULL;
-	
-	while(1) {
-		/* retry if we need to */
-		while(udp_sock == -1) {
-			ESP_LOGE(TAG, "setting up LToUDP listener failed.  Retrying...");
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-			init_udp();
+// ltoudp_read reads one datagram from the multicast group and, if it's one
+// for us, puts it on the inbound queue.
+static udp_io_result_t ltoudp_read(transport_t *transport, int sock) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
+
+	if (state->recv_buf == NULL) {
+		// this buffer is too big but the size will do for now
+		// 7 => size of ltoudp header
+		state->recv_buf = newbuf(ETHERNET_FRAME_LEN, 7);
+	}
+	buffer_t *recv_buf = state->recv_buf;
+		
+	int len = recv(sock, recv_buf->data, recv_buf->capacity, 0);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return UDP_IO_IDLE;
 		}
+		stats.transport_in_errors__transport_ltoudp__err_recv_failed++;
+		return UDP_IO_BROKEN;
+	}
+	stats.transport_in_octets__transport_ltoudp += len;
+	stats.transport_in_frames__transport_ltoudp++;
+	recv_buf->length = len;
 	
-		while(1) {
-			if (recv_buf == NULL) {
-				// this buffer is too big but the size will do for now
-				// 7 => size of ltoudp header
-				recv_buf = newbuf(ETHERNET_FRAME_LEN, 7);
-			}
-		
-			int len = recv(udp_sock, recv_buf->data, recv_buf->capacity, 0);
-			if (len < 0) {
-				stats.transport_in_errors__transport_ltoudp__err_recv_failed++;
-				break;
-			}
-			stats.transport_in_octets__transport_ltoudp += len;
-			stats.transport_in_frames__transport_ltoudp++;
-			recv_buf->length = len;
-			
-			if (len > 609) {
-				stats.transport_in_errors__transport_ltoudp__err_packet_too_long++;
-				ESP_LOGE(TAG, "packet too long: %d", len);
-				continue;
-			}
-			if (len >= 7 && ltoudp_transport_enabled) {
-				// trim off the LToUDP tag
-				buf_trim_l2_hdr_bytes(recv_buf, 4);
-				BaseType_t err = xQueueSendToBack(ltoudp_inbound_queue, &recv_buf, (TickType_t)0);
-				if (err != pdTRUE) {
-					stats.transport_in_errors__transport_ltoudp__err_lap_queue_full++;
-					freebuf(recv_buf);
-				}
-				
-				recv_buf = NULL;
-			}
+	if (len > 609) {
+		stats.transport_in_errors__transport_ltoudp__err_packet_too_long++;
+		ESP_LOGE(TAG, "packet too long: %d", len);
+		return UDP_IO_MORE;
+	}
+	if (len >= 7 && state->enabled) {
+		if (ltoudp_should_drop(state, recv_buf->data, len)) {
+			return UDP_IO_MORE;
 		}
 	
-		close(udp_sock);
-		udp_sock = -1;
+		// trim off the LToUDP tag
+		buf_trim_l2_hdr_bytes(recv_buf, LTOUDP_HDR_LEN);
+		if (!tdeliver(transport, recv_buf)) {
+			stats.transport_in_errors__transport_ltoudp__err_lap_queue_full++;
+			freebuf(recv_buf);
+		}
+		
+		state->recv_buf = NULL;
 	}
+	
+	return UDP_IO_MORE;
 }
 
-void udp_tx_runloop(void *pvParameters) {
-	buffer_t* packet = NULL;
+// ltoudp_write tags a packet with our sender ID and sends it to the group.
+static void ltoudp_write(transport_t *transport, int sock, buffer_t *packet) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
 	struct sockaddr_in dest_addr = {0};
-	int err = 0;
+	
+	if (packet->data == NULL || !state->enabled) {
+		return;
+	}
 		
-	dest_addr.sin_addr.s_addr = inet_addr("239.192.76.84");
+	dest_addr.sin_addr = state->group;
 	dest_addr.sin_family = AF_INET;
-	dest_addr.sin_port = htons(1954);
-	
-	ESP_LOGI(TAG, "starting LToUDP sender");
+	dest_addr.sin_port = htons(LTOUDP_PORT);
 	
-	while(1) {
-		xQueueReceive(ltoudp_outbound_queue, &packet, portMAX_DELAY);
-						
-		if (packet == NULL) {
-			continue;
-		}
-		
-		if (packet->data == NULL) {
-			continue;
-		}
-		   
-		if (udp_sock != -1 && ltoudp_transport_enabled) {
-			buf_give_me_extra_l2_hdr_bytes(packet, 4);
-			err = sendto(udp_sock, packet->data, packet->length, 0, 
-				(struct sockaddr *)&dest_addr, sizeof(dest_addr));
-			if (err < 0) {
-				ESP_LOGE(TAG, "error: sendto: errno %d", errno);
-				stats.transport_out_errors__transport_ltoudp__err_send_failed++;
-			} else {
-				stats.transport_out_octets__transport_ltoudp += packet->length + 4;
-				stats.transport_out_frames__transport_ltoudp++;
-			}
-			err = 0;
-		}
-				
-		freebuf(packet);
+	buf_give_me_extra_l2_hdr_bytes(packet, LTOUDP_HDR_LEN);
+	memcpy(packet->data, &state->sender_id, LTOUDP_HDR_LEN);
+	int err = sendto(sock, packet->data, packet->length, 0, 
+		(struct sockaddr *)&dest_addr, sizeof(dest_addr));
+	if (err < 0) {
+		ESP_LOGE(TAG, "error: sendto: errno %d", errno);
+		stats.transport_out_errors__transport_ltoudp__err_send_failed++;
+	} else {
+		stats.transport_out_octets__transport_ltoudp += packet->length;
+		stats.transport_out_frames__transport_ltoudp++;
 	}
 }
 
 
-void start_ltoudp(void) {
-	ltoudp_transport.ready_event = xEventGroupCreate();
-	ltoudp_outbound_queue = xQueueCreate(LTOUDP_QUEUE_DEPTH, sizeof(buffer_t*));;
-	ltoudp_inbound_queue = xQueueCreate(LTOUDP_QUEUE_DEPTH, sizeof(buffer_t*));;
-	xTaskCreate(&udp_rx_runloop, "LToUDP-rx", 4096, NULL, 5, &udp_rx_task);
-	xTaskCreate(&udp_tx_runloop, "LToUDP-tx", 4096, NULL, 5, &udp_tx_task);
+static esp_err_t ltoudp_transport_enable(transport_t* transport) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
+	state->enabled = true;
+	return ESP_OK;
 }
 
-esp_err_t ltoudp_transport_enable(transport_t* dummy) {
-	ltoudp_transport_enabled = true;
+static esp_err_t ltoudp_transport_disable(transport_t* transport) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
+	state->enabled = false;
 	return ESP_OK;
 }
 
-esp_err_t ltoudp_transport_disable(transport_t* dummy) {
-	ltoudp_transport_enabled = false;
+static esp_err_t ltoudp_set_node_address(transport_t* transport, uint8_t addr) {
+	ltoudp_state_t *state = (ltoudp_state_t*)transport->private_data;
+	state->node_address = addr;
 	return ESP_OK;
 }
 
-static transport_t ltoudp_transport = {
-	.quality = QUALITY_LTOUDP,
-
-	.kind = "ltoudp",
-	.private_data = NULL,
+transport_t* start_ltoudp(const char* multicast_group) {
+	transport_t *transport = calloc(1, sizeof(transport_t));
+	ltoudp_state_t *state = calloc(1, sizeof(ltoudp_state_t));
 	
-	.enable = &ltoudp_transport_enable,
-	.disable = &ltoudp_transport_disable,
-};
+	if (inet_aton(multicast_group, &state->group) == 0) {
+		ESP_LOGE(TAG, "'%s' isn't a multicast group I understand", multicast_group);
+		free(state);
+		free(transport);
+		return NULL;
+	}
 
-transport_t* ltoudp_get_transport(void) {
-	// warn if we do something silly and attempt to get multiple
-	// transports for this interface
-	static int attempts = 0;
-	if (attempts > 0) {
-		ESP_LOGE(TAG, "multiple transports requested for ltoudp; beware - there can be only one!");
+	// Zero is what everyone else who doesn't care sends, so avoid it
+	while (state->sender_id == 0) {
+		state->sender_id = esp_random();
 	}
-	attempts++;
-	
-	ltoudp_transport.inbound = ltoudp_inbound_queue;
-	ltoudp_transport.outbound = ltoudp_outbound_queue;
-	
-	return &ltoudp_transport;
+
+	transport->quality = QUALITY_LTOUDP;
+	transport->kind = "ltoudp";
+	transport->private_data = state;
+	transport->enable = &ltoudp_transport_enable;
+	transport->disable = &ltoudp_transport_disable;
+	transport->set_node_address = &ltoudp_set_node_address;
+
+	transport->ready_event = xEventGroupCreate();
+	transport->outbound = xQueueCreate(LTOUDP_QUEUE_DEPTH, sizeof(buffer_t*));
+	transport->inbound = xQueueCreate(LTOUDP_QUEUE_DEPTH, sizeof(buffer_t*));
+	udp_reactor_add(transport, &ltoudp_open, &ltoudp_read, &ltoudp_write);
 	
+	return transport;
 }
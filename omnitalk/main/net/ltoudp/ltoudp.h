@@ -4,5 +4,11 @@
 
 #define LTOUDP_QUEUE_DEPTH 60
 
-void start_ltoudp(void);
-transport_t* ltoudp_get_transport(void);
\ No newline at end of file
+// The multicast group everyone uses unless told otherwise
+#define LTOUDP_DEFAULT_GROUP "239.192.76.84"
+#define LTOUDP_PORT 1954
+
+// start_ltoudp starts an LToUDP transport on the given multicast group and
+// returns it.  You can have as many of these as you like, as long as they're
+// on different groups; each will be a separate port on the router.
+transport_t* start_ltoudp(const char* multicast_group);
@@ -1,35 +1,133 @@
 #include "net/net.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+
 #include "lap/llap/llap.h"
 #include "lap/sink/sink.h"
 #include "lap/registry.h"
 #include "net/b2udptunnel/b2udptunnel.h"
 #include "net/ethernet/ethernet.h"
+#include "net/loadgen/loadgen.h"
 #include "net/ltoudp/ltoudp.h"
 #include "net/tashtalk/tashtalk.h"
 #include "net/common.h"
 #include "net/mdns.h"
+#include "net/packet_capture.h"
 #include "global_state.h"
+#include "tunables.h"
+
+static const char* TAG = "NET";
+
+static transport_t* ethernet_transport;
+
+static transport_t* ltoudp_transports[MAX_UDP_TRANSPORTS];
+static char* ltoudp_groups[MAX_UDP_TRANSPORTS];
+static int ltoudp_transport_count = 0;
+
+static transport_t* b2_transports[MAX_UDP_TRANSPORTS];
+static uint16_t b2_ports[MAX_UDP_TRANSPORTS];
+static int b2_transport_count = 0;
 
-void start_net(runloop_info_t* controlplane, runloop_info_t* dataplane) {
+void start_net_common(void) {
 	start_common();
+	packet_capture_init();
 
-	start_ethernet();
+	global_aarp_table = aarp_new_table();
+}
+
+void start_net_ethernet(void) {
+	ethernet_transport = start_ethernet(ethernet_esp_driver());
+}
+
+void start_net_mdns(void) {
 	start_mdns();
-	start_tashtalk();
-	start_ltoudp();
-	start_b2udptunnel();
+}
+
+void start_net_tashtalk(void) {
+	start_tashtalk(tt_uart_esp_backend());
+}
+
+void start_net_udp(void) {
+#ifdef B2UDPTUNNEL_PEERS
+	const char* b2_peers = B2UDPTUNNEL_PEERS;
+#else
+	const char* b2_peers = NULL;
+#endif
+
+	char *list = strdup(LTOUDP_GROUPS);
+	char *saveptr = NULL;
+	
+	for (char *tok = strtok_r(list, ", ", &saveptr); tok != NULL;
+		tok = strtok_r(NULL, ", ", &saveptr)) {
+		
+		if (ltoudp_transport_count == MAX_UDP_TRANSPORTS) {
+			ESP_LOGE(TAG, "too many LToUDP groups, ignoring '%s'", tok);
+			continue;
+		}
+		
+		transport_t *transport = start_ltoudp(tok);
+		if (transport != NULL) {
+			ltoudp_transports[ltoudp_transport_count] = transport;
+			ltoudp_groups[ltoudp_transport_count] = strdup(tok);
+			ltoudp_transport_count++;
+		}
+	}
+	free(list);
+	
+	list = strdup(B2UDPTUNNEL_PORTS);
+	saveptr = NULL;
 	
+	for (char *tok = strtok_r(list, ", ", &saveptr); tok != NULL;
+		tok = strtok_r(NULL, ", ", &saveptr)) {
+		
+		if (b2_transport_count == MAX_UDP_TRANSPORTS) {
+			ESP_LOGE(TAG, "too many B2 tunnels, ignoring port '%s'", tok);
+			continue;
+		}
+		
+		uint16_t port = (uint16_t)strtoul(tok, NULL, 0);
+		transport_t *transport = start_b2udptunnel(port, b2_peers);
+		if (transport != NULL) {
+			b2_transports[b2_transport_count] = transport;
+			b2_ports[b2_transport_count] = port;
+			b2_transport_count++;
+		}
+	}
+	free(list);
+}
+
+void start_net_laps(runloop_info_t* controlplane, runloop_info_t* dataplane) {
 	// forcibly clean up after any lingering unit tests
 	lap_lsend_mock = NULL;
 	
 	global_lap_registry = lap_registry_new();
 	
-	start_sink("SINK-eth", ethertalkv2_get_transport());
+	if (ethernet_transport != NULL) {
+		start_sink("SINK-eth", ethernet_transport);
+	}
 //	start_sink("SINK-tt", tashtalk_get_transport());
-//	start_sink("SINK-ltoudp", ltoudp_get_transport());
-	start_sink("SINK-b2", b2_get_transport());
+	
+	for (int i = 0; i < b2_transport_count; i++) {
+		char* name;
+		asprintf(&name, "SINK-b2-%u", (unsigned int)b2_ports[i]);
+		start_sink(name, b2_transports[i]);
+	}
 	
 	start_llap("localtalk", tashtalk_get_transport(), global_lap_registry, controlplane, dataplane);
-	start_llap("ltoudp", ltoudp_get_transport(), global_lap_registry, controlplane, dataplane);
+	
+	// Each group's LAP is named after it, so they don't trip over each
+	// other in the LAP registry or in what's persisted about them.
+	for (int i = 0; i < ltoudp_transport_count; i++) {
+		char* name;
+		asprintf(&name, "ltoudp-%s", ltoudp_groups[i]);
+		start_llap(name, ltoudp_transports[i], global_lap_registry, controlplane, dataplane);
+	}
+	
+#ifdef LOADGEN_NETWORK
+	start_llap("loadgen", start_loadgen(LOADGEN_NETWORK), global_lap_registry, controlplane, dataplane);
+#endif
 }
@@ -2,4 +2,27 @@
 
 #include "runloop_types.h"
 
-void start_net(runloop_info_t* controlplane, runloop_info_t* dataplane);
+// Starting the network is split into phases so that boot can run the ones
+// that don't depend on each other at the same time (see main.c).  Each
+// phase's comment says which have to have finished before it.
+
+// start_net_common sets up the IP stack and the AARP table.
+void start_net_common(void);
+
+// start_net_ethernet starts the Ethernet port.  After start_net_common.
+void start_net_ethernet(void);
+
+// start_net_mdns advertises us over mDNS.  After start_net_ethernet.
+void start_net_mdns(void);
+
+// start_net_tashtalk brings up the TashTalk, which takes a while since it
+// has to be fed a kilobyte of zeros down the UART first.
+void start_net_tashtalk(void);
+
+// start_net_udp starts the LToUDP and B2 tunnel transports.  After
+// start_net_common.
+void start_net_udp(void);
+
+// start_net_laps starts the LAPs on top of the transports.  After all of
+// the above, and the runloops, apps and persist.
+void start_net_laps(runloop_info_t* controlplane, runloop_info_t* dataplane);
@@ -0,0 +1,427 @@
+#include "net/packet_capture.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include "mem/buffers.h"
+#include "proto/SNAP.h"
+#include "net/transport.h"
+#include "tunables.h"
+
+static const char* TAG = "CAPTURE";
+
+// PACKET_CAPTURE_FLAG_DDP_ONLY means the slot holds a bare DDP packet that
+// was handed to an Ethernet transport to put a header on
+#define PACKET_CAPTURE_FLAG_DDP_ONLY (1 << 0)
+
+#define DDP_LONG_HDR_LEN 13
+#define DDP_SHORT_HDR_LEN 5
+
+typedef struct {
+	// seq is 0 until the slot's written and committed, and one more than the
+	// slot's position in the stream of frames once it's done
+	_Atomic uint32_t seq;
+	
+	int64_t timestamp;
+	uint16_t orig_len;
+	uint16_t cap_len;
+	uint8_t flags;
+	
+	uint8_t data[];
+} packet_capture_slot_t;
+
+struct packet_capture_s {
+	char name[PACKET_CAPTURE_MAX_NAME_LEN];
+	transport_framing_t framing;
+	
+	// next counts up forever; next % slot_count is the slot to write next
+	_Atomic uint32_t next;
+	
+	_Atomic size_t snaplen;
+	_Atomic int filter_ddp_type;
+	_Atomic int filter_socket;
+	_Atomic int filter_node;
+	
+	size_t slot_count;
+	size_t max_snaplen;
+	size_t slot_stride;
+	uint8_t* slots;
+};
+
+static packet_capture_t* rings[PACKET_CAPTURE_MAX_RINGS];
+static _Atomic size_t ring_count = 0;
+static SemaphoreHandle_t rings_mutex;
+
+static inline packet_capture_slot_t* slot_at(packet_capture_t* capture, uint32_t idx) {
+	return (packet_capture_slot_t*)(capture->slots + (idx % capture->slot_count) * capture->slot_stride);
+}
+
+packet_capture_t* packet_capture_new(const char* name, transport_framing_t framing,
+	size_t slot_count, size_t max_snaplen) {
+	
+	packet_capture_t* capture = calloc(1, sizeof(packet_capture_t));
+	if (capture == NULL) {
+		return NULL;
+	}
+	
+	// Keep the slots aligned for the timestamps
+	size_t stride = sizeof(packet_capture_slot_t) + max_snaplen;
+	stride = (stride + 7) & ~(size_t)7;
+	
+	capture->slots = calloc(slot_count, stride);
+	if (capture->slots == NULL) {
+		free(capture);
+		return NULL;
+	}
+	
+	snprintf(capture->name, sizeof(capture->name), "%s", name);
+	capture->framing = framing;
+	capture->slot_count = slot_count;
+	capture->max_snaplen = max_snaplen;
+	capture->slot_stride = stride;
+	capture->snaplen = max_snaplen;
+	capture->filter_ddp_type = PACKET_CAPTURE_ANY;
+	capture->filter_socket = PACKET_CAPTURE_ANY;
+	capture->filter_node = PACKET_CAPTURE_ANY;
+	
+	return capture;
+}
+
+void packet_capture_free(packet_capture_t* capture) {
+	if (capture == NULL) {
+		return;
+	}
+	free(capture->slots);
+	free(capture);
+}
+
+void packet_capture_init(void) {
+	rings_mutex = xSemaphoreCreateMutex();
+}
+
+void packet_capture_attach(transport_t* transport) {
+#ifdef PACKET_CAPTURE_SLOTS
+	if (transport->capture != NULL) {
+		return;
+	}
+	
+	while (xSemaphoreTake(rings_mutex, portMAX_DELAY) != pdTRUE) {}
+	
+	size_t count = ring_count;
+	if (count == PACKET_CAPTURE_MAX_RINGS) {
+		xSemaphoreGive(rings_mutex);
+		ESP_LOGW(TAG, "no capture ring left for %s", transport->kind);
+		return;
+	}
+	
+	// Name it after the transport, telling apart any of the same kind
+	char name[PACKET_CAPTURE_MAX_NAME_LEN];
+	int same_kind = 0;
+	snprintf(name, sizeof(name), "%s", transport->kind);
+	while (packet_capture_find(name) != NULL) {
+		same_kind++;
+		snprintf(name, sizeof(name), "%s-%d", transport->kind, same_kind + 1);
+	}
+	
+	packet_capture_t* capture = packet_capture_new(name, transport->framing,
+		PACKET_CAPTURE_SLOTS, PACKET_CAPTURE_SNAPLEN);
+	if (capture != NULL) {
+		rings[count] = capture;
+		ring_count = count + 1;
+		transport->capture = capture;
+	}
+	
+	xSemaphoreGive(rings_mutex);
+#endif
+}
+
+// packet_capture_ddp_fields picks the bits of the DDP header the filter
+// looks at out of a frame, returning false if it isn't DDP at all
+static bool packet_capture_ddp_fields(packet_capture_t* capture, buffer_t* buffer,
+	bool ddp_only, uint8_t* ddp_type, uint8_t sockets[2], uint8_t nodes[2]) {
+	
+	const uint8_t* d;
+	
+	if (ddp_only) {
+		d = buffer->ddp_data;
+		if (buffer->ddp_type == BUF_LONG_HEADER && buffer->ddp_length >= DDP_LONG_HDR_LEN) {
+			goto long_header;
+		}
+		return false;
+	}
+	
+	d = buffer->data;
+	if (capture->framing == TRANSPORT_FRAMING_ETHERNET) {
+		// 802.3 with the AppleTalk SNAP header; anything else (including
+		// AARP, which has its own) isn't DDP
+		const uint8_t* snap = d + sizeof(struct eth_hdr);
+		if (buffer->length < ELAP_HDR_LEN + DDP_LONG_HDR_LEN || snap[0] != 0xAA ||
+			snap[3] != 0x08 || snap[4] != 0x00 || snap[5] != 0x07 || snap[6] != 0x80 ||
+			snap[7] != 0x9B) {
+			
+			return false;
+		}
+		d += ELAP_HDR_LEN;
+		goto long_header;
+	}
+	
+	// LLAP
+	if (buffer->length >= 3 + DDP_SHORT_HDR_LEN && d[2] == BUF_SHORT_HEADER) {
+		nodes[0] = d[0];
+		nodes[1] = d[1];
+		sockets[0] = d[5];
+		sockets[1] = d[6];
+		*ddp_type = d[7];
+		return true;
+	}
+	if (buffer->length >= 3 + DDP_LONG_HDR_LEN && d[2] == BUF_LONG_HEADER) {
+		d += 3;
+		goto long_header;
+	}
+	return false;
+
+long_header:
+	nodes[0] = d[8];
+	nodes[1] = d[9];
+	sockets[0] = d[10];
+	sockets[1] = d[11];
+	*ddp_type = d[12];
+	return true;
+}
+
+static inline bool filter_matches(int want, const uint8_t got[2]) {
+	return want == PACKET_CAPTURE_ANY || want == got[0] || want == got[1];
+}
+
+uint32_t packet_capture_stage(packet_capture_t* capture, buffer_t* buffer,
+	packet_capture_direction_t direction) {
+	
+	int want_type = capture->filter_ddp_type;
+	int want_socket = capture->filter_socket;
+	int want_node = capture->filter_node;
+	
+	// Outbound DDP packets for Ethernet haven't got their headers yet, so
+	// record just the DDP packet and make the header up when serving it
+	bool ddp_only = direction == PACKET_CAPTURE_OUTBOUND &&
+		capture->framing == TRANSPORT_FRAMING_ETHERNET && buffer->ddp_ready;
+	
+	if (want_type != PACKET_CAPTURE_ANY || want_socket != PACKET_CAPTURE_ANY ||
+		want_node != PACKET_CAPTURE_ANY) {
+		
+		uint8_t ddp_type, sockets[2], nodes[2];
+		if (!packet_capture_ddp_fields(capture, buffer, ddp_only, &ddp_type, sockets, nodes)) {
+			return 0;
+		}
+		if ((want_type != PACKET_CAPTURE_ANY && want_type != ddp_type) ||
+			!filter_matches(want_socket, sockets) || !filter_matches(want_node, nodes)) {
+			
+			return 0;
+		}
+	}
+	
+	const uint8_t* data = ddp_only ? buffer->ddp_data : buffer->data;
+	size_t length = ddp_only ? buffer->ddp_length : buffer->length;
+	size_t cap_len = length;
+	size_t snaplen = capture->snaplen;
+	if (cap_len > snaplen) {
+		cap_len = snaplen;
+	}
+	
+	uint32_t idx = atomic_fetch_add(&capture->next, 1);
+	packet_capture_slot_t* slot = slot_at(capture, idx);
+	
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	
+	slot->timestamp = esp_timer_get_time();
+	slot->orig_len = length;
+	slot->cap_len = cap_len;
+	slot->flags = ddp_only ? PACKET_CAPTURE_FLAG_DDP_ONLY : 0;
+	memcpy(slot->data, data, cap_len);
+	
+	return idx + 1;
+}
+
+void packet_capture_commit(packet_capture_t* capture, uint32_t ticket) {
+	if (ticket == 0) {
+		return;
+	}
+	
+	// If the ring's come all the way round and someone else has the slot
+	// now, it's theirs
+	uint32_t unwritten = 0;
+	atomic_compare_exchange_strong_explicit(&slot_at(capture, ticket - 1)->seq, &unwritten, ticket,
+		memory_order_release, memory_order_relaxed);
+}
+
+void packet_capture_record(packet_capture_t* capture, buffer_t* buffer,
+	packet_capture_direction_t direction) {
+	
+	packet_capture_commit(capture, packet_capture_stage(capture, buffer, direction));
+}
+
+const char* packet_capture_name(packet_capture_t* capture) {
+	return capture->name;
+}
+
+uint32_t packet_capture_linktype(packet_capture_t* capture) {
+	return capture->framing == TRANSPORT_FRAMING_ETHERNET ?
+		PCAP_LINKTYPE_ETHERNET : PCAP_LINKTYPE_LOCALTALK;
+}
+
+size_t packet_capture_count(void) {
+	return ring_count;
+}
+
+packet_capture_t* packet_capture_get(size_t idx) {
+	if (idx >= ring_count) {
+		return NULL;
+	}
+	return rings[idx];
+}
+
+packet_capture_t* packet_capture_find(const char* name) {
+	size_t count = ring_count;
+	for (size_t i = 0; i < count; i++) {
+		if (strcmp(rings[i]->name, name) == 0) {
+			return rings[i];
+		}
+	}
+	return NULL;
+}
+
+void packet_capture_configure(packet_capture_t* capture, size_t snaplen,
+	packet_capture_filter_t* filter) {
+	
+	if (snaplen > capture->max_snaplen) {
+		snaplen = capture->max_snaplen;
+	}
+	if (snaplen > 0) {
+		capture->snaplen = snaplen;
+	}
+	
+	if (filter != NULL) {
+		capture->filter_ddp_type = filter->ddp_type;
+		capture->filter_socket = filter->socket;
+		capture->filter_node = filter->node;
+	}
+}
+
+void packet_capture_get_config(packet_capture_t* capture, size_t* snaplen,
+	packet_capture_filter_t* filter) {
+	
+	*snaplen = capture->snaplen;
+	filter->ddp_type = capture->filter_ddp_type;
+	filter->socket = capture->filter_socket;
+	filter->node = capture->filter_node;
+}
+
+uint32_t packet_capture_recorded(packet_capture_t* capture) {
+	return capture->next;
+}
+
+static inline void put_u32(uint8_t* p, uint32_t v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline void put_u16(uint8_t* p, uint16_t v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+// packet_capture_elap_hdr makes up an ELAP header for a bare DDP packet.
+// We don't know what hardware address it was sent to, so a DDP broadcast
+// gets the AppleTalk broadcast address and anything else gets zeros.
+static void packet_capture_elap_hdr(uint8_t* hdr, const uint8_t* ddp, size_t cap_len, size_t orig_len) {
+	static const struct eth_addr broadcast = {{ 0x09, 0x00, 0x07, 0xff, 0xff, 0xff }};
+	static const struct eth_addr unknown = {{ 0 }};
+	
+	bool is_broadcast = cap_len >= DDP_LONG_HDR_LEN && ddp[8] == 0xff;
+	snap_fill_appletalk_hdr(hdr, is_broadcast ? &broadcast : &unknown, &unknown);
+	snap_set_appletalk_hdr_length(hdr, orig_len);
+}
+
+bool packet_capture_write_pcap(packet_capture_t* capture, packet_capture_write_fn write, void* ctx) {
+	// pcap files can be either byte order, so we write them in ours
+	uint8_t hdr[24];
+	put_u32(hdr, 0xa1b2c3d4);
+	put_u16(hdr + 4, 2);
+	put_u16(hdr + 6, 4);
+	put_u32(hdr + 8, 0);
+	put_u32(hdr + 12, 0);
+	put_u32(hdr + 16, capture->max_snaplen + (capture->framing == TRANSPORT_FRAMING_ETHERNET ? ELAP_HDR_LEN : 0));
+	put_u32(hdr + 20, packet_capture_linktype(capture));
+	if (!write(ctx, hdr, sizeof(hdr))) {
+		return false;
+	}
+	
+	// Timestamps are taken from esp_timer, which is cheap; work out what
+	// they are in wall clock time
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	int64_t wall_offset = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec - esp_timer_get_time();
+	
+	uint8_t* copy = malloc(capture->max_snaplen);
+	if (copy == NULL) {
+		ESP_LOGE(TAG, "couldn't allocate buffer for %s", capture->name);
+		return false;
+	}
+	
+	uint32_t end = capture->next;
+	uint32_t start = end > capture->slot_count ? end - capture->slot_count : 0;
+	bool ok = true;
+	
+	for (uint32_t idx = start; idx != end && ok; idx++) {
+		packet_capture_slot_t* slot = slot_at(capture, idx);
+		
+		uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq != idx + 1) {
+			continue;
+		}
+		
+		int64_t timestamp = slot->timestamp;
+		size_t orig_len = slot->orig_len;
+		size_t cap_len = slot->cap_len;
+		uint8_t flags = slot->flags;
+		if (cap_len > capture->max_snaplen) {
+			continue;
+		}
+		memcpy(copy, slot->data, cap_len);
+		
+		// If it was written over while we were copying it, it's no good
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+			continue;
+		}
+		
+		uint8_t elap_hdr[ELAP_HDR_LEN];
+		size_t extra = 0;
+		if (flags & PACKET_CAPTURE_FLAG_DDP_ONLY) {
+			packet_capture_elap_hdr(elap_hdr, copy, cap_len, orig_len);
+			extra = ELAP_HDR_LEN;
+		}
+		
+		int64_t wall = timestamp + wall_offset;
+		uint8_t rec[16];
+		put_u32(rec, (uint32_t)(wall / 1000000));
+		put_u32(rec + 4, (uint32_t)(wall % 1000000));
+		put_u32(rec + 8, cap_len + extra);
+		put_u32(rec + 12, orig_len + extra);
+		
+		ok = write(ctx, rec, sizeof(rec)) &&
+			(extra == 0 || write(ctx, elap_hdr, extra)) &&
+			write(ctx, copy, cap_len);
+	}
+	
+	free(copy);
+	return ok;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mem/buffers.h"
+#include "net/transport_types.h"
+
+// A packet capture ring remembers the last few frames to go through a
+// transport's queues, so that they can be pulled off the router as a pcap
+// file (see web/capture.c) when something looks wrong, without having to
+// get a sniffer onto the network first.
+//
+// Frames are recorded by tdeliver and the tsend family as they go onto the
+// transport's queues, so it costs the transports nothing.  The
+// ring is a fixed array of fixed-size slots, and recording never takes a
+// lock or allocates: a writer claims the next slot with an atomic
+// increment and stamps it with a sequence number once it's written.
+// Readers copy a slot out and check the sequence number didn't change
+// underneath them, skipping it if it did.
+//
+// Frames are truncated to the ring's snaplen.  A filter on the DDP type,
+// socket and node can be set to keep a busy network from washing what
+// you're after out of the ring; with a filter set, only DDP packets are
+// recorded.
+
+// How many rings there can be; transports after that don't get one
+#define PACKET_CAPTURE_MAX_RINGS 8
+
+#define PACKET_CAPTURE_MAX_NAME_LEN 24
+
+// PACKET_CAPTURE_ANY in a filter field matches anything
+#define PACKET_CAPTURE_ANY -1
+
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_LOCALTALK 114
+
+typedef enum {
+	PACKET_CAPTURE_INBOUND = 0,
+	PACKET_CAPTURE_OUTBOUND,
+} packet_capture_direction_t;
+
+typedef struct {
+	int ddp_type;
+	// socket and node match either the source or the destination
+	int socket;
+	int node;
+} packet_capture_filter_t;
+
+// packet_capture_new makes a ring of slot_count frames of up to
+// max_snaplen bytes each.  It isn't attached to anything, or findable by
+// name; that's packet_capture_attach's job.
+packet_capture_t* packet_capture_new(const char* name, transport_framing_t framing,
+	size_t slot_count, size_t max_snaplen);
+void packet_capture_free(packet_capture_t* capture);
+
+// packet_capture_init sets up what packet_capture_attach needs.  It must be
+// called once, before any transport's enabled.
+void packet_capture_init(void);
+
+// packet_capture_attach gives a transport a capture ring named after its
+// kind, if it hasn't got one and PACKET_CAPTURE_SLOTS is defined in
+// tunables.h.  A second transport of the same kind gets "-2" on the end of
+// its ring's name, and so on.
+void packet_capture_attach(transport_t* transport);
+
+// packet_capture_record copies a frame into the ring, if it gets past the
+// filter.  It's safe to call from any task at any time.
+void packet_capture_record(packet_capture_t* capture, buffer_t* buffer,
+	packet_capture_direction_t direction);
+
+// packet_capture_stage copies a frame into the ring like
+// packet_capture_record, but readers don't see it until it's committed
+// with the ticket it returns.  A frame that's never committed is skipped.
+// This lets a frame be copied while it's still the caller's and only show
+// up once it's been queued.  A ticket of 0 means the filter didn't want it.
+uint32_t packet_capture_stage(packet_capture_t* capture, buffer_t* buffer,
+	packet_capture_direction_t direction);
+void packet_capture_commit(packet_capture_t* capture, uint32_t ticket);
+
+const char* packet_capture_name(packet_capture_t* capture);
+
+// packet_capture_linktype says what kind of pcap file the ring makes
+uint32_t packet_capture_linktype(packet_capture_t* capture);
+
+// packet_capture_count returns how many rings there are, and
+// packet_capture_get and packet_capture_find get at them.  Rings live
+// forever, so the pointers stay good.
+size_t packet_capture_count(void);
+packet_capture_t* packet_capture_get(size_t idx);
+packet_capture_t* packet_capture_find(const char* name);
+
+// packet_capture_configure sets a ring's snaplen (clamped to what it was
+// made with; 0 leaves it alone) and filter.  Frames already in the ring
+// are kept.
+void packet_capture_configure(packet_capture_t* capture, size_t snaplen,
+	packet_capture_filter_t* filter);
+void packet_capture_get_config(packet_capture_t* capture, size_t* snaplen,
+	packet_capture_filter_t* filter);
+
+// packet_capture_recorded returns how many frames have ever been put in
+// the ring, which is more than it holds once it's wrapped.  Staged frames
+// count even if they were never committed.
+uint32_t packet_capture_recorded(packet_capture_t* capture);
+
+// packet_capture_write_fn is handed the pcap file a piece at a time.  It
+// returns false to give up.
+typedef bool (*packet_capture_write_fn)(void* ctx, const uint8_t* data, size_t len);
+
+// packet_capture_write_pcap writes what's in the ring out as a pcap file,
+// oldest frame first.  Frames recorded after it starts aren't included,
+// and older ones they overwrite before it gets to them are left out, so
+// nothing comes out half-written.  Returns false if write gave up.
+bool packet_capture_write_pcap(packet_capture_t* capture, packet_capture_write_fn write, void* ctx);
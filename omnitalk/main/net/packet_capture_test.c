@@ -0,0 +1,252 @@
+#include "net/packet_capture_test.h"
+#include "net/packet_capture.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "mem/buffers.h"
+#include "mem/buffers_test.h"
+#include "net/transport.h"
+#include "test.h"
+
+typedef struct {
+	uint8_t data[2048];
+	size_t length;
+} pcap_sink_t;
+
+static bool pcap_sink_write(void* ctx, const uint8_t* data, size_t len) {
+	pcap_sink_t* sink = (pcap_sink_t*)ctx;
+	if (sink->length + len > sizeof(sink->data)) {
+		return false;
+	}
+	memcpy(sink->data + sink->length, data, len);
+	sink->length += len;
+	return true;
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// pcap_sink_records counts the records in a pcap file, and finds the
+// offset of the nth one's header
+static size_t pcap_sink_records(pcap_sink_t* sink, size_t n, size_t* offset) {
+	size_t count = 0;
+	for (size_t off = 24; off + 16 <= sink->length; off += 16 + get_u32(sink->data + off + 8)) {
+		if (count == n && offset != NULL) {
+			*offset = off;
+		}
+		count++;
+	}
+	return count;
+}
+
+// An NBP LkUp broadcast from node 0x20 socket 0xfd, with short headers
+#define NBP_LKUP "\xff\x20\x01\x00\x14\x02\xfd\x02\x21\x01\x00\x2a\x20\xfd\x00\x01=\x01=\x01*"
+#define NBP_LKUP_LEN 23
+
+// An AEP request to node 0x87 socket 4 from node 0x1f, with long headers
+#define AEP_REQ "\x87\x1f\x02\x00\x10\x00\x00\x00\x0c\x00\x08\x87\x1f\x04\xf0\x04\x01\x00\x00"
+#define AEP_REQ_LEN 19
+
+TEST_FUNCTION(test_packet_capture_ring) {
+	pcap_sink_t* sink = calloc(1, sizeof(pcap_sink_t));
+	packet_capture_t* capture = packet_capture_new("test", TRANSPORT_FRAMING_LLAP, 4, 16);
+	size_t offset = 0;
+	
+	TEST_ASSERT(capture != NULL);
+	TEST_ASSERT(packet_capture_linktype(capture) == PCAP_LINKTYPE_LOCALTALK);
+	
+	// An empty ring is just a header
+	TEST_ASSERT(packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	TEST_ASSERT(sink->length == 24);
+	TEST_ASSERT(get_u32(sink->data) == 0xa1b2c3d4);
+	TEST_ASSERT(get_u32(sink->data + 20) == PCAP_LINKTYPE_LOCALTALK);
+	
+	// Frames get cut down to the snaplen, but remember how long they were
+	buffer_t* buf = buf_from_string(NBP_LKUP, 0, NBP_LKUP_LEN);
+	packet_capture_record(capture, buf, PACKET_CAPTURE_INBOUND);
+	sink->length = 0;
+	TEST_ASSERT(packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, &offset) == 1);
+	TEST_ASSERT(get_u32(sink->data + offset + 8) == 16);
+	TEST_ASSERT(get_u32(sink->data + offset + 12) == NBP_LKUP_LEN);
+	TEST_ASSERT(memcmp(sink->data + offset + 16, NBP_LKUP, 16) == 0);
+	
+	// ... and the snaplen can be turned down, but not up past what the
+	// ring was made with
+	size_t snaplen;
+	packet_capture_filter_t filter;
+	packet_capture_configure(capture, 8, NULL);
+	packet_capture_get_config(capture, &snaplen, &filter);
+	TEST_ASSERT(snaplen == 8);
+	packet_capture_configure(capture, 1000, NULL);
+	packet_capture_get_config(capture, &snaplen, &filter);
+	TEST_ASSERT(snaplen == 16);
+	
+	// Once it wraps, only the newest frames are kept, oldest first
+	for (int i = 0; i < 6; i++) {
+		buf->data[1] = i;
+		packet_capture_record(capture, buf, PACKET_CAPTURE_OUTBOUND);
+	}
+	TEST_ASSERT(packet_capture_recorded(capture) == 7);
+	sink->length = 0;
+	TEST_ASSERT(packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, &offset) == 4);
+	TEST_ASSERT(sink->data[offset + 16 + 1] == 2);
+	pcap_sink_records(sink, 3, &offset);
+	TEST_ASSERT(sink->data[offset + 16 + 1] == 5);
+	
+	// A writer that gives up stops the whole thing
+	sink->length = sizeof(sink->data) - 30;
+	TEST_ASSERT(!packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	
+	freebuf(buf);
+	packet_capture_free(capture);
+	free(sink);
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_packet_capture_filter) {
+	pcap_sink_t* sink = calloc(1, sizeof(pcap_sink_t));
+	packet_capture_t* capture = packet_capture_new("test", TRANSPORT_FRAMING_LLAP, 8, 32);
+	buffer_t* nbp = buf_from_string(NBP_LKUP, 0, NBP_LKUP_LEN);
+	buffer_t* aep = buf_from_string(AEP_REQ, 0, AEP_REQ_LEN);
+	buffer_t* enq = buf_from_string("\x20\x20\x81", 0, 3);
+	
+	// Only AEP
+	packet_capture_filter_t filter = { .ddp_type = 4, .socket = PACKET_CAPTURE_ANY, .node = PACKET_CAPTURE_ANY };
+	packet_capture_configure(capture, 0, &filter);
+	packet_capture_record(capture, nbp, PACKET_CAPTURE_INBOUND);
+	packet_capture_record(capture, aep, PACKET_CAPTURE_INBOUND);
+	packet_capture_record(capture, enq, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 1);
+	
+	// Sockets and nodes match either end; control frames never get past a
+	// filter
+	filter = (packet_capture_filter_t) { .ddp_type = PACKET_CAPTURE_ANY, .socket = 0xfd, .node = PACKET_CAPTURE_ANY };
+	packet_capture_configure(capture, 0, &filter);
+	packet_capture_record(capture, nbp, PACKET_CAPTURE_INBOUND);
+	packet_capture_record(capture, aep, PACKET_CAPTURE_INBOUND);
+	packet_capture_record(capture, enq, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 2);
+	
+	filter = (packet_capture_filter_t) { .ddp_type = PACKET_CAPTURE_ANY, .socket = PACKET_CAPTURE_ANY, .node = 0x87 };
+	packet_capture_configure(capture, 0, &filter);
+	packet_capture_record(capture, nbp, PACKET_CAPTURE_INBOUND);
+	packet_capture_record(capture, aep, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 3);
+	
+	// With no filter, everything goes in
+	filter = (packet_capture_filter_t) { PACKET_CAPTURE_ANY, PACKET_CAPTURE_ANY, PACKET_CAPTURE_ANY };
+	packet_capture_configure(capture, 0, &filter);
+	packet_capture_record(capture, enq, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 4);
+	
+	TEST_ASSERT(packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, NULL) == 4);
+	
+	freebuf(nbp);
+	freebuf(aep);
+	freebuf(enq);
+	packet_capture_free(capture);
+	free(sink);
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_packet_capture_ethernet_ddp_only) {
+	pcap_sink_t* sink = calloc(1, sizeof(pcap_sink_t));
+	packet_capture_t* capture = packet_capture_new("test", TRANSPORT_FRAMING_ETHERNET, 4, 64);
+	size_t offset = 0;
+	
+	TEST_ASSERT(packet_capture_linktype(capture) == PCAP_LINKTYPE_ETHERNET);
+	
+	// An outbound DDP packet with no ELAP header on it yet, to a broadcast
+	buffer_t* buf = buf_from_string(AEP_REQ, 0, AEP_REQ_LEN);
+	buf_setup_ddp(buf, 3, BUF_LONG_HEADER);
+	buf->ddp_ready = true;
+	buf->ddp_data[8] = 0xff;
+	
+	packet_capture_filter_t filter = { .ddp_type = 4, .socket = PACKET_CAPTURE_ANY, .node = 0xff };
+	packet_capture_configure(capture, 0, &filter);
+	packet_capture_record(capture, buf, PACKET_CAPTURE_OUTBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 1);
+	
+	// It comes out with a made-up header, so it's a proper Ethernet frame
+	TEST_ASSERT(packet_capture_write_pcap(capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, &offset) == 1);
+	TEST_ASSERT(get_u32(sink->data + offset + 8) == 22 + AEP_REQ_LEN - 3);
+	const uint8_t* frame = sink->data + offset + 16;
+	TEST_ASSERT(memcmp(frame, "\x09\x00\x07\xff\xff\xff", 6) == 0);
+	TEST_ASSERT(frame[12] == 0 && frame[13] == 8 + AEP_REQ_LEN - 3);
+	TEST_ASSERT(memcmp(frame + 14, "\xaa\xaa\x03\x08\x00\x07\x80\x9b", 8) == 0);
+	TEST_ASSERT(memcmp(frame + 22, buf->ddp_data, AEP_REQ_LEN - 3) == 0);
+	
+	// Inbound frames are whole, so the filter has to look past the header
+	uint8_t elap[22 + AEP_REQ_LEN - 3];
+	memcpy(elap, frame, sizeof(elap));
+	buffer_t* in = wrapbuf(elap, sizeof(elap));
+	packet_capture_record(capture, in, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 2);
+	
+	// ... and AARP isn't DDP
+	memcpy(elap + 17, "\x00\x00\x00\x80\xf3", 5);
+	packet_capture_record(capture, in, PACKET_CAPTURE_INBOUND);
+	TEST_ASSERT(packet_capture_recorded(capture) == 2);
+	
+	free(in);
+	freebuf(buf);
+	packet_capture_free(capture);
+	free(sink);
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_packet_capture_only_queued_frames) {
+	pcap_sink_t* sink = calloc(1, sizeof(pcap_sink_t));
+	size_t offset = 0;
+	transport_t transport = {
+		.inbound = xQueueCreate(1, sizeof(buffer_t*)),
+		.outbound = xQueueCreate(1, sizeof(buffer_t*)),
+		.capture = packet_capture_new("test", TRANSPORT_FRAMING_LLAP, 8, 32),
+	};
+	buffer_t* in = buf_from_string(NBP_LKUP, 0, NBP_LKUP_LEN);
+	buffer_t* out = buf_from_string(AEP_REQ, 0, AEP_REQ_LEN);
+	
+	// Frames are recorded as they go onto the queues, both ways ...
+	TEST_ASSERT(tdeliver(&transport, in));
+	TEST_ASSERT(tsend(&transport, out));
+	
+	// ... but not if the queue's full and they never get on it
+	TEST_ASSERT(!tdeliver(&transport, in));
+	TEST_ASSERT(!tsend(&transport, out));
+	buffer_t* batch[] = { out, in };
+	TEST_ASSERT(tsend_batch(&transport, batch, 2) == 0);
+	
+	TEST_ASSERT(packet_capture_write_pcap(transport.capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, &offset) == 2);
+	TEST_ASSERT(memcmp(sink->data + offset + 16, NBP_LKUP, 16) == 0);
+	pcap_sink_records(sink, 1, &offset);
+	TEST_ASSERT(memcmp(sink->data + offset + 16, AEP_REQ, 16) == 0);
+	
+	// Taking them off the queue doesn't record them again
+	TEST_ASSERT(trecv_with_timeout(&transport, 0) == in);
+	TEST_ASSERT(packet_capture_recorded(transport.capture) == 5);
+	sink->length = 0;
+	TEST_ASSERT(packet_capture_write_pcap(transport.capture, &pcap_sink_write, sink));
+	TEST_ASSERT(pcap_sink_records(sink, 0, NULL) == 2);
+	
+	freebuf(in);
+	freebuf(out);
+	vQueueDelete(transport.inbound);
+	vQueueDelete(transport.outbound);
+	packet_capture_free(transport.capture);
+	free(sink);
+	TEST_OK();
+}
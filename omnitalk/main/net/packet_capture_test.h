@@ -0,0 +1,7 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_packet_capture_ring);
+TEST_FUNCTION(test_packet_capture_filter);
+TEST_FUNCTION(test_packet_capture_ethernet_ddp_only);
+TEST_FUNCTION(test_packet_capture_only_queued_frames);
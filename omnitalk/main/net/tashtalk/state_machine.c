@@ -1,5 +1,7 @@
-#include <strings.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "freertos/FreeRTOS.h"
@@ -10,29 +12,33 @@
 #include "net/common.h"
 #include "net/tashtalk/state_machine.h"
 #include "net/tashtalk/uart.h"
+#include "net/transport.h"
 #include "proto/llap.h"
 #include "util/crc.h"
 #include "web/stats.h"
 
 static const char* TAG = "tashtalk";
 
-tashtalk_rx_state_t* new_tashtalk_rx_state(QueueHandle_t output_queue) {
+tashtalk_rx_state_t* new_tashtalk_rx_state(transport_t* transport) {
 	tashtalk_rx_state_t* ns = calloc(1, sizeof(tashtalk_rx_state_t));
 	
 	if (ns == NULL) {
 		return NULL;
 	}
 	
-	ns->output_queue = output_queue;
+	ns->transport = transport;
 	
 	return ns;
 }
 
-static void append(buffer_t* packet, unsigned char byte) {
-	if (!buf_append(packet, byte)) {
+// append_run adds a run of unescaped bytes to the packet in progress and
+// its CRC in one go.
+static void append_run(tashtalk_rx_state_t* state, unsigned char* run, int len) {
+	if (!buf_append_all(state->packet_in_progress, run, len)) {
 		ESP_LOGE(TAG, "buffer overflow in packet");
 		stats.transport_in_errors__transport_localtalk__err_frame_too_long++;
 	}
+	crc_state_append_all(&state->crc, run, len);
 }
 
 static void do_something_sensible_with_packet(tashtalk_rx_state_t* state) {
@@ -58,8 +64,7 @@ static void do_something_sensible_with_packet(tashtalk_rx_state_t* state) {
 			return;
 		}
 		
-		BaseType_t err = xQueueSendToBack(state->output_queue, &state->packet_in_progress, 0);
-		if (err != pdTRUE) {
+		if (!tdeliver(state->transport, state->packet_in_progress)) {
 			stats.transport_in_errors__transport_localtalk__err_lap_queue_full++;
 			freebuf(state->packet_in_progress);
 		}
@@ -71,67 +76,123 @@ static void do_something_sensible_with_packet(tashtalk_rx_state_t* state) {
 //	uart_check_for_tx_wedge(state->packet_in_progress);
 }
 
-void tashtalk_feed(tashtalk_rx_state_t* state, unsigned char byte) {
-
-	// do we have a buffer?
+static void ensure_packet_in_progress(tashtalk_rx_state_t* state) {
 	if (state->packet_in_progress == NULL) {
 		state->packet_in_progress = newbuf(ETHERNET_FRAME_LEN, 3);
 		crc_state_init(&state->crc);
 	}
+}
+
+// handle_escape deals with the byte after a 0x00.
+static void handle_escape(tashtalk_rx_state_t* state, unsigned char byte) {
+	unsigned char zero = 0x00;
 	
-	// Are we in an escape state?
-	if (state->in_escape) {
-		switch(byte) {
-			case 0xFF:
-				// 0x00 0xFF is a literal 0x00 byte
-				append(state->packet_in_progress, 0x00);
-				crc_state_append(&state->crc, 0x00);
-				break;
-				
-			case 0xFD:
-				// 0x00 0xFD is a complete frame
-				if (!crc_state_ok(&state->crc)) {
-					ESP_LOGE(TAG, "/!\\ CRC fail: %d", state->crc);
-					stats.transport_in_errors__transport_localtalk__err_bad_crc++;
-				}
-				
-				do_something_sensible_with_packet(state);
-				state->packet_in_progress = NULL;
-				break;
-				
-			case 0xFE:
-				// 0x00 0xFD is a complete frame
-				ESP_LOGI(TAG, "framing error of %d bytes", 
-					state->packet_in_progress->length);
-				stats.transport_in_errors__transport_localtalk__err_framing_error++;
-				
+	switch(byte) {
+		case 0xFF:
+			// 0x00 0xFF is a literal 0x00 byte
+			append_run(state, &zero, 1);
+			break;
+			
+		case 0xFD:
+			// 0x00 0xFD is a complete frame
+			if (!crc_state_ok(&state->crc)) {
+				// TashTalk hands us frames whatever their CRC, so it's up
+				// to us to throw the broken ones away.
+				ESP_LOGE(TAG, "/!\\ CRC fail: %d", state->crc);
+				stats.transport_in_errors__transport_localtalk__err_bad_crc++;
 				freebuf(state->packet_in_progress);
 				state->packet_in_progress = NULL;
 				break;
+			}
+			
+			do_something_sensible_with_packet(state);
+			state->packet_in_progress = NULL;
+			break;
+			
+		case 0xFE:
+			// 0x00 0xFE is a framing error
+			ESP_LOGI(TAG, "framing error of %d bytes", 
+				state->packet_in_progress->length);
+			stats.transport_in_errors__transport_localtalk__err_framing_error++;
+			
+			freebuf(state->packet_in_progress);
+			state->packet_in_progress = NULL;
+			break;
 
-			case 0xFA:
-				// 0x00 0xFD is a complete frame
-				ESP_LOGI(TAG, "frame abort of %d bytes", 
-					state->packet_in_progress->length);
-				stats.transport_in_errors__transport_localtalk__err_frame_abort++;
-				
-				freebuf(state->packet_in_progress);
-				state->packet_in_progress = NULL;
-				break;			
+		case 0xFA:
+			// 0x00 0xFA is a frame abort
+			ESP_LOGI(TAG, "frame abort of %d bytes", 
+				state->packet_in_progress->length);
+			stats.transport_in_errors__transport_localtalk__err_frame_abort++;
+			
+			freebuf(state->packet_in_progress);
+			state->packet_in_progress = NULL;
+			break;			
+	}
+	
+	state->in_escape = false;
+}
+
+// find_escape returns the offset of the first 0x00 in buf, or len if there
+// isn't one.  Escapes are rare and most of what we see is long runs of
+// frame data, so it looks at a word at a time where it can.
+static int find_escape(unsigned char* buf, int len) {
+	int i = 0;
+	
+	// Get ourselves word-aligned first
+	while (i < len && ((uintptr_t)(buf + i) % sizeof(uint32_t)) != 0) {
+		if (buf[i] == 0x00) {
+			return i;
 		}
-		
-		state->in_escape = false;
-	} else if (byte == 0x00) {
-		state->in_escape = true;
-	} else {
-		append(state->packet_in_progress, byte);
-		crc_state_append(&state->crc, byte);
+		i++;
 	}
+	
+	// (w - 0x01010101) & ~w & 0x80808080 is non-zero if and only if one of
+	// the bytes in w is zero.
+	while (i + (int)sizeof(uint32_t) <= len) {
+		uint32_t w;
+		memcpy(&w, buf + i, sizeof(w));
+		if (((w - 0x01010101u) & ~w & 0x80808080u) != 0) {
+			break;
+		}
+		i += sizeof(uint32_t);
+	}
+	
+	// Then find exactly where it is (or finish off the tail end)
+	while (i < len && buf[i] != 0x00) {
+		i++;
+	}
+	
+	return i;
+}
+
+void tashtalk_feed(tashtalk_rx_state_t* state, unsigned char byte) {
+	tashtalk_feed_all(state, &byte, 1);
 }
 
 void tashtalk_feed_all(tashtalk_rx_state_t* state, unsigned char* buf, int count) {
-	for (int i = 0; i < count; i++) {
-		tashtalk_feed(state, buf[i]);
+	int i = 0;
+	
+	while (i < count) {
+		ensure_packet_in_progress(state);
+		
+		// If the last read ended on a 0x00, this is the byte after it
+		if (state->in_escape) {
+			handle_escape(state, buf[i]);
+			i++;
+			continue;
+		}
+		
+		int run = find_escape(buf + i, count - i);
+		if (run > 0) {
+			append_run(state, buf + i, run);
+			i += run;
+		}
+		
+		// Anything left starts with a 0x00
+		if (i < count) {
+			state->in_escape = true;
+			i++;
+		}
 	}
 }
-
@@ -7,6 +7,7 @@
 #include "freertos/queue.h"
 
 #include "mem/buffers.h"
+#include "net/transport.h"
 #include "util/crc.h"   
    
 /* a tashtalk_rx_state_t value represents a state machine for getting LLAP 
@@ -14,12 +15,12 @@
 typedef struct {
 	_Atomic bool send_output_to_queue;
 	buffer_t* packet_in_progress; // the buffer that holds the in-flight packet
-	QueueHandle_t output_queue;
+	transport_t* transport; // what the frames are delivered to
 	bool in_escape;
 	crc_state_t crc;
 } tashtalk_rx_state_t;
 
-tashtalk_rx_state_t* new_tashtalk_rx_state(QueueHandle_t output_queue);
+tashtalk_rx_state_t* new_tashtalk_rx_state(transport_t* transport);
 void tashtalk_feed(tashtalk_rx_state_t* state, unsigned char byte);
 void tashtalk_feed_all(tashtalk_rx_state_t* state, unsigned char* buf, int count);
 
@@ -0,0 +1,128 @@
+#include "net/tashtalk/state_machine_test.h"
+#include "net/tashtalk/state_machine.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+#include "mem/buffers.h"
+#include "util/crc.h"
+#include "test.h"
+
+// escape_frame appends a frame, with its CRC, to out in the form TashTalk
+// would hand it to us, and returns how many bytes it appended.
+static int escape_frame(unsigned char* frame, int len, unsigned char* out) {
+	int o = 0;
+	unsigned char crc_bytes[2];
+	crc_state_t crc;
+	
+	crc_state_init(&crc);
+	crc_state_append_all(&crc, frame, len);
+	crc_bytes[0] = crc_state_byte_1(&crc);
+	crc_bytes[1] = crc_state_byte_2(&crc);
+	
+	for (int i = 0; i < len + 2; i++) {
+		unsigned char b = i < len ? frame[i] : crc_bytes[i - len];
+		out[o++] = b;
+		if (b == 0x00) {
+			out[o++] = 0xFF;
+		}
+	}
+	
+	out[o++] = 0x00;
+	out[o++] = 0xFD;
+	return o;
+}
+
+TEST_FUNCTION(test_tashtalk_feed_chunking) {
+	// A data frame with zeroes scattered about, including a run of them
+	// and some either side of where word boundaries are likely to be,
+	// then an aborted frame, then a control frame.
+	unsigned char frame_1[] = { 0x01, 0x02, 0x01, 0x00, 0x0b, 0x00, 0x00, 0x00, 0x41,
+		0x42, 0x43, 0x00, 0x44, 0x45, 0x46, 0x47, 0x48, 0x00 };
+	unsigned char frame_2[] = { 0xFF, 0x08, 0x81 };
+	unsigned char stream[128];
+	int stream_len = 0;
+	
+	stream_len += escape_frame(frame_1, sizeof(frame_1), stream + stream_len);
+	stream[stream_len++] = 0x12;
+	stream[stream_len++] = 0x34;
+	stream[stream_len++] = 0x00;
+	stream[stream_len++] = 0xFA;
+	stream_len += escape_frame(frame_2, sizeof(frame_2), stream + stream_len);
+	
+	// However the stream gets chopped up into reads, and wherever those
+	// land in memory, we should get the same two frames out.
+	for (int chunk = 1; chunk <= stream_len; chunk++) {
+		for (int offset = 0; offset < 4; offset++) {
+			QueueHandle_t queue = xQueueCreate(4, sizeof(buffer_t*));
+			transport_t transport = { .inbound = queue };
+			tashtalk_rx_state_t* state = new_tashtalk_rx_state(&transport);
+			state->send_output_to_queue = true;
+			
+			unsigned char* copy = malloc(stream_len + 4);
+			memcpy(copy + offset, stream, stream_len);
+			
+			for (int i = 0; i < stream_len; i += chunk) {
+				int len = stream_len - i < chunk ? stream_len - i : chunk;
+				tashtalk_feed_all(state, copy + offset + i, len);
+			}
+			
+			buffer_t* out = NULL;
+			TEST_ASSERT(uxQueueMessagesWaiting(queue) == 2);
+			
+			xQueueReceive(queue, &out, 0);
+			TEST_ASSERT(out->length == sizeof(frame_1));
+			TEST_ASSERT(memcmp(out->data, frame_1, sizeof(frame_1)) == 0);
+			freebuf(out);
+			
+			xQueueReceive(queue, &out, 0);
+			TEST_ASSERT(out->length == sizeof(frame_2));
+			TEST_ASSERT(memcmp(out->data, frame_2, sizeof(frame_2)) == 0);
+			freebuf(out);
+			
+			TEST_ASSERT(state->packet_in_progress == NULL);
+			TEST_ASSERT(!state->in_escape);
+			
+			free(copy);
+			free(state);
+			vQueueDelete(queue);
+		}
+	}
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_tashtalk_drops_bad_crc) {
+	unsigned char frame[] = { 0x01, 0x02, 0x01, 0x00, 0x07, 0x04, 0x04, 0x04, 0x41, 0x42 };
+	unsigned char stream[64];
+	int stream_len = 0;
+	
+	// First a frame with a broken CRC, then a good one
+	stream_len += escape_frame(frame, sizeof(frame), stream + stream_len);
+	stream[sizeof(frame)] ^= 0x55;
+	stream_len += escape_frame(frame, sizeof(frame), stream + stream_len);
+	
+	QueueHandle_t queue = xQueueCreate(4, sizeof(buffer_t*));
+	transport_t transport = { .inbound = queue };
+	tashtalk_rx_state_t* state = new_tashtalk_rx_state(&transport);
+	state->send_output_to_queue = true;
+	
+	tashtalk_feed_all(state, stream, stream_len);
+	
+	buffer_t* out = NULL;
+	TEST_ASSERT(uxQueueMessagesWaiting(queue) == 1);
+	xQueueReceive(queue, &out, 0);
+	TEST_ASSERT(out->length == sizeof(frame));
+	TEST_ASSERT(memcmp(out->data, frame, sizeof(frame)) == 0);
+	freebuf(out);
+	
+	TEST_ASSERT(state->packet_in_progress == NULL);
+	
+	free(state);
+	vQueueDelete(queue);
+	
+	TEST_OK();
+}
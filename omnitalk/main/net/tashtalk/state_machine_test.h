@@ -0,0 +1,6 @@
+#pragma once
+
+#include "test.h"
+
+TEST_FUNCTION(test_tashtalk_feed_chunking);
+TEST_FUNCTION(test_tashtalk_drops_bad_crc);
@@ -52,9 +52,12 @@ transport_t* tashtalk_get_transport(void) {
 	return &tashtalk_transport;	
 }
 
-void start_tashtalk(void) {
+void start_tashtalk(tt_uart_backend_t* backend) {
 	tashtalk_transport.ready_event = xEventGroupCreate();
 
-	tt_uart_init();
+	if (tt_uart_init(backend) != ESP_OK) {
+		ESP_LOGE(TAG, "UART init failed, LocalTalk will be unavailable");
+		return;
+	}
 	tt_uart_start();
 }
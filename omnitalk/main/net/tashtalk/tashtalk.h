@@ -1,6 +1,7 @@
 #pragma once
 
 #include "net/transport.h"
+#include "net/tashtalk/uart_backend.h"
 
-void start_tashtalk(void);
+void start_tashtalk(tt_uart_backend_t* backend);
 transport_t* tashtalk_get_transport(void);
\ No newline at end of file
@@ -1,21 +1,21 @@
 #include "net/tashtalk/uart.h"
 
+#include <string.h>
+
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <esp_system.h>
 #include <esp_log.h>
-#include <driver/uart.h>
-#include "driver/gpio.h"
 
 #include "mem/buffers.h"
 #include "net/common.h"
 #include "net/transport.h"
 #include "net/tashtalk/state_machine.h"
+#include "net/tashtalk/uart_backend.h"
 #include "web/stats.h"
-#include "hw.h"
 
 static const char* TAG = "TT_UART";
-static const int uart_num = UART_NUM_1;
+static tt_uart_backend_t* uart_backend = NULL;
 
 TaskHandle_t uart_rx_task = NULL;
 TaskHandle_t uart_tx_task = NULL;
@@ -29,60 +29,67 @@ uint8_t tashtalk_node_address = 0;
 extern transport_t tashtalk_transport;
 
 #define RX_BUFFER_SIZE 1024
+
+// TT_UART_TX_BATCH_SIZE is the most we'll hand the UART driver in one write
+// when we're sending several frames back to back.  It'll fit at least three
+// maximum-length LLAP frames.
+#define TT_UART_TX_BATCH_SIZE 2048
+
 uint8_t uart_buffer[RX_BUFFER_SIZE];
 
 void tt_uart_init_tashtalk(void) {
 	// Sending 1k of zeroes is guaranteed to get tashtalk back into
 	// a known state.
-	char init[32] = { 0 };
+	uint8_t init[32] = { 0 };
 	for (int i = 0; i < 32; i++) {
-		uart_write_bytes(uart_num, init, 32);
+		uart_backend->write(uart_backend, init, 32);
 	}
 	
 	// Then send an all-zero set of nodebits so we don't have an address.
-	uart_write_bytes(uart_num, "\x02", 1);
-	uart_write_bytes(uart_num, init, 32);
+	uart_backend->write(uart_backend, (const uint8_t*)"\x02", 1);
+	uart_backend->write(uart_backend, init, 32);
 }
 
-void tt_uart_init(void) {	
-	const uart_config_t uart_config = {
-		.baud_rate = 1000000,
-		.data_bits = UART_DATA_8_BITS,
-		.parity = UART_PARITY_DISABLE,
-		.stop_bits = UART_STOP_BITS_1,
-		.flow_ctrl = UART_HW_FLOWCTRL_CTS_RTS,
-		.rx_flow_ctrl_thresh = 0,		
-	};
+esp_err_t tt_uart_init(tt_uart_backend_t* backend) {
+	uart_backend = backend;
 	
-	ESP_ERROR_CHECK(uart_param_config(uart_num, &uart_config));
-	ESP_ERROR_CHECK(uart_set_pin(uart_num, UART_TX, UART_RX, UART_RTS, UART_CTS));
-	ESP_ERROR_CHECK(uart_driver_install(uart_num, 2048, 0, 0, NULL, 0));
+	esp_err_t err = uart_backend->open(uart_backend);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "couldn't open %s UART", uart_backend->kind);
+		return err;
+	}
 
 	tt_uart_init_tashtalk();
 	
 	mark_transport_ready(&tashtalk_transport);
 
 	ESP_LOGI(TAG, "tt_uart_init complete");
+	return ESP_OK;
 }
 
 void tt_uart_rx_runloop(void* dummy) {
 	static const char *TAG = "UART_RX";	
 	ESP_LOGI(TAG, "started");
 	
-	rxstate = new_tashtalk_rx_state(tashtalk_inbound_queue);
+	rxstate = new_tashtalk_rx_state(&tashtalk_transport);
 	
 	while(1){
-		/* TODO: this is stupid, read a byte at a time instead and wait for MAX_DELAY */
-		const int len = uart_read_bytes(uart_num, uart_buffer, 1, 1000 / portTICK_PERIOD_MS);
+		const int len = uart_backend->read(uart_backend, uart_buffer, RX_BUFFER_SIZE);
+		if (len <= 0) {
+			ESP_LOGE(TAG, "read from %s UART failed", uart_backend->kind);
+			vTaskDelay(10 / portTICK_PERIOD_MS);
+			continue;
+		}
 		
 		stats.transport_in_octets__transport_localtalk += len;
-		if (len > 0) {
-			tashtalk_feed_all(rxstate, uart_buffer, len);
-		}
+		tashtalk_feed_all(rxstate, uart_buffer, len);
 	}
 }
 
-bool tashtalk_tx_validate(buffer_t* packet) {
+// tashtalk_tx_validate checks a data packet is one TashTalk won't choke on.
+// crc should be the CRC state after running over the whole packet, CRC
+// bytes and all.
+bool tashtalk_tx_validate(buffer_t* packet, crc_state_t* crc) {
 	if (packet->length < 5) {
 		// Too short
 		ESP_LOGE(TAG, "tx packet too short");
@@ -119,10 +126,7 @@ bool tashtalk_tx_validate(buffer_t* packet) {
 	}
 
 	// check the CRC
-	crc_state_t crc;
-	crc_state_init(&crc);
-	crc_state_append_all(&crc, packet->data, packet->length);
-	if (!crc_state_ok(&crc)) {
+	if (!crc_state_ok(crc)) {
 		ESP_LOGE(TAG, "bad CRC on tx: IP bug?");
 		stats.transport_out_errors__transport_localtalk__err_bad_crc++;
 		return false;
@@ -131,6 +135,86 @@ bool tashtalk_tx_validate(buffer_t* packet) {
 	return true;
 }
 
+// tt_uart_prepare_packet gets a packet ready to go down the wire: data
+// packets get their CRC appended, are checked, and get the 0x01 that tells
+// tashtalk it's a data frame put in front of them.  It returns false if the
+// packet should be dropped.  *needs_prefix is set if there was no headroom
+// for the 0x01, in which case the caller has to send it separately.
+static bool tt_uart_prepare_packet(buffer_t* packet, bool* needs_prefix) {
+	static const char *TAG = "UART_TX";
+	
+	*needs_prefix = false;
+	
+	if ((packet->transport_flags & TRANSPORT_FLAG_TASHTALK_CONTROL_FRAME) != 0) {
+		return true;
+	}
+	
+	// Append the CRC to data packets
+	if (packet->capacity < packet->length + 2) {
+		ESP_LOGE(TAG, "no room to add CRC");
+		stats.transport_out_errors__transport_localtalk__err_no_room_for_crc_in_buffer++;
+		return false;
+	}
+
+	packet->length += 2;
+	crc_state_t crc;
+	crc_state_init(&crc);
+	crc_state_append_all(&crc, packet->data, packet->length - 2);
+	packet->data[packet->length - 2] = crc_state_byte_1(&crc);
+	packet->data[packet->length - 1] = crc_state_byte_2(&crc);
+	
+	// Carrying on over the two CRC bytes gives us the CRC of the
+	// whole frame for validation, without going over it again.
+	crc_state_append_all(&crc, packet->data + packet->length - 2, 2);
+						
+	if (!tashtalk_tx_validate(packet, &crc)) {
+		ESP_LOGE(TAG, "packet validation failed");
+		return false;
+	}
+	
+	// Put the 0x01 in the headroom, so the whole thing can go in one write.
+	// Everything that comes down from the LAP has room, but be careful.
+	if (packet->data > packet->mem_top) {
+		buf_give_me_extra_l2_hdr_bytes(packet, 1);
+		packet->data[0] = 0x01;
+	} else {
+		*needs_prefix = true;
+	}
+	
+	return true;
+}
+
+static void tt_uart_record_write_size(size_t len) {
+	if (len <= 8) {
+		stats.tashtalk_tx_bytes_per_write_bucket__le_8++;
+	}
+	if (len <= 32) {
+		stats.tashtalk_tx_bytes_per_write_bucket__le_32++;
+	}
+	if (len <= 128) {
+		stats.tashtalk_tx_bytes_per_write_bucket__le_128++;
+	}
+	if (len <= 512) {
+		stats.tashtalk_tx_bytes_per_write_bucket__le_512++;
+	}
+	if (len <= 2048) {
+		stats.tashtalk_tx_bytes_per_write_bucket__le_2048++;
+	}
+	stats.tashtalk_tx_bytes_per_write_bucket__le_Inf++;
+	stats.tashtalk_tx_bytes_per_write_sum += len;
+	stats.tashtalk_tx_bytes_per_write_count++;
+}
+
+static void tt_uart_write(const uint8_t* data, size_t len) {
+	uart_backend->write(uart_backend, data, len);
+	stats.transport_out_octets__transport_localtalk += len;
+	tt_uart_record_write_size(len);
+}
+
+// tx_batch is where frames get gathered up when there are several waiting,
+// so that they go to the UART in one go.
+static uint8_t tx_batch[TT_UART_TX_BATCH_SIZE];
+
 void tt_uart_tx_runloop(void* buffer_pool) {
 	buffer_t* packet = NULL;
 	static const char *TAG = "UART_TX";
@@ -139,40 +223,45 @@ void tt_uart_tx_runloop(void* buffer_pool) {
 	
 	while(1){
 		xQueueReceive(tashtalk_outbound_queue, &packet, portMAX_DELAY);
+		size_t batch_len = 0;
 		
-		if ((packet->transport_flags && TRANSPORT_FLAG_TASHTALK_CONTROL_FRAME) == 0) {
-			// Append the CRC to data packets
-			if (packet->capacity < packet->length + 2) {
-				ESP_LOGE(TAG, "no room to add CRC");
-				stats.transport_out_errors__transport_localtalk__err_no_room_for_crc_in_buffer++;
-				goto skip_processing;
-			}
-		
-			packet->length += 2;
-			crc_state_t crc;
-			crc_state_init(&crc);
-			crc_state_append_all(&crc, packet->data, packet->length - 2);
-			packet->data[packet->length - 2] = crc_state_byte_1(&crc);
-			packet->data[packet->length - 1] = crc_state_byte_2(&crc);
-								
-			if (!tashtalk_tx_validate(packet)) {
-				ESP_LOGE(TAG, "packet validation failed");
+		while (packet != NULL) {
+			// Is anything waiting behind this one?
+			buffer_t* next = NULL;
+			xQueueReceive(tashtalk_outbound_queue, &next, 0);
+			
+			bool needs_prefix = false;
+			if (!tt_uart_prepare_packet(packet, &needs_prefix) || !tashtalk_enable_uart_tx) {
 				goto skip_processing;
 			}
-		}
-		
-		if (tashtalk_enable_uart_tx) {
-			if ((packet->transport_flags && TRANSPORT_FLAG_TASHTALK_CONTROL_FRAME) == 0) {
-				// if it's a data frame, send a 0x01 to signal a data frame to tashtalk.
-				uart_write_bytes(uart_num, "\x01", 1);
+			
+			if (batch_len == 0 && next == NULL && !needs_prefix) {
+				// It's on its own, so send it straight from the buffer
+				tt_uart_write(packet->data, packet->length);
+			} else {
+				size_t frame_len = packet->length + (needs_prefix ? 1 : 0);
+				if (batch_len + frame_len > TT_UART_TX_BATCH_SIZE) {
+					tt_uart_write(tx_batch, batch_len);
+					batch_len = 0;
+				}
+				
+				if (needs_prefix) {
+					tx_batch[batch_len++] = 0x01;
+				}
+				memcpy(tx_batch + batch_len, packet->data, packet->length);
+				batch_len += packet->length;
 			}
-			uart_write_bytes(uart_num, (const char*)packet->data, packet->length);
 			
-			stats.transport_out_octets__transport_localtalk += packet->length + 1;
 			stats.transport_out_frames__transport_localtalk++;
+			
+		skip_processing:
+			freebuf(packet);
+			packet = next;
+		}
+		
+		if (batch_len > 0) {
+			tt_uart_write(tx_batch, batch_len);
 		}
-skip_processing:
-		freebuf(packet);
 	}
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "net/tashtalk/state_machine.h"
+#include "net/tashtalk/uart_backend.h"
 
 extern _Atomic bool tashtalk_enable_uart_tx;
 extern tashtalk_rx_state_t* rxstate;
@@ -10,5 +11,5 @@ extern QueueHandle_t tashtalk_outbound_queue;
 extern uint8_t tashtalk_node_address;
 
 esp_err_t tt_uart_refresh_address(void);
-void tt_uart_init(void);
+esp_err_t tt_uart_init(tt_uart_backend_t* backend);
 void tt_uart_start(void);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <esp_err.h>
+
+// A tt_uart_backend_t is the serial port that TashTalk is on the other end
+// of.  On the device it's the ESP32's UART; on a Linux box it's a tty (or a
+// pty with something pretending to be TashTalk on the other side).
+//
+// The backend only moves bytes about.  Everything that knows about what
+// the bytes mean lives in uart.c and the state machine.
+
+typedef struct tt_uart_backend_s tt_uart_backend_t;
+
+struct tt_uart_backend_s {
+	char* kind;
+	void* private_data;
+
+	// open sets the port up for TashTalk: 1Mbaud, 8N1, hardware flow control
+	esp_err_t (*open)(tt_uart_backend_t* backend);
+
+	// read waits until there's something to read, then reads as much as is
+	// there, up to max bytes.  It returns how many bytes it read, or -1 if
+	// something went wrong.
+	int (*read)(tt_uart_backend_t* backend, uint8_t* buf, size_t max);
+
+	// write writes all len bytes, blocking until they've been accepted.
+	int (*write)(tt_uart_backend_t* backend, const uint8_t* data, size_t len);
+};
+
+// tt_uart_esp_backend returns the backend for the ESP32's UART, wired up
+// as described in hw.h.
+tt_uart_backend_t* tt_uart_esp_backend(void);
+
+// tt_uart_linux_backend returns a backend for a Linux tty or pty device.
+tt_uart_backend_t* tt_uart_linux_backend(const char* device);
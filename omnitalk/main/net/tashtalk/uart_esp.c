@@ -0,0 +1,109 @@
+#include "net/tashtalk/uart_backend.h"
+
+#include <stdlib.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <driver/uart.h>
+#include "driver/gpio.h"
+
+#include "hw.h"
+
+static const char* TAG = "TT_UART_ESP";
+
+#define UART_DRIVER_RX_BUFFER_SIZE 4096
+#define UART_EVENT_QUEUE_DEPTH 20
+
+// The UART driver tells us there's data when it's got this many bytes in
+// its FIFO, or when the line's been idle for UART_RX_TIMEOUT_SYMBOLS
+// character times, whichever comes first.  An LLAP frame ends with a
+// pause, so the timeout means we see the end of each frame promptly.
+#define UART_RX_FULL_THRESHOLD 100
+#define UART_RX_TIMEOUT_SYMBOLS 4
+
+typedef struct {
+	uart_port_t port;
+	QueueHandle_t events;
+} esp_uart_state_t;
+
+static esp_err_t esp_uart_open(tt_uart_backend_t* backend) {
+	esp_uart_state_t* state = (esp_uart_state_t*)backend->private_data;
+	
+	const uart_config_t uart_config = {
+		.baud_rate = 1000000,
+		.data_bits = UART_DATA_8_BITS,
+		.parity = UART_PARITY_DISABLE,
+		.stop_bits = UART_STOP_BITS_1,
+		.flow_ctrl = UART_HW_FLOWCTRL_CTS_RTS,
+		.rx_flow_ctrl_thresh = 0,
+	};
+	
+	ESP_ERROR_CHECK(uart_param_config(state->port, &uart_config));
+	ESP_ERROR_CHECK(uart_set_pin(state->port, UART_TX, UART_RX, UART_RTS, UART_CTS));
+	ESP_ERROR_CHECK(uart_driver_install(state->port, UART_DRIVER_RX_BUFFER_SIZE, 0,
+		UART_EVENT_QUEUE_DEPTH, &state->events, 0));
+	ESP_ERROR_CHECK(uart_set_rx_full_threshold(state->port, UART_RX_FULL_THRESHOLD));
+	ESP_ERROR_CHECK(uart_set_rx_timeout(state->port, UART_RX_TIMEOUT_SYMBOLS));
+	
+	return ESP_OK;
+}
+
+static int esp_uart_read(tt_uart_backend_t* backend, uint8_t* buf, size_t max) {
+	esp_uart_state_t* state = (esp_uart_state_t*)backend->private_data;
+	uart_event_t event;
+	
+	while (1) {
+		// Take everything the driver's got, not just what the last event
+		// mentioned, so we're never playing catch-up.
+		size_t buffered = 0;
+		uart_get_buffered_data_len(state->port, &buffered);
+		if (buffered > 0) {
+			size_t want = buffered < max ? buffered : max;
+			return uart_read_bytes(state->port, buf, want, 0);
+		}
+		
+		if (xQueueReceive(state->events, &event, portMAX_DELAY) != pdTRUE) {
+			continue;
+		}
+		
+		if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+			// We've lost bytes, so whatever frame is in flight is toast.
+			// TashTalk will tell us about the next one with a framing
+			// error or a CRC failure, so there's nothing else to do.
+			ESP_LOGE(TAG, "UART overflow");
+			
+			// Events queue up behind the data, and we've likely read past
+			// this one by now; what's come in since is fine.  Only throw
+			// it away if the buffer's still too full for the driver to
+			// carry on receiving.
+			size_t still_buffered = 0;
+			uart_get_buffered_data_len(state->port, &still_buffered);
+			if (still_buffered > UART_DRIVER_RX_BUFFER_SIZE - UART_HW_FIFO_LEN(state->port)) {
+				ESP_LOGE(TAG, "UART buffer still full, flushing");
+				uart_flush_input(state->port);
+				xQueueReset(state->events);
+			}
+		}
+	}
+}
+
+static int esp_uart_write(tt_uart_backend_t* backend, const uint8_t* data, size_t len) {
+	esp_uart_state_t* state = (esp_uart_state_t*)backend->private_data;
+	return uart_write_bytes(state->port, (const char*)data, len);
+}
+
+tt_uart_backend_t* tt_uart_esp_backend(void) {
+	tt_uart_backend_t* backend = calloc(1, sizeof(tt_uart_backend_t));
+	esp_uart_state_t* state = calloc(1, sizeof(esp_uart_state_t));
+	
+	state->port = UART_NUM_1;
+	
+	backend->kind = "esp32";
+	backend->private_data = state;
+	backend->open = &esp_uart_open;
+	backend->read = &esp_uart_read;
+	backend->write = &esp_uart_write;
+	
+	return backend;
+}
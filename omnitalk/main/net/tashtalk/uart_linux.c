@@ -0,0 +1,108 @@
+#include "net/tashtalk/uart_backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+
+// This is only built for the host build; the device uses uart_esp.c.
+
+static const char* TAG = "TT_UART_LINUX";
+
+typedef struct {
+	char* device;
+	int fd;
+} linux_uart_state_t;
+
+static esp_err_t linux_uart_open(tt_uart_backend_t* backend) {
+	linux_uart_state_t* state = (linux_uart_state_t*)backend->private_data;
+	struct termios tio;
+	
+	state->fd = open(state->device, O_RDWR | O_NOCTTY);
+	if (state->fd < 0) {
+		ESP_LOGE(TAG, "couldn't open %s: %s", state->device, strerror(errno));
+		return ESP_FAIL;
+	}
+	
+	if (tcgetattr(state->fd, &tio) != 0) {
+		ESP_LOGE(TAG, "tcgetattr on %s failed: %s", state->device, strerror(errno));
+		goto err_cleanup;
+	}
+	
+	// Raw bytes in and out.  VMIN=1, VTIME=0 means read() waits for at
+	// least one byte and then returns whatever's there, which is exactly
+	// what we want.
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD | CRTSCTS;
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	
+	// ptys don't care about the speed, but real USB serial adapters do
+	cfsetispeed(&tio, B1000000);
+	cfsetospeed(&tio, B1000000);
+	
+	if (tcsetattr(state->fd, TCSANOW, &tio) != 0) {
+		ESP_LOGE(TAG, "tcsetattr on %s failed: %s", state->device, strerror(errno));
+		goto err_cleanup;
+	}
+	
+	ESP_LOGI(TAG, "opened %s", state->device);
+	return ESP_OK;
+
+err_cleanup:
+	close(state->fd);
+	state->fd = -1;
+	return ESP_FAIL;
+}
+
+static int linux_uart_read(tt_uart_backend_t* backend, uint8_t* buf, size_t max) {
+	linux_uart_state_t* state = (linux_uart_state_t*)backend->private_data;
+	
+	while (1) {
+		ssize_t len = read(state->fd, buf, max);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		
+		return (int)len;
+	}
+}
+
+static int linux_uart_write(tt_uart_backend_t* backend, const uint8_t* data, size_t len) {
+	linux_uart_state_t* state = (linux_uart_state_t*)backend->private_data;
+	size_t done = 0;
+	
+	while (done < len) {
+		ssize_t written = write(state->fd, data + done, len - done);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			ESP_LOGE(TAG, "write to %s failed: %s", state->device, strerror(errno));
+			return -1;
+		}
+		done += written;
+	}
+	
+	return (int)done;
+}
+
+tt_uart_backend_t* tt_uart_linux_backend(const char* device) {
+	tt_uart_backend_t* backend = calloc(1, sizeof(tt_uart_backend_t));
+	linux_uart_state_t* state = calloc(1, sizeof(linux_uart_state_t));
+	
+	state->device = strdup(device);
+	state->fd = -1;
+	
+	backend->kind = "linux";
+	backend->private_data = state;
+	backend->open = &linux_uart_open;
+	backend->read = &linux_uart_read;
+	backend->write = &linux_uart_write;
+	
+	return backend;
+}
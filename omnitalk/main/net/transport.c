@@ -6,8 +6,10 @@
 #include <esp_err.h>
 
 #include "mem/buffers.h"
+#include "net/packet_capture.h"
 
 esp_err_t enable_transport(transport_t* transport) {
+	packet_capture_attach(transport);
 	return transport->enable(transport);
 }
 
@@ -45,6 +47,38 @@ struct eth_addr transport_ether_multicast_for_zone(transport_t* transport, pstri
 }
 
 
+// capture_stage copies a frame into the transport's capture ring before
+// it goes on a queue, since once it's there it's not ours to look at any
+// more; capture_commit makes it visible once it's actually on the queue.
+static inline uint32_t capture_stage(transport_t* transport, buffer_t *buff,
+	packet_capture_direction_t direction) {
+	
+	if (transport->capture == NULL) {
+		return 0;
+	}
+	return packet_capture_stage(transport->capture, buff, direction);
+}
+
+static inline void capture_commit(transport_t* transport, uint32_t ticket) {
+	if (ticket != 0) {
+		packet_capture_commit(transport->capture, ticket);
+	}
+}
+
+bool tdeliver(transport_t* transport, buffer_t *buff) {
+	return tdeliver_with_timeout(transport, buff, 0);
+}
+
+bool tdeliver_with_timeout(transport_t* transport, buffer_t *buff, TickType_t timeout) {
+	uint32_t ticket = capture_stage(transport, buff, PACKET_CAPTURE_INBOUND);
+	if (xQueueSendToBack(transport->inbound, &buff, timeout) != pdTRUE) {
+		return false;
+	}
+	
+	capture_commit(transport, ticket);
+	return true;
+}
+
 buffer_t* trecv(transport_t* transport) {
 	buffer_t *buff = NULL;
 	xQueueReceive(transport->inbound, &buff, portMAX_DELAY);
@@ -58,7 +92,14 @@ buffer_t* trecv_with_timeout(transport_t* transport, TickType_t timeout) {
 }
 
 
+static void notify_outbound_ready(transport_t* transport) {
+	if (transport->outbound_ready != NULL) {
+		transport->outbound_ready(transport);
+	}
+}
+
 bool tsend(transport_t* transport, buffer_t *buff) {
+	uint32_t ticket = capture_stage(transport, buff, PACKET_CAPTURE_OUTBOUND);
 	BaseType_t err = xQueueSendToBack(transport->outbound,
 		&buff, 0);
 	
@@ -66,10 +107,31 @@ bool tsend(transport_t* transport, buffer_t *buff) {
 		return false;
 	} 
 	
+	capture_commit(transport, ticket);
+	notify_outbound_ready(transport);
 	return true;
 }
 
+size_t tsend_batch(transport_t* transport, buffer_t **buffs, size_t count) {
+	size_t sent = 0;
+	
+	while (sent < count) {
+		uint32_t ticket = capture_stage(transport, buffs[sent], PACKET_CAPTURE_OUTBOUND);
+		if (xQueueSendToBack(transport->outbound, &buffs[sent], 0) != pdTRUE) {
+			break;
+		}
+		capture_commit(transport, ticket);
+		sent++;
+	}
+	
+	if (sent > 0) {
+		notify_outbound_ready(transport);
+	}
+	return sent;
+}
+
 bool tsend_and_block(transport_t* transport, buffer_t *buff) {
+	uint32_t ticket = capture_stage(transport, buff, PACKET_CAPTURE_OUTBOUND);
 	BaseType_t err = xQueueSendToBack(transport->outbound,
 		&buff, portMAX_DELAY);
 	
@@ -77,5 +139,21 @@ bool tsend_and_block(transport_t* transport, buffer_t *buff) {
 		return false;
 	} 
 	
+	capture_commit(transport, ticket);
+	notify_outbound_ready(transport);
+	return true;
+}
+
+bool tsend_first_and_block(transport_t* transport, buffer_t *buff) {
+	uint32_t ticket = capture_stage(transport, buff, PACKET_CAPTURE_OUTBOUND);
+	BaseType_t err = xQueueSendToFront(transport->outbound,
+		&buff, portMAX_DELAY);
+	
+	if (err != pdTRUE) {
+		return false;
+	} 
+	
+	capture_commit(transport, ticket);
+	notify_outbound_ready(transport);
 	return true;
 }
@@ -25,6 +25,14 @@ struct eth_addr transport_ether_multicast_for_zone(transport_t* transport, pstri
 void wait_for_transport_ready(transport_t* transport);
 void mark_transport_ready(transport_t* transport);
 
+// tdeliver is how a transport hands a frame it's received to its LAP,
+// never blocking.  It returns true if the frame got on the inbound queue
+// and is the LAP's now, false if the queue was full and it's still the
+// caller's.
+bool tdeliver(transport_t* transport, buffer_t *buff);
+
+bool tdeliver_with_timeout(transport_t* transport, buffer_t *buff, TickType_t timeout);
+
 // trecv is a utility function to receive a frame from a transport,
 // blocking until a frame is available.
 buffer_t* trecv(transport_t* transport);
@@ -37,5 +45,13 @@ buffer_t* trecv_with_timeout(transport_t* transport, TickType_t timeout);
 // otherwise
 bool tsend(transport_t* transport, buffer_t *buff);
 
+// tsend_batch is like tsend for several frames at once, waking the
+// transport once they're all queued rather than for each.  It returns how
+// many of them, from the start, it sent; the rest are still the caller's.
+size_t tsend_batch(transport_t* transport, buffer_t **buffs, size_t count);
+
 // tsend_and_block is like tsend but blocks indefinitely
 bool tsend_and_block(transport_t* transport, buffer_t *buff);
+
+// tsend_first_and_block is like tsend_and_block but jumps the queue
+bool tsend_first_and_block(transport_t* transport, buffer_t *buff);
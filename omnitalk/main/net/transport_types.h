@@ -8,6 +8,16 @@
 // dependency between transports and buffers.
 
 typedef struct transport_s transport_t;
+typedef struct packet_capture_s packet_capture_t;
+
+// transport_framing_t says what the frames on a transport's queues look
+// like, for things (such as packet capture) that need to pick them apart
+typedef enum {
+	// LLAP header and all, as for LocalTalk and LToUDP
+	TRANSPORT_FRAMING_LLAP = 0,
+	// whole Ethernet frames coming in; DDP packets or whole frames going out
+	TRANSPORT_FRAMING_ETHERNET,
+} transport_framing_t;
 
 typedef esp_err_t(*transport_handler)(transport_t*);
 typedef esp_err_t(*transport_node_address_handler)(transport_t*, uint8_t);
@@ -17,6 +27,7 @@ struct transport_s {
 	int quality;
 
 	char* kind;
+	transport_framing_t framing;
 	void* private_data;
 	
 	EventGroupHandle_t ready_event;
@@ -28,7 +39,16 @@ struct transport_s {
 	// get_zone_ether_multicast is NULL if the transport does not support ethernet
 	// multicast (e.g., if it's not ethernet)
 	transport_zone_ether_multicast_handler get_zone_ether_multicast;
+	
+	// outbound_ready is called, if it's not NULL, whenever a frame is put on
+	// the outbound queue.  It's for transports that don't have a task sat
+	// waiting on the queue and need poking to go and look at it.
+	transport_handler outbound_ready;
 		
 	QueueHandle_t inbound;
 	QueueHandle_t outbound;
+	
+	// capture is the transport's packet capture ring, or NULL if it hasn't
+	// got one; see net/packet_capture.h
+	packet_capture_t* capture;
 };
@@ -0,0 +1,226 @@
+#include "net/udp_reactor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_vfs_eventfd.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include <lwip/sockets.h>
+
+#include "mem/buffers.h"
+#include "net/common.h"
+#include "net/transport.h"
+
+static const char* TAG = "UDP-io";
+
+typedef struct {
+	transport_t* transport;
+	udp_reactor_open_fn open;
+	udp_reactor_read_fn read;
+	udp_reactor_write_fn write;
+	
+	// sock is -1 until open has succeeded, and again after it breaks
+	int sock;
+	int64_t retry_at;
+} udp_reactor_handler_t;
+
+// Handlers only ever get added, at startup.  An entry is filled in before
+// handler_count is bumped, so the reactor never sees a half-made one.
+static udp_reactor_handler_t handlers[UDP_REACTOR_MAX_HANDLERS];
+static _Atomic size_t handler_count = 0;
+
+// wake_fd is an eventfd that gets written to when there's something on an
+// outbound queue, since we can't select() on a FreeRTOS queue.
+static int wake_fd = -1;
+static TaskHandle_t reactor_task = NULL;
+
+static esp_err_t udp_reactor_wake(transport_t* transport) {
+	uint64_t one = 1;
+	write(wake_fd, &one, sizeof(one));
+	return ESP_OK;
+}
+
+static void udp_reactor_open_handler(udp_reactor_handler_t *h) {
+	int sock = h->open(h->transport);
+	if (sock < 0) {
+		ESP_LOGE(TAG, "setting up %s socket failed.  Retrying...", h->transport->kind);
+		h->retry_at = esp_timer_get_time() + (UDP_REACTOR_RETRY_INTERVAL_MS * 1000LL);
+		return;
+	}
+	
+	int flags = fcntl(sock, F_GETFL, 0);
+	fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+	h->sock = sock;
+}
+
+static void udp_reactor_close_handler(udp_reactor_handler_t *h) {
+	ESP_LOGE(TAG, "%s socket broke, reopening it", h->transport->kind);
+	close(h->sock);
+	h->sock = -1;
+	h->retry_at = esp_timer_get_time() + (UDP_REACTOR_RETRY_INTERVAL_MS * 1000LL);
+}
+
+// udp_reactor_drain_inbound reads from a readable socket until it runs dry
+// or we've read our budget.  It returns true if there might be more.
+static bool udp_reactor_drain_inbound(udp_reactor_handler_t *h) {
+	for (int i = 0; i < UDP_REACTOR_RX_BUDGET; i++) {
+		udp_io_result_t result = h->read(h->transport, h->sock);
+		
+		if (result == UDP_IO_IDLE) {
+			return false;
+		}
+		
+		if (result == UDP_IO_BROKEN) {
+			udp_reactor_close_handler(h);
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+// udp_reactor_drain_outbound sends frames from a transport's outbound queue
+// until it's empty or we've sent our budget.  It returns true if there
+// might be more.  If the socket isn't open, frames get thrown away, like
+// they always have been.
+static bool udp_reactor_drain_outbound(udp_reactor_handler_t *h) {
+	buffer_t *packet = NULL;
+	
+	for (int i = 0; i < UDP_REACTOR_TX_BUDGET; i++) {
+		if (xQueueReceive(h->transport->outbound, &packet, 0) != pdTRUE) {
+			return false;
+		}
+		
+		if (packet == NULL) {
+			continue;
+		}
+		
+		if (h->sock != -1) {
+			h->write(h->transport, h->sock, packet);
+		}
+		freebuf(packet);
+	}
+	
+	return true;
+}
+
+static void udp_reactor_runloop(void* dummy) {
+	ESP_LOGI(TAG, "waiting for IP connectivity");
+	wait_for_ip_ready();
+	
+	// busy is set if we stopped short of emptying something last time
+	// round, in which case we shouldn't wait about in select()
+	bool busy = false;
+	
+	while (1) {
+		size_t count = handler_count;
+		int64_t now = esp_timer_get_time();
+		bool any_closed = false;
+		
+		fd_set readfds;
+		FD_ZERO(&readfds);
+		FD_SET(wake_fd, &readfds);
+		int maxfd = wake_fd;
+		
+		for (size_t i = 0; i < count; i++) {
+			udp_reactor_handler_t *h = &handlers[i];
+			
+			if (h->sock == -1 && now >= h->retry_at) {
+				udp_reactor_open_handler(h);
+			}
+			
+			if (h->sock == -1) {
+				any_closed = true;
+				continue;
+			}
+			
+			FD_SET(h->sock, &readfds);
+			if (h->sock > maxfd) {
+				maxfd = h->sock;
+			}
+		}
+		
+		// Sleep until something happens, unless we've got work left over,
+		// and check back now and again if there's a socket to reopen.
+		struct timeval timeout = { 0 };
+		struct timeval *timeoutp = NULL;
+		if (busy) {
+			timeoutp = &timeout;
+		} else if (any_closed) {
+			timeout.tv_sec = UDP_REACTOR_RETRY_INTERVAL_MS / 1000;
+			timeout.tv_usec = (UDP_REACTOR_RETRY_INTERVAL_MS % 1000) * 1000;
+			timeoutp = &timeout;
+		}
+		
+		int ready = select(maxfd + 1, &readfds, NULL, NULL, timeoutp);
+		if (ready < 0) {
+			ESP_LOGE(TAG, "select() failed, errno %d", errno);
+			vTaskDelay(10 / portTICK_PERIOD_MS);
+			continue;
+		}
+		
+		// Empty the eventfd before we look at the queues, so that anything
+		// queued after we've looked wakes us up again.
+		if (FD_ISSET(wake_fd, &readfds)) {
+			uint64_t wakeups = 0;
+			read(wake_fd, &wakeups, sizeof(wakeups));
+		}
+		
+		busy = false;
+		for (size_t i = 0; i < count; i++) {
+			udp_reactor_handler_t *h = &handlers[i];
+			
+			if (h->sock != -1 && FD_ISSET(h->sock, &readfds)) {
+				busy |= udp_reactor_drain_inbound(h);
+			}
+			
+			busy |= udp_reactor_drain_outbound(h);
+		}
+	}
+}
+
+bool udp_reactor_add(transport_t* transport, udp_reactor_open_fn open,
+	udp_reactor_read_fn read, udp_reactor_write_fn write) {
+	
+	size_t index = handler_count;
+	if (index >= UDP_REACTOR_MAX_HANDLERS) {
+		ESP_LOGE(TAG, "too many UDP transports, not adding %s", transport->kind);
+		return false;
+	}
+	
+	if (reactor_task == NULL) {
+		esp_vfs_eventfd_config_t config = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+		esp_vfs_eventfd_register(&config);
+		
+		wake_fd = eventfd(0, 0);
+		if (wake_fd < 0) {
+			ESP_LOGE(TAG, "eventfd() failed, errno %d", errno);
+			return false;
+		}
+		
+		xTaskCreate(&udp_reactor_runloop, "UDP-io", 4096, NULL, 5, &reactor_task);
+	}
+	
+	handlers[index] = (udp_reactor_handler_t) {
+		.transport = transport,
+		.open = open,
+		.read = read,
+		.write = write,
+		.sock = -1,
+		.retry_at = 0,
+	};
+	transport->outbound_ready = &udp_reactor_wake;
+	handler_count = index + 1;
+	
+	udp_reactor_wake(transport);
+	
+	return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "mem/buffers.h"
+#include "net/transport.h"
+
+// The UDP reactor is one task that does all the socket I/O for all the
+// UDP-based transports.  Rather than each transport having a task blocked
+// in recv() and another blocked on its outbound queue, they hand the
+// reactor a few callbacks and it select()s across all of their sockets,
+// calling them when there's something to do.
+//
+// Sockets are made non-blocking once they're open, so the callbacks must
+// never sit about waiting for anything.
+
+#define UDP_REACTOR_MAX_HANDLERS 16
+
+// How long to wait before trying to set up a socket again if it failed
+#define UDP_REACTOR_RETRY_INTERVAL_MS 1000
+
+// How many frames to read from or send to each socket before moving on to
+// the next one, so that a busy transport can't starve the others.
+#define UDP_REACTOR_RX_BUDGET 8
+#define UDP_REACTOR_TX_BUDGET 8
+
+typedef enum {
+	// UDP_IO_MORE means we got a frame and there might be more
+	UDP_IO_MORE,
+	
+	// UDP_IO_IDLE means there's nothing to read right now
+	UDP_IO_IDLE,
+	
+	// UDP_IO_BROKEN means the socket is broken, and the reactor should
+	// close it and open a new one
+	UDP_IO_BROKEN,
+} udp_io_result_t;
+
+// udp_reactor_open_fn creates and sets up a transport's socket, returning
+// it, or -1 if it couldn't.  It'll be called again later if it fails.
+typedef int (*udp_reactor_open_fn)(transport_t* transport);
+
+// udp_reactor_read_fn reads (at most) one datagram from the socket.
+typedef udp_io_result_t (*udp_reactor_read_fn)(transport_t* transport, int sock);
+
+// udp_reactor_write_fn sends a frame from the transport's outbound queue.
+// The reactor frees the frame afterwards.
+typedef void (*udp_reactor_write_fn)(transport_t* transport, int sock, buffer_t* packet);
+
+// udp_reactor_add hands a transport over to the reactor, starting the
+// reactor if it's not already running.  It also sets the transport's
+// outbound_ready handler, so the reactor gets woken up when there are
+// frames to send.
+bool udp_reactor_add(transport_t* transport, udp_reactor_open_fn open,
+	udp_reactor_read_fn read, udp_reactor_write_fn write);
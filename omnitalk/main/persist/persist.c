@@ -0,0 +1,551 @@
+#include "persist/persist.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#include "lap/id.h"
+#include "lap/lap.h"
+#include "util/pstring.h"
+#include "web/stats.h"
+#include "global_state.h"
+#include "tunables.h"
+
+static const char* TAG = "PERSIST";
+
+#define PERSIST_NAMESPACE "omnitalk"
+#define PERSIST_TABLES_KEY "tables"
+
+// A snapshot of the tables is a header:
+//
+//   'O' 'T' version(1) entry_count(2)
+//
+// and then an entry for each network:
+//
+//   range_start(2) range_end(2) flags(1)
+//   route_count(1), then for each route:
+//       distance(1) nexthop_network(2) nexthop_node(1) lap_name(pstring)
+//   zone_count(1), then each zone as a pstring
+//
+// with everything big-endian.  A network we're directly connected to has
+// the DIRECT flag, and a route with a distance of 0 naming the LAP it's on.
+#define PERSIST_SNAPSHOT_VERSION 2
+#define PERSIST_FLAG_DIRECT 0x01
+
+// How many routes a snapshot can be made from
+#define PERSIST_MAX_ROUTES 256
+
+static bool started = false;
+static nvs_handle_t nvs;
+static SemaphoreHandle_t mutex;
+
+// What NVS has for each LAP, by LAP id, and which LAPs have come up
+static persist_lap_record_t lap_records[MAX_LAP_COUNT];
+static bool lap_record_known[MAX_LAP_COUNT];
+static lap_t* laps[MAX_LAP_COUNT];
+
+// What we last saved of the tables, or restored them from
+static uint8_t* saved_snapshot;
+static size_t saved_snapshot_length;
+
+typedef struct {
+	uint8_t* out;
+	size_t capacity;
+	size_t length;
+	bool full;
+} snapshot_writer_t;
+
+static void put_u8(snapshot_writer_t* w, uint8_t v) {
+	if (w->length + 1 > w->capacity) {
+		w->full = true;
+		return;
+	}
+	w->out[w->length++] = v;
+}
+
+static void put_u16(snapshot_writer_t* w, uint16_t v) {
+	put_u8(w, v >> 8);
+	put_u8(w, v & 0xff);
+}
+
+static void put_bytes(snapshot_writer_t* w, const void* bytes, uint8_t length) {
+	if (w->length + 1 + length > w->capacity) {
+		w->full = true;
+		return;
+	}
+	w->out[w->length++] = length;
+	memcpy(w->out + w->length, bytes, length);
+	w->length += length;
+}
+
+typedef struct {
+	const uint8_t* in;
+	size_t length;
+	size_t offset;
+	bool bad;
+} snapshot_reader_t;
+
+static uint8_t get_u8(snapshot_reader_t* r) {
+	if (r->offset + 1 > r->length) {
+		r->bad = true;
+		return 0;
+	}
+	return r->in[r->offset++];
+}
+
+static uint16_t get_u16(snapshot_reader_t* r) {
+	uint16_t v = get_u8(r) << 8;
+	return v | get_u8(r);
+}
+
+static pstring* get_pstring(snapshot_reader_t* r) {
+	if (r->offset + 1 > r->length || r->offset + 1 + r->in[r->offset] > r->length) {
+		r->bad = true;
+		return NULL;
+	}
+	pstring* s = (pstring*)(r->in + r->offset);
+	r->offset += 1 + s->length;
+	return s;
+}
+
+typedef struct {
+	rt_route_t routes[PERSIST_MAX_ROUTES];
+	size_t count;
+} route_collector_t;
+
+static bool collect_route(void* pvt, rt_route_t* route, enum rt_route_status status) {
+	route_collector_t* collector = (route_collector_t*)pvt;
+	
+	// Routes on their way out aren't worth remembering
+	if (status == RT_BAD) {
+		return true;
+	}
+	if (collector->count == PERSIST_MAX_ROUTES) {
+		return false;
+	}
+	collector->routes[collector->count++] = *route;
+	return true;
+}
+
+static bool snapshot_zones_init(void* pvt, uint16_t network, bool exists, size_t zone_count, bool complete) {
+	snapshot_writer_t* w = (snapshot_writer_t*)pvt;
+	
+	// Only networks we know all the zones for are any use
+	if (!exists || !complete || zone_count == 0 || zone_count > 255) {
+		return false;
+	}
+	put_u8(w, zone_count);
+	return !w->full;
+}
+
+static bool snapshot_zones_loop(void* pvt, int idx, uint16_t network, pstring* zone) {
+	snapshot_writer_t* w = (snapshot_writer_t*)pvt;
+	put_bytes(w, zone->str, zone->length);
+	return !w->full;
+}
+
+size_t persist_snapshot_tables(rt_routing_table_t *routing_table, zt_zip_table_t *zip_table,
+	uint8_t *out, size_t capacity) {
+	
+	route_collector_t* collector = calloc(1, sizeof(route_collector_t));
+	if (collector == NULL) {
+		return 0;
+	}
+	rt_iterate(routing_table, collector, &collect_route);
+	
+	snapshot_writer_t w = { .out = out, .capacity = capacity };
+	put_u8(&w, 'O');
+	put_u8(&w, 'T');
+	put_u8(&w, PERSIST_SNAPSHOT_VERSION);
+	put_u16(&w, 0);
+	if (w.full) {
+		free(collector);
+		return 0;
+	}
+	
+	uint16_t entries = 0;
+	for (size_t i = 0; i < collector->count; i++) {
+		rt_route_t* best = &collector->routes[i];
+		
+		// Each network gets one entry, when we come to its best route
+		bool seen = false;
+		for (size_t j = 0; j < i && !seen; j++) {
+			seen = collector->routes[j].range_start == best->range_start;
+		}
+		if (seen) {
+			continue;
+		}
+		
+		size_t entry_start = w.length;
+		put_u16(&w, best->range_start);
+		put_u16(&w, best->range_end);
+		size_t flags_at = w.length;
+		put_u8(&w, 0);
+		size_t route_count_at = w.length;
+		put_u8(&w, 0);
+		
+		uint8_t flags = 0;
+		uint8_t route_count = 0;
+		for (size_t j = i; j < collector->count && !w.full; j++) {
+			rt_route_t* route = &collector->routes[j];
+			if (route->range_start != best->range_start) {
+				continue;
+			}
+			
+			if (route->outbound_lap == NULL || route->outbound_lap->name == NULL || route_count == 255) {
+				continue;
+			}
+			if (route->distance == 0) {
+				flags |= PERSIST_FLAG_DIRECT;
+			}
+			
+			put_u8(&w, route->distance);
+			put_u16(&w, route->nexthop.network);
+			put_u8(&w, route->nexthop.node);
+			put_bytes(&w, route->outbound_lap->name, strlen(route->outbound_lap->name));
+			route_count++;
+		}
+		
+		bool zones = !w.full && zt_iterate_net(zip_table, &w, best->range_start,
+			&snapshot_zones_init, &snapshot_zones_loop, NULL);
+		
+		if (w.full) {
+			// That's as much as we've room for
+			w.length = entry_start;
+			break;
+		}
+		if (!zones || (route_count == 0 && flags == 0)) {
+			w.length = entry_start;
+			continue;
+		}
+		
+		out[flags_at] = flags;
+		out[route_count_at] = route_count;
+		entries++;
+	}
+	
+	out[3] = entries >> 8;
+	out[4] = entries & 0xff;
+	
+	free(collector);
+	return w.length;
+}
+
+size_t persist_restore_snapshot(rt_routing_table_t *routing_table, zt_zip_table_t *zip_table,
+	lap_registry_t *registry, const uint8_t *snapshot, size_t length) {
+	
+	snapshot_reader_t r = { .in = snapshot, .length = length };
+	size_t restored = 0;
+	
+	if (get_u8(&r) != 'O' || get_u8(&r) != 'T' || get_u8(&r) != PERSIST_SNAPSHOT_VERSION) {
+		ESP_LOGW(TAG, "ignoring a snapshot we can't read");
+		return 0;
+	}
+	
+	uint16_t entries = get_u16(&r);
+	for (uint16_t i = 0; i < entries && !r.bad; i++) {
+		uint16_t range_start = get_u16(&r);
+		uint16_t range_end = get_u16(&r);
+		uint8_t flags = get_u8(&r);
+		uint8_t route_count = get_u8(&r);
+		
+		size_t preloaded = 0;
+		bool direct = false;
+		for (uint8_t j = 0; j < route_count && !r.bad; j++) {
+			uint8_t distance = get_u8(&r);
+			uint16_t nexthop_network = get_u16(&r);
+			uint8_t nexthop_node = get_u8(&r);
+			pstring* lap_name = get_pstring(&r);
+			if (r.bad) {
+				break;
+			}
+			
+			// We can only have the route back if we've still got its LAP
+			char name[256];
+			memcpy(name, lap_name->str, lap_name->length);
+			name[lap_name->length] = '\0';
+			rt_route_t route = {
+				.range_start = range_start,
+				.range_end = range_end,
+				.outbound_lap = lap_registry_find_by_name(registry, name),
+				.nexthop = {
+					.network = nexthop_network,
+					.node = nexthop_node,
+				},
+				.distance = distance,
+			};
+			if (route.outbound_lap == NULL) {
+				continue;
+			}
+			
+			// Direct routes come back when the LAP does, but the network's
+			// zones are only any use if the LAP's still on it
+			if (distance == 0) {
+				uint16_t lap_network = route.outbound_lap->my_network;
+				if ((flags & PERSIST_FLAG_DIRECT) != 0 && (lap_network == 0 ||
+					(lap_network >= range_start && lap_network <= range_end))) {
+					
+					direct = true;
+				}
+				continue;
+			}
+			
+			rt_preload(routing_table, route);
+			preloaded++;
+		}
+		stats.persist_restored_routes += preloaded;
+		
+		uint8_t zone_count = get_u8(&r);
+		
+		// Zones for a network we've no way to get to would never go away,
+		// and ones we've heard about since are more up to date
+		bool wanted = !r.bad && (direct || preloaded > 0) &&
+			!zt_contains_net(zip_table, range_start);
+		if (wanted) {
+			zt_add_net_range(zip_table, range_start, range_end);
+		}
+		
+		for (uint8_t j = 0; j < zone_count && !r.bad; j++) {
+			pstring* zone = get_pstring(&r);
+			if (wanted && zone != NULL) {
+				zt_add_zone_for(zip_table, range_start, zone);
+			}
+		}
+		
+		if (!wanted) {
+			continue;
+		}
+		if (r.bad) {
+			zt_delete_network(zip_table, range_start);
+			break;
+		}
+		
+		zt_set_expected_zone_count(zip_table, range_start, zone_count);
+		zt_mark_network_complete(zip_table, range_start);
+		restored++;
+	}
+	
+	if (r.bad) {
+		ESP_LOGW(TAG, "snapshot was cut short");
+	}
+	
+	stats.persist_restored_networks += restored;
+	return restored;
+}
+
+// persist_lap_key makes the NVS key for a LAP's record.  NVS keys are too
+// short for names, so it's an FNV-1a hash of the name.
+static void persist_lap_key(lap_t *lap, char* key) {
+	uint32_t hash = 2166136261u;
+	for (const char* c = lap->name; *c != '\0'; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 16777619;
+	}
+	snprintf(key, NVS_KEY_NAME_MAX_SIZE, "lap.%08lx", (unsigned long)hash);
+}
+
+static bool persist_load_lap_unguarded(lap_t *lap) {
+	if (lap_record_known[lap->id]) {
+		return true;
+	}
+	
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	persist_lap_key(lap, key);
+	
+	persist_lap_record_t record;
+	size_t length = sizeof(record);
+	if (nvs_get_blob(nvs, key, &record, &length) != ESP_OK || length != sizeof(record) ||
+		strncmp(record.name, lap->name, sizeof(record.name)) != 0) {
+		
+		return false;
+	}
+	if (record.zone[0] >= sizeof(record.zone)) {
+		record.zone[0] = 0;
+	}
+	
+	lap_records[lap->id] = record;
+	lap_record_known[lap->id] = true;
+	return true;
+}
+
+static void persist_save_lap_unguarded(lap_t *lap) {
+	persist_lap_record_t record = {
+		.node = lap->my_address,
+		.network = lap->my_network,
+	};
+	snprintf(record.name, sizeof(record.name), "%s", lap->name);
+	if (lap->my_zone != NULL && lap->my_zone->length < sizeof(record.zone)) {
+		record.zone[0] = lap->my_zone->length;
+		memcpy(record.zone + 1, lap->my_zone->str, lap->my_zone->length);
+	}
+	
+	if (lap_record_known[lap->id] && memcmp(&lap_records[lap->id], &record, sizeof(record)) == 0) {
+		return;
+	}
+	
+	char key[NVS_KEY_NAME_MAX_SIZE];
+	persist_lap_key(lap, key);
+	
+	esp_err_t err = nvs_set_blob(nvs, key, &record, sizeof(record));
+	if (err == ESP_OK) {
+		err = nvs_commit(nvs);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "couldn't save %s: %s", key, esp_err_to_name(err));
+		stats.persist_save_errors++;
+		return;
+	}
+	
+	lap_records[lap->id] = record;
+	lap_record_known[lap->id] = true;
+	stats.persist_saves__kind_lap++;
+}
+
+static bool persist_lap_ok(lap_t *lap) {
+	return started && lap->id >= 0 && lap->id < MAX_LAP_COUNT && lap->name != NULL &&
+		strlen(lap->name) < PERSIST_LAP_NAME_LEN;
+}
+
+bool persist_get_lap(lap_t *lap, persist_lap_record_t *record) {
+	if (!persist_lap_ok(lap)) {
+		return false;
+	}
+	
+	while (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {}
+	bool found = persist_load_lap_unguarded(lap);
+	if (found) {
+		*record = lap_records[lap->id];
+	}
+	xSemaphoreGive(mutex);
+	
+	return found;
+}
+
+void persist_lap_acquired(lap_t *lap) {
+	rt_route_t route;
+	
+	if (!persist_lap_ok(lap)) {
+		return;
+	}
+	
+	while (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {}
+	
+	laps[lap->id] = lap;
+	if (persist_load_lap_unguarded(lap)) {
+		persist_lap_record_t *before = &lap_records[lap->id];
+		
+		if (before->network == lap->my_network) {
+			// Same network as before, so the same zone; it would otherwise
+			// come from a ZIP reply, which we don't need to ask for now
+			if (before->zone[0] != 0 && lap->my_zone == NULL) {
+				lap_set_my_zone(lap, pstrclone((pstring*)before->zone));
+				lap_registry_update_zone_cache(global_lap_registry);
+			}
+		} else if (before->network != 0 && !rt_lookup(global_routing_table, before->network, &route)) {
+			// The network we were on has gone, and its zones with it
+			zt_delete_network(global_zip_table, before->network);
+		}
+	}
+	persist_save_lap_unguarded(lap);
+	
+	xSemaphoreGive(mutex);
+}
+
+static void persist_save_tables(void) {
+	uint8_t* snapshot = malloc(PERSIST_SNAPSHOT_BYTES);
+	if (snapshot == NULL) {
+		return;
+	}
+	
+	size_t length = persist_snapshot_tables(global_routing_table, global_zip_table,
+		snapshot, PERSIST_SNAPSHOT_BYTES);
+	
+	// Flash wears out, so only write it if it's changed
+	if (length == 0 || (length == saved_snapshot_length && memcmp(snapshot, saved_snapshot, length) == 0)) {
+		free(snapshot);
+		return;
+	}
+	
+	esp_err_t err = nvs_set_blob(nvs, PERSIST_TABLES_KEY, snapshot, length);
+	if (err == ESP_OK) {
+		err = nvs_commit(nvs);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "couldn't save the tables: %s", esp_err_to_name(err));
+		stats.persist_save_errors++;
+		free(snapshot);
+		return;
+	}
+	
+	stats.persist_saves__kind_tables++;
+	free(saved_snapshot);
+	saved_snapshot = snapshot;
+	saved_snapshot_length = length;
+}
+
+static void persist_runloop(void* dummy) {
+	while (1) {
+		vTaskDelay(PERSIST_SAVE_INTERVAL_SECONDS * 1000 / portTICK_PERIOD_MS);
+		
+		persist_save_tables();
+		
+		// The LAPs' zones turn up after they've come up
+		while (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {}
+		for (int i = 0; i < MAX_LAP_COUNT; i++) {
+			if (laps[i] != NULL) {
+				persist_save_lap_unguarded(laps[i]);
+			}
+		}
+		xSemaphoreGive(mutex);
+	}
+}
+
+void start_persist(void) {
+	esp_err_t err = nvs_flash_init();
+	if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+		// Whatever was there, we can't use it
+		ESP_ERROR_CHECK(nvs_flash_erase());
+		err = nvs_flash_init();
+	}
+	if (err == ESP_OK) {
+		err = nvs_open(PERSIST_NAMESPACE, NVS_READWRITE, &nvs);
+	}
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "no NVS, so starting from scratch: %s", esp_err_to_name(err));
+		return;
+	}
+	
+	mutex = xSemaphoreCreateMutex();
+	started = true;
+}
+
+void persist_warm_start(void) {
+	size_t length = 0;
+	
+	if (!started) {
+		return;
+	}
+	
+	if (nvs_get_blob(nvs, PERSIST_TABLES_KEY, NULL, &length) == ESP_OK && length > 0) {
+		uint8_t* snapshot = malloc(length);
+		if (snapshot != NULL && nvs_get_blob(nvs, PERSIST_TABLES_KEY, snapshot, &length) == ESP_OK) {
+			size_t restored = persist_restore_snapshot(global_routing_table, global_zip_table,
+				global_lap_registry, snapshot, length);
+			ESP_LOGI(TAG, "restored %d networks from before", (int)restored);
+			
+			saved_snapshot = snapshot;
+			saved_snapshot_length = length;
+		} else {
+			free(snapshot);
+		}
+	}
+	
+	xTaskCreate(&persist_runloop, "persist", 4096, NULL, tskIDLE_PRIORITY, NULL);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lap/lap_types.h"
+#include "lap/registry.h"
+#include "table/routing/table.h"
+#include "table/zip/table.h"
+
+// persist keeps what the router has learnt in NVS, so that after a reboot
+// it can carry on from where it was rather than start from nothing:
+//
+//   - each LAP's node address, network and zone, which the LAP tries first
+//     when it next comes up;
+//   - the routing table's routes, and the zones of the networks they go
+//     to.  These come back as suspect routes to complete networks.  If
+//     nothing confirms a route, it's aged out as usual and its network's
+//     zones go with it.
+//
+// The tables are saved every PERSIST_SAVE_INTERVAL_SECONDS if they've
+// changed, up to PERSIST_SNAPSHOT_BYTES of them (see tunables.h).
+
+// LAP names longer than this can't be remembered
+#define PERSIST_LAP_NAME_LEN 24
+
+typedef struct {
+	// Records are found by a hash of the LAP's name, so the name's kept to
+	// tell LAPs whose names hash the same apart
+	char name[PERSIST_LAP_NAME_LEN];
+	
+	uint8_t node;
+	uint16_t network;
+	// The LAP's zone, as a pstring; zero length if it didn't have one
+	uint8_t zone[33];
+} __attribute__((packed)) persist_lap_record_t;
+
+// start_persist gets NVS going.  Call it before the LAPs start.
+void start_persist(void);
+
+// persist_warm_start puts the tables back as they were saved, and starts
+// saving them.  Call it once the LAPs are registered.
+void persist_warm_start(void);
+
+// persist_get_lap fills in what the LAP was last time, if we know.
+bool persist_get_lap(lap_t *lap, persist_lap_record_t *record);
+
+// persist_lap_acquired is for a LAP to call once it has its address and
+// network: it gives the LAP back its zone, if it's on the same network as
+// before, and saves what it's got.
+void persist_lap_acquired(lap_t *lap);
+
+// These are how the tables are saved and restored.  persist_snapshot_tables
+// returns the length of the snapshot, which is only as much as fits;
+// persist_restore_snapshot returns how many networks it put back.
+size_t persist_snapshot_tables(rt_routing_table_t *routing_table, zt_zip_table_t *zip_table,
+	uint8_t *out, size_t capacity);
+size_t persist_restore_snapshot(rt_routing_table_t *routing_table, zt_zip_table_t *zip_table,
+	lap_registry_t *registry, const uint8_t *snapshot, size_t length);
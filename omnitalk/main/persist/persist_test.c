@@ -0,0 +1,161 @@
+#include "persist/persist_test.h"
+#include "persist/persist.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lap/registry.h"
+#include "table/routing/table.h"
+#include "table/zip/table.h"
+#include "test.h"
+
+// The tables persist_test_tables makes are, on LAPs "a" and "b":
+//
+//   10     direct on a         zone Here
+//   20-22  2 hops via a 10.5   zones There, Elsewhere
+//   30     1 hop via b 30.7    zone Gone
+//   40     3 hops via a 10.5   zone Partial, but there may be more
+static void persist_test_tables(rt_routing_table_t **routing_table, zt_zip_table_t **zip_table,
+	lap_t *lap_a, lap_t *lap_b) {
+	
+	*routing_table = rt_new();
+	*zip_table = zt_new();
+	
+	rt_touch_direct(*routing_table, 10, 10, lap_a);
+	rt_touch(*routing_table, (rt_route_t){ .range_start = 20, .range_end = 22, .outbound_lap = lap_a,
+		.nexthop = { .network = 10, .node = 5 }, .distance = 2 });
+	rt_touch(*routing_table, (rt_route_t){ .range_start = 30, .range_end = 30, .outbound_lap = lap_b,
+		.nexthop = { .network = 30, .node = 7 }, .distance = 1 });
+	rt_touch(*routing_table, (rt_route_t){ .range_start = 40, .range_end = 40, .outbound_lap = lap_a,
+		.nexthop = { .network = 10, .node = 5 }, .distance = 3 });
+	
+	zt_add_net_range(*zip_table, 10, 10);
+	zt_add_zone_for(*zip_table, 10, (pstring*)"\x04Here");
+	zt_mark_network_complete(*zip_table, 10);
+	zt_add_net_range(*zip_table, 20, 22);
+	zt_add_zone_for(*zip_table, 20, (pstring*)"\x05There");
+	zt_add_zone_for(*zip_table, 20, (pstring*)"\x09""Elsewhere");
+	zt_mark_network_complete(*zip_table, 20);
+	zt_add_net_range(*zip_table, 30, 30);
+	zt_add_zone_for(*zip_table, 30, (pstring*)"\x04Gone");
+	zt_mark_network_complete(*zip_table, 30);
+	zt_add_net_range(*zip_table, 40, 40);
+	zt_add_zone_for(*zip_table, 40, (pstring*)"\x07Partial");
+}
+
+TEST_FUNCTION(test_persist_snapshot_round_trip) {
+	lap_t before_a = { .id = 1, .quality = 1, .name = "a" };
+	lap_t before_b = { .id = 2, .quality = 1, .name = "b" };
+	rt_routing_table_t *routing_table;
+	zt_zip_table_t *zip_table;
+	uint8_t snapshot[512];
+	rt_route_t route;
+	
+	persist_test_tables(&routing_table, &zip_table, &before_a, &before_b);
+	size_t length = persist_snapshot_tables(routing_table, zip_table, snapshot, sizeof(snapshot));
+	TEST_ASSERT(length > 0);
+	
+	// After the reboot, there's only LAP a, and it's a different lap_t
+	lap_t after_a = { .id = 1, .quality = 1, .name = "a" };
+	lap_registry_t *registry = lap_registry_new();
+	lap_registry_register(registry, &after_a);
+	rt_routing_table_t *new_routing_table = rt_new();
+	zt_zip_table_t *new_zip_table = zt_new();
+	
+	size_t restored = persist_restore_snapshot(new_routing_table, new_zip_table, registry,
+		snapshot, length);
+	
+	// The direct network's zones come back, but not its route: that comes
+	// back when the LAP does
+	TEST_ASSERT(restored == 2);
+	TEST_ASSERT(!rt_lookup(new_routing_table, 10, &route));
+	TEST_ASSERT(zt_network_is_complete(new_zip_table, 10));
+	TEST_ASSERT(zt_zone_is_valid_for(new_zip_table, (pstring*)"\x04Here", 10));
+	
+	// The distant network comes back as it was
+	TEST_ASSERT(rt_lookup(new_routing_table, 21, &route));
+	TEST_ASSERT(route.outbound_lap == &after_a);
+	TEST_ASSERT(route.distance == 2);
+	TEST_ASSERT(route.nexthop.network == 10 && route.nexthop.node == 5);
+	TEST_ASSERT(route.range_start == 20 && route.range_end == 22);
+	TEST_ASSERT(zt_network_is_complete(new_zip_table, 20));
+	TEST_ASSERT(zt_count_zones_for(new_zip_table, 20) == 2);
+	TEST_ASSERT(zt_zone_is_valid_for(new_zip_table, (pstring*)"\x09""Elsewhere", 20));
+	
+	// There's no way to network 30 now, and we never knew all of network
+	// 40's zones
+	TEST_ASSERT(!rt_lookup(new_routing_table, 30, &route));
+	TEST_ASSERT(!zt_contains_net(new_zip_table, 30));
+	TEST_ASSERT(!rt_lookup(new_routing_table, 40, &route));
+	TEST_ASSERT(!zt_contains_net(new_zip_table, 40));
+	
+	// Restored routes are suspect: one that RTMP updates keep confirming
+	// stays, but otherwise it's gone by the second prune
+	rt_route_t confirmed = { .range_start = 50, .range_end = 50, .outbound_lap = &after_a,
+		.nexthop = { .network = 10, .node = 5 }, .distance = 4 };
+	rt_preload(new_routing_table, confirmed);
+	for (int i = 0; i < 2; i++) {
+		rt_touch(new_routing_table, confirmed);
+		rt_prune(new_routing_table);
+	}
+	TEST_ASSERT(!rt_lookup(new_routing_table, 21, &route));
+	TEST_ASSERT(rt_lookup(new_routing_table, 50, &route));
+	TEST_ASSERT(route.distance == 4);
+	
+	// Preloading doesn't replace a route we've heard about since
+	rt_preload(new_routing_table, (rt_route_t){ .range_start = 50, .range_end = 50, .outbound_lap = &after_a,
+		.nexthop = { .network = 10, .node = 5 }, .distance = 7 });
+	TEST_ASSERT(rt_lookup(new_routing_table, 50, &route));
+	TEST_ASSERT(route.distance == 4);
+	
+	// If LAP a's come back on a different network, network 10's zones are
+	// no use any more
+	after_a.my_network = 12;
+	new_zip_table = zt_new();
+	restored = persist_restore_snapshot(rt_new(), new_zip_table, registry, snapshot, length);
+	TEST_ASSERT(restored == 1);
+	TEST_ASSERT(!zt_contains_net(new_zip_table, 10));
+	TEST_ASSERT(zt_network_is_complete(new_zip_table, 20));
+	
+	// but if it's back on the same one, they are
+	after_a.my_network = 10;
+	new_zip_table = zt_new();
+	restored = persist_restore_snapshot(rt_new(), new_zip_table, registry, snapshot, length);
+	TEST_ASSERT(restored == 2);
+	TEST_ASSERT(zt_zone_is_valid_for(new_zip_table, (pstring*)"\x04Here", 10));
+	
+	TEST_OK();
+}
+
+TEST_FUNCTION(test_persist_snapshot_limits) {
+	lap_t lap_a = { .id = 1, .quality = 1, .name = "a" };
+	lap_t lap_b = { .id = 2, .quality = 1, .name = "b" };
+	rt_routing_table_t *routing_table;
+	zt_zip_table_t *zip_table;
+	uint8_t snapshot[512];
+	
+	lap_registry_t *registry = lap_registry_new();
+	lap_registry_register(registry, &lap_a);
+	lap_registry_register(registry, &lap_b);
+	persist_test_tables(&routing_table, &zip_table, &lap_a, &lap_b);
+	size_t length = persist_snapshot_tables(routing_table, zip_table, snapshot, sizeof(snapshot));
+	
+	// Without room for anything, there's nothing to save
+	TEST_ASSERT(persist_snapshot_tables(routing_table, zip_table, snapshot, 4) == 0);
+	
+	// With room for some of it, we get whole networks, as many as fit
+	uint8_t small_snapshot[24];
+	size_t small_length = persist_snapshot_tables(routing_table, zip_table, small_snapshot, sizeof(small_snapshot));
+	TEST_ASSERT(small_length > 0 && small_length < length);
+	TEST_ASSERT(persist_restore_snapshot(rt_new(), zt_new(), registry, small_snapshot, small_length) == 1);
+	
+	// All three networks we know all the zones for fit in the big one
+	TEST_ASSERT(persist_restore_snapshot(rt_new(), zt_new(), registry, snapshot, length) == 3);
+	
+	// A snapshot that's been cut short gives back what's whole, and one
+	// that isn't a snapshot gives back nothing
+	TEST_ASSERT(persist_restore_snapshot(rt_new(), zt_new(), registry, snapshot, length - 3) == 2);
+	TEST_ASSERT(persist_restore_snapshot(rt_new(), zt_new(), registry, (uint8_t*)"XX\x01\x00\x01", 5) == 0);
+	
+	TEST_OK();
+}
@@ -0,0 +1,5 @@
+#pragma once
+#include "test.h"
+
+TEST_FUNCTION(test_persist_snapshot_round_trip);
+TEST_FUNCTION(test_persist_snapshot_limits);
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
+#include <lwip/def.h>
 #include <lwip/prot/ethernet.h>
 
 struct snap_hdr {
@@ -17,4 +20,33 @@ struct snap_hdr {
 
 typedef struct snap_hdr snap_hdr_t;
 
-#define GET_SNAP_HDR(x) (snap_hdr_t *)((x) + sizeof(struct eth_hdr))
\ No newline at end of file
+#define GET_SNAP_HDR(x) (snap_hdr_t *)((x) + sizeof(struct eth_hdr))
+
+// An ELAP header is everything that goes in front of a DDP packet on
+// EtherTalk: an 802.3 header, then 802.2 LLC and SNAP.
+#define ELAP_HDR_LEN (sizeof(struct eth_hdr) + sizeof(snap_hdr_t))
+
+// snap_fill_appletalk_hdr writes a complete ELAP header for a DDP packet
+// into hdr, which needs to be ELAP_HDR_LEN bytes long.  The 802.3 length
+// field is left as zero; use snap_set_appletalk_hdr_length to fill it in.
+static inline void snap_fill_appletalk_hdr(uint8_t *hdr, const struct eth_addr *dst, const struct eth_addr *src) {
+	struct eth_hdr *eth_hdr = (struct eth_hdr*)hdr;
+	snap_hdr_t *snap_hdr = GET_SNAP_HDR(hdr);
+	
+	memset(hdr, 0, ELAP_HDR_LEN);
+	eth_hdr->dest = *dst;
+	eth_hdr->src = *src;
+	
+	snap_hdr->dest_sap = 0xAA;
+	snap_hdr->src_sap = 0xAA;
+	snap_hdr->control_byte = 3;
+	snap_hdr->proto_discriminator_top_byte = 0x08;
+	snap_hdr->proto_discriminator_bottom_bytes = PP_HTONL(0x0007809B);
+}
+
+// snap_set_appletalk_hdr_length fills in the 802.3 length field of an ELAP
+// header for a DDP packet that's ddp_length bytes long.
+static inline void snap_set_appletalk_hdr_length(uint8_t *hdr, size_t ddp_length) {
+	struct eth_hdr *eth_hdr = (struct eth_hdr*)hdr;
+	eth_hdr->type = htons((uint16_t)(sizeof(snap_hdr_t) + ddp_length));
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <lwip/prot/ethernet.h>
+
+#define AARP_FUNCTION_REQUEST 1
+#define AARP_FUNCTION_RESPONSE 2
+#define AARP_FUNCTION_PROBE 3
+
+// An AARP packet, as it follows the ELAP header, for Ethernet hardware
+// addresses and AppleTalk protocol addresses.
+struct aarp_packet_s {
+	uint16_t hardware_type;
+	uint16_t protocol_type;
+	uint8_t hardware_addr_len;
+	uint8_t protocol_addr_len;
+	uint16_t function;
+	
+	struct eth_addr src_hwaddr;
+	uint8_t src_pad;
+	uint16_t src_network;
+	uint8_t src_node;
+	
+	struct eth_addr dst_hwaddr;
+	uint8_t dst_pad;
+	uint16_t dst_network;
+	uint8_t dst_node;
+} __attribute__((packed));
+
+typedef struct aarp_packet_s aarp_packet_t;
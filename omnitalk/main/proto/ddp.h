@@ -9,11 +9,15 @@
 #include "mem/buffers.h"
 
 #define DDP_ADDR_BROADCAST 0xFF
+// Node 0 on a network is whichever router's on it
+#define DDP_ADDR_ANY_ROUTER 0
 #define DDP_MAX_PAYLOAD_LEN 586 // Inside Appletalk 2 ed. p. 4-15, 4-16
 
 #define DDP_SOCKET_RTMP 1
+#define DDP_SOCKET_NBP 2
 #define DDP_SOCKET_ZIP 6
 
+#define DDP_TYPE_NBP 2
 #define DDP_TYPE_ATP 3
 #define DDP_TYPE_ZIP 6
 
@@ -168,6 +172,16 @@ static inline bool ddp_packet_is_mine(lap_t *lap, buffer_t *packet) {
 		return true;
 	}
 	
+	// Packets for any router on one of our networks, such as NBP FwdReqs,
+	// are for us
+	if (packet->ddp_type == BUF_LONG_HEADER &&
+	    DDP_DST(packet) == DDP_ADDR_ANY_ROUTER &&
+	    DDP_DSTNET(packet) >= lap->network_range_start &&
+	    DDP_DSTNET(packet) <= lap->network_range_end) {
+	
+		return true;
+	}
+	
 	// in theory, we can have a DDP long-header packet being sent on a
 	// LocalTalk network with a network ID of 0; this is pointless but
 	// legit.
@@ -1,6 +1,9 @@
 #include "proto/nbp.h"
 
+#include <string.h>
+
 #include "mem/buffers.h"
+#include "util/pstring.h"
 
 static struct nbp_tuple_s *nbp_tuple_at(buffer_t *buff, uint8_t* ptr_within_packet) {
 	uint8_t* cursor = ptr_within_packet;
@@ -80,3 +83,39 @@ pstring* nbp_tuple_get_zone(struct nbp_tuple_s *tuple) {
 	return (pstring*)cursor;
 }
 
+void nbp_fold(char* dst, const char* src, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		dst[i] = pstring_mac_uc(src[i]);
+	}
+	dst[len] = '\0';
+}
+
+void nbp_pattern_from(nbp_pattern_t* pattern, pstring* p) {
+	nbp_fold(pattern->str, p->str, p->length);
+	pattern->len = p->length;
+	pattern->any = p->length == 1 && p->str[0] == '=';
+	pattern->wildcard = pstring_index_of(p, NBP_PARTIAL_WILDCARD);
+}
+
+bool nbp_pattern_is_exact(nbp_pattern_t* pattern) {
+	return !pattern->any && pattern->wildcard < 0;
+}
+
+bool nbp_pattern_matches(nbp_pattern_t* pattern, const char* folded) {
+	if (pattern->any) {
+		return true;
+	}
+	
+	size_t len = strlen(folded);
+	if (pattern->wildcard < 0) {
+		return len == pattern->len && memcmp(pattern->str, folded, len) == 0;
+	}
+	
+	// The wildcard can stand for nothing at all, so the name only has to
+	// be as long as the rest of the pattern
+	size_t head = pattern->wildcard;
+	size_t tail = pattern->len - head - 1;
+	return len >= head + tail &&
+		memcmp(folded, pattern->str, head) == 0 &&
+		memcmp(folded + len - tail, pattern->str + head + 1, tail) == 0;
+}
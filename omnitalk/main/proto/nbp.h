@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <lwip/inet.h>
@@ -71,3 +73,22 @@ pstring* nbp_tuple_get_object(struct nbp_tuple_s *tuple);
 pstring* nbp_tuple_get_type(struct nbp_tuple_s *tuple);
 pstring* nbp_tuple_get_zone(struct nbp_tuple_s *tuple);
 
+// nbp_fold copies len characters of src to dst, uppercased the way NBP
+// compares names, and null-terminates it.
+void nbp_fold(char* dst, const char* src, size_t len);
+
+// An nbp_pattern_t is the object or type of a lookup, casefolded, ready to
+// be matched against casefolded names.
+typedef struct {
+	char str[256];
+	size_t len;
+	
+	// "=" matches anything; otherwise wildcard is where the partial
+	// wildcard is, or -1 if there isn't one
+	bool any;
+	int wildcard;
+} nbp_pattern_t;
+
+void nbp_pattern_from(nbp_pattern_t* pattern, pstring* p);
+bool nbp_pattern_is_exact(nbp_pattern_t* pattern);
+bool nbp_pattern_matches(nbp_pattern_t* pattern, const char* folded);
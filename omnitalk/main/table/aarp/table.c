@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
@@ -51,6 +52,9 @@ static void touch_in_list_unguarded(struct aarp_node_s *list, uint16_t network,
 		}
 		
 		if (curr->network == network && curr->node == node) {
+			if (!eth_addr_cmp(&curr->hwaddr, &hwaddr)) {
+				curr->hdr_template_valid = false;
+			}
 			curr->hwaddr = hwaddr;
 			curr->timestamp = esp_timer_get_time();
 			
@@ -124,3 +128,38 @@ bool aarp_lookup(aarp_table_t* table, uint16_t network, uint8_t node, struct eth
 	
 	return result;
 }
+
+static bool aarp_lookup_hdr_template_unguarded(aarp_table_t* table, uint16_t network, uint8_t node, const struct eth_addr* src, uint8_t* out) {
+	int bucket = node % AARP_TABLE_BUCKETS;
+
+	for (struct aarp_node_s *curr = &table->buckets[bucket]; curr != NULL; curr = curr->next) {
+		if (!curr->valid) {
+			continue;
+		}
+		
+		if (curr->network == network && curr->node == node) {
+			// Build the template if we haven't already, or if our own
+			// address has changed under us (which it shouldn't, but...)
+			if (!curr->hdr_template_valid ||
+				memcmp(&curr->hdr_template[ETH_HWADDR_LEN], src->addr, ETH_HWADDR_LEN) != 0) {
+				snap_fill_appletalk_hdr(curr->hdr_template, &curr->hwaddr, src);
+				curr->hdr_template_valid = true;
+			}
+			
+			memcpy(out, curr->hdr_template, ELAP_HDR_LEN);
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+bool aarp_lookup_hdr_template(aarp_table_t* table, uint16_t network, uint8_t node, const struct eth_addr* src, uint8_t* out) {
+	bool result;
+
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	result = aarp_lookup_hdr_template_unguarded(table, network, node, src, out);
+	xSemaphoreGive(table->mutex);
+	
+	return result;
+}
@@ -8,6 +8,7 @@
 #include <freertos/semphr.h>
 #include <lwip/prot/ethernet.h>
 
+#include "proto/SNAP.h"
 #include "tunables.h"
 
 struct aarp_node_s {
@@ -21,6 +22,12 @@ struct aarp_node_s {
 	
 	int64_t timestamp;
 	
+	// hdr_template is a prebuilt ELAP header for sending to this node,
+	// made the first time someone asks for it and thrown away if the
+	// hardware address changes.
+	bool hdr_template_valid;
+	uint8_t hdr_template[ELAP_HDR_LEN];
+	
 	struct aarp_node_s *next;
 };
 
@@ -36,3 +43,9 @@ aarp_table_t* aarp_new_table();
 size_t aarp_table_entry_count(aarp_table_t* table);
 void aarp_touch(aarp_table_t* table, uint16_t network, uint8_t node, struct eth_addr hwaddr);
 bool aarp_lookup(aarp_table_t* table, uint16_t network, uint8_t node, struct eth_addr* out);
+
+// aarp_lookup_hdr_template copies the cached ELAP header for the given
+// AppleTalk address into out, which must be ELAP_HDR_LEN bytes long.  The
+// length field is left for the caller to fill in.  Returns false if we don't
+// know the node's hardware address.
+bool aarp_lookup_hdr_template(aarp_table_t* table, uint16_t network, uint8_t node, const struct eth_addr* src, uint8_t* out);
@@ -5,8 +5,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <lwip/inet.h>
 #include <lwip/prot/ethernet.h>
 
+#include "proto/SNAP.h"
+
 size_t count_list_entries_unguarded(struct aarp_node_s *list);
 
 static struct eth_addr test_hwaddr_for_appletalk_address(uint16_t net, uint8_t node) {
@@ -80,3 +83,48 @@ TEST_FUNCTION(test_aarp_table) {
 
 	TEST_OK();
 }
+
+TEST_FUNCTION(test_aarp_hdr_templates) {
+	aarp_table_t* table;
+	bool found;
+	uint8_t hdr[ELAP_HDR_LEN];
+	struct eth_addr src = { .addr = {2, 0, 0, 0, 0, 1} };
+	struct eth_addr dst = test_hwaddr_for_appletalk_address(10, 230);
+	struct eth_hdr *eth_hdr = (struct eth_hdr*)hdr;
+	snap_hdr_t *snap_hdr = GET_SNAP_HDR(hdr);
+	
+	table = aarp_new_table();
+	
+	// No entry, no template
+	found = aarp_lookup_hdr_template(table, 10, 230, &src, hdr);
+	TEST_ASSERT(!found);
+	
+	// Once we know the node, we should get a sensible header out
+	aarp_touch(table, 10, 230, dst);
+	found = aarp_lookup_hdr_template(table, 10, 230, &src, hdr);
+	TEST_ASSERT(found);
+	TEST_ASSERT(eth_addr_cmp(&eth_hdr->dest, &dst));
+	TEST_ASSERT(eth_addr_cmp(&eth_hdr->src, &src));
+	TEST_ASSERT(snap_hdr->dest_sap == 0xAA && snap_hdr->src_sap == 0xAA);
+	TEST_ASSERT(snap_hdr->control_byte == 3);
+	TEST_ASSERT(snap_hdr->proto_discriminator_top_byte == 0x08);
+	TEST_ASSERT(snap_hdr->proto_discriminator_bottom_bytes == PP_HTONL(0x0007809B));
+	
+	// The length is left to the caller
+	snap_set_appletalk_hdr_length(hdr, 20);
+	TEST_ASSERT(ntohs(eth_hdr->type) == 28);
+	
+	// ... and scribbling on our copy mustn't touch the cached template
+	found = aarp_lookup_hdr_template(table, 10, 230, &src, hdr);
+	TEST_ASSERT(found);
+	TEST_ASSERT(eth_hdr->type == 0);
+	
+	// If the node moves, the template should follow it
+	dst = test_hwaddr_for_appletalk_address(10, 231);
+	aarp_touch(table, 10, 230, dst);
+	found = aarp_lookup_hdr_template(table, 10, 230, &src, hdr);
+	TEST_ASSERT(found);
+	TEST_ASSERT(eth_addr_cmp(&eth_hdr->dest, &dst));
+	
+	TEST_OK();
+}
@@ -3,3 +3,4 @@
 #include "test.h"
 
 TEST_FUNCTION(test_aarp_table);
+TEST_FUNCTION(test_aarp_hdr_templates);
@@ -19,6 +19,18 @@ char* rt_stats(rt_routing_table_t* table);
 void rt_print(rt_routing_table_t* table);
 size_t rt_count(rt_routing_table_t* table);
 
+// rt_preload adds a route we knew about before, such as before a reboot, as
+// suspect: unless something touches it it's aged out at the next prune or
+// two.  It does nothing if there's already a route to the same place, and
+// doesn't fire the touch event.
+void rt_preload(rt_routing_table_t* table, rt_route_t r);
+
+// Iterate over the routes, best first, under the table's lock.  Return false
+// from the callback to stop.  You MUST NOT alter the routing table from the
+// callback.
+typedef bool (*rt_route_iterator)(void* pvt, rt_route_t* route, enum rt_route_status status);
+void rt_iterate(rt_routing_table_t* table, void* private_data, rt_route_iterator callback);
+
 // Attach an event handler for when a route is touched.  You MUST NOT attempt to alter
 // the routing table in the event handler for this callback.  Your event handler will be
 // passed the route that was touched.  You MUST NOT modify this route.
@@ -24,6 +24,43 @@ rt_routing_table_t* rt_new() {
 }
 
 
+// rt_insert_node_unguarded puts a new node into the list, ahead of any
+// that are further away (or as far away, but on a worse LAP)
+static void rt_insert_node_unguarded(rt_routing_table_t* table, struct rt_node_s *new_node) {
+	struct rt_node_s *prev = NULL;
+	struct rt_node_s *curr = &table->list;
+		
+	while (curr != NULL) {
+		// skip dummy entries
+		if (curr->dummy) {
+			goto next_item_ins;
+		}
+		
+		// Is this beyond our new distance?
+		if (curr->route.distance > new_node->route.distance) {
+			break;
+		}
+		
+		// If it's the same distance, use the quality as a tie breaker
+		if (curr->route.distance == new_node->route.distance) {
+			int curr_quality = (curr->route.outbound_lap != NULL ? curr->route.outbound_lap->quality : 0);
+			int new_quality = (new_node->route.outbound_lap != NULL ? new_node->route.outbound_lap->quality : 0);
+			
+			// insert ahead of LAPs with lower quality
+			if (curr_quality < new_quality) {
+				break;
+			}
+		}
+		
+	next_item_ins:
+		prev = curr;
+		curr = curr->next;
+	}
+	
+	new_node->next = curr;
+	prev->next = new_node;
+}
+
 static void rt_touch_unguarded(rt_routing_table_t* table, rt_route_t r) {
 	bool found = false;
 	
@@ -86,39 +123,7 @@ static void rt_touch_unguarded(rt_routing_table_t* table, rt_route_t r) {
 		new_node->status = RT_GOOD;
 	}
 	
-	// and insert it into the list in the right position
-	prev = NULL;
-	curr = &table->list;
-		
-	while (curr != NULL) {
-		// skip dummy entries
-		if (curr->dummy) {
-			goto next_item_ins;
-		}
-
-		// Is this beyond our new distance?
-		if (curr->route.distance > new_node->route.distance) {
-			break;
-		}
-		
-		// If it's the same distance, use the quality as a tie breaker
-		if (curr->route.distance == new_node->route.distance) {
-			int curr_quality = (curr->route.outbound_lap != NULL ? curr->route.outbound_lap->quality : 0);
-			int new_quality = (new_node->route.outbound_lap != NULL ? new_node->route.outbound_lap->quality : 0);
-			
-			// insert ahead of LAPs with lower quality
-			if (curr_quality < new_quality) {
-				break;
-			}
-		}
-		
-	next_item_ins:
-		prev = curr;
-		curr = curr->next;
-	}
-
-	new_node->next = curr;
-	prev->next = new_node;
+	rt_insert_node_unguarded(table, new_node);
 	
 	event_fire(&table->touch_event, &r);
 }
@@ -142,6 +147,28 @@ void rt_touch_direct(rt_routing_table_t* table, uint16_t start, uint16_t end, la
 	rt_touch(table, route);	
 }
 
+static void rt_preload_unguarded(rt_routing_table_t* table, rt_route_t r) {
+	// Anything we've heard about the route since beats what we remembered
+	for (struct rt_node_s *curr = &table->list; curr != NULL; curr = curr->next) {
+		if (!curr->dummy && rt_routes_match(&curr->route, &r)) {
+			return;
+		}
+	}
+	
+	struct rt_node_s *new_node = calloc(1, sizeof(struct rt_node_s));
+	memcpy(&new_node->route, &r, sizeof(rt_route_t));
+	new_node->last_touched_timestamp = esp_timer_get_time();
+	new_node->status = RT_SUSPECT;
+	
+	rt_insert_node_unguarded(table, new_node);
+}
+
+void rt_preload(rt_routing_table_t* table, rt_route_t r) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	rt_preload_unguarded(table, r);
+	xSemaphoreGive(table->mutex);
+}
+
 static bool rt_lookup_unguarded(rt_routing_table_t* table, uint16_t network_number, rt_route_t *out) {
 	for (struct rt_node_s *curr = &table->list; curr != NULL; curr = curr->next) {
 		// skip dummy node
@@ -430,6 +457,21 @@ size_t rt_count(rt_routing_table_t* table) {
 	return count;
 }
 
+void rt_iterate(rt_routing_table_t* table, void* private_data, rt_route_iterator callback) {
+	while (xSemaphoreTake(table->mutex, portMAX_DELAY) != pdTRUE) {}
+	
+	for (struct rt_node_s *curr = &table->list; curr != NULL; curr = curr->next) {
+		if (curr->dummy) {
+			continue;
+		}
+		if (!callback(private_data, &curr->route, curr->status)) {
+			break;
+		}
+	}
+	
+	xSemaphoreGive(table->mutex);
+}
+
 bool rt_attach_touch_callback(rt_routing_table_t* table, event_callback_t callback) {
 	return event_add_callback(&table->touch_event, callback);
 }
@@ -56,6 +56,11 @@ bool zt_iterate_net(
 // ZIP protocol operations are defined in terms of indexes, so we have to support querying
 // by them.
 //
+// The zones of all the complete networks are listed in order, each once, and a
+// network's in the order they're kept in.  Both lists are arrays rebuilt when the
+// table's changed since they were last asked for, so a page of a list costs no more
+// for being far into it.
+//
 // This API is intentionally hobbled to prevent it being used for anything else.
 // Return false from the callback to bail out.  If you get a NULL pstring, that means
 // you've reached the end of the list.
@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <freertos/FreeRTOS.h>
@@ -18,6 +19,9 @@ zt_zip_table_t* zt_new() {
 	table->root.dummy = true;
 	table->root.root.dummy = true;
 	
+	// Indexes start out stamped 0, so this makes them out of date
+	table->generation = 1;
+	
 	return table;
 }
 
@@ -106,6 +110,7 @@ static bool zt_add_net_range_unguarded(zt_zip_table_t *table, uint16_t net_start
 	
 	new_node->next = curr;
 	prev->next = new_node;
+	table->generation++;
 	
 	return true;
 }
@@ -132,6 +137,8 @@ static void free_all_zones_for(struct zip_network_node_s* n) {
 		free(to_be_deleted->zone_name);
 		free(to_be_deleted);
 	}
+	
+	free(n->zone_index);
 }
 
 static bool zt_delete_network_unguarded(zt_zip_table_t *table, uint16_t network) {
@@ -145,10 +152,14 @@ static bool zt_delete_network_unguarded(zt_zip_table_t *table, uint16_t network)
 		}
 		
 		if (curr->net_start <= network && curr->net_end >= network) {
+			// Ranges don't overlap, so this is the only one, and we mustn't
+			// touch curr again once it's freed
 			free_all_zones_for(curr);
 			prev->next = curr->next;
 			free(curr);
 			deleted = true;
+			table->generation++;
+			break;
 		}
 
 		if (curr->net_start > network) {
@@ -243,6 +254,7 @@ static void zt_add_zone_for_unguarded(zt_zip_table_t *table, uint16_t network, p
 	new_node->next = curr;
 	prev->next = new_node;
 	net_node->zone_count++;
+	table->generation++;
 	
 	return;
 	
@@ -272,7 +284,10 @@ static void zt_mark_network_complete_unguarded(zt_zip_table_t *table, uint16_t n
 		return;
 	}
 
-	net_node->complete = true;
+	if (!net_node->complete) {
+		net_node->complete = true;
+		table->generation++;
+	}
 }
 
 void zt_mark_network_complete(zt_zip_table_t *table, uint16_t network) {
@@ -302,8 +317,9 @@ static void zt_check_zone_count_for_completeness_unguarded(zt_zip_table_t *table
 		return;
 	}
 	
-	if (net_node->zone_count == net_node->expected_zone_count) {
+	if (net_node->zone_count == net_node->expected_zone_count && !net_node->complete) {
 		net_node->complete = true;
+		table->generation++;
 	}
 }
 
@@ -613,68 +629,109 @@ bool zt_iterate_net(
 	return result;
 }
 
-static bool zt_iterate_zone_names_unguarded(zt_zip_table_t *table, void* private_data,
-	int starting_index, zip_zone_name_iterator callback) {
+static int zt_compare_zone_names(const void* a, const void* b) {
+	return pstrcmp(*(pstring**)a, *(pstring**)b);
+}
 
-	// Start by finding the network
+// zt_index_all_zones_unguarded brings table->all_zones up to date if the
+// table's changed since it was built, and returns false if it can't.
+static bool zt_index_all_zones_unguarded(zt_zip_table_t *table) {
+	if (table->all_zones_generation == table->generation) {
+		return true;
+	}
+	
 	struct zip_network_node_s* curr;
 	struct zip_zone_node_s* curr_zone;
-
-	int idx = 0;
-	bool carry_on = true;
+	
+	size_t count = 0;
 	for (curr = &table->root; curr != NULL; curr = curr->next) {
-		if (curr->dummy) {
-			continue;
-		}
-		
-		if (!curr->complete) {
-			continue;
-		}
-		
-		if (idx + curr->zone_count >= starting_index) {
-			break;
+		if (!curr->dummy && curr->complete) {
+			count += curr->zone_count;
 		}
-		
-		idx += curr->zone_count;
 	}
 	
-	if (curr == NULL) {
+	pstring** zones = realloc(table->all_zones, (count + 1) * sizeof(pstring*));
+	if (zones == NULL) {
 		return false;
 	}
+	table->all_zones = zones;
 	
-	for(; curr != NULL; curr = curr->next) {
-		if (curr->dummy) {
+	count = 0;
+	for (curr = &table->root; curr != NULL; curr = curr->next) {
+		if (curr->dummy || !curr->complete) {
 			continue;
 		}
-
-		for (curr_zone = &curr->root; curr_zone != NULL; curr_zone = curr_zone->next) {
-			if (curr_zone->dummy) {
-				continue;
-			}
-		
-			if (idx < starting_index) {
-				idx++;
-				continue;
-			}
-
-			carry_on = callback(private_data, curr_zone->zone_name);
-			idx++;
 		
-			if (!carry_on) {
-				break;
-			}
+		for (curr_zone = curr->root.next; curr_zone != NULL; curr_zone = curr_zone->next) {
+			zones[count++] = curr_zone->zone_name;
 		}
-		
-		if (!carry_on) {
-			break;
+	}
+	
+	// Zones that span several networks are only listed once
+	qsort(zones, count, sizeof(pstring*), zt_compare_zone_names);
+	size_t unique = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (unique == 0 || pstrcmp(zones[unique - 1], zones[i]) != 0) {
+			zones[unique++] = zones[i];
 		}
 	}
 	
-	if (carry_on) {
-		callback(private_data, NULL);
+	table->all_zone_count = unique;
+	table->all_zones_generation = table->generation;
+	return true;
+}
+
+// zt_index_zones_for_unguarded does the same for a network's zone_index.
+static bool zt_index_zones_for_unguarded(zt_zip_table_t *table, struct zip_network_node_s* node) {
+	if (node->index_generation == table->generation) {
+		return true;
 	}
+	
+	pstring** zones = realloc(node->zone_index, (node->zone_count + 1) * sizeof(pstring*));
+	if (zones == NULL) {
+		return false;
+	}
+	node->zone_index = zones;
+	
+	// The zone list is kept sorted, and without duplicates, already
+	size_t count = 0;
+	for (struct zip_zone_node_s* curr = node->root.next; curr != NULL; curr = curr->next) {
+		zones[count++] = curr->zone_name;
+	}
+	
+	node->index_generation = table->generation;
+	return true;
+}
 
-	return true;	
+// zt_iterate_zone_index calls the callback with each zone from
+// starting_index on, and then with NULL if it didn't bail out
+static void zt_iterate_zone_index(pstring** zones, size_t count, void* private_data,
+	int starting_index, zip_zone_name_iterator callback) {
+	
+	size_t idx = starting_index < 0 ? 0 : starting_index;
+	for (; idx < count; idx++) {
+		if (!callback(private_data, zones[idx])) {
+			return;
+		}
+	}
+	
+	callback(private_data, NULL);
+}
+
+static bool zt_iterate_zone_names_unguarded(zt_zip_table_t *table, void* private_data,
+	int starting_index, zip_zone_name_iterator callback) {
+	
+	if (!zt_index_all_zones_unguarded(table)) {
+		return false;
+	}
+	
+	if (table->all_zone_count == 0 || starting_index > (int)table->all_zone_count) {
+		return false;
+	}
+	
+	zt_iterate_zone_index(table->all_zones, table->all_zone_count, private_data, starting_index,
+		callback);
+	return true;
 }
 
 bool zt_iterate_zone_names(zt_zip_table_t *table, void* private_data,
@@ -700,33 +757,12 @@ static bool zt_iterate_zone_names_for_net_unguarded(zt_zip_table_t *table, void*
 		return false;
 	}
 	
-	int idx = 0;
-	struct zip_zone_node_s* curr;
-	bool carry_on = true;
-	
-	for (curr = &node->root; curr != NULL; curr = curr->next) {
-		if (curr->dummy) {
-			continue;
-		}
-		
-		if (idx < starting_index) {
-			idx++;
-			continue;
-		}
-		
-		carry_on = callback(private_data, curr->zone_name);
-		idx++;
-		
-		if (!carry_on) {
-			break;
-		}
-	}
-	
-	// If we didn't abort we must be at the end
-	if (carry_on) {
-		callback(private_data, NULL);
+	if (!zt_index_zones_for_unguarded(table, node)) {
+		return false;
 	}
 	
+	zt_iterate_zone_index(node->zone_index, node->zone_count, private_data, starting_index,
+		callback);
 	return true;
 }
 
@@ -27,6 +27,12 @@ struct zip_network_node_s {
 	
 	struct zip_zone_node_s root;
 	
+	// The zones again, as an array for GetLocalZones to index into, built
+	// when it's asked for.  It's only good while index_generation is the
+	// table's generation.
+	pstring** zone_index;
+	uint32_t index_generation;
+	
 	struct zip_network_node_s* next;
 };
 
@@ -34,5 +40,15 @@ typedef struct {
 	SemaphoreHandle_t mutex;
 	
 	struct zip_network_node_s root;
+	
+	// generation goes up whenever a network or zone comes or goes, or a
+	// network's completed; the zone indexes are rebuilt when it has.
+	uint32_t generation;
+	
+	// Every zone of every complete network, sorted and without duplicates,
+	// for GetZoneList
+	pstring** all_zones;
+	size_t all_zone_count;
+	uint32_t all_zones_generation;
 } zt_zip_table_t;
 
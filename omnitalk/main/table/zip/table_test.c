@@ -441,6 +441,56 @@ TEST_FUNCTION(test_zip_table_iteration) {
 	TEST_OK();
 }
 
+TEST_FUNCTION(test_zip_table_zone_index) {
+	zt_zip_table_t* table = zt_new();
+	TEST_ASSERT(zt_add_net_range(table, 1, 10));
+	zt_add_zone_for(table, 1, (pstring*)"\x06ZoneC");
+	zt_add_zone_for(table, 1, (pstring*)"\x06ZoneA");
+	zt_mark_network_complete(table, 1);
+	TEST_ASSERT(zt_add_net_range(table, 20, 30));
+	zt_add_zone_for(table, 20, (pstring*)"\x06ZoneB");
+	zt_add_zone_for(table, 20, (pstring*)"\x06ZoneA");
+	zt_mark_network_complete(table, 20);
+	
+	// Zones come out sorted, and a zone on two networks only once
+	struct zone_name_iter_state state = { 0 };
+	TEST_ASSERT(zt_iterate_zone_names(table, &state, 0, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "ZoneAZoneBZoneC") == 0);
+	TEST_ASSERT(state.seen_null);
+	
+	bzero(&state, sizeof(state));
+	TEST_ASSERT(zt_iterate_zone_names(table, &state, 2, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "ZoneC") == 0);
+	TEST_ASSERT(state.seen_null);
+	
+	// Starting at the end just gets the end; starting past it is an error
+	bzero(&state, sizeof(state));
+	TEST_ASSERT(zt_iterate_zone_names(table, &state, 3, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "") == 0);
+	TEST_ASSERT(state.seen_null);
+	TEST_ASSERT(!zt_iterate_zone_names(table, &state, 4, simple_zone_name_iterator));
+	
+	// Changes to the table are seen by the next iteration
+	zt_add_zone_for(table, 20, (pstring*)"\x06ZoneD");
+	TEST_ASSERT(zt_add_net_range(table, 40, 50));
+	zt_add_zone_for(table, 40, (pstring*)"\x06Zone0");
+	bzero(&state, sizeof(state));
+	TEST_ASSERT(zt_iterate_zone_names(table, &state, 0, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "ZoneAZoneBZoneCZoneD") == 0);
+	
+	bzero(&state, sizeof(state));
+	TEST_ASSERT(zt_iterate_zone_names_for_net(table, &state, 20, 1, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "ZoneBZoneD") == 0);
+	
+	zt_mark_network_complete(table, 40);
+	TEST_ASSERT(zt_delete_network(table, 1));
+	bzero(&state, sizeof(state));
+	TEST_ASSERT(zt_iterate_zone_names(table, &state, 0, simple_zone_name_iterator));
+	TEST_ASSERT(strcmp(state.buffer, "Zone0ZoneAZoneBZoneD") == 0);
+	
+	TEST_OK();
+}
+
 static bool test_null_iter_loop(void* pvt, int idx, uint16_t network, pstring* zone) {
 	SET_TEST_NAME((char*)pvt);
 	
@@ -7,4 +7,5 @@ TEST_FUNCTION(test_zip_table_zones);
 TEST_FUNCTION(test_zip_table_completion);
 TEST_FUNCTION(test_zip_table_stats);
 TEST_FUNCTION(test_zip_table_iteration);
+TEST_FUNCTION(test_zip_table_zone_index);
 TEST_FUNCTION(test_zip_table_zone_names_with_null_in);
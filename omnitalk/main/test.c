@@ -6,10 +6,14 @@
 #include <freertos/task.h>
 
 #include "test.inc.h"
+#include "ddp_socket.h"
+#include "nbp_registry.h"
 #include "tunables.h"
 
 static const char* TAG = "test_main";
 
+static int failures = 0;
+
 TEST_FUNCTION(test_tests) {
 	TEST_OK();
 }
@@ -20,6 +24,7 @@ void real_test_ok(char* test_name) {
 
 void real_test_fail(char* test_name, char* msg) {
 	ESP_LOGE(TAG, "[TEST %s] FAIL: %s", test_name, msg);
+	failures++;
 #ifndef TESTS_NO_HANG_ON_FAIL
 	vTaskDelay(portMAX_DELAY);
 #endif
@@ -31,6 +36,9 @@ void test_main(void) {
 	ESP_LOGI(TAG, "==================");
 	printf("\n");
 	
+	ddp_socket_init();
+	nbp_registry_init();
+	
 #include "test.inc"
 	
 	printf("\n\n\n");
@@ -39,3 +47,7 @@ void test_main(void) {
 	esp_restart();
 #endif
 }
+
+int test_failure_count(void) {
+	return failures;
+}
@@ -20,3 +20,6 @@ TEST_FUNCTION(test_tests);
 void real_test_ok(char*);
 void real_test_fail(char*, char*);
 void test_main(void);
+
+// test_failure_count returns how many tests have failed so far
+int test_failure_count(void);
@@ -1,9 +1,17 @@
 /* DO NOT EDIT THIS FILE.  IT IS AUTOMATICALLY GENERATED. */
 
+#include "app/nbp/nbp_test.h"
+
 #include "app/zip/zip_get_network_info_test.h"
 
 #include "app/zip/zip_test.h"
 
+#include "atp_responder_test.h"
+
+#include "boot/boot_test.h"
+
+#include "ddp_socket_test.h"
+
 #include "lap/lap_test.h"
 
 #include "lap/llap/llap_test.h"
@@ -12,6 +20,22 @@
 
 #include "mem/buffers_test.h"
 
+#include "nbp_cache_test.h"
+
+#include "nbp_registry_test.h"
+
+#include "net/b2udptunnel/peers_test.h"
+
+#include "net/ethernet/ethernet_test.h"
+
+#include "net/loadgen/loadgen_test.h"
+
+#include "net/packet_capture_test.h"
+
+#include "net/tashtalk/state_machine_test.h"
+
+#include "persist/persist_test.h"
+
 #include "proto/atp_test.h"
 
 #include "proto/ddp_test.h"
@@ -28,6 +52,8 @@
 
 #include "test.h"
 
+#include "util/crc_test.h"
+
 #include "util/event/event_test.h"
 
 #include "util/macroman_test.h"
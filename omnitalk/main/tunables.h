@@ -8,3 +8,50 @@
 #define QUALITY_LTOUDP 5
 #define QUALITY_B2ETH 5
 #define QUALITY_ETHERNET 10
+
+// LTOUDP_GROUPS is a comma-separated list of the LToUDP multicast groups to
+// have a port on, and B2UDPTUNNEL_PORTS one of the UDP ports to run B2
+// tunnels on; each group or port is a separate LAP.  There can be up to
+// MAX_UDP_TRANSPORTS of each.
+#define LTOUDP_GROUPS "239.192.76.84"
+#define B2UDPTUNNEL_PORTS "6066"
+#define MAX_UDP_TRANSPORTS 4
+
+// B2UDPTUNNEL_PEERS is a comma-separated list of IPv4 addresses of B2 tunnel
+// peers to always send broadcasts to, for peers we can't reach by subnet
+// broadcast.  Other peers are learned as we hear from them.
+// #define B2UDPTUNNEL_PEERS "192.168.1.10,10.0.0.5"
+
+// If LOADGEN_NETWORK is defined there's a load generator port, which
+// pretends to be a LocalTalk network of that number and throws traffic at
+// the router when told to from /loadgen.  See net/loadgen/loadgen.h.
+// #define LOADGEN_NETWORK 60000
+
+// Each transport keeps the last PACKET_CAPTURE_SLOTS frames through it, cut
+// down to PACKET_CAPTURE_SNAPLEN bytes, which can be downloaded as a pcap
+// file from /capture/<transport>.pcap.  Comment out PACKET_CAPTURE_SLOTS to
+// turn it off.
+#define PACKET_CAPTURE_SLOTS 64
+#define PACKET_CAPTURE_SNAPLEN 96
+
+// What the router's learnt is saved to NVS for the next boot (see
+// persist/persist.h) every PERSIST_SAVE_INTERVAL_SECONDS if it's changed.
+// The tables are cut down to PERSIST_SNAPSHOT_BYTES, since the NVS
+// partition is small and flash wears out.
+#define PERSIST_SAVE_INTERVAL_SECONDS 300
+#define PERSIST_SNAPSHOT_BYTES 2048
+
+// The NBP cache answers lookups the router would otherwise broadcast on a
+// port again, from the LkUp-Replies it's seen there in the last
+// NBP_CACHE_TTL_SECONDS.  It remembers up to NBP_CACHE_ENTRIES names and as
+// many lookups.  See nbp_cache.h.  Comment out NBP_CACHE_ENTRIES to turn it
+// off.
+#define NBP_CACHE_ENTRIES 64
+#define NBP_CACHE_TTL_SECONDS 10
+
+// NBP requests that are copies of one from the last NBP_DEDUPE_WINDOW_MS,
+// retried or looped round through another port, are dropped.  Up to
+// NBP_DEDUPE_ENTRIES requests are remembered.  Comment out
+// NBP_DEDUPE_ENTRIES to turn it off.
+#define NBP_DEDUPE_ENTRIES 32
+#define NBP_DEDUPE_WINDOW_MS 500
@@ -1,5 +1,10 @@
 #include "util/crc.h"
 
+#include <stdint.h>
+
+// crc_tables.inc is generated by mkcrctables.pl at build time
+#include "util/crc_tables.inc"
+
 /* Look, blame IBM, don't blame me */
 uint16_t LT_CRC_LUT[] = {
   0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF, 0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
@@ -30,9 +35,27 @@ void crc_state_append(crc_state_t* state, unsigned char b) {
 }
 
 void crc_state_append_all(crc_state_t* state, unsigned char* buf, int len) {
-	for (int i = 0; i < len; i++) {
-		crc_state_append(state, buf[i]);
+	uint16_t crc = *state;
+	
+	// Slice-by-4: four bytes at a time.  The CRC is only 16 bits, so after
+	// the first two bytes it's been shifted out completely; each byte then
+	// goes through the table for however many bytes come after it.
+	while (len >= LT_CRC_SLICES) {
+		crc ^= buf[0] | (buf[1] << 8);
+		crc = LT_CRC_SLICE_LUT[3][crc & 0xFF] ^ LT_CRC_SLICE_LUT[2][crc >> 8] ^
+		      LT_CRC_SLICE_LUT[1][buf[2]] ^ LT_CRC_SLICE_LUT[0][buf[3]];
+		buf += LT_CRC_SLICES;
+		len -= LT_CRC_SLICES;
+	}
+	
+	// and then the stragglers the old-fashioned way
+	while (len > 0) {
+		crc = LT_CRC_SLICE_LUT[0][(crc & 0xFF) ^ *buf] ^ (crc >> 8);
+		buf++;
+		len--;
 	}
+	
+	*state = crc;
 }
 
 bool crc_state_ok(crc_state_t* state) {
@@ -15,7 +15,8 @@ typedef uint16_t crc_state_t;
 void crc_state_init(crc_state_t* state);
 
 // crc_state_append and crc_state_append_all add either a single character or
-// a string to the CRC state, respectively
+// a string to the CRC state, respectively.  crc_state_append_all is the fast
+// one, and can be called on consecutive spans of a frame as they arrive.
 void crc_state_append(crc_state_t* state, unsigned char b);
 void crc_state_append_all(crc_state_t* state, unsigned char* buf, int len);
 
@@ -0,0 +1,54 @@
+#include "util/crc_test.h"
+#include "util/crc.h"
+
+#include <stdlib.h>
+
+#include "test.h"
+
+TEST_FUNCTION(test_crc_slicing_matches_bytewise) {
+	unsigned char buf[700];
+	
+	// Same seed every time, so a failure can be reproduced
+	srand(1954);
+	
+	for (int iteration = 0; iteration < 500; iteration++) {
+		int len = rand() % sizeof(buf);
+		for (int i = 0; i < len; i++) {
+			buf[i] = rand() & 0xFF;
+		}
+		
+		// The reference: a byte at a time through the original table
+		crc_state_t bytewise;
+		crc_state_init(&bytewise);
+		for (int i = 0; i < len; i++) {
+			crc_state_append(&bytewise, buf[i]);
+		}
+		
+		// All at once
+		crc_state_t sliced;
+		crc_state_init(&sliced);
+		crc_state_append_all(&sliced, buf, len);
+		TEST_ASSERT(sliced == bytewise);
+		
+		// In randomly-sized spans, starting at odd alignments
+		crc_state_t spans;
+		crc_state_init(&spans);
+		int done = 0;
+		while (done < len) {
+			int span = 1 + (rand() % 13);
+			if (span > len - done) {
+				span = len - done;
+			}
+			crc_state_append_all(&spans, buf + done, span);
+			done += span;
+		}
+		TEST_ASSERT(spans == bytewise);
+		
+		// And a frame with its own CRC on the end should check out
+		crc_state_append(&sliced, crc_state_byte_1(&bytewise));
+		crc_state_append(&sliced, crc_state_byte_2(&bytewise));
+		TEST_ASSERT(crc_state_ok(&sliced));
+	}
+	
+	TEST_OK();
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "test.h"
+
+TEST_FUNCTION(test_crc_slicing_matches_bytewise);
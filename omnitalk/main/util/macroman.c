@@ -1,6 +1,7 @@
 #include "util/macroman.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "util/pstring.h"
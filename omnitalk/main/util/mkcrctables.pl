@@ -0,0 +1,49 @@
+#!/usr/bin/perl
+use strict;
+use File::Basename;
+
+# This script generates crc_tables.inc, the slice-by-4 lookup tables for the
+# LLAP CRC in crc.c.  Table 0 is the ordinary byte-at-a-time table; table n
+# is what you get by pushing table n-1 through another zero byte.
+
+my $dir = dirname($0);
+my $incname = $dir . "/crc_tables.inc";
+
+# The SDLC polynomial, bit-reversed
+my $poly = 0x8408;
+my $slices = 4;
+
+my @tables = ([]);
+
+for my $i (0..255) {
+	my $crc = $i;
+	for (1..8) {
+		$crc = ($crc & 1) ? (($crc >> 1) ^ $poly) : ($crc >> 1);
+	}
+	$tables[0][$i] = $crc;
+}
+
+for my $n (1..$slices-1) {
+	for my $i (0..255) {
+		my $prev = $tables[$n-1][$i];
+		$tables[$n][$i] = $tables[0][$prev & 0xFF] ^ ($prev >> 8);
+	}
+}
+
+open(my $out, ">", $incname);
+
+print $out "/* DO NOT EDIT THIS FILE.  IT IS AUTOMATICALLY GENERATED. */\n\n";
+print $out "#define LT_CRC_SLICES $slices\n\n";
+print $out "static const uint16_t LT_CRC_SLICE_LUT[LT_CRC_SLICES][256] = {\n";
+
+for my $n (0..$slices-1) {
+	print $out "\t{\n";
+	for my $row (0..15) {
+		my @vals = map { sprintf("0x%04X", $tables[$n][$row * 16 + $_]) } (0..15);
+		print $out "\t\t" . join(", ", @vals) . ",\n";
+	}
+	print $out "\t},\n";
+}
+
+print $out "};\n";
+close($out);
@@ -2,10 +2,11 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 // uppercase according to appletalk rules
-static char mac_uc(char c) {
+char pstring_mac_uc(char c) {
 	// ascii gubbins
 	if (c >= 'a' && c <= 'z') {
 		return c - 32;
@@ -81,7 +82,7 @@ bool pstring_eq_cstring_mac_ci(pstring *p, const char *c) {
 	}
 	
 	for (int i = 0; i < p->length; i++) {
-		if (mac_uc(c[i]) != mac_uc(p->str[i])) {
+		if (pstring_mac_uc(c[i]) != pstring_mac_uc(p->str[i])) {
 			return false;
 		}
 	}
@@ -95,7 +96,7 @@ bool pstring_eq_pstring_mac_ci(pstring *a, pstring *b) {
 	}
 	
 	for (int i = 0; i < a->length; i++) {
-		if (mac_uc(a->str[i]) != mac_uc(b->str[i])) {
+		if (pstring_mac_uc(a->str[i]) != pstring_mac_uc(b->str[i])) {
 			return false;
 		}
 	}
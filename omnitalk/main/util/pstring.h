@@ -11,6 +11,9 @@ typedef struct {
 	char str[];
 } __attribute__((packed)) pstring;
 
+// pstring_mac_uc uppercases a character the way AppleTalk compares names
+char pstring_mac_uc(char c);
+
 void pstring_print(pstring *p);
 int pstring_index_of(pstring *p, char c);
 bool pstring_eq_cstring(pstring *p, const char *c);
@@ -0,0 +1,130 @@
+#include "web/capture.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "net/packet_capture.h"
+
+#define CAPTURE_URI_PREFIX "/capture/"
+#define CAPTURE_PCAP_SUFFIX ".pcap"
+
+#define CAPTURE_QUERY_LEN 128
+#define CAPTURE_VALUE_LEN 8
+
+static bool capture_send_chunk(void* ctx, const uint8_t* data, size_t len) {
+	return httpd_resp_send_chunk((httpd_req_t*)ctx, (const char*)data, len) == ESP_OK;
+}
+
+// capture_query_field reads a filter field out of the query string; if
+// it's missing or empty it's PACKET_CAPTURE_ANY
+static int capture_query_field(const char* query, const char* key) {
+	char value[CAPTURE_VALUE_LEN];
+	
+	if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK || value[0] == '\0') {
+		return PACKET_CAPTURE_ANY;
+	}
+	return (int)strtol(value, NULL, 0);
+}
+
+static void capture_send_config(httpd_req_t *req, packet_capture_t* capture) {
+	char line[128];
+	size_t snaplen;
+	packet_capture_filter_t filter;
+	
+	packet_capture_get_config(capture, &snaplen, &filter);
+	snprintf(line, sizeof(line), "%s: %lu frames recorded, snaplen %d, type %d, socket %d, node %d\n",
+		packet_capture_name(capture), (unsigned long)packet_capture_recorded(capture),
+		(int)snaplen, filter.ddp_type, filter.socket, filter.node);
+	httpd_resp_sendstr_chunk(req, line);
+}
+
+static esp_err_t capture_list(httpd_req_t *req) {
+	httpd_resp_set_type(req, "text/plain");
+	
+	for (size_t i = 0; i < packet_capture_count(); i++) {
+		capture_send_config(req, packet_capture_get(i));
+	}
+	if (packet_capture_count() == 0) {
+		httpd_resp_sendstr_chunk(req, "no capture rings\n");
+	}
+	
+	httpd_resp_sendstr_chunk(req, NULL);
+	return ESP_OK;
+}
+
+static esp_err_t capture_configure(httpd_req_t *req, packet_capture_t* capture) {
+	char query[CAPTURE_QUERY_LEN];
+	
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+		packet_capture_filter_t filter = {
+			.ddp_type = capture_query_field(query, "type"),
+			.socket = capture_query_field(query, "socket"),
+			.node = capture_query_field(query, "node"),
+		};
+		int snaplen = capture_query_field(query, "snaplen");
+		
+		packet_capture_configure(capture, snaplen > 0 ? snaplen : 0, &filter);
+	}
+	
+	httpd_resp_set_type(req, "text/plain");
+	capture_send_config(req, capture);
+	httpd_resp_sendstr_chunk(req, NULL);
+	return ESP_OK;
+}
+
+static esp_err_t capture_download(httpd_req_t *req, packet_capture_t* capture) {
+	char disposition[64];
+	
+	snprintf(disposition, sizeof(disposition), "attachment; filename=\"%s.pcap\"",
+		packet_capture_name(capture));
+	httpd_resp_set_type(req, "application/vnd.tcpdump.pcap");
+	httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+	
+	if (!packet_capture_write_pcap(capture, &capture_send_chunk, req)) {
+		// The client's gone away; there's no point finishing the response
+		return ESP_FAIL;
+	}
+	
+	httpd_resp_send_chunk(req, NULL, 0);
+	return ESP_OK;
+}
+
+esp_err_t http_capture_handler(httpd_req_t *req) {
+	char name[PACKET_CAPTURE_MAX_NAME_LEN + sizeof(CAPTURE_PCAP_SUFFIX)];
+	
+	if (strncmp(req->uri, CAPTURE_URI_PREFIX, strlen(CAPTURE_URI_PREFIX)) != 0) {
+		return httpd_resp_send_404(req);
+	}
+	
+	// Pick the ring name out of the URI, leaving off any query string
+	const char* start = req->uri + strlen(CAPTURE_URI_PREFIX);
+	size_t len = strcspn(start, "?");
+	if (len >= sizeof(name)) {
+		return httpd_resp_send_404(req);
+	}
+	memcpy(name, start, len);
+	name[len] = '\0';
+	
+	if (len == 0) {
+		return capture_list(req);
+	}
+	
+	bool download = false;
+	size_t suffix_len = strlen(CAPTURE_PCAP_SUFFIX);
+	if (len > suffix_len && strcmp(name + len - suffix_len, CAPTURE_PCAP_SUFFIX) == 0) {
+		name[len - suffix_len] = '\0';
+		download = true;
+	}
+	
+	packet_capture_t* capture = packet_capture_find(name);
+	if (capture == NULL) {
+		return httpd_resp_send_404(req);
+	}
+	
+	return download ? capture_download(req, capture) : capture_configure(req, capture);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// http_capture_handler serves the transports' packet capture rings (see
+// net/packet_capture.h):
+//
+//   /capture/                  lists the rings
+//   /capture/<name>.pcap       downloads what's in a ring as a pcap file
+//   /capture/<name>?type=&socket=&node=&snaplen=
+//                              sets a ring's filter and snaplen; a filter
+//                              field that's left out or empty matches
+//                              anything
+//
+// It needs registering with a wildcard URI of "/capture/*".
+esp_err_t http_capture_handler(httpd_req_t *req);
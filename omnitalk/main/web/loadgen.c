@@ -0,0 +1,143 @@
+#include "web/loadgen.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+#include "net/loadgen/loadgen.h"
+
+#define LOADGEN_QUERY_LEN 192
+#define LOADGEN_VALUE_LEN 16
+#define LOADGEN_LINE_LEN 160
+
+// query_range reads "a" or "a-b" out of the query string
+static bool query_range(const char* query, const char* key, unsigned long* lo, unsigned long* hi) {
+	char value[LOADGEN_VALUE_LEN];
+	char* end;
+	
+	if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK || value[0] == '\0') {
+		return false;
+	}
+	
+	*lo = strtoul(value, &end, 0);
+	*hi = *end == '-' ? strtoul(end + 1, NULL, 0) : *lo;
+	return true;
+}
+
+bool loadgen_apply_query(const char* query) {
+	transport_t* transport = loadgen_get_transport();
+	char value[LOADGEN_VALUE_LEN];
+	unsigned long lo, hi;
+	loadgen_config_t config;
+	
+	if (transport == NULL) {
+		return false;
+	}
+	loadgen_get_config(transport, &config);
+	
+	if (httpd_query_key_value(query, "traffic", value, sizeof(value)) == ESP_OK &&
+		!loadgen_traffic_from_name(value, &config.traffic)) {
+		
+		return false;
+	}
+	if (query_range(query, "rate", &lo, &hi)) {
+		config.rate = lo;
+	}
+	if (query_range(query, "count", &lo, &hi)) {
+		config.count = lo;
+	}
+	if (query_range(query, "size", &lo, &hi)) {
+		config.size_min = lo;
+		config.size_max = hi;
+	}
+	if (query_range(query, "routes", &lo, &hi)) {
+		config.routes = lo;
+	}
+	if (query_range(query, "nodes", &lo, &hi)) {
+		if (hi < lo || lo > 255) {
+			return false;
+		}
+		config.node_base = lo;
+		config.node_spread = hi - lo + 1;
+	}
+	if (query_range(query, "reset", &lo, &hi) && lo != 0) {
+		loadgen_reset_counters(transport);
+	}
+	
+	return loadgen_configure(transport, &config);
+}
+
+#define LOADGEN_COUNTER(R, LINE, NAME, VALUE) \
+	snprintf(LINE, LOADGEN_LINE_LEN, "#TYPE " NAME " counter\n" NAME " %llu\n", \
+		(unsigned long long)(VALUE)); \
+	httpd_resp_sendstr_chunk(R, LINE);
+
+void loadgen_write_status(httpd_req_t *req) {
+	transport_t* transport = loadgen_get_transport();
+	char line[LOADGEN_LINE_LEN];
+	loadgen_config_t config;
+	loadgen_counters_t c;
+	
+	if (transport == NULL) {
+		httpd_resp_sendstr_chunk(req, "# there's no load generator\n");
+		return;
+	}
+	loadgen_get_config(transport, &config);
+	loadgen_get_counters(transport, &c);
+	
+	snprintf(line, sizeof(line), "# traffic=%s rate=%u count=%u size=%u-%u routes=%u nodes=%u-%u\n",
+		loadgen_traffic_name(config.traffic), (unsigned)config.rate, (unsigned)config.count,
+		(unsigned)config.size_min, (unsigned)config.size_max, (unsigned)config.routes,
+		(unsigned)config.node_base, (unsigned)(config.node_base + config.node_spread - 1));
+	httpd_resp_sendstr_chunk(req, line);
+	
+	LOADGEN_COUNTER(req, line, "loadgen_sent_frames", c.sent);
+	LOADGEN_COUNTER(req, line, "loadgen_sent_octets", c.sent_octets);
+	LOADGEN_COUNTER(req, line, "loadgen_queue_full_frames", c.queue_full);
+	LOADGEN_COUNTER(req, line, "loadgen_received_frames", c.received);
+	LOADGEN_COUNTER(req, line, "loadgen_received_octets", c.received_octets);
+	LOADGEN_COUNTER(req, line, "loadgen_replies", c.replies);
+	LOADGEN_COUNTER(req, line, "loadgen_unmatched_replies", c.unmatched);
+	
+	// The round trip times, as a Prometheus histogram in seconds
+	httpd_resp_sendstr_chunk(req, "#TYPE loadgen_rtt_seconds histogram\n");
+	uint64_t cumulative = 0;
+	for (int i = 0; i < LOADGEN_RTT_BUCKETS - 1; i++) {
+		cumulative += c.rtt_histogram[i];
+		snprintf(line, sizeof(line), "loadgen_rtt_seconds_bucket{le=\"%.6f\"} %llu\n",
+			(double)(2ULL << i) / 1e6, (unsigned long long)cumulative);
+		httpd_resp_sendstr_chunk(req, line);
+	}
+	snprintf(line, sizeof(line), "loadgen_rtt_seconds_bucket{le=\"+Inf\"} %llu\n"
+		"loadgen_rtt_seconds_sum %.6f\nloadgen_rtt_seconds_count %llu\n",
+		(unsigned long long)c.replies, (double)c.rtt_sum / 1e6, (unsigned long long)c.replies);
+	httpd_resp_sendstr_chunk(req, line);
+	
+	snprintf(line, sizeof(line), "# rtt us: p50 %llu p90 %llu p99 %llu max %llu\n",
+		(unsigned long long)loadgen_rtt_percentile(&c, 50),
+		(unsigned long long)loadgen_rtt_percentile(&c, 90),
+		(unsigned long long)loadgen_rtt_percentile(&c, 99),
+		(unsigned long long)c.rtt_max);
+	httpd_resp_sendstr_chunk(req, line);
+}
+
+esp_err_t http_loadgen_handler(httpd_req_t *req) {
+	char query[LOADGEN_QUERY_LEN];
+	
+	httpd_resp_set_type(req, "text/plain; version=0.0.4; charset=utf-8");
+	
+	if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+		!loadgen_apply_query(query)) {
+		
+		httpd_resp_set_status(req, "400 Bad Request");
+		httpd_resp_sendstr_chunk(req, "# that configuration doesn't make sense\n");
+	}
+	
+	loadgen_write_status(req);
+	httpd_resp_sendstr_chunk(req, NULL);
+	return ESP_OK;
+}
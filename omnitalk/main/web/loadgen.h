@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+// http_loadgen_handler controls the load generator (see
+// net/loadgen/loadgen.h) and reports on it.  Without a query string it
+// just shows the configuration and counters, in Prometheus format;
+// otherwise it changes what the generator's doing first:
+//
+//   /loadgen?traffic=aep&rate=500&size=64-586&nodes=2-41
+//   /loadgen?traffic=rtmp&rate=1&routes=500
+//   /loadgen?rate=0                      stops it
+//   /loadgen?reset=1                     zeroes the counters
+//
+// Anything left out of the query stays as it was.  count stops the
+// generator after that many frames.
+esp_err_t http_loadgen_handler(httpd_req_t *req);
+
+// loadgen_apply_query configures the load generator from a query string
+// as above, returning false if it doesn't make sense.
+bool loadgen_apply_query(const char* query);
+
+// loadgen_write_status writes the load generator's configuration and
+// counters to a request.
+void loadgen_write_status(httpd_req_t *req);
@@ -30,6 +30,10 @@ while (my $line = <$fh>) {
 		@labels = split(/__/, $var);
 		$metric = shift @labels;
 		map { $_ =~ s/_/=\\"/; $_ .= "\\\""; $_=~s/_/ /g;} @labels;
+		
+		# prometheus histograms need an le="+Inf" bucket, and we can't have a +
+		# in a variable name
+		map { $_ =~ s/^le=\\"Inf/le=\\"+Inf/; } @labels;
 	}
 	
 	# extract help from comment
@@ -17,6 +17,9 @@ stats_omnitalk_metadata_t stats_omnitalk_metadata;
 
 _Atomic(char*) stats_routing_table;
 _Atomic(char*) stats_zip_table;
+_Atomic(char*) stats_b2_peers;
+_Atomic(char*) stats_ddp_sockets;
+_Atomic(char*) stats_boot_phases;
 
 // Have a reserved stats buffer so that we can't run out of memory mid-flow
 #define STATSBUFFER_SIZE 256
@@ -68,6 +71,18 @@ esp_err_t http_metrics_handler(httpd_req_t *req) {
 		httpd_resp_sendstr_chunk(req, stats_zip_table);
 	}
 	
+	if (stats_b2_peers != NULL) {
+		httpd_resp_sendstr_chunk(req, stats_b2_peers);
+	}
+	
+	if (stats_ddp_sockets != NULL) {
+		httpd_resp_sendstr_chunk(req, stats_ddp_sockets);
+	}
+	
+	if (stats_boot_phases != NULL) {
+		httpd_resp_sendstr_chunk(req, stats_boot_phases);
+	}
+	
 #include "stats.inc"	
 	
     httpd_resp_sendstr_chunk(req, NULL);
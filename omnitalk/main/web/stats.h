@@ -70,6 +70,14 @@ typedef struct stats {
 	prometheus_counter_t transport_out_errors__transport_localtalk__err_packet_length_inconsistent;
 	prometheus_counter_t transport_out_errors__transport_localtalk__err_bad_crc;
 	prometheus_counter_t transport_out_errors__transport_localtalk__err_no_room_for_crc_in_buffer;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_8; // help: tashtalk: bytes handed to the UART driver per write
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_32;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_128;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_512;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_2048;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_bucket__le_Inf;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_sum;
+	prometheus_counter_t tashtalk_tx_bytes_per_write_count;
 
 	prometheus_counter_t transport_in_octets__transport_ltoudp;
 	prometheus_counter_t transport_out_octets__transport_ltoudp; 
@@ -79,6 +87,8 @@ typedef struct stats {
 	prometheus_counter_t transport_in_errors__transport_ltoudp__err_packet_too_long;
 	prometheus_counter_t transport_in_errors__transport_ltoudp__err_lap_queue_full;
 	prometheus_counter_t transport_out_errors__transport_ltoudp__err_send_failed;
+	prometheus_counter_t transport_in_filtered__transport_ltoudp__reason_own_packet; // help: inbound frames dropped early by the transport
+	prometheus_counter_t transport_in_filtered__transport_ltoudp__reason_not_for_us;
 	
 	prometheus_counter_t transport_in_octets__transport_b2udp;
 	prometheus_counter_t transport_out_octets__transport_b2udp;
@@ -91,6 +101,10 @@ typedef struct stats {
 	prometheus_counter_t transport_out_errors__transport_b2udp__err_frame_too_short;
 	prometheus_counter_t transport_out_errors__transport_b2udp__err_invalid_dst_MAC;
 	prometheus_counter_t transport_out_errors__transport_b2udp__err_sendto_failed;
+	prometheus_counter_t transport_in_errors__transport_b2udp__err_peer_table_full;
+	prometheus_counter_t transport_in_filtered__transport_b2udp__reason_own_packet;
+	prometheus_counter_t b2udp_broadcasts_replicated; // help: b2udp: broadcast frames sent to peers by unicast
+	prometheus_counter_t b2udp_peers_dropped; // help: b2udp: peers heard from that the peer table had no room for
 
 	prometheus_counter_t transport_in_octets__transport_ethernet;
 	prometheus_counter_t transport_out_octets__transport_ethernet;
@@ -98,7 +112,13 @@ typedef struct stats {
 	prometheus_counter_t transport_out_frames__transport_ethernet;
 	prometheus_counter_t eth_recv_elap_frames; // help: ethernet: received ELAP frames (raw count)
 	prometheus_counter_t eth_recv_aarp_frames; // help: ethernet: received AARP frames (raw count)
+	prometheus_counter_t eth_send_elap_frames; // help: ethernet: ELAP frames sent from header templates
+	prometheus_counter_t eth_aarp_learned__source_aarp; // help: ethernet: hardware addresses learnt from received frames
+	prometheus_counter_t eth_aarp_learned__source_elap;
 	prometheus_counter_t transport_in_errors__transport_ethernet__err_lap_queue_full;
+	prometheus_counter_t transport_out_errors__transport_ethernet__err_not_long_header;
+	prometheus_counter_t transport_out_errors__transport_ethernet__err_no_aarp_entry;
+	prometheus_counter_t transport_out_errors__transport_ethernet__err_transmit_failed;
 	
 	// LAP registry
 	prometheus_counter_t lap_registry_registered_laps;
@@ -106,8 +126,26 @@ typedef struct stats {
 	// DDP metrics
 	prometheus_counter_t ddp_out_errors__err_no_route_for_network;
 	
+	// LLAP metrics
+	prometheus_counter_t llap_in_drops__reason_control_frame; // help: llap: inbound frames thrown away by the LAP
+	prometheus_counter_t llap_in_drops__reason_malformed;
+	prometheus_counter_t llap_in_drops__reason_not_for_us;
+	prometheus_counter_t llap_acquisitions__phase_address; // help: llap: address and network number acquisitions finished
+	prometheus_counter_t llap_acquisitions__phase_netinfo;
+	prometheus_counter_t llap_acquisition_milliseconds__phase_address; // help: llap: time spent acquiring addresses and network numbers
+	prometheus_counter_t llap_acquisition_milliseconds__phase_netinfo;
+	prometheus_counter_t llap_address_conflicts; // help: llap: addresses we tried for that someone else already had or wanted
+	
+	// Warm start
+	prometheus_counter_t persist_saves__kind_tables; // help: persist: what's been saved to NVS for the next boot
+	prometheus_counter_t persist_saves__kind_lap;
+	prometheus_counter_t persist_save_errors; // help: persist: saves to NVS that didn't work
+	prometheus_counter_t persist_restored_routes; // help: persist: routes put back as suspect from before the last boot
+	prometheus_counter_t persist_restored_networks; // help: persist: networks whose zones were put back from before the last boot
+	
 	// Control plane metrics
 	prometheus_counter_t controlplane_inbound_queue_full;
+	prometheus_counter_t controlplane_drops__reason_no_app; // help: control plane: packets for a socket nothing is listening on
 	
 	// RTMP
 	prometheus_counter_t rtmp_update_packets;
@@ -138,14 +176,44 @@ typedef struct stats {
 	prometheus_counter_t nbp_in_packets__function_LkUp;
 	prometheus_counter_t nbp_in_packets__function_LkUp_reply;
 	prometheus_counter_t nbp_in_packets__function_FwdReq;
+	prometheus_counter_t nbp_in_duplicates__function_BrRq; // help: nbp: requests dropped as copies of one seen moments before
+	prometheus_counter_t nbp_in_duplicates__function_LkUp;
+	prometheus_counter_t nbp_in_duplicates__function_FwdReq;
 	
 	prometheus_counter_t nbp_in_errors__err_no_tuple;
 	prometheus_counter_t nbp_in_errors__err_LkUp_with_too_many_tuples;
+	prometheus_counter_t nbp_in_errors__err_zone_not_known_yet;
+	prometheus_counter_t nbp_in_errors__err_BrRq_for_unknown_zone; // help: nbp: BrRqs for zones with no networks we know of
+	prometheus_counter_t nbp_in_errors__err_FwdReq_for_distant_network; // help: nbp: FwdReqs for networks that aren't directly connected
 	
 	prometheus_counter_t nbp_out_packets__function_LkUp_reply;
+	prometheus_counter_t nbp_out_reply_tuples; // help: nbp: names sent in LkUp-Replies, several to a packet
 	prometheus_counter_t nbp_out_errors__type_reply__err_ddp_send_failed;
+	prometheus_counter_t nbp_out_errors__type_reply__err_too_many_matches;
+	prometheus_counter_t nbp_out_packets__function_LkUp;
+	prometheus_counter_t nbp_out_packets__function_FwdReq;
+	prometheus_counter_t nbp_out_errors__type_LkUp__err_ddp_send_failed;
+	prometheus_counter_t nbp_out_errors__type_FwdReq__err_ddp_send_failed;
+	
+	// NBP cache
+	prometheus_counter_t nbp_cache_lookups__result_hit; // help: nbp: lookups answered from the cache instead of broadcast
+	prometheus_counter_t nbp_cache_lookups__result_miss;
+	prometheus_counter_t nbp_cache_names_learned;
+	prometheus_counter_t nbp_cache_names_evicted;
 
 	
+	// ATP responder
+	prometheus_counter_t atp_in_requests__kind_new;
+	prometheus_counter_t atp_in_requests__kind_retry; // help: atp: requests answered from the transaction cache
+	prometheus_counter_t atp_in_releases;
+	prometheus_counter_t atp_in_errors__err_empty_bitmap;
+	prometheus_counter_t atp_in_errors__err_unexpected_function;
+	prometheus_counter_t atp_out_responses;
+	prometheus_counter_t atp_out_errors__err_ddp_send_failed;
+	prometheus_counter_t atp_transactions_released__reason_TRel;
+	prometheus_counter_t atp_transactions_released__reason_timeout;
+	prometheus_counter_t atp_transactions_released__reason_evicted;
+	
 	// SIP
 	prometheus_counter_t sip_in_packets__function_SystemInfo;
 	prometheus_counter_t sip_out_packets__function_Ack;
@@ -165,6 +233,15 @@ extern _Atomic(char*) stats_routing_table;
 // zip table metrics
 extern _Atomic(char*) stats_zip_table;
 
+// b2 tunnel peer metrics
+extern _Atomic(char*) stats_b2_peers;
+
+// per-socket DDP receive queue metrics
+extern _Atomic(char*) stats_ddp_sockets;
+
+// how long each startup phase took
+extern _Atomic(char*) stats_boot_phases;
+
 
 // Other gubbins
 void start_stats(void);
@@ -2,6 +2,8 @@
 
 #include <esp_http_server.h>
 
+#include "web/capture.h"
+#include "web/loadgen.h"
 #include "web/stats.h"
 
 static const char* TAG = "HTTP";
@@ -10,7 +12,7 @@ static const char* TAG = "HTTP";
 esp_err_t http_root_handler(httpd_req_t *req) {
 	httpd_resp_set_type(req, "text/plain");
 
-	httpd_resp_send_chunk(req, "metrics are at /metrics", HTTPD_RESP_USE_STRLEN);
+	httpd_resp_send_chunk(req, "metrics are at /metrics, packet captures at /capture/", HTTPD_RESP_USE_STRLEN);
     httpd_resp_sendstr_chunk(req, NULL);
 
     return ESP_OK;
@@ -30,17 +32,36 @@ httpd_uri_t http_metrics = {
 	.user_ctx = NULL
 };
 
+httpd_uri_t http_loadgen = {
+	.uri = "/loadgen",
+	.method = HTTP_GET,
+	.handler = http_loadgen_handler,
+	.user_ctx = NULL
+};
+
+httpd_uri_t http_capture = {
+	.uri = "/capture/*",
+	.method = HTTP_GET,
+	.handler = http_capture_handler,
+	.user_ctx = NULL
+};
+
 
 // Start the httpd
 httpd_handle_t start_httpd(void) {
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 	httpd_handle_t server = NULL;
+	
+	// for /capture/<transport>.pcap
+	config.uri_match_fn = httpd_uri_match_wildcard;
 
 	httpd_start(&server, &config);
 	
 	if(server != NULL) {
 		httpd_register_uri_handler(server, &http_root);
 		httpd_register_uri_handler(server, &http_metrics);
+		httpd_register_uri_handler(server, &http_capture);
+		httpd_register_uri_handler(server, &http_loadgen);
 	}
 	return server;
 }